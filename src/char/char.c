@@ -387,6 +387,10 @@ void set_char_offline(int char_id, int account_id)
 			Sql_ShowDebug(sql_handle);
 	} else {
 		struct mmo_charstatus *cp = (struct mmo_charstatus *)idb_get(char_db_,char_id);
+
+		char_wb_flush(char_id); //Final save
+		memitem_cache_drop(TABLE_INVENTORY, char_id);
+		memitem_cache_drop(TABLE_CART, char_id);
 		inter_guild_CharOffline(char_id, cp ? cp->guild_id : -1);
 		if( cp )
 			idb_remove(char_db_, char_id);
@@ -417,6 +421,8 @@ void set_char_offline(int char_id, int account_id)
 	}
 
 	//Remove char if 1- Set all offline, or 2- character is no longer connected to char-server.
+	if( char_id == -1 || character == NULL || character->fd == -1 )
+		memitem_cache_drop(TABLE_STORAGE, account_id);
 	if( loginif_isconnected() && (char_id == -1 || character == NULL || character->fd == -1) ) {
 		WFIFOHEAD(login_fd,6);
 		WFIFOW(login_fd,0) = 0x272c;
@@ -506,6 +512,327 @@ static DBData create_charstatus(DBKey key, va_list args)
 	return db_ptr2data(cp);
 }
 
+/*==========================================
+ * Write-behind of character saves
+ *------------------------------------------*/
+/// Groups of statements written by mmo_char_tosql.
+/// The statements of a group rewrite all its rows, so a newer save of a group supersedes a pending one.
+/// The tables are MyISAM, so a statement can fail after the previous ones were written: a group never
+/// deletes rows before writing the new ones. Memo points and friends have no key to upsert on and are
+/// written right away instead.
+enum e_char_wb_group {
+	CHARWB_STATUS = 0,
+	CHARWB_STATUS2,
+	CHARWB_SKILL,
+	CHARWB_HOTKEY,
+	CHARWB_MAX
+};
+#define CHARWB_MAX_QUERIES 2 //Statements per group (upsert + DELETE of the stale rows)
+#define CHARWB_MAX_JOBS (CHARWB_MAX * CHARWB_MAX_QUERIES) //Statements of a save
+
+/// Save queued on the worker, reaped in order once executed
+struct char_wb_batch {
+	int char_id;
+	SqlJob *job[CHARWB_MAX_JOBS];
+	int count;
+	struct char_wb_batch *next;
+};
+
+/// Saves of a character that weren't written yet
+struct char_wb {
+	int account_id, char_id;
+	char *query[CHARWB_MAX][CHARWB_MAX_QUERIES]; //Not queued yet
+	bool pending;
+	struct char_wb_batch *batch; //Last queued save, until it's reaped
+};
+
+int save_write_behind = 0; //Interval between flushes of the character saves in ms (0: saves are written right away)
+static SqlWorker *char_wb_worker = NULL;
+static DBMap *char_wb_db = NULL; // int char_id -> struct char_wb*
+static struct char_wb_batch *char_wb_head = NULL, *char_wb_tail = NULL;
+static int char_wb_queued = 0; //Saves on the worker
+
+/// Save handling times in microseconds, to report the map-server link latency
+#define CHAR_SAVE_SAMPLES 1024
+static struct {
+	uint32 sample[CHAR_SAVE_SAMPLES];
+	unsigned int count; //Total saves, the last CHAR_SAVE_SAMPLES are kept
+	uint64 total;
+} char_save_latency;
+
+/// Returns the pending saves of a character, creating them when write-behind is enabled.
+/// @return NULL when the saves are written right away
+static struct char_wb *char_wb_get(int account_id, int char_id)
+{
+	struct char_wb *wb;
+
+	if( char_wb_worker == NULL )
+		return NULL;
+	if( (wb = (struct char_wb *)idb_get(char_wb_db, char_id)) == NULL ) {
+		CREATE(wb, struct char_wb, 1);
+		wb->account_id = account_id;
+		wb->char_id = char_id;
+		idb_put(char_wb_db, char_id, wb);
+	}
+	return wb;
+}
+
+/// Drops the pending statements of a group, a newer save of the group supersedes them.
+static void char_wb_begin(struct char_wb *wb, enum e_char_wb_group group)
+{
+	int i;
+
+	if( wb == NULL )
+		return;
+	for( i = 0; i < CHARWB_MAX_QUERIES; i++ ) {
+		if( wb->query[group][i] ) {
+			aFree(wb->query[group][i]);
+			wb->query[group][i] = NULL;
+		}
+	}
+}
+
+/// Executes a statement of a character save, or adds it to the pending statements of its group.
+/// @return SQL_SUCCESS or SQL_ERROR
+static int char_save_querystr(struct char_wb *wb, enum e_char_wb_group group, const char *query)
+{
+	int i;
+
+	if( wb == NULL ) {
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, query) ) {
+			Sql_ShowDebug(sql_handle);
+			return SQL_ERROR;
+		}
+		return SQL_SUCCESS;
+	}
+	ARR_FIND(0, CHARWB_MAX_QUERIES, i, wb->query[group][i] == NULL);
+	if( i == CHARWB_MAX_QUERIES ) {
+		ShowError("char_save_querystr: Too many statements in group %d of character %d.\n", group, wb->char_id);
+		return SQL_ERROR;
+	}
+	wb->query[group][i] = aStrdup(query);
+	wb->pending = true;
+	return SQL_SUCCESS;
+}
+
+/// Formatted version of char_save_querystr.
+static int char_save_query(struct char_wb *wb, enum e_char_wb_group group, const char *format, ...)
+{
+	StringBuf buf;
+	va_list args;
+	int result;
+
+	StringBuf_Init(&buf);
+	va_start(args, format);
+	StringBuf_Vprintf(&buf, format, args);
+	va_end(args);
+	result = char_save_querystr(wb, group, StringBuf_Value(&buf));
+	StringBuf_Destroy(&buf);
+	return result;
+}
+
+/// Queues the pending statements of a character on the worker.
+static void char_wb_flush_sub(struct char_wb *wb)
+{
+	struct char_wb_batch *batch;
+	int i, j;
+
+	if( !wb->pending )
+		return;
+	CREATE(batch, struct char_wb_batch, 1);
+	batch->char_id = wb->char_id;
+	for( i = 0; i < CHARWB_MAX; i++ ) {
+		for( j = 0; j < CHARWB_MAX_QUERIES && wb->query[i][j]; j++ ) {
+			batch->job[batch->count++] = SqlJob_Query(char_wb_worker, wb->query[i][j], 0);
+			aFree(wb->query[i][j]);
+			wb->query[i][j] = NULL;
+		}
+	}
+	wb->pending = false;
+	wb->batch = batch;
+
+	if( char_wb_tail )
+		char_wb_tail->next = batch;
+	else
+		char_wb_head = batch;
+	char_wb_tail = batch;
+	char_wb_queued++;
+}
+
+/// Reaps the executed saves, in the order they were queued.
+/// A failed statement drops the cached character, so that its next save is written whole.
+static void char_wb_reap(void)
+{
+	while( char_wb_head && (char_wb_head->job[char_wb_head->count - 1] == NULL || SqlJob_IsDone(char_wb_head->job[char_wb_head->count - 1])) ) {
+		struct char_wb_batch *batch = char_wb_head;
+		struct char_wb *wb;
+		bool failed = false;
+		int i;
+
+		for( i = 0; i < batch->count; i++ ) {
+			if( batch->job[i] == NULL || SqlJob_GetResult(batch->job[i]) != SQL_SUCCESS ) {
+				if( batch->job[i] )
+					SqlJob_ShowDebug(batch->job[i]);
+				failed = true;
+			}
+			SqlJob_Free(batch->job[i]);
+		}
+		if( failed ) {
+			ShowError("char_wb_reap: Failed to save character %d, it will be saved whole on its next save.\n", batch->char_id);
+			idb_remove(char_db_, batch->char_id);
+		}
+
+		if( (char_wb_head = batch->next) == NULL )
+			char_wb_tail = NULL;
+		char_wb_queued--;
+		if( (wb = (struct char_wb *)idb_get(char_wb_db, batch->char_id)) != NULL && wb->batch == batch ) {
+			wb->batch = NULL;
+			if( !wb->pending )
+				idb_remove(char_wb_db, batch->char_id);
+		}
+		aFree(batch);
+	}
+}
+
+/// Queues the pending saves of a character right away (logout).
+void char_wb_flush(int char_id)
+{
+	struct char_wb *wb;
+
+	if( char_wb_db && (wb = (struct char_wb *)idb_get(char_wb_db, char_id)) != NULL )
+		char_wb_flush_sub(wb);
+}
+
+/// Waits until the saves of a character are written, before its rows are read or written directly.
+void char_wb_sync(int char_id)
+{
+	struct char_wb *wb;
+
+	if( char_wb_db == NULL || (wb = (struct char_wb *)idb_get(char_wb_db, char_id)) == NULL )
+		return;
+	char_wb_flush_sub(wb);
+	if( wb->batch ) {
+		SqlJob_Wait(wb->batch->job[wb->batch->count - 1]);
+		char_wb_reap(); //Frees wb
+	}
+}
+
+/// Waits until the saves of all the characters of an account are written.
+void char_wb_sync_account(int account_id)
+{
+	DBIterator *iter;
+	struct char_wb *wb;
+	int char_id[MAX_CHARS];
+	int i, count = 0;
+
+	if( char_wb_db == NULL )
+		return;
+	iter = db_iterator(char_wb_db);
+	for( wb = (struct char_wb *)dbi_first(iter); dbi_exists(iter) && count < MAX_CHARS; wb = (struct char_wb *)dbi_next(iter) )
+		if( wb->account_id == account_id )
+			char_id[count++] = wb->char_id;
+	dbi_destroy(iter);
+	for( i = 0; i < count; i++ )
+		char_wb_sync(char_id[i]);
+}
+
+/// Waits until all the saves are written, before rows of several characters are written directly.
+void char_wb_sync_all(void)
+{
+	DBIterator *iter;
+	struct char_wb *wb;
+
+	if( char_wb_worker == NULL )
+		return;
+	iter = db_iterator(char_wb_db);
+	for( wb = (struct char_wb *)dbi_first(iter); dbi_exists(iter); wb = (struct char_wb *)dbi_next(iter) )
+		char_wb_flush_sub(wb);
+	dbi_destroy(iter);
+	if( char_wb_tail )
+		SqlJob_Wait(char_wb_tail->job[char_wb_tail->count - 1]);
+	char_wb_reap();
+}
+
+/// Flushes the pending saves and reaps the executed ones.
+static TIMER_FUNC(char_wb_timer)
+{
+	DBIterator *iter = db_iterator(char_wb_db);
+	struct char_wb *wb;
+
+	for( wb = (struct char_wb *)dbi_first(iter); dbi_exists(iter); wb = (struct char_wb *)dbi_next(iter) )
+		char_wb_flush_sub(wb);
+	dbi_destroy(iter);
+	char_wb_reap();
+	return 0;
+}
+
+/// Records how long the handling of a save took.
+static void char_save_latency_add(uint64 usec)
+{
+	char_save_latency.sample[char_save_latency.count % CHAR_SAVE_SAMPLES] = (uint32)min(usec, (uint64)UINT32_MAX);
+	char_save_latency.count++;
+	char_save_latency.total += usec;
+}
+
+static int char_save_latency_cmp(const void *a, const void *b)
+{
+	uint32 x = *(const uint32 *)a, y = *(const uint32 *)b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/// Shows the save handling times and the write-behind queue.
+void char_save_report(void)
+{
+	uint32 sorted[CHAR_SAVE_SAMPLES];
+	unsigned int n = min(char_save_latency.count, CHAR_SAVE_SAMPLES);
+
+	if( n == 0 )
+		ShowInfo("No character saves received yet.\n");
+	else {
+		memcpy(sorted, char_save_latency.sample, n * sizeof(uint32));
+		qsort(sorted, n, sizeof(uint32), char_save_latency_cmp);
+		ShowInfo("Character saves: %u, average %" PRIu64 " us. Last %u: median %u us, p99 %u us, max %u us.\n",
+			char_save_latency.count, char_save_latency.total / char_save_latency.count, n,
+			sorted[n / 2], sorted[(n * 99) / 100], sorted[n - 1]);
+	}
+	if( char_wb_worker )
+		ShowInfo("Write-behind: %d characters with unwritten saves, %d saves on the worker.\n", db_size(char_wb_db), char_wb_queued);
+	else
+		ShowInfo("Write-behind is disabled, saves are written right away.\n");
+}
+
+/// Starts the write-behind worker, when enabled.
+static void char_wb_init(void)
+{
+	char_wb_db = idb_alloc(DB_OPT_RELEASE_DATA);
+	if( save_write_behind <= 0 )
+		return;
+	if( (char_wb_worker = inter_sql_worker_create()) == NULL ) {
+		ShowWarning("Couldn't start the save_write_behind worker, character saves are written right away.\n");
+		return;
+	}
+	add_timer_func_list(char_wb_timer, "char_wb_timer");
+	add_timer_interval(gettick() + save_write_behind, char_wb_timer, 0, 0, save_write_behind);
+}
+
+/// Writes all the pending saves and stops the worker.
+static void char_wb_final(void)
+{
+	if( char_wb_worker ) {
+		char_wb_timer(INVALID_TIMER, gettick(), 0, 0);
+		if( char_wb_tail )
+			SqlJob_Wait(char_wb_tail->job[char_wb_tail->count - 1]);
+		char_wb_reap();
+		SqlWorker_Free(char_wb_worker);
+		char_wb_worker = NULL;
+	}
+	if( char_wb_db ) {
+		db_destroy(char_wb_db);
+		char_wb_db = NULL;
+	}
+}
+
 int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 {
 	int i = 0;
@@ -513,13 +840,15 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 	int diff = 0;
 	char save_status[128]; //For displaying save information. [Skotlex]
 	struct mmo_charstatus *cp;
-	int errors = 0; //If there are any errors while saving, "cp" will not be updated at the end.
+	struct char_wb *wb;
+	int errors = 0; //If there are any errors while saving, "cp" will not be updated at the end and -1 is returned.
 	StringBuf buf;
 
 	if (char_id != p->char_id)
 		return 0;
 
 	cp = (struct mmo_charstatus *)idb_ensure(char_db_, char_id, create_charstatus);
+	wb = char_wb_get(p->account_id, char_id); //Pending saves, NULL when they are written right away
 
 	StringBuf_Init(&buf);
 	memset(save_status, 0, sizeof(save_status));
@@ -552,7 +881,8 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 		if( p->show_equip )
 			opt |= OPT_SHOW_EQUIP;
 
-		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `base_level`='%d',`job_level`='%d',"
+		char_wb_begin(wb, CHARWB_STATUS);
+		if( SQL_ERROR == char_save_query(wb, CHARWB_STATUS, "UPDATE `%s` SET `base_level`='%d',`job_level`='%d',"
 			"`base_exp`='%u',`job_exp`='%u',`zeny`='%d',"
 			"`max_hp`='%u',`hp`='%u',`max_sp`='%u',`sp`='%u',`status_point`='%d',`skill_point`='%d',"
 			"`str`='%d',`agi`='%d',`vit`='%d',`int`='%d',`dex`='%d',`luk`='%d',"
@@ -573,10 +903,8 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 			(unsigned long)p->delete_date, //FIXME: platform-dependent size
 			p->robe,p->character_moves,opt,p->font,p->uniqueitem_counter,p->hotkey_rowshift,p->clan_id,p->title_id,
 			p->account_id,p->char_id) )
-		{
-			Sql_ShowDebug(sql_handle);
 			errors++;
-		} else
+		else
 			strcat(save_status, " status");
 	}
 
@@ -590,7 +918,8 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 		(p->fame != cp->fame)
 	)
 	{
-		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `class`='%d',"
+		char_wb_begin(wb, CHARWB_STATUS2);
+		if( SQL_ERROR == char_save_query(wb, CHARWB_STATUS2, "UPDATE `%s` SET `class`='%d',"
 			"`hair`='%d',`hair_color`='%d',`clothes_color`='%d',`body`='%d',"
 			"`partner_id`='%d',`father`='%d',`mother`='%d',`child`='%d',"
 			"`karma`='%d',`manner`='%d',`fame`='%d'"
@@ -600,10 +929,8 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 			p->partner_id, p->father, p->mother, p->child,
 			p->karma, p->manner, p->fame,
 			p->account_id, p->char_id) )
-		{
-			Sql_ShowDebug(sql_handle);
 			errors++;
-		} else
+		else
 			strcat(save_status, " status2");
 	}
 
@@ -624,6 +951,7 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 		char esc_mapname[NAME_LENGTH * 2 + 1];
 
 		//`memo` (`memo_id`,`char_id`,`map`,`x`,`y`)
+		//No key to upsert on, written right away
 		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", memo_db, p->char_id) ) {
 			Sql_ShowDebug(sql_handle);
 			errors++;
@@ -641,11 +969,9 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 				++count;
 			}
 		}
-		if( count ) {
-			if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-				Sql_ShowDebug(sql_handle);
-				errors++;
-			}
+		if( count && SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
+			Sql_ShowDebug(sql_handle);
+			errors++;
 		}
 		strcat(save_status, " memo");
 	}
@@ -659,11 +985,11 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 	//Skills
 	if( memcmp(p->skill, cp->skill, sizeof(p->skill)) ) {
 		//`skill` (`char_id`, `id`, `lv`)
-		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", skill_db, p->char_id) ) {
-			Sql_ShowDebug(sql_handle);
-			errors++;
-		}
+		//Upserted before the stale rows are deleted, a failed statement never loses the skills
+		StringBuf ids;
 
+		char_wb_begin(wb, CHARWB_SKILL);
+		StringBuf_Init(&ids);
 		StringBuf_Clear(&buf);
 		StringBuf_Printf(&buf, "INSERT INTO `%s`(`char_id`,`id`,`lv`,`flag`) VALUES ", skill_db);
 		//Insert here.
@@ -673,20 +999,25 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 					continue;
 				if( p->skill[i].flag != SKILL_FLAG_PERMANENT && p->skill[i].flag != SKILL_FLAG_PERM_GRANTED && (p->skill[i].flag - SKILL_FLAG_REPLACED_LV_0) == 0 )
 					continue;
-				if( count )
+				if( count ) {
 					StringBuf_AppendStr(&buf, ",");
+					StringBuf_AppendStr(&ids, ",");
+				}
+				StringBuf_Printf(&ids, "'%d'", p->skill[i].id);
 				StringBuf_Printf(&buf, "('%d','%d','%d','%d')", char_id, p->skill[i].id,
 					( (p->skill[i].flag == SKILL_FLAG_PERMANENT || p->skill[i].flag == SKILL_FLAG_PERM_GRANTED) ? p->skill[i].lv : p->skill[i].flag - SKILL_FLAG_REPLACED_LV_0),
 					p->skill[i].flag == SKILL_FLAG_PERM_GRANTED ? p->skill[i].flag : 0); /* Other flags do not need to be saved */
 				++count;
 			}
 		}
-		if( count ) {
-			if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-				Sql_ShowDebug(sql_handle);
-				errors++;
-			}
-		}
+		StringBuf_AppendStr(&buf, " ON DUPLICATE KEY UPDATE `lv`=VALUES(`lv`),`flag`=VALUES(`flag`)");
+		if( count && SQL_ERROR == char_save_querystr(wb, CHARWB_SKILL, StringBuf_Value(&buf)) )
+			errors++;
+		if( count && SQL_ERROR == char_save_query(wb, CHARWB_SKILL, "DELETE FROM `%s` WHERE `char_id`='%d' AND `id` NOT IN (%s)", skill_db, p->char_id, StringBuf_Value(&ids)) )
+			errors++;
+		if( !count && SQL_ERROR == char_save_query(wb, CHARWB_SKILL, "DELETE FROM `%s` WHERE `char_id`='%d'", skill_db, p->char_id) )
+			errors++;
+		StringBuf_Destroy(&ids);
 
 		strcat(save_status, " skills");
 	}
@@ -701,6 +1032,7 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 	}
 
 	if( diff == 1 ) { //Save friends
+		//No key to upsert on, written right away
 		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", friend_db, char_id) ) {
 			Sql_ShowDebug(sql_handle);
 			errors++;
@@ -716,85 +1048,250 @@ int mmo_char_tosql(int char_id, struct mmo_charstatus *p)
 				count++;
 			}
 		}
-		if( count ) {
-			if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-				Sql_ShowDebug(sql_handle);
-				errors++;
-			}
+		if( count && SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
+			Sql_ShowDebug(sql_handle);
+			errors++;
 		}
 		strcat(save_status, " friends");
 	}
 
 #ifdef HOTKEY_SAVING
 	//Hotkeys
-	StringBuf_Clear(&buf);
-	StringBuf_Printf(&buf, "REPLACE INTO `%s` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`) VALUES ", hotkey_db);
-	diff = 0;
-	for( i = 0; i < ARRAYLENGTH(p->hotkeys); i++ ) {
-		if( memcmp(&p->hotkeys[i], &cp->hotkeys[i], sizeof(struct hotkey)) ) {
-			if( diff )
-				StringBuf_AppendStr(&buf, ",");// not the first hotkey
-			StringBuf_Printf(&buf, "('%d','%u','%u','%u','%u')", char_id, (unsigned int)i, (unsigned int)p->hotkeys[i].type, p->hotkeys[i].id , (unsigned int)p->hotkeys[i].lv);
-			diff = 1;
+	//Only the changed ones are replaced, unless the statement supersedes a pending one
+	if( memcmp(p->hotkeys, cp->hotkeys, sizeof(p->hotkeys)) ) {
+		StringBuf_Clear(&buf);
+		StringBuf_Printf(&buf, "REPLACE INTO `%s` (`char_id`, `hotkey`, `type`, `itemskill_id`, `skill_lvl`) VALUES ", hotkey_db);
+		diff = 0;
+		for( i = 0; i < ARRAYLENGTH(p->hotkeys); i++ ) {
+			if( wb || memcmp(&p->hotkeys[i], &cp->hotkeys[i], sizeof(struct hotkey)) ) {
+				if( diff )
+					StringBuf_AppendStr(&buf, ",");// not the first hotkey
+				StringBuf_Printf(&buf, "('%d','%u','%u','%u','%u')", char_id, (unsigned int)i, (unsigned int)p->hotkeys[i].type, p->hotkeys[i].id , (unsigned int)p->hotkeys[i].lv);
+				diff = 1;
+			}
 		}
-	}
-	if( diff ) {
-		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-			Sql_ShowDebug(sql_handle);
+		char_wb_begin(wb, CHARWB_HOTKEY);
+		if( SQL_ERROR == char_save_querystr(wb, CHARWB_HOTKEY, StringBuf_Value(&buf)) )
 			errors++;
-		} else
+		else
 			strcat(save_status, " hotkeys");
 	}
 #endif
 	StringBuf_Destroy(&buf);
 	if( save_status[0] != '\0' && save_log )
-		ShowInfo("Saved char %d - %s:%s.\n", char_id, p->name, save_status);
+		ShowInfo("%s char %d - %s:%s.\n", (wb ? "Queued save of" : "Saved"), char_id, p->name, save_status);
 	if( !errors )
 		memcpy(cp, p, sizeof(struct mmo_charstatus));
+	if( wb && !wb->pending && wb->batch == NULL )
+		idb_remove(char_wb_db, char_id); //Nothing to write
+	return (errors ? -1 : 0);
+}
+
+/*==========================================
+ * Item rows cache
+ *------------------------------------------*/
+/// Item rows of an owner as they are in the database, so that saves are diffed without reading them back.
+/// Filled when the items are loaded, updated by each save and dropped when something else writes the rows.
+struct memitem_cache {
+	uint8 stor_id;
+	int count;
+	struct item *items; //Rows, with their `id`
+	struct memitem_cache *next; //Other storages of the same owner
+};
+static DBMap *memitem_cache_db[TABLE_GUILD_STORAGE + 1]; // int owner_id -> struct memitem_cache*, by enum storage_type
+static int memitem_autoinc_step = 1; //@@auto_increment_increment, between the ids given to the rows of a multi-row INSERT
+static int memitem_autoinc_lock_mode = -1; //@@innodb_autoinc_lock_mode (-1: unknown)
+static DBMap *memitem_autoinc_db = NULL; // char *table -> 1 if a multi-row INSERT gives it consecutive ids, 2 if not
+
+static struct memitem_cache *memitem_cache_get(enum storage_type type, uint8 stor_id, int id)
+{
+	struct memitem_cache *cache;
+
+	if( memitem_cache_db[type] == NULL )
+		return NULL;
+	for( cache = (struct memitem_cache *)idb_get(memitem_cache_db[type], id); cache && cache->stor_id != stor_id; cache = cache->next );
+	return cache;
+}
+
+/// Replaces the cached rows of an owner.
+static void memitem_cache_set(enum storage_type type, uint8 stor_id, int id, const struct item *rows, int count)
+{
+	struct memitem_cache *cache;
+
+	if( memitem_cache_db[type] == NULL )
+		return;
+	if( (cache = memitem_cache_get(type, stor_id, id)) == NULL ) {
+		CREATE(cache, struct memitem_cache, 1);
+		cache->stor_id = stor_id;
+		cache->next = (struct memitem_cache *)idb_get(memitem_cache_db[type], id);
+		idb_put(memitem_cache_db[type], id, cache);
+	}
+	if( cache->count != count ) {
+		if( cache->items )
+			aFree(cache->items);
+		cache->items = (count > 0 ? (struct item *)aMalloc(count * sizeof(struct item)) : NULL);
+		cache->count = count;
+	}
+	if( count > 0 )
+		memcpy(cache->items, rows, count * sizeof(struct item));
+}
+
+static void memitem_cache_free(struct memitem_cache *cache)
+{
+	while( cache ) {
+		struct memitem_cache *next = cache->next;
+
+		if( cache->items )
+			aFree(cache->items);
+		aFree(cache);
+		cache = next;
+	}
+}
+
+/// Drops the cached rows of an owner (all its storages), its next save reads them from the database.
+void memitem_cache_drop(enum storage_type type, int id)
+{
+	struct memitem_cache *cache;
+
+	if( memitem_cache_db[type] && (cache = (struct memitem_cache *)idb_get(memitem_cache_db[type], id)) != NULL ) {
+		idb_remove(memitem_cache_db[type], id);
+		memitem_cache_free(cache);
+	}
+}
+
+/**
+ * @see DBApply
+ */
+static int memitem_cache_final_sub(DBKey key, DBData *data, va_list ap)
+{
+	memitem_cache_free((struct memitem_cache *)db_data2ptr(data));
 	return 0;
 }
 
-/// Saves an array of 'item' entries into the specified table.
-int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_type tableswitch, uint8 stor_id)
+static void memitem_cache_init(void)
 {
-	StringBuf buf;
-	SqlStmt *stmt;
-	int i, j, offset = 0, errors = 0;
-	const char *tablename, *selectoption, *printname;
-	struct item item; // Temp storage variable
-	bool *flag; // Bit array for inventory matching
-	bool found;
+	int i;
+	char *data;
 
-	switch( tableswitch ) {
-		case TABLE_INVENTORY:
-			printname = "Inventory";
-			tablename = inventory_db;
-			selectoption = "char_id";
-			break;
-		case TABLE_CART:
-			printname = "Cart";
-			tablename = cart_db;
-			selectoption = "char_id";
-			break;
-		case TABLE_STORAGE:
-			printname = inter_premiumStorage_getPrintableName(stor_id);
-			tablename = inter_premiumStorage_getTableName(stor_id);
-			selectoption = "account_id";
-			break;
-		case TABLE_GUILD_STORAGE:
-			printname = "Guild Storage";
-			tablename = guild_storage_db;
-			selectoption = "guild_id";
-			break;
-		default:
-			ShowError("Invalid table name!\n");
-			return 1;
+	for( i = TABLE_INVENTORY; i <= TABLE_GUILD_STORAGE; i++ )
+		memitem_cache_db[i] = idb_alloc(DB_OPT_BASE);
+	memitem_autoinc_db = strdb_alloc(DB_OPT_DUP_KEY, 0);
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT @@auto_increment_increment") )
+		Sql_ShowDebug(sql_handle);
+	else if( SQL_SUCCESS == Sql_NextRow(sql_handle) && SQL_SUCCESS == Sql_GetData(sql_handle, 0, &data, NULL) && data )
+		memitem_autoinc_step = max(atoi(data), 1);
+	Sql_FreeResult(sql_handle);
+	//Not an error when the server has no InnoDB
+	if( SQL_SUCCESS == Sql_Query(sql_handle, "SELECT @@innodb_autoinc_lock_mode") &&
+		SQL_SUCCESS == Sql_NextRow(sql_handle) && SQL_SUCCESS == Sql_GetData(sql_handle, 0, &data, NULL) && data )
+		memitem_autoinc_lock_mode = atoi(data);
+	Sql_FreeResult(sql_handle);
+}
+
+/// Returns whether the rows of a multi-row INSERT into this table get consecutive ids,
+/// so that they can be derived from the insert id.
+/// Engines with table locks (MyISAM, Aria, MEMORY) hold the lock for the whole statement.
+/// InnoDB does too, unless innodb_autoinc_lock_mode is 2 (interleaved), where concurrent
+/// inserts can take ids in between. Unknown engines count as not consecutive.
+static bool memitem_autoinc_consecutive(const char *tablename)
+{
+	char esc_table[2 * 64 + 1];
+	char *data;
+	int consecutive;
+
+	if( memitem_autoinc_db == NULL )
+		return false;
+	if( (consecutive = strdb_iget(memitem_autoinc_db, tablename)) != 0 )
+		return (consecutive == 1);
+
+	consecutive = 2;
+	Sql_EscapeStringLen(sql_handle, esc_table, tablename, strnlen(tablename, 64));
+	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `ENGINE` FROM `information_schema`.`TABLES` WHERE `TABLE_SCHEMA` = DATABASE() AND `TABLE_NAME` = '%s'", esc_table) )
+		Sql_ShowDebug(sql_handle);
+	else if( SQL_SUCCESS == Sql_NextRow(sql_handle) && SQL_SUCCESS == Sql_GetData(sql_handle, 0, &data, NULL) && data ) {
+		if( !strcmpi(data, "MyISAM") || !strcmpi(data, "Aria") || !strcmpi(data, "MEMORY") )
+			consecutive = 1;
+		else if( !strcmpi(data, "InnoDB") && memitem_autoinc_lock_mode >= 0 && memitem_autoinc_lock_mode < 2 )
+			consecutive = 1;
 	}
+	Sql_FreeResult(sql_handle);
+	if( consecutive != 1 )
+		ShowInfo("Rows inserted into table '%s' are read back on the next save, its engine may not give consecutive ids to a multi-row INSERT.\n", tablename);
+	strdb_iput(memitem_autoinc_db, tablename, consecutive);
+	return (consecutive == 1);
+}
 
-	// The following code compares inventory with current database values
-	// and performs modification/deletion/insertion only on relevant rows.
-	// This approach is more complicated than a trivial delete&insert, but
-	// it significantly reduces cpu load on the database server.
+static void memitem_cache_final(void)
+{
+	int i;
+
+	for( i = TABLE_INVENTORY; i <= TABLE_GUILD_STORAGE; i++ ) {
+		if( memitem_cache_db[i] ) {
+			memitem_cache_db[i]->destroy(memitem_cache_db[i], memitem_cache_final_sub);
+			memitem_cache_db[i] = NULL;
+		}
+	}
+	if( memitem_autoinc_db ) {
+		db_destroy(memitem_autoinc_db);
+		memitem_autoinc_db = NULL;
+	}
+}
+
+/// Appends the item columns, or their assignments for ON DUPLICATE KEY UPDATE.
+static void memitemdata_columns(StringBuf *buf, enum storage_type tableswitch, const char *selectoption, bool assign)
+{
+	const char *fmt = (assign ? "%s`%s`=VALUES(`%s`)" : "%s`%s`");
+	static const char *columns[] = { "nameid", "amount", "equip", "identify", "refine", "attribute", "expire_time", "bound", "unique_id" };
+	char name[32];
+	int i;
+
+	StringBuf_Printf(buf, fmt, "", selectoption, selectoption);
+	for( i = 0; i < ARRAYLENGTH(columns); ++i )
+		StringBuf_Printf(buf, fmt, ", ", columns[i], columns[i]);
+	if( tableswitch == TABLE_INVENTORY ) {
+		StringBuf_Printf(buf, fmt, ", ", "favorite", "favorite");
+		StringBuf_Printf(buf, fmt, ", ", "equip_switch", "equip_switch");
+	}
+	for( i = 0; i < MAX_SLOTS; ++i ) {
+		safesnprintf(name, sizeof(name), "card%d", i);
+		StringBuf_Printf(buf, fmt, ", ", name, name);
+	}
+	for( i = 0; i < MAX_ITEM_RDM_OPT; ++i ) {
+		safesnprintf(name, sizeof(name), "option_id%d", i);
+		StringBuf_Printf(buf, fmt, ", ", name, name);
+		safesnprintf(name, sizeof(name), "option_val%d", i);
+		StringBuf_Printf(buf, fmt, ", ", name, name);
+		safesnprintf(name, sizeof(name), "option_parm%d", i);
+		StringBuf_Printf(buf, fmt, ", ", name, name);
+	}
+}
+
+/// Appends the values of an item, in the order of memitemdata_columns.
+static void memitemdata_values(StringBuf *buf, const struct item *item, int id, enum storage_type tableswitch)
+{
+	int j;
+
+	StringBuf_Printf(buf, "'%d', '%hu', '%d', '%u', '%d', '%d', '%d', '%u', '%d', '%"PRIu64"'",
+		id, item->nameid, item->amount, item->equip, item->identify, item->refine, item->attribute, item->expire_time, item->bound, item->unique_id);
+	if( tableswitch == TABLE_INVENTORY )
+		StringBuf_Printf(buf, ", '%d', '%u'", item->favorite, item->equipSwitch);
+	for( j = 0; j < MAX_SLOTS; ++j )
+		StringBuf_Printf(buf, ", '%hu'", item->card[j]);
+	for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
+		StringBuf_Printf(buf, ", '%d'", item->option[j].id);
+		StringBuf_Printf(buf, ", '%d'", item->option[j].value);
+		StringBuf_Printf(buf, ", '%d'", item->option[j].param);
+	}
+}
+
+/// Reads the item rows of an owner, when they aren't cached.
+/// @return Number of rows, or -1 on error
+static int memitemdata_select(struct item **out_rows, int id, enum storage_type tableswitch, const char *tablename, const char *selectoption)
+{
+	StringBuf buf;
+	SqlStmt *stmt;
+	struct item item, *rows = NULL;
+	int i, offset = 0, count = 0, size = 0;
 
 	StringBuf_Init(&buf);
 	StringBuf_AppendStr(&buf, "SELECT `id`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`");
@@ -816,9 +1313,10 @@ int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_
 		SqlStmt_ShowDebug(stmt);
 		SqlStmt_Free(stmt);
 		StringBuf_Destroy(&buf);
-		return 1;
+		return -1;
 	}
 
+	memset(&item, 0, sizeof(item));
 	SqlStmt_BindColumn(stmt, 0, SQLDT_INT,          &item.id,          0, NULL, NULL);
 	SqlStmt_BindColumn(stmt, 1, SQLDT_USHORT,       &item.nameid,      0, NULL, NULL);
 	SqlStmt_BindColumn(stmt, 2, SQLDT_SHORT,        &item.amount,      0, NULL, NULL);
@@ -841,10 +1339,87 @@ int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_
 		SqlStmt_BindColumn(stmt, 12+offset+MAX_SLOTS+i*3, SQLDT_CHAR,   &item.option[i].param, 0, NULL, NULL);
 	}
 
+	while( SQL_SUCCESS == SqlStmt_NextRow(stmt) ) {
+		if( count == size ) {
+			size += 64;
+			RECREATE(rows, struct item, size);
+		}
+		memcpy(&rows[count++], &item, sizeof(item));
+	}
+	SqlStmt_Free(stmt);
+	StringBuf_Destroy(&buf);
+
+	*out_rows = rows;
+	return count;
+}
+
+/// Saves an array of 'item' entries into the specified table.
+int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_type tableswitch, uint8 stor_id)
+{
+	StringBuf buf, updates, deletes;
+	int i, j, errors = 0;
+	const char *tablename, *selectoption, *printname;
+	struct memitem_cache *cache;
+	struct item *rows = NULL; //Rows in the database
+	struct item *saved; //Rows after the save
+	int row_count, r, saved_count = 0, inserted = 0;
+	bool *flag; // Bit array for inventory matching
+	bool found, updated = false, deleted = false;
+
+	switch( tableswitch ) {
+		case TABLE_INVENTORY:
+			printname = "Inventory";
+			tablename = inventory_db;
+			selectoption = "char_id";
+			break;
+		case TABLE_CART:
+			printname = "Cart";
+			tablename = cart_db;
+			selectoption = "char_id";
+			break;
+		case TABLE_STORAGE:
+			printname = inter_premiumStorage_getPrintableName(stor_id);
+			tablename = inter_premiumStorage_getTableName(stor_id);
+			selectoption = "account_id";
+			break;
+		case TABLE_GUILD_STORAGE:
+			printname = "Guild Storage";
+			tablename = guild_storage_db;
+			selectoption = "guild_id";
+			break;
+		default:
+			ShowError("Invalid table name!\n");
+			return 1;
+	}
+
+	// The following code compares inventory with current database values
+	// and performs modification/deletion/insertion only on relevant rows.
+	// This approach is more complicated than a trivial delete&insert, but
+	// it significantly reduces cpu load on the database server.
+	// The database values are known from the previous load/save of the owner, unless it isn't cached.
+
+	if( (cache = memitem_cache_get(tableswitch, stor_id, id)) != NULL ) {
+		rows = cache->items;
+		row_count = cache->count;
+	} else if( (row_count = memitemdata_select(&rows, id, tableswitch, tablename, selectoption)) < 0 )
+		return 1;
+
+	StringBuf_Init(&buf);
+	StringBuf_Init(&updates);
+	StringBuf_Init(&deletes);
+
 	// Bit array indicating which inventory items have already been matched
 	flag = (bool *)aCalloc(max, sizeof(bool));
+	CREATE(saved, struct item, max);
+
+	StringBuf_Printf(&updates, "INSERT INTO `%s`(`id`, ", tablename);
+	memitemdata_columns(&updates, tableswitch, selectoption, false);
+	StringBuf_AppendStr(&updates, ") VALUES ");
+	StringBuf_Printf(&deletes, "DELETE FROM `%s` WHERE `id` IN (", tablename);
+
+	for( r = 0; r < row_count; ++r ) {
+		const struct item *item = &rows[r];
 
-	while( SQL_SUCCESS == SqlStmt_NextRow(stmt) ) {
 		found = false;
 		// Search for the presence of the item in the char's inventory
 		for( i = 0; i < max; ++i ) {
@@ -852,108 +1427,106 @@ int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_
 			if( items[i].nameid == 0 || flag[i] )
 				continue;
 
-			if( items[i].nameid == item.nameid &&
-				items[i].card[0] == item.card[0] &&
-				items[i].card[2] == item.card[2] &&
-				items[i].card[3] == item.card[3] &&
-				items[i].unique_id == item.unique_id )
+			if( items[i].nameid == item->nameid &&
+				items[i].card[0] == item->card[0] &&
+				items[i].card[2] == item->card[2] &&
+				items[i].card[3] == item->card[3] &&
+				items[i].unique_id == item->unique_id )
 			{ // They are the same item.
 				int k;
 
-				ARR_FIND(0, MAX_SLOTS, j, items[i].card[j] != item.card[j]);
-				ARR_FIND(0, MAX_ITEM_RDM_OPT, k, (items[i].option[k].id != item.option[k].id || items[i].option[k].value != item.option[k].value || items[i].option[k].param != item.option[k].param));
+				ARR_FIND(0, MAX_SLOTS, j, items[i].card[j] != item->card[j]);
+				ARR_FIND(0, MAX_ITEM_RDM_OPT, k, (items[i].option[k].id != item->option[k].id || items[i].option[k].value != item->option[k].value || items[i].option[k].param != item->option[k].param));
 				if( j == MAX_SLOTS &&
 					k == MAX_ITEM_RDM_OPT &&
-					items[i].amount == item.amount &&
-					items[i].equip == item.equip &&
-					items[i].identify == item.identify &&
-					items[i].refine == item.refine &&
-					items[i].attribute == item.attribute &&
-					items[i].expire_time == item.expire_time &&
-					items[i].bound == item.bound &&
-					(tableswitch != TABLE_INVENTORY || (items[i].favorite == item.favorite && items[i].equipSwitch == item.equipSwitch)) )
+					items[i].amount == item->amount &&
+					items[i].equip == item->equip &&
+					items[i].identify == item->identify &&
+					items[i].refine == item->refine &&
+					items[i].attribute == item->attribute &&
+					items[i].expire_time == item->expire_time &&
+					items[i].bound == item->bound &&
+					(tableswitch != TABLE_INVENTORY || (items[i].favorite == item->favorite && items[i].equipSwitch == item->equipSwitch)) )
 					; // Do nothing.
-				else {
-					// Update all fields.
-					StringBuf_Clear(&buf);
-					StringBuf_Printf(&buf, "UPDATE `%s` SET `amount`='%d', `equip`='%u', `identify`='%d', `refine`='%d',`attribute`='%d', `expire_time`='%u', `bound`='%d', `unique_id`='%"PRIu64"'",
-						tablename, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].bound, items[i].unique_id);
-					if( tableswitch == TABLE_INVENTORY )
-						StringBuf_Printf(&buf, ", `favorite`='%d', `equip_switch`='%u'", items[i].favorite, items[i].equipSwitch);
-					for( j = 0; j < MAX_SLOTS; ++j )
-						StringBuf_Printf(&buf, ", `card%d`=%hu", j, items[i].card[j]);
-					for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-						StringBuf_Printf(&buf, ", `option_id%d`=%d", j, items[i].option[j].id);
-						StringBuf_Printf(&buf, ", `option_val%d`=%d", j, items[i].option[j].value);
-						StringBuf_Printf(&buf, ", `option_parm%d`=%d", j, items[i].option[j].param);
-					}
-					StringBuf_Printf(&buf, " WHERE `id`='%d' LIMIT 1", item.id);
-
-					if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-						Sql_ShowDebug(sql_handle);
-						errors++;
-					}
+				else { // Update all fields, in one statement with the other changed rows
+					StringBuf_Printf(&updates, "%s('%d', ", (updated ? "," : ""), item->id);
+					memitemdata_values(&updates, &items[i], id, tableswitch);
+					StringBuf_AppendStr(&updates, ")");
+					updated = true;
 				}
 
+				memcpy(&saved[saved_count], &items[i], sizeof(struct item));
+				saved[saved_count++].id = item->id;
 				found = flag[i] = true; // Item dealt with.
 				break; // Skip to next item in the db.
 			}
 		}
 		if( !found ) { // Item not present in inventory, remove it.
-			if( SQL_ERROR == Sql_Query(sql_handle, "DELETE from `%s` where `id`='%d' LIMIT 1", tablename, item.id) ) {
-				Sql_ShowDebug(sql_handle);
-				errors++;
-			}
+			StringBuf_Printf(&deletes, "%s'%d'", (deleted ? "," : ""), item->id);
+			deleted = true;
 		}
 	}
-	SqlStmt_Free(stmt);
 
-	StringBuf_Clear(&buf);
-	StringBuf_Printf(&buf, "INSERT INTO `%s`(`%s`, `nameid`, `amount`, `equip`, `identify`, `refine`, `attribute`, `expire_time`, `bound`, `unique_id`", tablename, selectoption);
-	if( tableswitch == TABLE_INVENTORY )
-		StringBuf_Printf(&buf, ", `favorite`, `equip_switch`");
-	for( i = 0; i < MAX_SLOTS; ++i )
-		StringBuf_Printf(&buf, ", `card%d`", i);
-	for( i = 0; i < MAX_ITEM_RDM_OPT; ++i ) {
-		StringBuf_Printf(&buf, ", `option_id%d`", i);
-		StringBuf_Printf(&buf, ", `option_val%d`", i);
-		StringBuf_Printf(&buf, ", `option_parm%d`", i);
+	if( deleted ) {
+		StringBuf_AppendStr(&deletes, ")");
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&deletes)) ) {
+			Sql_ShowDebug(sql_handle);
+			errors++;
+		}
 	}
+
+	if( updated ) {
+		StringBuf_AppendStr(&updates, " ON DUPLICATE KEY UPDATE ");
+		memitemdata_columns(&updates, tableswitch, selectoption, true);
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&updates)) ) {
+			Sql_ShowDebug(sql_handle);
+			errors++;
+		}
+	}
+
+	StringBuf_Printf(&buf, "INSERT INTO `%s`(", tablename);
+	memitemdata_columns(&buf, tableswitch, selectoption, false);
 	StringBuf_AppendStr(&buf, ") VALUES ");
 
-	found = false;
 	// Insert non-matched items into the db as new items
 	for( i = 0; i < max; ++i ) {
 		// Skip empty and already matched entries
 		if( !(items[i].nameid) || flag[i] )
 			continue;
 
-		if( found )
-			StringBuf_AppendStr(&buf, ",");
-		else
-			found = true;
-
-		StringBuf_Printf(&buf, "('%d', '%hu', '%d', '%u', '%d', '%d', '%d', '%u', '%d', '%"PRIu64"'",
-			id, items[i].nameid, items[i].amount, items[i].equip, items[i].identify, items[i].refine, items[i].attribute, items[i].expire_time, items[i].bound, items[i].unique_id);
-		if( tableswitch == TABLE_INVENTORY )
-			StringBuf_Printf(&buf, ", '%d', '%u'", items[i].favorite, items[i].equipSwitch);
-		for( j = 0; j < MAX_SLOTS; ++j )
-			StringBuf_Printf(&buf, ", '%hu'", items[i].card[j]);
-		for( j = 0; j < MAX_ITEM_RDM_OPT; ++j ) {
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].id);
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].value);
-			StringBuf_Printf(&buf, ", '%d'", items[i].option[j].param);
-		}
+		StringBuf_AppendStr(&buf, (inserted ? ",(" : "("));
+		memitemdata_values(&buf, &items[i], id, tableswitch);
 		StringBuf_AppendStr(&buf, ")");
+		memcpy(&saved[saved_count + inserted], &items[i], sizeof(struct item));
+		inserted++;
 	}
 
-	if( found && SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
-		Sql_ShowDebug(sql_handle);
-		errors++;
+	if( inserted ) {
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&buf)) ) {
+			Sql_ShowDebug(sql_handle);
+			errors++;
+		} else if( memitem_autoinc_consecutive(tablename) ) { // The insert id is the id of the first row
+			int first_id = (int)Sql_LastInsertId(sql_handle);
+
+			for( i = 0; i < inserted; ++i )
+				saved[saved_count + i].id = first_id + i * memitem_autoinc_step;
+			saved_count += inserted;
+		}
 	}
 
-	ShowInfo("Saved %s data to table %s for %s: %d\n", printname, tablename, selectoption, id);
+	if( errors || (inserted && !memitem_autoinc_consecutive(tablename)) ) // Unknown state or ids, read it back on the next save
+		memitem_cache_drop(tableswitch, id);
+	else
+		memitem_cache_set(tableswitch, stor_id, id, saved, saved_count);
+
+	if( save_log )
+		ShowInfo("Saved %s data to table %s for %s: %d\n", printname, tablename, selectoption, id);
+	if( cache == NULL && rows )
+		aFree(rows);
 	StringBuf_Destroy(&buf);
+	StringBuf_Destroy(&updates);
+	StringBuf_Destroy(&deletes);
+	aFree(saved);
 	aFree(flag);
 
 	return errors;
@@ -1066,6 +1639,11 @@ bool memitemdata_from_sql(struct s_storage *p, int max, int id, enum storage_typ
 	p->amount = i;
 	ShowInfo("Loaded %s data from table %s for %s: %d (total: %d)\n", printname, tablename, selectoption, id, p->amount);
 
+	if( SqlStmt_NumRows(stmt) <= (uint64)i ) // All the rows were loaded, the next save can diff against them
+		memitem_cache_set(tableswitch, stor_id, id, storage, i);
+	else
+		memitem_cache_drop(tableswitch, id);
+
 	SqlStmt_FreeResult(stmt);
 	SqlStmt_Free(stmt);
 	StringBuf_Destroy(&buf);
@@ -1073,6 +1651,53 @@ bool memitemdata_from_sql(struct s_storage *p, int max, int id, enum storage_typ
 	return true;
 }
 
+/// Times the saves of a full storage, diffed against the cached rows and against a SELECT of them.
+/// Uses the storage of account 0, which is emptied afterwards.
+void memitem_bench(int saves)
+{
+	struct item *items;
+	uint64 tick, cached = 0, selected = 0;
+	int save_log_ = save_log;
+	int i, n, max = inter_premiumStorage_getMax(0);
+
+	if( saves <= 0 )
+		saves = 100;
+	CREATE(items, struct item, max);
+	for( i = 0; i < max; i++ ) {
+		items[i].nameid = 501 + i;
+		items[i].amount = 1 + i % 30;
+		items[i].identify = 1;
+	}
+	save_log = false;
+	memitem_cache_drop(TABLE_STORAGE, 0);
+	memitemdata_to_sql(items, max, 0, TABLE_STORAGE, 0); //Initial rows
+
+	for( n = 0; n < saves * 2; n++ ) {
+		// A few slots change between saves: amounts, an item taken out and one put in
+		items[rnd() % max].amount++;
+		items[rnd() % max].refine = rnd() % 10;
+		i = rnd() % max;
+		items[i].nameid = (items[i].nameid ? 0 : 501 + i);
+		if( n % 2 )
+			memitem_cache_drop(TABLE_STORAGE, 0);
+		tick = gettick_usec();
+		memitemdata_to_sql(items, max, 0, TABLE_STORAGE, 0);
+		tick = gettick_usec() - tick;
+		if( n % 2 )
+			selected += tick;
+		else
+			cached += tick;
+	}
+
+	memset(items, 0, max * sizeof(struct item));
+	memitemdata_to_sql(items, max, 0, TABLE_STORAGE, 0);
+	memitem_cache_drop(TABLE_STORAGE, 0);
+	save_log = save_log_;
+	aFree(items);
+	ShowInfo("Storage saves of %d slots (%d each): cached rows %" PRIu64 " us, SELECT %" PRIu64 " us per save.\n",
+		max, saves, cached / saves, selected / saves);
+}
+
 /**
  * Returns the correct gender ID for the given character and enum value.
  *
@@ -1157,6 +1782,8 @@ int mmo_chars_fromsql(struct char_session_data *sd, uint8 *buf, uint8 *count)
 	char last_map[MAP_NAME_LENGTH_EXT];
 	char sex[2];
 
+	char_wb_sync_account(sd->account_id); //Unwritten saves
+
 	stmt = SqlStmt_Malloc(sql_handle);
 	if( stmt == NULL ) {
 		SqlStmt_ShowDebug(stmt);
@@ -1272,6 +1899,8 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus *p, bool load_everything
 	if( save_log )
 		ShowInfo("Char load request (%d)\n", char_id);
 
+	char_wb_sync(char_id); //Unwritten saves
+
 	stmt = SqlStmt_Malloc(sql_handle);
 	if( stmt == NULL ) {
 		SqlStmt_ShowDebug(stmt);
@@ -1481,6 +2110,8 @@ int mmo_char_fromsql(int char_id, struct mmo_charstatus *p, bool load_everything
 int mmo_char_sql_init(void)
 {
 	char_db_= idb_alloc(DB_OPT_RELEASE_DATA);
+	char_wb_init();
+	memitem_cache_init();
 
 	//the 'set offline' part is now in check_login_conn ...
 	//if the server connects to loginserver
@@ -1580,6 +2211,7 @@ int rename_char_sql(struct char_session_data *sd, int char_id)
 			return 8;
 	}
 
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `name` = '%s', `rename` = '%d' WHERE `char_id` = '%d'",
 		char_db, esc_name, --char_dat.rename, char_id) ) {
 		Sql_ShowDebug(sql_handle);
@@ -1753,10 +2385,14 @@ int divorce_char_sql(int partner_id1, int partner_id2)
 {
 	unsigned char buf[64];
 
+	char_wb_sync(partner_id1);
+	char_wb_sync(partner_id2);
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `partner_id`='0' WHERE `char_id`='%d' OR `char_id`='%d' LIMIT 2", char_db, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE (`nameid`='%hu' OR `nameid`='%hu') AND (`char_id`='%d' OR `char_id`='%d') LIMIT 2", inventory_db, WEDDING_RING_M, WEDDING_RING_F, partner_id1, partner_id2) )
 		Sql_ShowDebug(sql_handle);
+	memitem_cache_drop(TABLE_INVENTORY, partner_id1);
+	memitem_cache_drop(TABLE_INVENTORY, partner_id2);
 
 	WBUFW(buf,0) = 0x2b12;
 	WBUFL(buf,2) = partner_id1;
@@ -1788,6 +2424,7 @@ enum e_char_del_response char_delete(struct char_session_data *sd, uint32 char_i
 		return CHAR_DELETE_NOTFOUND;
 	}
 
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `name`,`account_id`,`party_id`,`guild_id`,`base_level`,`homun_id`,`partner_id`,`father`,`mother`,`elemental_id`,`delete_date` FROM `%s` WHERE `account_id`='%u' AND `char_id`='%u'", char_db, sd->account_id, char_id) ) {
 		Sql_ShowDebug(sql_handle);
 		return CHAR_DELETE_DATABASE;
@@ -1843,6 +2480,8 @@ enum e_char_del_response char_delete(struct char_session_data *sd, uint32 char_i
 	if( father_id || mother_id ) { //Char is Baby
 		unsigned char buf[64];
 
+		char_wb_sync(father_id);
+		char_wb_sync(mother_id);
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `child`='0' WHERE `char_id`='%d' OR `char_id`='%d'", char_db, father_id, mother_id) )
 			Sql_ShowDebug(sql_handle);
 		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `id` = '410' AND (`char_id`='%d' OR `char_id`='%d')", skill_db, father_id, mother_id) )
@@ -1903,6 +2542,8 @@ enum e_char_del_response char_delete(struct char_session_data *sd, uint32 char_i
 	/* Delete cart inventory */
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", cart_db, char_id) )
 		Sql_ShowDebug(sql_handle);
+	memitem_cache_drop(TABLE_INVENTORY, char_id);
+	memitem_cache_drop(TABLE_CART, char_id);
 
 	/* Delete memo areas */
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `char_id`='%d'", memo_db, char_id) )
@@ -2494,8 +3135,10 @@ void loginif_parse_changesex(int sex, int acc, int char_id, int class_, int guil
 	else if( class_ == JOB_BABY_KAGEROU || class_ == JOB_BABY_OBORO )
 		class_ = (sex == SEX_MALE ? JOB_BABY_KAGEROU : JOB_BABY_OBORO);
 
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `equip` = '0' WHERE `char_id` = '%d'", inventory_db, char_id) )
 		Sql_ShowDebug(sql_handle);
+	memitem_cache_drop(TABLE_INVENTORY, char_id);
 
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `class` = '%d', `weapon` = '0', `shield` = '0', `head_top` = '0', `head_mid` = '0', `head_bottom` = '0', `robe` = '0' WHERE `char_id` = '%d'", char_db, class_, char_id) )
 		Sql_ShowDebug(sql_handle);
@@ -2518,6 +3161,7 @@ void loginif_parse_ackchangecharsex(int char_id, int sex)
 	int class_ = 0, guild_id = 0, account_id = 0;
 	char *data;
 
+	char_wb_sync(char_id); //Unwritten saves
 	//Get character data
 	if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `account_id`,`class`,`guild_id` FROM `%s` WHERE `char_id` = '%d'", char_db, char_id) ) {
 		Sql_ShowDebug(sql_handle);
@@ -3596,9 +4240,10 @@ int parse_frommap(int fd)
 				{
 					int aid = RFIFOL(fd,4), cid = RFIFOL(fd,8), size = RFIFOW(fd,2);
 					struct online_char_data *character;
+					uint64 start = gettick_usec();
 
-					if( size - 13 != sizeof(struct mmo_charstatus) ) {
-						ShowError("parse_from_map (save-char): Size mismatch! %d != %" PRIuPTR "\n", size - 13, sizeof(struct mmo_charstatus));
+					if( size - 17 != sizeof(struct mmo_charstatus) ) {
+						ShowError("parse_from_map (save-char): Size mismatch! %d != %" PRIuPTR "\n", size - 17, sizeof(struct mmo_charstatus));
 						RFIFOSKIP(fd,size);
 						break;
 					}
@@ -3608,9 +4253,13 @@ int parse_frommap(int fd)
 						character->char_id == cid) )
 					{
 						struct mmo_charstatus char_dat;
+						bool saved;
 
 						memcpy(&char_dat, RFIFOP(fd,13), sizeof(struct mmo_charstatus));
-						mmo_char_tosql(cid, &char_dat);
+						saved = (mmo_char_tosql(cid, &char_dat) == 0);
+						//Base of the next delta saves, a failed save must be sent whole again
+						if( (character = (struct online_char_data *)idb_get(online_char_db, aid)) != NULL && character->char_id == cid )
+							character->save_version = (saved ? RFIFOL(fd,13 + sizeof(struct mmo_charstatus)) : 0);
 					} else { //This may be valid on char-server reconnection, when re-sending characters that already logged off.
 						ShowError("parse_from_map (save-char): Received data for non-existant/offline character (%d:%d).\n", aid, cid);
 						set_char_online(id, cid, aid);
@@ -3625,6 +4274,52 @@ int parse_frommap(int fd)
 						WFIFOSET(fd,10);
 					}
 					RFIFOSKIP(fd,size);
+					char_save_latency_add(gettick_usec() - start);
+				}
+				break;
+
+			case 0x2b29: //Receive the changed sections of a character from map-server for saving
+				if( RFIFOREST(fd) < 4 || RFIFOREST(fd) < RFIFOW(fd,2) )
+					return 0;
+				{
+					int aid = RFIFOL(fd,4), cid = RFIFOL(fd,8), size = RFIFOW(fd,2);
+					uint32 base_version = RFIFOL(fd,12), version = RFIFOL(fd,16);
+					struct online_char_data *character = (struct online_char_data *)idb_get(online_char_db, aid);
+					struct mmo_charstatus *cp = (struct mmo_charstatus *)idb_get(char_db_, cid);
+					bool saved = false;
+					uint64 start = gettick_usec();
+
+					//The delta applies to the previous save, which must be the one still cached
+					if( character != NULL && character->char_id == cid && character->save_version == base_version && cp != NULL ) {
+						struct mmo_charstatus char_dat;
+						int pos = 20;
+
+						memcpy(&char_dat, cp, sizeof(struct mmo_charstatus));
+						while( pos < size ) {
+							int section = RFIFOB(fd,pos);
+							size_t len;
+
+							if( section >= CHARSAVE_SECT_MAX || pos + 1 + (len = charsave_section_size(section)) > (size_t)size )
+								break;
+							memcpy((uint8 *)&char_dat + charsave_section_offset(section), RFIFOP(fd,pos + 1), len);
+							pos += 1 + (int)len;
+						}
+						if( pos != size )
+							ShowError("parse_from_map (save-char-delta): Malformed sections for character %d:%d, requesting the whole data.\n", aid, cid);
+						else
+							saved = (mmo_char_tosql(cid, &char_dat) == 0);
+						character->save_version = (saved ? version : 0);
+					}
+
+					if( !saved ) { //Ask the map-server for the whole data
+						WFIFOHEAD(fd,10);
+						WFIFOW(fd,0) = 0x2b2c;
+						WFIFOL(fd,2) = aid;
+						WFIFOL(fd,6) = cid;
+						WFIFOSET(fd,10);
+					}
+					RFIFOSKIP(fd,size);
+					char_save_latency_add(gettick_usec() - start);
 				}
 				break;
 
@@ -4242,6 +4937,7 @@ static void char_delete2_req(int fd, struct char_session_data *sd)
 		return;
 	}
 
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_SUCCESS != Sql_Query(sql_handle, "SELECT `delete_date`, `party_id`, `guild_id` FROM `%s` WHERE `char_id`='%d'", char_db, char_id) ||
 		SQL_SUCCESS != Sql_NextRow(sql_handle) ) {
 		Sql_ShowDebug(sql_handle);
@@ -4371,6 +5067,7 @@ static void char_delete2_cancel(int fd, struct char_session_data *sd)
 	// There is no need to check, whether or not the character was
 	// queued for deletion, as the client prints an error message by
 	// itself, if it was not the case (@see char_delete2_cancel_ack)
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_SUCCESS != Sql_Query(sql_handle, "UPDATE `%s` SET `delete_date`='0' WHERE `char_id`='%d'", char_db, char_id) ) {
 		Sql_ShowDebug(sql_handle);
 		char_delete2_cancel_ack(fd, char_id, 2);
@@ -4941,11 +5638,20 @@ int parse_console(const char *buf)
 			ShowInfo(CL_CYAN"Console: "CL_BOLD"I'm Alive."CL_RESET"\n");
 	} else if( strcmpi("ers_report", type) == 0 )
 		ers_report();
+	else if( strcmpi("save_report", type) == 0 )
+		char_save_report();
+	else if( strcmpi("sql_report", type) == 0 )
+		Sql_Report(atoi(command));
+	else if( strcmpi("bench", type) == 0 && n == 2 && strncmpi("storage", command, 7) == 0 )
+		memitem_bench(atoi(command + 7));
 	else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t server:alive => Checks if the server is running.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t save_report => Displays the character save handling times and the write-behind queue.\n");
+		ShowInfo("\t bench:storage <saves> => Times full storage saves with and without the cached rows.\n");
+		ShowInfo("\t sql_report[:<top>] => Displays the slowest query templates and the statement cache since the previous report.\n");
 	}
 
 	return 0;
@@ -5334,6 +6040,7 @@ void moveCharSlot(int fd, struct char_session_data *sd, unsigned short from, uns
 
 	if( !char_moves_unlimited ) {
 		sd->char_moves[from]--;
+		char_wb_sync(sd->found_char[from]); //Unwritten saves
 		Sql_Query(sql_handle, "UPDATE `%s` SET `moves`='%d' WHERE `char_id`='%d'", char_db, sd->char_moves[from], sd->found_char[from] );
 	}
 
@@ -5497,8 +6204,9 @@ void bonus_script_get(int fd) {
 
 		RFIFOSKIP(fd,6);
 		if( SQL_ERROR == SqlStmt_Prepare(stmt,
-			"SELECT `script`, `tick`, `flag`, `type`, `icon` FROM `%s` WHERE `char_id` = '%d' LIMIT %d",
-			bonus_script_db, cid, MAX_PC_BONUS_SCRIPT) ||
+			"SELECT `script`, `tick`, `flag`, `type`, `icon` FROM `%s` WHERE `char_id` = ? LIMIT %d",
+			bonus_script_db, MAX_PC_BONUS_SCRIPT) ||
+			SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_UINT32, &cid, 0) ||
 			SQL_ERROR == SqlStmt_Execute(stmt) ||
 			SQL_ERROR == SqlStmt_BindColumn(stmt, 0, SQLDT_STRING, &tmp_bsdata.script_str, sizeof(tmp_bsdata.script_str), NULL, NULL) ||
 			SQL_ERROR == SqlStmt_BindColumn(stmt, 1, SQLDT_UINT32, &tmp_bsdata.tick, 0, NULL, NULL) ||
@@ -5533,7 +6241,8 @@ void bonus_script_get(int fd) {
 			}
 			WFIFOSET(fd,size);
 			ShowInfo("Bonus Script loaded for CID=%d. Total: %d.\n", cid, i);
-			if (SQL_ERROR == SqlStmt_Prepare(stmt,"DELETE FROM `%s` WHERE `char_id`='%d'",bonus_script_db,cid) ||
+			if (SQL_ERROR == SqlStmt_Prepare(stmt,"DELETE FROM `%s` WHERE `char_id`=?",bonus_script_db) ||
+				SQL_ERROR == SqlStmt_BindParam(stmt, 0, SQLDT_UINT32, &cid, 0) ||
 				SQL_ERROR == SqlStmt_Execute(stmt))
 				SqlStmt_ShowDebug(stmt);
 		}
@@ -5711,6 +6420,7 @@ static TIMER_FUNC(clan_member_cleanup)
 {
 	if(clan_remove_inactive_days <= 0) //Auto removal is disabled
 		return 0;
+	char_wb_sync_all(); //Unwritten saves
 	if(SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `clan_id`='0' WHERE `online`='0' AND `clan_id`<>'0' AND `last_login` IS NOT NULL AND `last_login` <= NOW() - INTERVAL %d DAY", char_db, clan_remove_inactive_days))
 		Sql_ShowDebug(sql_handle);
 	return 0;
@@ -6031,6 +6741,8 @@ int char_config_read(const char *cfgName)
 				autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
 		} else if(strcmpi(w1, "save_log") == 0)
 			save_log = config_switch(w2);
+		else if(strcmpi(w1, "save_write_behind") == 0)
+			save_write_behind = max(atoi(w2), 0);
 #ifdef RENEWAL
 		else if(strcmpi(w1, "start_point") == 0)
 #else
@@ -6162,6 +6874,7 @@ void do_final(void)
 {
 	ShowStatus("Terminating...\n");
 
+	char_wb_final(); //Write the pending saves
 	set_all_offline(-1);
 	set_all_offline_sql();
 
@@ -6179,6 +6892,7 @@ void do_final(void)
 	char_db_->destroy(char_db_, NULL);
 	online_char_db->destroy(online_char_db, NULL);
 	auth_db->destroy(auth_db, NULL);
+	memitem_cache_final();
 
 	if(char_fd != -1) {
 		do_close(char_fd);
@@ -35,6 +35,7 @@ struct online_char_data {
 	int waiting_disconnect;
 	short server; // -2: unknown server, -1: not connected, 0+: id of server
 	bool pincode_success;
+	uint32 save_version; // Version of the last save of char_id received from the map-server, base of its delta saves (0: none)
 };
 DBMap *online_char_db; // int account_id -> struct online_char_data*
 
@@ -68,8 +69,16 @@ enum e_char_del_response {
 	CHAR_DELETE_TIME,
 };
 
+void char_wb_flush(int char_id);
+void char_wb_sync(int char_id);
+void char_wb_sync_account(int account_id);
+void char_wb_sync_all(void);
+void char_save_report(void);
+
 int memitemdata_to_sql(const struct item items[], int max, int id, enum storage_type tableswitch, uint8 stor_id);
 bool memitemdata_from_sql(struct s_storage *p, int max, int id, enum storage_type tableswitch, uint8 stor_id);
+void memitem_cache_drop(enum storage_type type, int id);
+void memitem_bench(int saves);
 
 int mapif_sendall(unsigned char *buf, unsigned int len);
 int mapif_sendallwos(int fd, unsigned char *buf, unsigned int len);
@@ -17,6 +17,7 @@
 static DBMap *clan_db_; //int clan_id -> struct clan*
 
 int inter_clan_removemember_tosql(uint32 account_id, uint32 char_id) {
+	char_wb_sync(char_id); //Unwritten saves
 	if (SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `clan_id` = '0' WHERE `char_id` = '%d'", char_db, char_id)) {
 		Sql_ShowDebug(sql_handle);
 		return 1;
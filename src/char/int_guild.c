@@ -89,6 +89,7 @@ int inter_guild_removemember_tosql(int account_id, int char_id)
 {
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE from `%s` where `account_id` = '%d' and `char_id` = '%d'", guild_member_db, account_id, char_id) )
 		Sql_ShowDebug(sql_handle);
+	char_wb_sync(char_id); //Unwritten saves
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id` = '0' WHERE `char_id` = '%d'", char_db, char_id) )
 		Sql_ShowDebug(sql_handle);
 	return 0;
@@ -232,6 +233,7 @@ int inter_guild_tosql(struct guild *g, int flag)
 					m->class_, m->lv, m->exp, m->exp_payper, m->online, m->position, esc_name) )
 					Sql_ShowDebug(sql_handle);
 				if( m->modified&GS_MEMBER_NEW || new_guild == 1 ) {
+					char_wb_sync(m->char_id); //Unwritten saves
 					if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id` = '%d' WHERE `char_id` = '%d'",
 						char_db, g->guild_id, m->char_id) )
 						Sql_ShowDebug(sql_handle);
@@ -1250,6 +1252,7 @@ int mapif_parse_GuildLeave(int fd, int guild_id, int account_id, int char_id, in
 	struct guild *g = inter_guild_fromsql(guild_id);
 	if( g == NULL ) {
 		// Unknown guild, just update the player
+		char_wb_sync(char_id); //Unwritten saves
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id`='0' WHERE `account_id`='%d' AND `char_id`='%d'", char_db, account_id, char_id) )
 			Sql_ShowDebug(sql_handle);
 		// mapif_guild_withdraw(guild_id, account_id, char_id, flag, g->member[i].name, mes);
@@ -1369,6 +1372,7 @@ int mapif_parse_BreakGuild(int fd,int guild_id)
 
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `guild_id` = '%d'", guild_storage_db, guild_id) )
 		Sql_ShowDebug(sql_handle);
+	memitem_cache_drop(TABLE_GUILD_STORAGE, guild_id);
 
 	if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `guild_id` = '%d' OR `alliance_id` = '%d'", guild_alliance_db, guild_id, guild_id) )
 		Sql_ShowDebug(sql_handle);
@@ -1383,6 +1387,7 @@ int mapif_parse_BreakGuild(int fd,int guild_id)
 		Sql_ShowDebug(sql_handle);
 
 	//printf("- Update guild %d of char\n",guild_id);
+	char_wb_sync_all(); //Unwritten saves of the members
 	if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `guild_id`='0' WHERE `guild_id`='%d'", char_db, guild_id) )
 		Sql_ShowDebug(sql_handle);
 
@@ -134,6 +134,7 @@ int inter_party_tosql(struct party *p, int flag, int index)
 	if( flag & PS_BREAK )
 	{// Break the party
 		// We'll skip name-checking and just reset everyone with the same party id [celest]
+		char_wb_sync_all(); //Unwritten saves of the members
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `party_id`='0' WHERE `party_id`='%d'", char_db, party_id) )
 			Sql_ShowDebug(sql_handle);
 		if( SQL_ERROR == Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `party_id`='%d'", party_db, party_id) )
@@ -172,6 +173,7 @@ int inter_party_tosql(struct party *p, int flag, int index)
 	
 	if( flag & PS_ADDMEMBER )
 	{// Add one party member.
+		char_wb_sync(p->member[index].char_id); //Unwritten saves
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `party_id`='%d' WHERE `account_id`='%d' AND `char_id`='%d'",
 			char_db, party_id, p->member[index].account_id, p->member[index].char_id) )
 			Sql_ShowDebug(sql_handle);
@@ -179,6 +181,7 @@ int inter_party_tosql(struct party *p, int flag, int index)
 
 	if( flag & PS_DELMEMBER )
 	{// Remove one party member.
+		char_wb_sync(p->member[index].char_id); //Unwritten saves
 		if( SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `party_id`='0' WHERE `party_id`='%d' AND `account_id`='%d' AND `char_id`='%d'",
 			char_db, party_id, p->member[index].account_id, p->member[index].char_id) )
 			Sql_ShowDebug(sql_handle);
@@ -635,6 +638,7 @@ int mapif_parse_PartyLeave(int fd, int party_id, uint32 account_id, uint32 char_
 	unsigned int leader;
 
 	if (!(p = inter_party_fromsql(party_id))) { //Party does not exists?
+		char_wb_sync_all(); //Unwritten saves of the members
 		if (SQL_ERROR == Sql_Query(sql_handle, "UPDATE `%s` SET `party_id`='0' WHERE `party_id`='%d'", char_db, party_id))
 			Sql_ShowDebug(sql_handle);
 		return 0;
@@ -412,6 +412,8 @@ bool mapif_parse_itembound_retrieve(int fd)
 	set_session_flag(account_id, 1);
 
 	//Delete bound items from player's inventory
+	char_wb_sync(char_id); //Unwritten saves
+	memitem_cache_drop(TABLE_INVENTORY, char_id);
 	StringBuf_Clear(&buf);
 	StringBuf_Printf(&buf, "DELETE FROM `%s` WHERE `char_id` = %d AND `bound` = %d", inventory_db, char_id, BOUND_GUILD);
 	if( SQL_ERROR == SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf)) ||
@@ -696,6 +696,67 @@ int inter_accreg_tosql(int account_id, int char_id, struct accreg* reg, int type
 	return 1;
 }
 
+/// Saves the variables of a registry changed since its last save.
+/// An empty value deletes the variable, the others are inserted or updated.
+int inter_accreg_changes_tosql(int account_id, int char_id, struct accreg *reg, int type)
+{
+	StringBuf upsert, del;
+	int i, sets = 0, dels = 0;
+
+	if( account_id <= 0 )
+		return 0;
+
+	//`global_reg_value` (`type`, `account_id`, `char_id`, `str`, `value`)
+	switch( type ) {
+		case 3: // Char Reg
+			account_id = 0;
+			break;
+		case 2: // Account Reg
+			char_id = 0;
+			break;
+		default:
+			ShowError("inter_accreg_changes_tosql: Invalid type %d\n", type);
+			return 0;
+	}
+
+	StringBuf_Init(&upsert);
+	StringBuf_Init(&del);
+	StringBuf_Printf(&upsert, "INSERT INTO `%s` (`type`,`account_id`,`char_id`,`str`,`value`) VALUES ", reg_db);
+	StringBuf_Printf(&del, "DELETE FROM `%s` WHERE `type`=%d AND `account_id`='%d' AND `char_id`='%d' AND `str` IN (", reg_db, type, account_id, char_id);
+
+	for( i = 0; i < reg->reg_num; ++i ) {
+		struct global_reg *r = &reg->reg[i];
+		char str[32*2+1];
+		char val[256*2+1];
+
+		if( r->str[0] == '\0' )
+			continue;
+		Sql_EscapeString(sql_handle, str, r->str);
+		if( r->value[0] == '\0' ) {
+			StringBuf_Printf(&del, "%s'%s'", (dels++ ? "," : ""), str);
+			continue;
+		}
+		Sql_EscapeString(sql_handle, val, r->value);
+		StringBuf_Printf(&upsert, "%s('%d','%d','%d','%s','%s')", (sets++ ? "," : ""), type, account_id, char_id, str, val);
+	}
+
+	if( sets ) {
+		StringBuf_AppendStr(&upsert, " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&upsert)) )
+			Sql_ShowDebug(sql_handle);
+	}
+	if( dels ) {
+		StringBuf_AppendStr(&del, ")");
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&del)) )
+			Sql_ShowDebug(sql_handle);
+	}
+
+	StringBuf_Destroy(&upsert);
+	StringBuf_Destroy(&del);
+
+	return 1;
+}
+
 // Load account_reg from sql (type=2)
 int inter_accreg_fromsql(int account_id,int char_id, struct accreg *reg, int type)
 {
@@ -939,6 +1000,13 @@ int inter_init_sql(const char *file)
 }
 
 // Finalize
+/// Starts a background connection to the character database.
+/// @return SqlWorker handle or NULL if the thread couldn't be started
+SqlWorker *inter_sql_worker_create(void)
+{
+	return SqlWorker_Create(char_server_id, char_server_pw, char_server_ip, (uint16)char_server_port, char_server_db, default_codepage);
+}
+
 void inter_final(void)
 {
 	wis_db->destroy(wis_db, NULL);
@@ -1266,7 +1334,7 @@ int mapif_parse_Registry(int fd)
 	struct accreg *reg = accreg_pt;
 
 	memset(accreg_pt,0,sizeof(struct accreg));
-	switch (RFIFOB(fd,12)) {
+	switch (RFIFOB(fd,12)&~REG_CHANGES) {
 		case 3: //Character registry
 			max = GLOBAL_REG_NUM;
 			break;
@@ -1278,6 +1346,18 @@ int mapif_parse_Registry(int fd)
 		default:
 			return 1;
 	}
+	if (RFIFOB(fd,12)&REG_CHANGES) { //Changed variables only, the values can be empty (deleted)
+		for (j = 0, p = 13; j < max && p < RFIFOW(fd,2); j++) {
+			safestrncpy(reg->reg[j].str, (char *)RFIFOP(fd,p), sizeof(reg->reg[j].str));
+			p += strlen((char *)RFIFOP(fd,p)) + 1;
+			safestrncpy(reg->reg[j].value, (char *)RFIFOP(fd,p), sizeof(reg->reg[j].value));
+			p += strlen((char *)RFIFOP(fd,p)) + 1;
+		}
+		reg->reg_num = j;
+		inter_accreg_changes_tosql(RFIFOL(fd,4),RFIFOL(fd,8),reg,RFIFOB(fd,12)&~REG_CHANGES);
+		mapif_account_reg(fd,RFIFOP(fd,0)); //Other map servers apply the changes
+		return 0;
+	}
 	for (j = 0, p = 13; j < max && p < RFIFOW(fd,2); j++) {
 		sscanf((char *)RFIFOP(fd,p),"%31c%n",reg->reg[j].str,&len);
 		reg->reg[j].str[len] = '\0';
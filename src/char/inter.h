@@ -20,6 +20,7 @@ extern struct Inter_Config interserv_config;
 
 int inter_init_sql(const char *file);
 void inter_final(void);
+SqlWorker *inter_sql_worker_create(void);
 int inter_parse_frommap(int fd);
 int inter_mapif_init(int fd);
 int mapif_send_gmaccounts(void);
@@ -36,5 +37,6 @@ extern Sql *sql_handle;
 extern Sql *lsql_handle;
 
 int inter_accreg_tosql(int account_id, int char_id, struct accreg *reg, int type);
+int inter_accreg_changes_tosql(int account_id, int char_id, struct accreg *reg, int type);
 
 #endif /* _INTER_SQL_H_ */
@@ -0,0 +1,169 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+#ifndef _BINLOG_H_
+#define _BINLOG_H_
+
+#include "cbasetypes.h"
+
+#include <string.h>
+
+/// Binary log segments, written by the map server when 'log_binary' is enabled
+/// and converted to the log tables or CSV by the logconv tool.
+///
+/// A segment is a file that starts with a segment header and is followed by blocks.
+/// Every flush of the map server appends one block: a block header followed by its
+/// records, deflated when the segment has BINLOG_ZLIB set. A record is a record header
+/// followed by the fields of its type, see e_binlog_type.
+///
+/// Integers are little endian. Strings are a uint8 length followed by the characters,
+/// without terminator. Segments are never rewritten, a block cut short by a crash is
+/// the last one of its segment.
+///
+/// Segment header (BINLOG_HEADER_SIZE):
+///   char   magic[4]  BINLOG_MAGIC
+///   uint16 version   BINLOG_VERSION
+///   uint16 flags     e_binlog_flag
+///   uint32 created   Unix time
+///   uint32 reserved
+/// Block header (BINLOG_BLOCK_SIZE):
+///   uint32 length    Stored length of the records
+///   uint32 raw_len   Length of the records once inflated
+///   uint32 records   Number of records
+/// Record header (BINLOG_RECORD_SIZE):
+///   uint16 length    Length of the record, header included
+///   uint8  type      e_binlog_type
+///   uint8  reserved
+///   uint32 time      Unix time the record was logged
+
+#define BINLOG_MAGIC "ALOG"
+#define BINLOG_VERSION 1
+#define BINLOG_HEADER_SIZE 16
+#define BINLOG_BLOCK_SIZE 12
+#define BINLOG_RECORD_SIZE 8
+#define BINLOG_RECORD_MAX 1024 // Longest record, header included
+#define BINLOG_EXT ".blog"
+
+enum e_binlog_flag {
+	BINLOG_ZLIB = 0x1, // Blocks are deflated
+};
+
+/// Record types and their fields.
+/// Type characters are the ones written to the type columns of the log tables.
+enum e_binlog_type {
+	BINLOG_BRANCH = 0, // uint32 account_id, uint32 char_id, str char_name, str map
+	BINLOG_PICK,       // uint32 char_id, uint8 type, uint32 nameid, int32 amount, uint8 refine, str map, uint64 unique_id, uint8 bound,
+	                   // uint8 cards, cards * uint32 card, uint8 options, options * (int16 id, int16 value, uint8 param)
+	BINLOG_ZENY,       // uint32 char_id, uint32 src_id, uint8 type, int32 amount, str map
+	BINLOG_MVPDROP,    // uint32 kill_char_id, uint32 monster_id, uint32 prize, uint32 mvpexp, str map
+	BINLOG_GM,         // uint32 account_id, uint32 char_id, str char_name, str map, str command
+	BINLOG_NPC,        // uint32 account_id, uint32 char_id, str char_name, str map, str mes
+	BINLOG_CHAT,       // uint8 type, int32 type_id, uint32 src_charid, uint32 src_accountid, str src_map, uint16 src_map_x, uint16 src_map_y,
+	                   // str dst_charname, str message
+	BINLOG_CASH,       // uint32 char_id, uint8 type, uint8 cash_type, int32 amount, str map
+	BINLOG_FEEDING,    // uint32 char_id, uint32 target_id, uint16 target_class, uint8 type, uint32 intimacy, uint32 item_id, str map, uint16 x, uint16 y
+	BINLOG_MAX
+};
+
+
+// Writing: every function writes at p and returns the position after the value.
+
+static inline uint8 *binlog_put8(uint8 *p, uint8 v) {
+	p[0] = v;
+	return p + 1;
+}
+
+static inline uint8 *binlog_put16(uint8 *p, uint16 v) {
+	p[0] = (uint8)v;
+	p[1] = (uint8)(v>>8);
+	return p + 2;
+}
+
+static inline uint8 *binlog_put32(uint8 *p, uint32 v) {
+	p[0] = (uint8)v;
+	p[1] = (uint8)(v>>8);
+	p[2] = (uint8)(v>>16);
+	p[3] = (uint8)(v>>24);
+	return p + 4;
+}
+
+static inline uint8 *binlog_put64(uint8 *p, uint64 v) {
+	p = binlog_put32(p, (uint32)v);
+	return binlog_put32(p, (uint32)(v>>32));
+}
+
+/// Writes at most max_len characters of a string, stopping at its terminator.
+static inline uint8 *binlog_putstr(uint8 *p, const char *str, size_t max_len) {
+	size_t len = 0;
+
+	if( str != NULL )
+		while( len < max_len && len < UINT8_MAX && str[len] != '\0' )
+			len++;
+	p[0] = (uint8)len;
+	memcpy(p + 1, str, len);
+	return p + 1 + len;
+}
+
+
+// Reading: every function reads at the position of the reader and moves it past the value.
+// Reading past the end sets the error flag and returns zeros.
+
+struct binlog_reader {
+	const uint8 *p, *end;
+	bool error;
+};
+
+static inline bool binlog_need(struct binlog_reader *r, size_t len) {
+	if( r->error || (size_t)(r->end - r->p) < len ) {
+		r->error = true;
+		return false;
+	}
+	return true;
+}
+
+static inline uint8 binlog_get8(struct binlog_reader *r) {
+	if( !binlog_need(r, 1) )
+		return 0;
+	return *r->p++;
+}
+
+static inline uint16 binlog_get16(struct binlog_reader *r) {
+	uint16 v;
+
+	if( !binlog_need(r, 2) )
+		return 0;
+	v = (uint16)(r->p[0] | (r->p[1]<<8));
+	r->p += 2;
+	return v;
+}
+
+static inline uint32 binlog_get32(struct binlog_reader *r) {
+	uint32 v;
+
+	if( !binlog_need(r, 4) )
+		return 0;
+	v = (uint32)r->p[0] | ((uint32)r->p[1]<<8) | ((uint32)r->p[2]<<16) | ((uint32)r->p[3]<<24);
+	r->p += 4;
+	return v;
+}
+
+static inline uint64 binlog_get64(struct binlog_reader *r) {
+	uint64 lo = binlog_get32(r);
+
+	return lo | ((uint64)binlog_get32(r)<<32);
+}
+
+/// Reads a string into out, which receives the terminator.
+/// @param size : Size of out, at least UINT8_MAX + 1 to never truncate
+static inline void binlog_getstr(struct binlog_reader *r, char *out, size_t size) {
+	size_t len = binlog_get8(r);
+
+	out[0] = '\0';
+	if( !binlog_need(r, len) )
+		return;
+	memcpy(out, r->p, min(len, size - 1));
+	out[min(len, size - 1)] = '\0';
+	r->p += len;
+}
+
+#endif /* _BINLOG_H_ */
@@ -270,6 +270,7 @@ int main(int argc, char **argv)
 
 	timer_final();
 	socket_final();
+	Sql_final();
 	db_final();
 #endif
 
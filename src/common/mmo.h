@@ -285,6 +285,10 @@ struct global_reg {
 	char value[256];
 };
 
+/// Flag of the type of a registry save/update (0x3004, 0x3804, 0x2728, 0x2729):
+/// the packet only holds the variables changed since the last save, an empty value deletes the variable.
+#define REG_CHANGES 0x80
+
 //Holds array of global registries, used by the char server and converter.
 struct accreg {
 	int account_id, char_id;
@@ -509,6 +513,32 @@ struct mmo_charstatus {
 	unsigned long title_id;
 };
 
+/// Sections of struct mmo_charstatus, as sent by the map-server delta save (0x2b29).
+/// Only the sections that changed since the previous save of the character are sent.
+enum e_charsave_section {
+	CHARSAVE_SECT_BASE = 0, //Everything before the skills
+	CHARSAVE_SECT_SKILL,
+	CHARSAVE_SECT_FRIEND,
+	CHARSAVE_SECT_HOTKEY, //Empty without HOTKEY_SAVING
+	CHARSAVE_SECT_MISC, //Everything after the hotkeys
+	CHARSAVE_SECT_MAX
+};
+
+#ifdef HOTKEY_SAVING
+	#define CHARSAVE_HOTKEY_START offsetof(struct mmo_charstatus, hotkeys)
+#else
+	#define CHARSAVE_HOTKEY_START offsetof(struct mmo_charstatus, show_equip)
+#endif
+/// Offset of a section in struct mmo_charstatus, CHARSAVE_SECT_MAX gives the size of the whole structure
+#define charsave_section_offset(s) ( \
+	(s) == CHARSAVE_SECT_BASE   ? (size_t)0 : \
+	(s) == CHARSAVE_SECT_SKILL  ? offsetof(struct mmo_charstatus, skill) : \
+	(s) == CHARSAVE_SECT_FRIEND ? offsetof(struct mmo_charstatus, friends) : \
+	(s) == CHARSAVE_SECT_HOTKEY ? CHARSAVE_HOTKEY_START : \
+	(s) == CHARSAVE_SECT_MISC   ? offsetof(struct mmo_charstatus, show_equip) : \
+	sizeof(struct mmo_charstatus) )
+#define charsave_section_size(s) ( charsave_section_offset((s) + 1) - charsave_section_offset(s) )
+
 typedef enum mail_status {
 	MAIL_NEW,
 	MAIL_UNREAD,
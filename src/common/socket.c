@@ -156,6 +156,7 @@ char *sErr(int code)
 
 #define sBind(fd,name,namelen) bind(fd2sock(fd),name,namelen)
 #define sConnect(fd,name,namelen) connect(fd2sock(fd),name,namelen)
+#define sGetsockname(fd,name,namelen) getsockname(fd2sock(fd),name,namelen)
 #define sIoctl(fd,cmd,argp) ioctlsocket(fd2sock(fd),cmd,argp)
 #define sListen(fd,backlog) listen(fd2sock(fd),backlog)
 #define sRecv(fd,buf,len,flags) recv(fd2sock(fd),buf,len,flags)
@@ -188,6 +189,7 @@ char *sErr(int code)
 
 #define sBind bind
 #define sConnect connect
+#define sGetsockname getsockname
 #define sIoctl ioctl
 #define sListen listen
 #define sRecv recv
@@ -272,12 +274,20 @@ int null_send(int fd) { return 0; }
 int null_parse(int fd) { return 0; }
 
 ParseFunc default_func_parse = null_parse;
+PresendFunc presend_func = NULL;
 
 void set_defaultparse(ParseFunc defaultparse)
 {
 	default_func_parse = defaultparse;
 }
 
+/// Sets a function invoked once per server tick, right before pending data is sent.
+/// Lets the server queue packets that were coalesced during the tick.
+void set_presend(PresendFunc presend)
+{
+	presend_func = presend;
+}
+
 
 /*======================================
  *	CORE : Socket options
@@ -588,6 +598,93 @@ int make_connection(uint32 ip, uint16 port, bool silent, int timeout) {
 	return fd;
 }
 
+/*======================================
+ *	CORE : Wakeup sockets
+ *--------------------------------------
+ * A loopback UDP socket connected to itself. Other threads send a byte to
+ * it to interrupt the select() of do_sockets, and the handler runs on the
+ * main thread once the pending bytes have been drained.
+ *--------------------------------------*/
+struct wakeup_data {
+	WakeupFunc func;
+};
+
+static int wakeup_recv(int fd)
+{
+	char buf[64];
+	struct wakeup_data *data = (struct wakeup_data *)session[fd]->session_data;
+
+	while( sRecv(fd, buf, sizeof(buf), 0) > 0 )
+		;// Drain, one call to the handler covers all of the signals
+	if( data && data->func )
+		data->func();
+	return 0;
+}
+
+/// Creates a wakeup socket that runs func on the main thread after socket_wakeup was called.
+/// Returns the socket or -1 on failure.
+int make_wakeup(WakeupFunc func)
+{
+	struct sockaddr_in address;
+	socklen_t len = sizeof(address);
+	struct wakeup_data *data;
+	int fd;
+
+	fd = sSocket(AF_INET, SOCK_DGRAM, 0);
+
+	if( fd == -1 ) {
+		ShowError("make_wakeup: socket creation failed (%s)!\n", error_msg());
+		return -1;
+	}
+	if( fd == 0 )
+	{// reserved
+		ShowError("make_wakeup: Socket #0 is reserved - Please report this!!!\n");
+		sClose(fd);
+		return -1;
+	}
+	if( fd >= FD_SETSIZE )
+	{// socket number too big
+		ShowError("make_wakeup: New socket #%d is greater than can we handle! Increase the value of FD_SETSIZE (currently %d) for your OS to fix this!\n", fd, FD_SETSIZE);
+		sClose(fd);
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family      = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port        = 0; // any free port
+
+	if( sBind(fd, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR ||
+		sGetsockname(fd, (struct sockaddr *)&address, &len) == SOCKET_ERROR ||
+		sConnect(fd, (struct sockaddr *)&address, sizeof(address)) == SOCKET_ERROR ) {
+		ShowError("make_wakeup: binding the loopback address failed (socket #%d, %s)!\n", fd, error_msg());
+		sClose(fd);
+		return -1;
+	}
+	set_nonblocking(fd, 1);
+
+	if (fd_max <= fd) fd_max = fd + 1;
+	sFD_SET(fd,&readfds);
+
+	create_session(fd, wakeup_recv, null_send, null_parse);
+	session[fd]->client_addr = 0; // local
+	session[fd]->rdata_tick = 0; // disable timeouts on this socket
+	CREATE(data, struct wakeup_data, 1);
+	data->func = func;
+	session[fd]->session_data = data;
+
+	return fd;
+}
+
+/// Signals a wakeup socket. Safe to call from any thread.
+void socket_wakeup(int fd)
+{
+	char c = 0;
+
+	// A full buffer means a wakeup is already pending
+	sSend(fd, &c, 1, 0);
+}
+
 static int create_session(int fd, RecvFunc func_recv, SendFunc func_send, ParseFunc func_parse)
 {
 	CREATE(session[fd], struct socket_data, 1);
@@ -756,6 +853,8 @@ int do_sockets(int next)
 
 	// PRESEND Timers are executed before do_sendrecv and can send packets and/or set sessions to eof.
 	// Send remaining data and process client-side disconnects here.
+	if (presend_func)
+		presend_func();
 #ifdef SEND_SHORTLIST
 	send_shortlist_do_sends();
 #else
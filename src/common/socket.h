@@ -72,6 +72,8 @@
 typedef int (*RecvFunc)(int fd);
 typedef int (*SendFunc)(int fd);
 typedef int (*ParseFunc)(int fd);
+typedef void (*PresendFunc)(void);
+typedef void (*WakeupFunc)(void);
 
 struct socket_data
 {
@@ -116,6 +118,8 @@ extern bool session_isActive(int fd);
 
 int make_listen_bind(uint32 ip, uint16 port);
 int make_connection(uint32 ip, uint16 port, bool silent, int timeout);
+int make_wakeup(WakeupFunc func);
+void socket_wakeup(int fd);
 int realloc_fifo(int fd, unsigned int rfifo_size, unsigned int wfifo_size);
 int realloc_writefifo(int fd, size_t addition);
 int WFIFOSET(int fd, size_t len);
@@ -131,6 +135,7 @@ extern void flush_fifos(void);
 extern void set_nonblocking(int fd, unsigned long yes);
 
 void set_defaultparse(ParseFunc defaultparse);
+void set_presend(PresendFunc presend);
 
 // Server operation request
 enum chrif_req_op {
@@ -2,14 +2,19 @@
 // For more information, see LICENCE in the main folder
 
 #include "../common/cbasetypes.h"
+#include "../common/db.h"
 #include "../common/malloc.h"
 #include "../common/showmsg.h"
+#include "../common/socket.h"
 #include "../common/strlib.h"
 #include "../common/timer.h"
 #include "sql.h"
 
 #ifdef WIN32
 #include "../common/winapi.h"
+#else
+#include <pthread.h>
+#include <unistd.h>// usleep
 #endif
 #include <mysql.h>
 #include <string.h>// strlen/strnlen/memcpy/memset
@@ -22,6 +27,10 @@ void hercules_mysql_error_handler(unsigned int ecode);
 int mysql_reconnect_type;
 unsigned int mysql_reconnect_count;
 
+int sql_stmt_cache_size = 64; // Prepared statements kept per connection (0 disables the cache)
+bool sql_stats = true; // Collect the query statistics shown by Sql_Report
+unsigned int sql_slow_query_ms = 500; // Queries taking at least this long are reported (0 disables)
+
 /// Sql handle
 struct Sql
 {
@@ -31,6 +40,21 @@ struct Sql
 	MYSQL_ROW row;
 	unsigned long *lengths;
 	int keepalive;
+	DBMap *stmt_cache;// Prepared statements by query (struct SqlStmtCache *)
+	unsigned long stmt_thread_id;// Connection the cached statements belong to
+	unsigned int stmt_clock;// Use counter of the cached statements
+};
+
+
+
+/// Prepared statement kept by a connection
+struct SqlStmtCache
+{
+	MYSQL_STMT *stmt;
+	char *query;// Key
+	bool in_use;// Taken by a SqlStmt handle
+	bool stale;// Dropped from the cache while in use, closed on release
+	unsigned int last_use;// For the LRU eviction
 };
 
 
@@ -50,7 +74,9 @@ typedef struct s_column_length s_column_length;
 struct SqlStmt
 {
 	StringBuf buf;
+	Sql *sql;
 	MYSQL_STMT *stmt;
+	struct SqlStmtCache *cache;// Cache entry of the statement (NULL if not cached)
 	MYSQL_BIND *params;
 	MYSQL_BIND *columns;
 	s_column_length *column_lengths;
@@ -62,6 +88,223 @@ struct SqlStmt
 
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Query Statistics
+///////////////////////////////////////////////////////////////////////////////
+// Queries are grouped by template: the format string of Sql_Query, or the
+// query text with its literals replaced by '?' (and value lists collapsed)
+// for Sql_QueryStr and the prepared statements.
+// Only the main thread records statistics.
+
+
+
+#define SQL_STATS_MAX 512 // Templates tracked, the rest are counted together
+#define SQL_STATS_BUCKETS 25 // Latency histogram, bucket i counts [2^i, 2^(i+1)) us
+#define SQL_TEMPLATE_LEN 160
+
+
+
+/// Statistics of a query template
+struct SqlStats
+{
+	char *query;// Template (key)
+	unsigned int count, errors;
+	uint64 total_us, max_us;
+	uint64 rows;// Rows returned or affected
+	unsigned int hist[SQL_STATS_BUCKETS];
+};
+
+static DBMap *sql_stats_db = NULL;// Statistics by template (struct SqlStats *)
+static struct SqlStats sql_stats_other;// Templates over SQL_STATS_MAX
+static struct {
+	unsigned int hits, misses, evictions;
+} sql_stmt_stats;
+
+
+
+/// Writes the template of a query to out.
+///
+/// @private
+static void Sql_P_Template(const char *query, char *out, size_t size)
+{
+	size_t len = 0;
+	char quote = 0;
+
+	while( *query && len + 1 < size )
+	{
+		char c = *query++;
+
+		if( c == '`' )
+		{// Identifier, copied as is
+			out[len++] = c;
+			while( *query && len + 1 < size && (out[len++] = *query++) != '`' )
+				;
+			continue;
+		}
+		if( c == '\'' || c == '"' )
+		{// String literal
+			quote = c;
+			do
+			{// A doubled quote doesn't end it
+				while( *query && *query != quote )
+					query += ( query[0] == '\\' && query[1] ? 2 : 1 );
+				if( *query )
+					++query;
+			} while( *query == quote && *++query );
+			c = '?';
+		}
+		else if( ISDIGIT(c) && (len == 0 || !(ISALNUM(out[len - 1]) || out[len - 1] == '_')) )
+		{// Number literal
+			while( ISDIGIT(*query) || *query == '.' )
+				++query;
+			c = '?';
+		}
+		out[len++] = c;
+		if( c == '?' && len >= 3 && out[len - 2] == ',' && out[len - 3] == '?' )
+			len -= 2;// "?,?" -> "?"
+		else if( c == ')' && len >= 7 && strncmp(out + len - 7, "(?),(?)", 7) == 0 )
+			len -= 4;// "(?),(?)" -> "(?)"
+		else if( c == ')' && len >= 8 && strncmp(out + len - 8, "(?), (?)", 8) == 0 )
+			len -= 5;
+	}
+	out[len] = '\0';
+}
+
+
+
+/// Records an executed query.
+/// The template is either given or made from the query text.
+///
+/// @private
+static void Sql_P_Record(const char *tmpl, const char *query, uint64 start, uint64 rows, bool error)
+{
+	char buf[SQL_TEMPLATE_LEN];
+	struct SqlStats *stats;
+	uint64 elapsed = gettick_usec() - start;
+	int i;
+
+	if( sql_slow_query_ms && elapsed >= (uint64)sql_slow_query_ms * 1000 )
+		ShowSQL("Slow query (%.1f ms): %.1024s\n", elapsed / 1000., query);
+	if( !sql_stats )
+		return;
+	if( tmpl == NULL )
+	{
+		Sql_P_Template(query, buf, sizeof(buf));
+		tmpl = buf;
+	}
+	if( sql_stats_db == NULL )
+		sql_stats_db = strdb_alloc(DB_OPT_BASE, 0);
+	if( (stats = (struct SqlStats *)strdb_get(sql_stats_db, tmpl)) == NULL )
+	{
+		if( db_size(sql_stats_db) < SQL_STATS_MAX )
+		{
+			CREATE(stats, struct SqlStats, 1);
+			stats->query = aStrdup(tmpl);
+			strdb_put(sql_stats_db, stats->query, stats);
+		}
+		else
+			stats = &sql_stats_other;
+	}
+	stats->count++;
+	if( error )
+		stats->errors++;
+	stats->total_us += elapsed;
+	stats->max_us = max(stats->max_us, elapsed);
+	stats->rows += rows;
+	for( i = 0; i < SQL_STATS_BUCKETS - 1 && (elapsed >> (i + 1)) != 0; ++i )
+		;
+	stats->hist[i]++;
+}
+
+
+
+/// Returns the latency (us) under which pct percent of the queries completed.
+///
+/// @private
+static uint64 Sql_P_Percentile(struct SqlStats *stats, int pct)
+{
+	unsigned int sum = 0, target = (unsigned int)(((uint64)stats->count * pct + 99) / 100);
+	int i;
+
+	for( i = 0; i < SQL_STATS_BUCKETS - 1; ++i )
+	{
+		if( (sum += stats->hist[i]) >= target )
+			break;
+	}
+	return min((uint64)1 << (i + 1), stats->max_us);
+}
+
+
+
+static int Sql_P_CompareStats(const void *a, const void *b)
+{
+	uint64 ta = (*(struct SqlStats **)a)->total_us, tb = (*(struct SqlStats **)b)->total_us;
+
+	return ( ta < tb ? 1 : ( ta > tb ? -1 : 0 ) );
+}
+
+
+
+/// Shows the templates with the most time spent since the previous report,
+/// and the prepared statement cache counters, then resets them.
+void Sql_Report(int top)
+{
+	struct SqlStats **list;
+	DBIterator *iter;
+	struct SqlStats *stats;
+	int i, n = 0;
+
+	if( top <= 0 )
+		top = 15;
+	ShowInfo("Sql_Report: statement cache %u hits, %u misses, %u evictions (%d per connection).\n",
+		sql_stmt_stats.hits, sql_stmt_stats.misses, sql_stmt_stats.evictions, sql_stmt_cache_size);
+	memset(&sql_stmt_stats, 0, sizeof(sql_stmt_stats));
+	if( !sql_stats )
+	{
+		ShowInfo("Sql_Report: statistics are disabled (sql_stats).\n");
+		return;
+	}
+	if( sql_stats_db == NULL )
+		return;
+
+	CREATE(list, struct SqlStats *, db_size(sql_stats_db) + 1);
+	iter = db_iterator(sql_stats_db);
+	for( stats = (struct SqlStats *)dbi_first(iter); dbi_exists(iter); stats = (struct SqlStats *)dbi_next(iter) )
+		if( stats->count )
+			list[n++] = stats;
+	dbi_destroy(iter);
+	if( sql_stats_other.count )
+		list[n++] = &sql_stats_other;
+	qsort(list, n, sizeof(*list), Sql_P_CompareStats);
+	if( n == 0 )
+	{
+		ShowInfo("Sql_Report: no queries since the previous report.\n");
+		aFree(list);
+		return;
+	}
+
+	ShowInfo("Sql_Report: %d query templates used since the previous report, top %d by total time:\n", n, min(n, top));
+	ShowInfo("  %8s %6s %10s %9s %9s %9s %9s %10s  %s\n", "count", "errors", "total ms", "avg ms", "p50 ms", "p99 ms", "max ms", "rows", "template");
+	for( i = 0; i < n && i < top; ++i )
+	{
+		stats = list[i];
+		ShowInfo("  %8u %6u %10.1f %9.3f %9.3f %9.3f %9.3f %10"PRIu64"  %s\n", stats->count, stats->errors,
+			stats->total_us / 1000., stats->total_us / 1000. / stats->count,
+			Sql_P_Percentile(stats, 50) / 1000., Sql_P_Percentile(stats, 99) / 1000., stats->max_us / 1000.,
+			stats->rows, ( stats == &sql_stats_other ? "(other templates)" : stats->query ));
+	}
+	for( i = 0; i < n; ++i )
+	{
+		char *query = list[i]->query;
+
+		memset(list[i], 0, sizeof(struct SqlStats));
+		list[i]->query = query;
+	}
+	aFree(list);
+}
+
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // Sql Handle
 ///////////////////////////////////////////////////////////////////////////////
@@ -246,6 +489,35 @@ size_t Sql_EscapeStringLen(Sql *self, char *out_to, const char *from, size_t fro
 
 
 
+/// Executes the query in the buffer and records it under tmpl.
+///
+/// @private
+static int Sql_P_Execute(Sql *self, const char *tmpl)
+{
+	uint64 start = gettick_usec();
+
+	if( mysql_real_query(&self->handle, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
+	{
+		Sql_P_Record(tmpl, StringBuf_Value(&self->buf), start, 0, true);
+		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
+		hercules_mysql_error_handler(mysql_errno(&self->handle));
+		return SQL_ERROR;
+	}
+	self->result = mysql_store_result(&self->handle);
+	if( mysql_errno(&self->handle) != 0 )
+	{
+		Sql_P_Record(tmpl, StringBuf_Value(&self->buf), start, 0, true);
+		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
+		hercules_mysql_error_handler(mysql_errno(&self->handle));
+		return SQL_ERROR;
+	}
+	Sql_P_Record(tmpl, StringBuf_Value(&self->buf), start,
+		( self->result ? (uint64)mysql_num_rows(self->result) : (uint64)mysql_affected_rows(&self->handle) ), false);
+	return SQL_SUCCESS;
+}
+
+
+
 /// Executes a query.
 int Sql_Query(Sql *self, const char *query, ...)
 {
@@ -270,20 +542,7 @@ int Sql_QueryV(Sql *self, const char *query, va_list args)
 	Sql_FreeResult(self);
 	StringBuf_Clear(&self->buf);
 	StringBuf_Vprintf(&self->buf, query, args);
-	if( mysql_real_query(&self->handle, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
-	{
-		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
-		hercules_mysql_error_handler(mysql_errno(&self->handle));
-		return SQL_ERROR;
-	}
-	self->result = mysql_store_result(&self->handle);
-	if( mysql_errno(&self->handle) != 0 )
-	{
-		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
-		hercules_mysql_error_handler(mysql_errno(&self->handle));
-		return SQL_ERROR;
-	}
-	return SQL_SUCCESS;
+	return Sql_P_Execute(self, query);
 }
 
 
@@ -297,20 +556,7 @@ int Sql_QueryStr(Sql *self, const char *query)
 	Sql_FreeResult(self);
 	StringBuf_Clear(&self->buf);
 	StringBuf_AppendStr(&self->buf, query);
-	if( mysql_real_query(&self->handle, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
-	{
-		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
-		hercules_mysql_error_handler(mysql_errno(&self->handle));
-		return SQL_ERROR;
-	}
-	self->result = mysql_store_result(&self->handle);
-	if( mysql_errno(&self->handle) != 0 )
-	{
-		ShowSQL("DB error - %s\n", mysql_error(&self->handle));
-		hercules_mysql_error_handler(mysql_errno(&self->handle));
-		return SQL_ERROR;
-	}
-	return SQL_SUCCESS;
+	return Sql_P_Execute(self, NULL);
 }
 
 
@@ -425,11 +671,16 @@ void Sql_ShowDebug_(Sql *self, const char *debug_file, const unsigned long debug
 
 
 
+static void SqlStmt_P_CacheFlush(Sql *sql);
+
 /// Frees a Sql handle returned by Sql_Malloc.
 void Sql_Free(Sql *self)
 {
 	if( self ) {
 		Sql_FreeResult(self);
+		SqlStmt_P_CacheFlush(self);
+		if( self->stmt_cache )
+			db_destroy(self->stmt_cache);
 		StringBuf_Destroy(&self->buf);
 		if( self->keepalive != INVALID_TIMER )
 			delete_timer(self->keepalive, Sql_P_KeepaliveTimer);
@@ -607,20 +858,15 @@ static void SqlStmt_P_ShowDebugTruncatedColumn(SqlStmt *self, size_t i)
 SqlStmt *SqlStmt_Malloc(Sql *sql)
 {
 	SqlStmt *self;
-	MYSQL_STMT *stmt;
 
 	if( sql == NULL )
 		return NULL;
 
-	stmt = mysql_stmt_init(&sql->handle);
-	if( stmt == NULL )
-	{
-		ShowSQL("DB error - %s\n", mysql_error(&sql->handle));
-		return NULL;
-	}
 	CREATE(self, SqlStmt, 1);
 	StringBuf_Init(&self->buf);
-	self->stmt = stmt;
+	self->sql = sql;
+	self->stmt = NULL;// Taken from the cache or created when the query is known
+	self->cache = NULL;
 	self->params = NULL;
 	self->columns = NULL;
 	self->column_lengths = NULL;
@@ -634,6 +880,163 @@ SqlStmt *SqlStmt_Malloc(Sql *sql)
 
 
 
+/// Closes a statement that isn't kept by the cache.
+///
+/// @private
+static void SqlStmt_P_CacheFree(struct SqlStmtCache *entry)
+{
+	mysql_stmt_close(entry->stmt);
+	aFree(entry->query);
+	aFree(entry);
+}
+
+
+
+/// Drops all of the cached statements of a connection.
+/// Statements in use are closed when they are released.
+///
+/// @private
+static void SqlStmt_P_CacheFlush(Sql *sql)
+{
+	DBIterator *iter;
+	struct SqlStmtCache *entry;
+
+	if( sql->stmt_cache == NULL )
+		return;
+	iter = db_iterator(sql->stmt_cache);
+	for( entry = (struct SqlStmtCache *)dbi_first(iter); dbi_exists(iter); entry = (struct SqlStmtCache *)dbi_next(iter) )
+	{
+		if( entry->in_use )
+			entry->stale = true;
+		else
+			SqlStmt_P_CacheFree(entry);
+	}
+	dbi_destroy(iter);
+	db_clear(sql->stmt_cache);
+}
+
+
+
+/// Takes the cached statement of a query.
+/// The cache is dropped when the connection was re-established, since the
+/// server forgets the statements.
+///
+/// @private
+static struct SqlStmtCache *SqlStmt_P_CacheTake(Sql *sql, const char *query)
+{
+	struct SqlStmtCache *entry;
+
+	if( sql_stmt_cache_size <= 0 )
+		return NULL;
+	if( sql->stmt_cache == NULL )
+		sql->stmt_cache = strdb_alloc(DB_OPT_BASE, 0);
+	if( sql->stmt_thread_id != mysql_thread_id(&sql->handle) )
+	{
+		SqlStmt_P_CacheFlush(sql);
+		sql->stmt_thread_id = mysql_thread_id(&sql->handle);
+	}
+	if( (entry = (struct SqlStmtCache *)strdb_get(sql->stmt_cache, query)) == NULL || entry->in_use )
+		return NULL;// Not cached, or taken by another handle
+	entry->in_use = true;
+	return entry;
+}
+
+
+
+/// Adds a freshly prepared statement to the cache, evicting the least
+/// recently used idle one when it's full.
+///
+/// @return the cache entry, or NULL if the statement isn't cached
+/// @private
+static struct SqlStmtCache *SqlStmt_P_CachePut(Sql *sql, const char *query, MYSQL_STMT *stmt)
+{
+	struct SqlStmtCache *entry;
+
+	if( sql_stmt_cache_size <= 0 || sql->stmt_cache == NULL || strdb_exists(sql->stmt_cache, query) )
+		return NULL;
+	if( db_size(sql->stmt_cache) >= (unsigned int)sql_stmt_cache_size )
+	{
+		DBIterator *iter = db_iterator(sql->stmt_cache);
+		struct SqlStmtCache *lru = NULL;
+
+		for( entry = (struct SqlStmtCache *)dbi_first(iter); dbi_exists(iter); entry = (struct SqlStmtCache *)dbi_next(iter) )
+			if( !entry->in_use && (lru == NULL || entry->last_use < lru->last_use) )
+				lru = entry;
+		dbi_destroy(iter);
+		if( lru == NULL )
+			return NULL;// All in use
+		strdb_remove(sql->stmt_cache, lru->query);
+		SqlStmt_P_CacheFree(lru);
+		sql_stmt_stats.evictions++;
+	}
+	CREATE(entry, struct SqlStmtCache, 1);
+	entry->stmt = stmt;
+	entry->query = aStrdup(query);
+	entry->in_use = true;
+	strdb_put(sql->stmt_cache, entry->query, entry);
+	return entry;
+}
+
+
+
+/// Gives the statement back to the cache, or closes it.
+///
+/// @private
+static void SqlStmt_P_Release(SqlStmt *self)
+{
+	if( self->stmt == NULL )
+		return;
+	mysql_stmt_free_result(self->stmt);
+	if( self->cache == NULL )
+		mysql_stmt_close(self->stmt);
+	else if( self->cache->stale )
+		SqlStmt_P_CacheFree(self->cache);
+	else
+	{
+		self->cache->in_use = false;
+		self->cache->last_use = ++self->sql->stmt_clock;
+	}
+	self->stmt = NULL;
+	self->cache = NULL;
+}
+
+
+
+/// Prepares the query in the buffer, or takes it from the cache.
+///
+/// @private
+static int SqlStmt_P_Prepare(SqlStmt *self)
+{
+	const char *query = StringBuf_Value(&self->buf);
+
+	SqlStmt_P_Release(self);
+	self->bind_params = false;
+	if( (self->cache = SqlStmt_P_CacheTake(self->sql, query)) != NULL )
+	{
+		self->stmt = self->cache->stmt;
+		sql_stmt_stats.hits++;
+		return SQL_SUCCESS;
+	}
+	sql_stmt_stats.misses++;
+	if( (self->stmt = mysql_stmt_init(&self->sql->handle)) == NULL )
+	{
+		ShowSQL("DB error - %s\n", mysql_error(&self->sql->handle));
+		return SQL_ERROR;
+	}
+	if( mysql_stmt_prepare(self->stmt, query, (unsigned long)StringBuf_Length(&self->buf)) )
+	{
+		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
+		hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
+		mysql_stmt_close(self->stmt);
+		self->stmt = NULL;
+		return SQL_ERROR;
+	}
+	self->cache = SqlStmt_P_CachePut(self->sql, query, self->stmt);
+	return SQL_SUCCESS;
+}
+
+
+
 /// Prepares the statement.
 int SqlStmt_Prepare(SqlStmt *self, const char *query, ...)
 {
@@ -658,15 +1061,7 @@ int SqlStmt_PrepareV(SqlStmt *self, const char *query, va_list args)
 	SqlStmt_FreeResult(self);
 	StringBuf_Clear(&self->buf);
 	StringBuf_Vprintf(&self->buf, query, args);
-	if( mysql_stmt_prepare(self->stmt, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
-	{
-		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
-		hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
-		return SQL_ERROR;
-	}
-	self->bind_params = false;
-
-	return SQL_SUCCESS;
+	return SqlStmt_P_Prepare(self);
 }
 
 
@@ -680,15 +1075,7 @@ int SqlStmt_PrepareStr(SqlStmt *self, const char *query)
 	SqlStmt_FreeResult(self);
 	StringBuf_Clear(&self->buf);
 	StringBuf_AppendStr(&self->buf, query);
-	if( mysql_stmt_prepare(self->stmt, StringBuf_Value(&self->buf), (unsigned long)StringBuf_Length(&self->buf)) )
-	{
-		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
-		hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
-		return SQL_ERROR;
-	}
-	self->bind_params = false;
-
-	return SQL_SUCCESS;
+	return SqlStmt_P_Prepare(self);
 }
 
 
@@ -696,7 +1083,7 @@ int SqlStmt_PrepareStr(SqlStmt *self, const char *query)
 /// Returns the number of parameters in the prepared statement.
 size_t SqlStmt_NumParams(SqlStmt *self)
 {
-	if( self )
+	if( self && self->stmt )
 		return (size_t)mysql_stmt_param_count(self->stmt);
 	else
 		return 0;
@@ -734,27 +1121,52 @@ int SqlStmt_BindParam(SqlStmt *self, size_t idx, enum SqlDataType buffer_type, v
 
 
 
+/// Reports a failed execution.
+///
+/// @private
+static void SqlStmt_P_ExecuteError(SqlStmt *self, uint64 start)
+{
+	Sql_P_Record(NULL, StringBuf_Value(&self->buf), start, 0, true);
+	ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
+	hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
+	if( self->cache && !self->cache->stale )
+	{// May be invalid after a reconnect, prepare it again next time
+		strdb_remove(self->sql->stmt_cache, self->cache->query);
+		self->cache->stale = true;
+	}
+}
+
+
+
 /// Executes the prepared statement.
 int SqlStmt_Execute(SqlStmt *self)
 {
-	if( self == NULL )
+	uint64 start;
+
+	if( self == NULL || self->stmt == NULL )
 		return SQL_ERROR;
 
+	if( !self->bind_params && self->cache && SqlStmt_NumParams(self) > 0 )
+	{// A cached statement still has the bindings of its previous user
+		ShowSQL("DB error - No data supplied for parameters in prepared statement\n");
+		return SQL_ERROR;
+	}
+	start = gettick_usec();
 	SqlStmt_FreeResult(self);
 	if( (self->bind_params && mysql_stmt_bind_param(self->stmt, self->params)) ||
 		mysql_stmt_execute(self->stmt) )
 	{
-		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
-		hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
+		SqlStmt_P_ExecuteError(self, start);
 		return SQL_ERROR;
 	}
 	self->bind_columns = false;
 	if( mysql_stmt_store_result(self->stmt) )// store all the data
 	{
-		ShowSQL("DB error - %s\n", mysql_stmt_error(self->stmt));
-		hercules_mysql_error_handler(mysql_stmt_errno(self->stmt));
+		SqlStmt_P_ExecuteError(self, start);
 		return SQL_ERROR;
 	}
+	Sql_P_Record(NULL, StringBuf_Value(&self->buf), start,
+		( mysql_stmt_field_count(self->stmt) ? (uint64)mysql_stmt_num_rows(self->stmt) : (uint64)mysql_stmt_affected_rows(self->stmt) ), false);
 
 	return SQL_SUCCESS;
 }
@@ -764,7 +1176,7 @@ int SqlStmt_Execute(SqlStmt *self)
 /// Returns the number of the AUTO_INCREMENT column of the last INSERT/UPDATE statement.
 uint64 SqlStmt_LastInsertId(SqlStmt *self)
 {
-	if( self )
+	if( self && self->stmt )
 		return (uint64)mysql_stmt_insert_id(self->stmt);
 	else
 		return 0;
@@ -775,7 +1187,7 @@ uint64 SqlStmt_LastInsertId(SqlStmt *self)
 /// Returns the number of columns in each row of the result.
 size_t SqlStmt_NumColumns(SqlStmt *self)
 {
-	if( self )
+	if( self && self->stmt )
 		return (size_t)mysql_stmt_field_count(self->stmt);
 	else
 		return 0;
@@ -832,7 +1244,7 @@ int SqlStmt_BindColumn(SqlStmt *self, size_t idx, enum SqlDataType buffer_type,
 /// Returns the number of rows in the result.
 uint64 SqlStmt_NumRows(SqlStmt *self)
 {
-	if( self )
+	if( self && self->stmt )
 		return (uint64)mysql_stmt_num_rows(self->stmt);
 	else
 		return 0;
@@ -847,11 +1259,17 @@ int SqlStmt_NextRow(SqlStmt *self)
 	size_t i;
 	size_t cols;
 
-	if( self == NULL )
+	if( self == NULL || self->stmt == NULL )
 		return SQL_ERROR;
 
-	// bind columns
-	if( self->bind_columns && mysql_stmt_bind_result(self->stmt, self->columns) )
+	if( !self->bind_columns && self->cache && SqlStmt_NumColumns(self) > 0 )
+	{// A cached statement still has the bindings of its previous user, ignore the columns instead
+		if( SQL_ERROR == SqlStmt_BindColumn(self, 0, SQLDT_NULL, NULL, 0, NULL, NULL) )
+			return SQL_ERROR;
+	}
+
+	// bind columns
+	if( self->bind_columns && mysql_stmt_bind_result(self->stmt, self->columns) )
 		err = 1;// error binding columns
 	else
 		err = mysql_stmt_fetch(self->stmt);// fetch row
@@ -936,7 +1354,7 @@ int SqlStmt_NextRow(SqlStmt *self)
 /// Frees the result of the statement execution.
 void SqlStmt_FreeResult(SqlStmt *self)
 {
-	if( self )
+	if( self && self->stmt )
 		mysql_stmt_free_result(self->stmt);
 }
 
@@ -960,9 +1378,8 @@ void SqlStmt_Free(SqlStmt *self)
 {
 	if( self )
 	{
-		SqlStmt_FreeResult(self);
+		SqlStmt_P_Release(self);
 		StringBuf_Destroy(&self->buf);
-		mysql_stmt_close(self->stmt);
 		if( self->params )
 			aFree(self->params);
 		if( self->columns )
@@ -974,6 +1391,796 @@ void SqlStmt_Free(SqlStmt *self)
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous Queries
+///////////////////////////////////////////////////////////////////////////////
+// Everything touched by the worker threads is allocated with the C library
+// (malloc/free), since the memory manager isn't thread safe.
+// Jobs with a callback are handed back to the main thread through a wakeup
+// socket, so the callbacks run from do_sockets like any other network event.
+
+
+
+#define SQL_DISPATCH_INTERVAL 10 // Polling interval (ms) used when the wakeup socket isn't available
+
+
+
+/// Connection of a worker thread
+struct SqlWorkerThread
+{
+	SqlWorker *worker;
+	MYSQL handle;
+	bool connected;
+	char error[256];// Last connection error
+#ifdef WIN32
+	HANDLE thread;
+#else
+	pthread_t thread;
+#endif
+};
+
+
+
+/// Pool of background query threads
+struct SqlWorker
+{
+	char user[64], passwd[64], host[64], db[64], encoding[32];
+	uint16 port;
+	bool stub;// Jobs are answered without a database
+	unsigned int stub_latency;// Simulated execution time of the stub backend (ms)
+	int num_threads;
+	struct SqlWorkerThread *threads;
+	struct SqlJob *head, *tail;// Queued jobs
+	struct SqlJob *done_head, *done_tail;// Executed jobs with a callback, waiting for the main thread
+	int jobs;// Jobs not released yet (protected by the lock)
+	bool stop;
+	bool freed;// SqlWorker_Free was called, the last released job frees the worker
+	SqlWorker *next;// Next worker with callbacks to dispatch (main thread only)
+#ifdef WIN32
+	CRITICAL_SECTION lock;
+	HANDLE wakeup;
+#else
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+#endif
+};
+
+
+
+/// Queued query
+struct SqlJob
+{
+	struct SqlJob *next;
+	SqlWorker *worker;
+	char *query;
+	size_t max_rows;
+	SqlJobFunc func;// Completion callback
+	void *data;// Callback data
+	bool done;// Executed (protected by the worker lock)
+	bool notified;// Callback invoked (protected by the worker lock)
+	bool abandoned;// Freed by the owner before it was done (protected by the worker lock)
+	int result;
+	uint64 num_rows;
+	size_t stored_rows;
+	uint32 num_columns;
+	char **data_rows;// stored_rows*num_columns values
+	char error[256];
+};
+
+
+
+static SqlWorker *sql_workers = NULL;// Workers, for the dispatcher (main thread only)
+static int sql_wakeup_fd = -1;// Wakeup socket of the dispatcher
+static int sql_dispatch_timer = INVALID_TIMER;// Polling fallback of the dispatcher
+
+
+
+#ifdef WIN32
+#define SqlWorker_P_Lock(self) EnterCriticalSection(&(self)->lock)
+#define SqlWorker_P_Unlock(self) LeaveCriticalSection(&(self)->lock)
+#define SqlWorker_P_Signal(self) SetEvent((self)->wakeup)
+/// Waits for a signal, the lock is held before and after.
+#define SqlWorker_P_Wait(self) ( SqlWorker_P_Unlock(self), WaitForSingleObject((self)->wakeup, INFINITE), SqlWorker_P_Lock(self) )
+#define SqlWorker_P_Sleep(ms) Sleep(ms)
+#else
+#define SqlWorker_P_Lock(self) pthread_mutex_lock(&(self)->lock)
+#define SqlWorker_P_Unlock(self) pthread_mutex_unlock(&(self)->lock)
+#define SqlWorker_P_Signal(self) pthread_cond_signal(&(self)->wakeup)
+/// Waits for a signal, the lock is held before and after.
+#define SqlWorker_P_Wait(self) pthread_cond_wait(&(self)->wakeup, &(self)->lock)
+#define SqlWorker_P_Sleep(ms) usleep((ms)*1000)
+#endif
+
+
+
+/// Frees a stopped worker.
+///
+/// @private
+static void SqlWorker_P_Destroy(SqlWorker *self)
+{
+#ifdef WIN32
+	CloseHandle(self->wakeup);
+	DeleteCriticalSection(&self->lock);
+#else
+	pthread_cond_destroy(&self->wakeup);
+	pthread_mutex_destroy(&self->lock);
+#endif
+	aFree(self->threads);
+	aFree(self);
+}
+
+
+
+/// Releases a job and its result.
+/// Frees its worker too if it's the last job of a freed worker.
+///
+/// @private
+static void SqlJob_P_Release(SqlJob *self)
+{
+	SqlWorker *worker = self->worker;
+	bool last;
+
+	if( self->data_rows )
+	{
+		size_t i;
+		for( i = 0; i < self->stored_rows * self->num_columns; ++i )
+			free(self->data_rows[i]);
+		free(self->data_rows);
+	}
+	free(self->query);
+	free(self);
+
+	SqlWorker_P_Lock(worker);
+	last = ( --worker->jobs == 0 && worker->freed );
+	SqlWorker_P_Unlock(worker);
+	if( last )
+		SqlWorker_P_Destroy(worker);
+}
+
+
+
+/// (Re)connects the thread.
+///
+/// @private
+static bool SqlWorker_P_Connect(struct SqlWorkerThread *self)
+{
+	SqlWorker *worker = self->worker;
+	my_bool reconnect = 1;
+
+	if( self->connected || worker->stub )
+		return true;
+	mysql_init(&self->handle);
+	mysql_options(&self->handle, MYSQL_OPT_RECONNECT, &reconnect);
+	if( !mysql_real_connect(&self->handle, worker->host, worker->user, worker->passwd, worker->db, (unsigned int)worker->port, NULL/*unix_socket*/, 0/*clientflag*/) )
+	{
+		safestrncpy(self->error, mysql_error(&self->handle), sizeof(self->error));
+		mysql_close(&self->handle);
+		return false;
+	}
+	if( worker->encoding[0] != '\0' && mysql_set_character_set(&self->handle, worker->encoding) )
+		safestrncpy(self->error, mysql_error(&self->handle), sizeof(self->error));
+	self->connected = true;
+	return true;
+}
+
+
+
+/// Answers a job without a database.
+/// Every query succeeds and returns a single row with the query text in its only column.
+///
+/// @private
+static void SqlWorker_P_ExecuteStub(SqlWorker *self, SqlJob *job)
+{
+	if( self->stub_latency )
+		SqlWorker_P_Sleep(self->stub_latency);
+	job->num_rows = 1;
+	job->num_columns = 1;
+	job->stored_rows = min(1, job->max_rows);
+	if( job->stored_rows && (job->data_rows = (char **)calloc(1, sizeof(char *))) != NULL &&
+		(job->data_rows[0] = (char *)malloc(strlen(job->query) + 1)) != NULL )
+		strcpy(job->data_rows[0], job->query);
+	job->result = SQL_SUCCESS;
+}
+
+
+
+/// Executes a job on a worker thread and buffers its result.
+///
+/// @private
+static void SqlWorker_P_Execute(struct SqlWorkerThread *self, SqlJob *job)
+{
+	MYSQL_RES *result;
+	MYSQL_ROW row;
+
+	if( self->worker->stub )
+	{
+		SqlWorker_P_ExecuteStub(self->worker, job);
+		return;
+	}
+	job->result = SQL_ERROR;
+	if( !SqlWorker_P_Connect(self) )
+	{
+		safestrncpy(job->error, self->error, sizeof(job->error));
+		return;
+	}
+	if( mysql_real_query(&self->handle, job->query, (unsigned long)strlen(job->query)) )
+	{
+		safestrncpy(job->error, mysql_error(&self->handle), sizeof(job->error));
+		return;
+	}
+	result = mysql_store_result(&self->handle);
+	if( result == NULL )
+	{
+		if( mysql_field_count(&self->handle) != 0 )
+		{// Should have returned rows
+			safestrncpy(job->error, mysql_error(&self->handle), sizeof(job->error));
+			return;
+		}
+		job->result = SQL_SUCCESS;
+		return;
+	}
+
+	job->num_rows = (uint64)mysql_num_rows(result);
+	job->num_columns = (uint32)mysql_num_fields(result);
+	job->stored_rows = (size_t)min(job->num_rows, (uint64)job->max_rows);
+	if( job->stored_rows && job->num_columns )
+	{
+		size_t i, j;
+
+		job->data_rows = (char **)calloc(job->stored_rows * job->num_columns, sizeof(char *));
+		if( job->data_rows == NULL )
+			job->stored_rows = 0;
+		for( i = 0; i < job->stored_rows && (row = mysql_fetch_row(result)) != NULL; ++i )
+		{
+			unsigned long *lengths = mysql_fetch_lengths(result);
+
+			for( j = 0; j < job->num_columns; ++j )
+			{
+				char *value;
+
+				if( row[j] == NULL || (value = (char *)malloc(lengths[j] + 1)) == NULL )
+					continue;
+				memcpy(value, row[j], lengths[j]);
+				value[lengths[j]] = '\0';
+				job->data_rows[i * job->num_columns + j] = value;
+			}
+		}
+	}
+	mysql_free_result(result);
+	job->result = SQL_SUCCESS;
+}
+
+
+
+/// Worker thread main loop.
+/// The threads of a pool share the queue, each signal wakes a single thread
+/// so it's passed on while there's work left (or the pool is stopping).
+///
+/// @private
+#ifdef WIN32
+static DWORD WINAPI SqlWorker_P_Main(LPVOID param)
+#else
+static void *SqlWorker_P_Main(void *param)
+#endif
+{
+	struct SqlWorkerThread *thread = (struct SqlWorkerThread *)param;
+	SqlWorker *self = thread->worker;
+
+	mysql_thread_init();
+	SqlWorker_P_Connect(thread);
+
+	SqlWorker_P_Lock(self);
+	for(;;)
+	{
+		SqlJob *job;
+
+		while( self->head == NULL && !self->stop )
+			SqlWorker_P_Wait(self);
+		if( (job = self->head) == NULL )
+		{// Stopped and nothing left to do
+			SqlWorker_P_Signal(self);
+			break;
+		}
+		if( (self->head = job->next) == NULL )
+			self->tail = NULL;
+		job->next = NULL;
+		if( self->head )
+			SqlWorker_P_Signal(self);
+
+		if( !job->abandoned )
+		{
+			SqlWorker_P_Unlock(self);
+			SqlWorker_P_Execute(thread, job);
+			SqlWorker_P_Lock(self);
+		}
+		if( job->abandoned )
+		{
+			SqlWorker_P_Unlock(self);
+			SqlJob_P_Release(job);
+			SqlWorker_P_Lock(self);
+			continue;
+		}
+		job->done = true;
+		if( job->func )
+		{// Hand it over to the main thread
+			if( self->done_tail )
+				self->done_tail->next = job;
+			else
+				self->done_head = job;
+			self->done_tail = job;
+			if( sql_wakeup_fd > 0 )
+				socket_wakeup(sql_wakeup_fd);
+		}
+	}
+	SqlWorker_P_Unlock(self);
+
+	if( thread->connected )
+		mysql_close(&thread->handle);
+	mysql_thread_end();
+	return 0;
+}
+
+
+
+/// Invokes the callbacks of the executed jobs.
+/// Callbacks may queue and free jobs or free whole workers, so the scan
+/// starts over after each one.
+///
+/// @private
+static void SqlWorker_P_Dispatch(void)
+{
+	SqlWorker *worker = sql_workers;
+
+	while( worker )
+	{
+		SqlJob *job;
+		bool abandoned = false;
+
+		SqlWorker_P_Lock(worker);
+		if( (job = worker->done_head) != NULL )
+		{
+			if( (worker->done_head = job->next) == NULL )
+				worker->done_tail = NULL;
+			job->next = NULL;
+			if( !(abandoned = job->abandoned) )
+				job->notified = true;
+		}
+		SqlWorker_P_Unlock(worker);
+
+		if( job == NULL )
+			worker = worker->next;
+		else if( abandoned )
+			SqlJob_P_Release(job);
+		else
+		{
+			job->func(job, job->data);
+			worker = sql_workers;
+		}
+	}
+}
+
+
+
+/// Polling fallback of the dispatcher.
+///
+/// @private
+static TIMER_FUNC(SqlWorker_P_DispatchTimer)
+{
+	SqlWorker_P_Dispatch();
+	return 0;
+}
+
+
+
+/// Sets up the delivery of callbacks on the main thread.
+///
+/// @private
+static void SqlWorker_P_InitDispatch(void)
+{
+	if( sql_wakeup_fd > 0 || sql_dispatch_timer != INVALID_TIMER )
+		return;
+	if( (sql_wakeup_fd = make_wakeup(SqlWorker_P_Dispatch)) <= 0 )
+	{
+		ShowWarning("SqlWorker: Couldn't create the wakeup socket, completed queries will be polled every %d ms.\n", SQL_DISPATCH_INTERVAL);
+		sql_wakeup_fd = -1;
+		add_timer_func_list(SqlWorker_P_DispatchTimer, "SqlWorker_P_DispatchTimer");
+		sql_dispatch_timer = add_timer_interval(gettick() + SQL_DISPATCH_INTERVAL, SqlWorker_P_DispatchTimer, 0, 0, SQL_DISPATCH_INTERVAL);
+	}
+}
+
+
+
+/// Starts the threads of a worker.
+///
+/// @private
+static SqlWorker *SqlWorker_P_Start(SqlWorker *self, int threads)
+{
+	int i;
+
+	self->num_threads = max(threads, 1);
+	CREATE(self->threads, struct SqlWorkerThread, self->num_threads);
+#ifdef WIN32
+	InitializeCriticalSection(&self->lock);
+	if( (self->wakeup = CreateEvent(NULL, FALSE, FALSE, NULL)) == NULL )
+	{
+		DeleteCriticalSection(&self->lock);
+		aFree(self->threads);
+		aFree(self);
+		return NULL;
+	}
+#else
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->wakeup, NULL);
+#endif
+	for( i = 0; i < self->num_threads; ++i )
+	{
+		self->threads[i].worker = self;
+#ifdef WIN32
+		if( (self->threads[i].thread = CreateThread(NULL, 0, SqlWorker_P_Main, &self->threads[i], 0, NULL)) == NULL )
+			break;
+#else
+		if( pthread_create(&self->threads[i].thread, NULL, SqlWorker_P_Main, &self->threads[i]) != 0 )
+			break;
+#endif
+	}
+	if( i == 0 )
+	{
+		SqlWorker_P_Destroy(self);
+		return NULL;
+	}
+	if( i < self->num_threads )
+	{
+		ShowWarning("SqlWorker: Only %d of %d threads could be started.\n", i, self->num_threads);
+		self->num_threads = i;
+	}
+	self->next = sql_workers;
+	sql_workers = self;
+	return self;
+}
+
+
+
+/// Starts a worker thread that connects to the database on its own.
+SqlWorker *SqlWorker_Create(const char *user, const char *passwd, const char *host, uint16 port, const char *db, const char *encoding)
+{
+	return SqlWorker_CreatePool(user, passwd, host, port, db, encoding, 1);
+}
+
+
+
+/// Starts a pool of worker threads, each with its own connection.
+SqlWorker *SqlWorker_CreatePool(const char *user, const char *passwd, const char *host, uint16 port, const char *db, const char *encoding, int threads)
+{
+	SqlWorker *self;
+
+	CREATE(self, SqlWorker, 1);
+	safestrncpy(self->user, user, sizeof(self->user));
+	safestrncpy(self->passwd, passwd, sizeof(self->passwd));
+	safestrncpy(self->host, host, sizeof(self->host));
+	safestrncpy(self->db, db, sizeof(self->db));
+	safestrncpy(self->encoding, (encoding ? encoding : ""), sizeof(self->encoding));
+	self->port = port;
+	return SqlWorker_P_Start(self, threads);
+}
+
+
+
+/// Starts a pool of worker threads that answer the jobs without a database.
+SqlWorker *SqlWorker_CreateStub(int threads, unsigned int latency)
+{
+	SqlWorker *self;
+
+	CREATE(self, SqlWorker, 1);
+	self->stub = true;
+	self->stub_latency = latency;
+	return SqlWorker_P_Start(self, threads);
+}
+
+
+
+/// Stops the worker after executing the queued jobs.
+/// The callbacks that weren't dispatched yet are invoked here. Jobs that are
+/// still held by their owner keep the worker allocated until they are freed.
+void SqlWorker_Free(SqlWorker *self)
+{
+	SqlWorker **prev;
+	int i;
+
+	if( self == NULL || self->stop )
+		return;
+
+	for( prev = &sql_workers; *prev; prev = &(*prev)->next )
+	{
+		if( *prev == self )
+		{
+			*prev = self->next;
+			break;
+		}
+	}
+
+	SqlWorker_P_Lock(self);
+	self->stop = true;
+	SqlWorker_P_Signal(self);
+	SqlWorker_P_Unlock(self);
+	for( i = 0; i < self->num_threads; ++i )
+	{
+#ifdef WIN32
+		WaitForSingleObject(self->threads[i].thread, INFINITE);
+		CloseHandle(self->threads[i].thread);
+#else
+		pthread_join(self->threads[i].thread, NULL);
+#endif
+	}
+
+	// The threads are gone, only the main thread uses the worker from here
+	self->jobs++;// Keeps the worker while the callbacks run
+	while( self->done_head )
+	{// Executed jobs that weren't dispatched yet
+		SqlJob *job = self->done_head;
+
+		if( (self->done_head = job->next) == NULL )
+			self->done_tail = NULL;
+		job->next = NULL;
+		if( job->abandoned )
+			SqlJob_P_Release(job);
+		else
+		{
+			job->notified = true;
+			job->func(job, job->data);
+		}
+	}
+	self->freed = true;
+	if( --self->jobs == 0 )
+		SqlWorker_P_Destroy(self);
+}
+
+
+
+/// Returns the number of threads of the worker.
+int SqlWorker_NumThreads(SqlWorker *self)
+{
+	return ( self ? self->num_threads : 0 );
+}
+
+
+
+/// Queues a job.
+///
+/// @private
+static SqlJob *SqlJob_P_Queue(SqlWorker *worker, const char *query, size_t max_rows, SqlJobFunc func, void *data)
+{
+	SqlJob *self;
+
+	if( worker == NULL || query == NULL )
+		return NULL;
+	if( (self = (SqlJob *)calloc(1, sizeof(SqlJob))) == NULL )
+		return NULL;
+	if( (self->query = (char *)malloc(strlen(query) + 1)) == NULL )
+	{
+		free(self);
+		return NULL;
+	}
+	strcpy(self->query, query);
+	self->worker = worker;
+	self->max_rows = max_rows;
+	self->func = func;
+	self->data = data;
+
+	SqlWorker_P_Lock(worker);
+	if( worker->stop )
+	{// Being freed, nothing would execute it
+		SqlWorker_P_Unlock(worker);
+		free(self->query);
+		free(self);
+		return NULL;
+	}
+	worker->jobs++;
+	if( worker->tail )
+		worker->tail->next = self;
+	else
+		worker->head = self;
+	worker->tail = self;
+	SqlWorker_P_Signal(worker);
+	SqlWorker_P_Unlock(worker);
+	return self;
+}
+
+
+
+/// Queues a query, storing at most max_rows rows of its result.
+SqlJob *SqlJob_Query(SqlWorker *worker, const char *query, size_t max_rows)
+{
+	return SqlJob_P_Queue(worker, query, max_rows, NULL, NULL);
+}
+
+
+
+/// Queues a query and invokes func on the main thread once it's done.
+SqlJob *SqlJob_QueryCallback(SqlWorker *worker, const char *query, size_t max_rows, SqlJobFunc func, void *data)
+{
+	if( func == NULL )
+		return NULL;
+	SqlWorker_P_InitDispatch();
+	return SqlJob_P_Queue(worker, query, max_rows, func, data);
+}
+
+
+
+/// Returns true once the worker has executed the job.
+bool SqlJob_IsDone(SqlJob *self)
+{
+	bool done;
+
+	if( self == NULL )
+		return false;
+	SqlWorker_P_Lock(self->worker);
+	done = self->done;
+	SqlWorker_P_Unlock(self->worker);
+	return done;
+}
+
+
+
+/// Blocks until the worker has executed the job.
+void SqlJob_Wait(SqlJob *self)
+{
+	if( self == NULL )
+		return;
+	while( !SqlJob_IsDone(self) )
+		SqlWorker_P_Sleep(1);
+}
+
+
+
+/// Returns SQL_SUCCESS or SQL_ERROR depending on how the query went.
+int SqlJob_GetResult(SqlJob *self)
+{
+	if( self && SqlJob_IsDone(self) )
+		return self->result;
+	return SQL_ERROR;
+}
+
+
+
+/// Returns the number of rows in the result, including the ones that weren't stored.
+uint64 SqlJob_NumRows(SqlJob *self)
+{
+	if( self && SqlJob_IsDone(self) )
+		return self->num_rows;
+	return 0;
+}
+
+
+
+/// Returns the number of stored rows.
+size_t SqlJob_NumStoredRows(SqlJob *self)
+{
+	if( self && SqlJob_IsDone(self) )
+		return self->stored_rows;
+	return 0;
+}
+
+
+
+/// Returns the number of columns in each row.
+uint32 SqlJob_NumColumns(SqlJob *self)
+{
+	if( self && SqlJob_IsDone(self) )
+		return self->num_columns;
+	return 0;
+}
+
+
+
+/// Gets the data of a column of a stored row.
+int SqlJob_GetData(SqlJob *self, size_t row, size_t col, char **out_buf)
+{
+	if( self == NULL || !SqlJob_IsDone(self) || row >= self->stored_rows || col >= self->num_columns )
+		return SQL_ERROR;
+	if( out_buf )
+		*out_buf = ( self->data_rows ? self->data_rows[row * self->num_columns + col] : NULL );
+	return SQL_SUCCESS;
+}
+
+
+
+/// Shows debug information (error and query).
+void SqlJob_ShowDebug_(SqlJob *self, const char *debug_file, const unsigned long debug_line)
+{
+	if( self == NULL )
+		ShowDebug("at %s:%lu -  self is NULL\n", debug_file, debug_line);
+	else
+	{
+		if( self->error[0] != '\0' )
+			ShowSQL("DB error - %s\n", self->error);
+		ShowDebug("at %s:%lu - %s\n", debug_file, debug_line, self->query);
+	}
+}
+
+
+
+/// Frees a SqlJob returned by SqlJob_Query or SqlJob_QueryCallback.
+void SqlJob_Free(SqlJob *self)
+{
+	bool release = true;
+
+	if( self == NULL )
+		return;
+	SqlWorker_P_Lock(self->worker);
+	if( !self->done || (self->func && !self->notified) )
+	{// The worker or the dispatcher releases it
+		self->abandoned = true;
+		release = false;
+	}
+	SqlWorker_P_Unlock(self->worker);
+	if( release )
+		SqlJob_P_Release(self);
+}
+
+
+
+/*==========================================
+ * Async layer self-test [console: bench:sqlasync]
+ * Queues 'count' jobs with callbacks on a stub pool and reports how long
+ * it took until all of the callbacks ran on the main thread.
+ *------------------------------------------*/
+static struct {
+	SqlWorker *worker;
+	int count, done, failed;
+	uint64 start;
+} sql_bench_data = { NULL, 0, 0, 0, 0 };
+
+static void SqlWorker_P_BenchEnd(void)
+{
+	ShowInfo("SqlWorker_Bench: %d jobs on %d threads dispatched in %.3f ms (%d bad results).\n",
+		sql_bench_data.count, SqlWorker_NumThreads(sql_bench_data.worker),
+		(gettick_usec() - sql_bench_data.start) / 1000., sql_bench_data.failed);
+	SqlWorker_Free(sql_bench_data.worker);
+	sql_bench_data.worker = NULL;
+}
+
+static void SqlWorker_P_BenchDone(SqlJob *job, void *data)
+{
+	char *str = NULL;
+
+	if( SqlJob_GetResult(job) != SQL_SUCCESS || SqlJob_GetData(job, 0, 0, &str) != SQL_SUCCESS ||
+		str == NULL || atoi(str + 7) != (int)(intptr_t)data )
+		sql_bench_data.failed++;
+	SqlJob_Free(job);
+	if( ++sql_bench_data.done == sql_bench_data.count )
+		SqlWorker_P_BenchEnd();// The dispatcher allows freeing the worker from its callbacks
+}
+
+void SqlWorker_Bench(int count, int threads, unsigned int latency)
+{
+	char query[32];
+	int i;
+
+	if( count <= 0 )
+		return;
+	if( sql_bench_data.worker ) {
+		ShowWarning("SqlWorker_Bench: A test is already running.\n");
+		return;
+	}
+	if( !(sql_bench_data.worker = SqlWorker_CreateStub(threads, latency)) ) {
+		ShowError("SqlWorker_Bench: Couldn't start the stub worker.\n");
+		return;
+	}
+	sql_bench_data.count = count;
+	sql_bench_data.done = sql_bench_data.failed = 0;
+	sql_bench_data.start = gettick_usec();
+	for( i = 0; i < count; i++ ) {
+		safesnprintf(query, sizeof(query), "SELECT %d", i);
+		if( !SqlJob_QueryCallback(sql_bench_data.worker, query, 1, SqlWorker_P_BenchDone, (void *)(intptr_t)i) ) {
+			sql_bench_data.failed++;
+			if( ++sql_bench_data.done == sql_bench_data.count )
+				SqlWorker_P_BenchEnd();
+		}
+	}
+}
+
+
+
 /* Receives mysql error codes during runtime (not on first-time-connects) */
 void hercules_mysql_error_handler(unsigned int ecode) {
 	switch( ecode ) {
@@ -1025,6 +2232,12 @@ void Sql_inter_server_read(const char *cfgName, bool first) {
 			mysql_reconnect_count = atoi(w2);
 			if( mysql_reconnect_count < 1 )
 				mysql_reconnect_count = 1;
+		} else if(!strcmpi(w1,"sql_stmt_cache_size")) {
+			sql_stmt_cache_size = max(atoi(w2), 0);
+		} else if(!strcmpi(w1,"sql_stats")) {
+			sql_stats = (config_switch(w2) != 0);
+		} else if(!strcmpi(w1,"sql_slow_query_ms")) {
+			sql_slow_query_ms = (unsigned int)max(atoi(w2), 0);
 		} else if(!strcmpi(w1,"import"))
 			Sql_inter_server_read(w2,false);
 	}
@@ -1086,3 +2299,18 @@ void Sql_HerculesUpdateCheck(Sql *self) {
 void Sql_init(void) {
 	Sql_inter_server_read(SQL_CONF_NAME,true);
 }
+
+static int Sql_P_StatsFree(DBKey key, DBData *data, va_list ap) {
+	struct SqlStats *stats = (struct SqlStats *)db_data2ptr(data);
+
+	aFree(stats->query);
+	aFree(stats);
+	return 0;
+}
+
+void Sql_final(void) {
+	if( sql_stats_db ) {
+		sql_stats_db->destroy(sql_stats_db, Sql_P_StatsFree);
+		sql_stats_db = NULL;
+	}
+}
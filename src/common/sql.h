@@ -345,7 +345,157 @@ void SqlStmt_ShowDebug_(SqlStmt *self, const char *debug_file, const unsigned lo
 /// Frees a SqlStmt returned by SqlStmt_Malloc.
 void SqlStmt_Free(SqlStmt *self);
 
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Asynchronous Queries
+///////////////////////////////////////////////////////////////////////////////
+// A SqlWorker is a pool of background threads, each with its own connection.
+// Queries are queued as SqlJob handles and executed in order of arrival.
+// A worker with a single thread also completes them in that order, so users
+// that depend on it (transactions, write-behind) must use one of those.
+// The owner either polls the job from the main thread, or gets a callback on
+// the main thread (from do_sockets) once it's done, and then reads the
+// buffered result. The worker threads don't use the memory manager, timers
+// or showmsg.
+
+
+
+struct SqlWorker;// Background query thread (private access)
+struct SqlJob;// Queued query (private access)
+
+typedef struct SqlWorker SqlWorker;
+typedef struct SqlJob SqlJob;
+
+/// Completion callback, invoked on the main thread.
+/// The job still has to be freed by the owner (it can be done here).
+typedef void (*SqlJobFunc)(SqlJob *job, void *data);
+
+
+
+/// Starts a worker thread that connects to the database on its own.
+/// Connection failures are reported through the jobs.
+///
+/// @return SqlWorker handle or NULL if the thread couldn't be started
+struct SqlWorker *SqlWorker_Create(const char *user, const char *passwd, const char *host, uint16 port, const char *db, const char *encoding);
+
+
+
+/// Starts a pool of worker threads, each with its own connection.
+/// Jobs may complete out of order when there's more than one thread.
+///
+/// @return SqlWorker handle or NULL if no thread could be started
+struct SqlWorker *SqlWorker_CreatePool(const char *user, const char *passwd, const char *host, uint16 port, const char *db, const char *encoding, int threads);
+
+
+
+/// Starts a pool of worker threads that answer the jobs without a database,
+/// for testing. Every query takes latency ms, succeeds and returns a single
+/// row with the query text in its only column.
+///
+/// @return SqlWorker handle or NULL if no thread could be started
+struct SqlWorker *SqlWorker_CreateStub(int threads, unsigned int latency);
+
+
+
+/// Stops the worker after executing the queued jobs.
+/// Callbacks that weren't dispatched yet are invoked before it returns.
+/// Jobs that weren't freed yet stay valid, the worker is released along with the last one.
+void SqlWorker_Free(SqlWorker *self);
+
+
+
+/// Returns the number of threads of the worker.
+int SqlWorker_NumThreads(SqlWorker *self);
+
+
+
+/// Runs the self-test of the asynchronous layer on a stub worker.
+/// Queues count jobs with callbacks and reports when all of them were dispatched.
+void SqlWorker_Bench(int count, int threads, unsigned int latency);
+
+
+
+/// Queues a query, storing at most max_rows rows of its result.
+///
+/// @return SqlJob handle or NULL if an error occured
+struct SqlJob *SqlJob_Query(SqlWorker *worker, const char *query, size_t max_rows);
+
+
+
+/// Queues a query, storing at most max_rows rows of its result, and invokes
+/// func on the main thread once it's done. No callback is made for a job that
+/// was freed before.
+///
+/// @return SqlJob handle or NULL if an error occured
+struct SqlJob *SqlJob_QueryCallback(SqlWorker *worker, const char *query, size_t max_rows, SqlJobFunc func, void *data);
+
+
+
+/// Returns true once the worker has executed the job.
+bool SqlJob_IsDone(SqlJob *self);
+
+
+
+/// Blocks until the worker has executed the job.
+/// Only meant for the rare cases where the result is needed right away.
+void SqlJob_Wait(SqlJob *self);
+
+
+
+/// Returns SQL_SUCCESS or SQL_ERROR depending on how the query went.
+/// Only valid once the job is done.
+int SqlJob_GetResult(SqlJob *self);
+
+
+
+/// Returns the number of rows in the result, including the ones that weren't stored.
+uint64 SqlJob_NumRows(SqlJob *self);
+
+
+
+/// Returns the number of stored rows.
+size_t SqlJob_NumStoredRows(SqlJob *self);
+
+
+
+/// Returns the number of columns in each row.
+uint32 SqlJob_NumColumns(SqlJob *self);
+
+
+
+/// Gets the data of a column of a stored row.
+/// out_buf is set to NULL for NULL values.
+///
+/// @return SQL_SUCCESS or SQL_ERROR
+int SqlJob_GetData(SqlJob *self, size_t row, size_t col, char **out_buf);
+
+
+
+#if defined(SQL_REMOVE_SHOWDEBUG)
+#define SqlJob_ShowDebug(self) (void)0
+#else
+#define SqlJob_ShowDebug(self) SqlJob_ShowDebug_(self, __FILE__, __LINE__)
+#endif
+/// Shows debug information (error and query).
+void SqlJob_ShowDebug_(SqlJob *self, const char *debug_file, const unsigned long debug_line);
+
+
+
+/// Frees a SqlJob returned by SqlJob_Query or SqlJob_QueryCallback.
+/// A job that is still pending (or waiting for its callback) is abandoned
+/// and released by the worker.
+void SqlJob_Free(SqlJob *self);
+
 void Sql_init(void);
+void Sql_final(void);
+
+
+
+/// Shows the top query templates by total time since the previous report
+/// (count, latency percentiles, rows) and the prepared statement cache counters.
+/// top <= 0 shows the default number of templates.
+void Sql_Report(int top);
 
 
 #endif /* _COMMON_SQL_H_ */
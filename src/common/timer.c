@@ -194,6 +194,28 @@ unsigned int gettick(void)
 #endif
 //////////////////////////////////////////////////////////////////////////
 
+/// Microseconds since an arbitrary point, for measuring short durations.
+uint64 gettick_usec(void)
+{
+#if defined(WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if( freq.QuadPart == 0 )
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint64)(count.QuadPart / freq.QuadPart) * 1000000 + (uint64)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(HAVE_MONOTONIC_CLOCK)
+	struct timespec tval;
+	clock_gettime(CLOCK_MONOTONIC, &tval);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_nsec / 1000;
+#else
+	struct timeval tval;
+	gettimeofday(&tval, NULL);
+	return (uint64)tval.tv_sec * 1000000 + tval.tv_usec;
+#endif
+}
+
 /*======================================
  * 	CORE : Timer Heap
  *--------------------------------------*/
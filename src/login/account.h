@@ -136,6 +136,16 @@ struct AccountDB
 	/// @return true if successful
 	bool (*save)(AccountDB *self, const struct mmo_account *acc);
 
+	/// Saves the account_reg2 variables of an account changed since their last save.
+	/// An empty value deletes the variable.
+	///
+	/// @param self Database
+	/// @param account_id Target account id
+	/// @param reg Changed variables
+	/// @param reg_num Number of changed variables
+	/// @return true if successful
+	bool (*save_reg2)(AccountDB *self, const int account_id, const struct global_reg *reg, int reg_num);
+
 	/// Finds an account with account_id and copies it to acc.
 	///
 	/// @param self Database
@@ -7,6 +7,7 @@
 #include "../common/sql.h"
 #include "../common/strlib.h"
 #include "../common/timer.h"
+#include "../common/utils.h"
 #include "account.h"
 #include <stdlib.h>
 #include <string.h>
@@ -59,6 +60,7 @@ static bool account_db_sql_set_property(AccountDB *self, const char *option, con
 static bool account_db_sql_create(AccountDB *self, struct mmo_account *acc);
 static bool account_db_sql_remove(AccountDB *self, const int account_id);
 static bool account_db_sql_save(AccountDB *self, const struct mmo_account *acc);
+static bool account_db_sql_save_reg2(AccountDB *self, const int account_id, const struct global_reg *reg, int reg_num);
 static bool account_db_sql_load_num(AccountDB *self, struct mmo_account *acc, const int account_id);
 static bool account_db_sql_load_str(AccountDB *self, struct mmo_account *acc, const char *userid);
 static AccountDBIterator *account_db_sql_iterator(AccountDB *self);
@@ -67,6 +69,7 @@ static bool account_db_sql_iter_next(AccountDBIterator *self, struct mmo_account
 
 static bool mmo_auth_fromsql(AccountDB_SQL *db, struct mmo_account *acc, int account_id);
 static bool mmo_auth_tosql(AccountDB_SQL *db, const struct mmo_account *acc, bool is_new);
+static bool mmo_auth_reg2_tosql(AccountDB_SQL *db, int account_id, const struct global_reg *reg, int reg_num, bool whole);
 
 /// public constructor
 AccountDB *account_db_sql(void)
@@ -79,6 +82,7 @@ AccountDB *account_db_sql(void)
 	db->vtable.get_property = &account_db_sql_get_property;
 	db->vtable.set_property = &account_db_sql_set_property;
 	db->vtable.save         = &account_db_sql_save;
+	db->vtable.save_reg2    = &account_db_sql_save_reg2;
 	db->vtable.create       = &account_db_sql_create;
 	db->vtable.remove       = &account_db_sql_remove;
 	db->vtable.load_num     = &account_db_sql_load_num;
@@ -408,6 +412,13 @@ static bool account_db_sql_save(AccountDB *self, const struct mmo_account *acc)
 	return mmo_auth_tosql(db, acc, false);
 }
 
+/// save the account_reg2 variables that changed (empty value = deleted)
+static bool account_db_sql_save_reg2(AccountDB *self, const int account_id, const struct global_reg *reg, int reg_num)
+{
+	AccountDB_SQL *db = (AccountDB_SQL *)self;
+	return mmo_auth_reg2_tosql(db, account_id, reg, reg_num, false);
+}
+
 /// retrieve data from db and store it in the provided data structure
 static bool account_db_sql_load_num(AccountDB *self, struct mmo_account *acc, const int account_id)
 {
@@ -589,7 +600,6 @@ static bool mmo_auth_tosql(AccountDB_SQL *db, const struct mmo_account *acc, boo
 	Sql *sql_handle = db->accounts;
 	SqlStmt *stmt = SqlStmt_Malloc(sql_handle);
 	bool result = false;
-	int i;
 
 	// try
 	do {
@@ -666,31 +676,9 @@ static bool mmo_auth_tosql(AccountDB_SQL *db, const struct mmo_account *acc, boo
 			}
 		}
 
-		// remove old account regs
-		if( SQL_SUCCESS != Sql_Query(sql_handle, "DELETE FROM `%s` WHERE `type`='1' AND `account_id`='%d'", db->accreg_db, acc->account_id) )
-		{
-			Sql_ShowDebug(sql_handle);
-			break;
-		}
-		// insert new account regs
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, "INSERT INTO `%s` (`type`, `account_id`, `str`, `value`) VALUES ( 1 , '%d' , ? , ? );",  db->accreg_db, acc->account_id) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			break;
-		}
-		for( i = 0; i < acc->account_reg2_num; ++i ) {
-			if( SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, (void *)acc->account_reg2[i].str, strlen(acc->account_reg2[i].str))
-			||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (void *)acc->account_reg2[i].value, strlen(acc->account_reg2[i].value))
-			||  SQL_SUCCESS != SqlStmt_Execute(stmt)
-			) {
-				SqlStmt_ShowDebug(stmt);
-				break;
-			}
-		}
-		if( i < acc->account_reg2_num ) {
-			result = false;
+		// account regs, only the rows that differ are written
+		if( !mmo_auth_reg2_tosql(db, acc->account_id, acc->account_reg2, acc->account_reg2_num, !is_new) )
 			break;
-		}
 
 		// if we got this far, everything was successful
 		result = true;
@@ -703,6 +691,81 @@ static bool mmo_auth_tosql(AccountDB_SQL *db, const struct mmo_account *acc, boo
 
 	return result;
 }
+
+/// Writes account_reg2 variables, only touching the rows that differ.
+/// @param whole true if reg holds all the variables of the account (the stored ones missing from it are deleted),
+///              false if it only holds changed ones (an empty value deletes the variable)
+static bool mmo_auth_reg2_tosql(AccountDB_SQL *db, int account_id, const struct global_reg *reg, int reg_num, bool whole)
+{
+	Sql *sql_handle = db->accounts;
+	StringBuf upsert, del;
+	bool same[ACCOUNT_REG2_NUM]; // reg[i] is already stored
+	char esc_str[255*2+1]; // `str` is a varchar(255)
+	char esc_val[256*2+1];
+	int i, sets = 0, dels = 0;
+	bool result = true;
+
+	reg_num = cap_value(reg_num, 0, ACCOUNT_REG2_NUM);
+	memset(same, 0, sizeof(same));
+	StringBuf_Init(&upsert);
+	StringBuf_Init(&del);
+	StringBuf_Printf(&upsert, "INSERT INTO `%s` (`type`, `account_id`, `str`, `value`) VALUES ", db->accreg_db);
+	StringBuf_Printf(&del, "DELETE FROM `%s` WHERE `type`='1' AND `account_id`='%d' AND `str` IN (", db->accreg_db, account_id);
+
+	if( whole ) { // compare with the stored rows
+		char *data;
+		size_t len;
+
+		if( SQL_ERROR == Sql_Query(sql_handle, "SELECT `str`,`value` FROM `%s` WHERE `type`='1' AND `account_id`='%d'", db->accreg_db, account_id) ) {
+			Sql_ShowDebug(sql_handle);
+			result = false;
+		}
+		while( result && SQL_SUCCESS == Sql_NextRow(sql_handle) ) {
+			Sql_GetData(sql_handle, 0, &data, &len);
+			ARR_FIND(0, reg_num, i, strcmp(reg[i].str, data) == 0);
+			if( i < reg_num ) {
+				Sql_GetData(sql_handle, 1, &data, NULL);
+				same[i] = (strcmp(reg[i].value, data) == 0);
+				continue;
+			}
+			Sql_EscapeStringLen(sql_handle, esc_str, data, min(len, 255));
+			StringBuf_Printf(&del, "%s'%s'", (dels++ ? "," : ""), esc_str);
+		}
+		Sql_FreeResult(sql_handle);
+	}
+
+	for( i = 0; result && i < reg_num; ++i ) {
+		if( reg[i].str[0] == '\0' || same[i] )
+			continue;
+		Sql_EscapeString(sql_handle, esc_str, reg[i].str);
+		if( reg[i].value[0] == '\0' ) {
+			if( !whole )
+				StringBuf_Printf(&del, "%s'%s'", (dels++ ? "," : ""), esc_str);
+			continue;
+		}
+		Sql_EscapeString(sql_handle, esc_val, reg[i].value);
+		StringBuf_Printf(&upsert, "%s(1, '%d', '%s', '%s')", (sets++ ? "," : ""), account_id, esc_str, esc_val);
+	}
+
+	if( result && dels ) {
+		StringBuf_AppendStr(&del, ")");
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&del)) ) {
+			Sql_ShowDebug(sql_handle);
+			result = false;
+		}
+	}
+	if( result && sets ) {
+		StringBuf_AppendStr(&upsert, " ON DUPLICATE KEY UPDATE `value`=VALUES(`value`)");
+		if( SQL_ERROR == Sql_QueryStr(sql_handle, StringBuf_Value(&upsert)) ) {
+			Sql_ShowDebug(sql_handle);
+			result = false;
+		}
+	}
+
+	StringBuf_Destroy(&upsert);
+	StringBuf_Destroy(&del);
+	return result;
+}
 void account_db_sql_up(AccountDB *self) {
 	AccountDB_SQL *db = (AccountDB_SQL *)self;
 	Sql_HerculesUpdateCheck(db->accounts);
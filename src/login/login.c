@@ -8,6 +8,7 @@
 #include "../common/random.h"
 #include "../common/showmsg.h"
 #include "../common/socket.h"
+#include "../common/sql.h"
 #include "../common/strlib.h"
 #include "../common/timer.h"
 #include "../common/cli.h"
@@ -398,6 +399,8 @@ int parse_console(const char *buf) {
 		ShowNotice("Type of command: '%s' || Command: '%s'\n",type,command);
 
 	if( n == 2 ) {
+		if( strcmpi("sql_report", type) == 0 )
+			Sql_Report(atoi(command));
 		if(strcmpi("server", type) == 0 ) {
 			if( strcmpi("shutdown", command) == 0 || strcmpi("exit", command) == 0 || strcmpi("quit", command) == 0 ) {
 				runflag = 0;
@@ -423,12 +426,15 @@ int parse_console(const char *buf) {
 		}
 	} else if( strcmpi("ers_report", type) == 0 ) {
 		ers_report();
+	} else if( strcmpi("sql_report", type) == 0 ) {
+		Sql_Report(0);
 	} else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t server:alive => Checks if the server is running.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
 		ShowInfo("\t create:<username> <password> <sex:M|F> => Creates a new account.\n");
+		ShowInfo("\t sql_report[:<top>] => Displays the slowest query templates and the statement cache since the previous report.\n");
 	} else { // commands with parameters
 
 	}
@@ -862,7 +868,23 @@ int parse_fromchar(int fd) {
 
 					if( !accounts->load_num(accounts, &acc, account_id) )
 						ShowStatus("Char-server '%s': receiving (from the char-server) of account_reg2 (account: %d not found, ip: %s).\n", ch_server[id].name, account_id, ip);
-					else {
+					else if( RFIFOB(fd,12)&REG_CHANGES ) { //Only the changed variables, an empty value deletes
+						int p;
+
+						for( j = 0, p = 13; j < ACCOUNT_REG2_NUM && p < RFIFOW(fd,2); ++j ) {
+							safestrncpy(acc.account_reg2[j].str, (char *)RFIFOP(fd,p), sizeof(acc.account_reg2[j].str));
+							p += strlen((char *)RFIFOP(fd,p)) + 1;
+							safestrncpy(acc.account_reg2[j].value, (char *)RFIFOP(fd,p), sizeof(acc.account_reg2[j].value));
+							p += strlen((char *)RFIFOP(fd,p)) + 1;
+							remove_control_chars(acc.account_reg2[j].str);
+							remove_control_chars(acc.account_reg2[j].value);
+						}
+						accounts->save_reg2(accounts, account_id, acc.account_reg2, j);
+
+						//Sending the changes towards the other char-servers.
+						RFIFOW(fd,0) = 0x2729; //Reusing read buffer
+						charif_sendallwos(fd, RFIFOP(fd,0), RFIFOW(fd,2));
+					} else {
 						int len;
 						int p;
 
@@ -8964,6 +8964,97 @@ int battle_config_read(const char *cfgName)
 	return 0;
 }
 
+/*==========================================
+ * Deterministic damage calculation benchmark [console: bench:battle]
+ * Builds a pool of synthetic attacker/target pairs from mob_db, seeds the RNG and
+ * runs 'count' weapon and magic calculations through battle_calc_attack().
+ * Reports calls/sec and a checksum of the results, so that changes to the damage
+ * pipeline can be timed and checked for behavior drift (pass 'expected' to compare).
+ *------------------------------------------*/
+#define BATTLE_BENCH_POOL 32
+void battle_bench(int count, uint32 seed, uint32 expected)
+{
+	static const struct {
+		int type;
+		uint16 skill_id, skill_lv;
+	} attacks[] = {
+		{ BF_WEAPON, 0,             0 },
+		{ BF_WEAPON, SM_BASH,      10 },
+		{ BF_WEAPON, AS_SONICBLOW, 10 },
+		{ BF_MAGIC,  MG_FIREBOLT,  10 },
+		{ BF_MAGIC,  MG_COLDBOLT,  10 },
+		{ BF_MAGIC,  WZ_EARTHSPIKE, 5 },
+	};
+	struct mob_data *pool[BATTLE_BENCH_POOL];
+	struct spawn_data data;
+	uint32 checksum = 2166136261U; //FNV-1a offset basis
+	unsigned int tick;
+	int i, j, pool_size = 0, elapsed;
+
+	if( count <= 0 || map_num <= 0 )
+		return;
+
+	rnd_seed(seed);
+
+	memset(&data, 0, sizeof(data));
+	data.m = 0;
+	data.x = mapdata[0].xs / 2;
+	data.y = mapdata[0].ys / 2;
+	data.num = 1;
+	for( i = 0; pool_size < BATTLE_BENCH_POOL && i < MAX_MOB_DB * 4; i++ ) {
+		struct mob_data *md;
+
+		data.id = 1001 + rnd()%(MAX_MOB_DB - 1001);
+		if( !mobdb_checkid(data.id) )
+			continue;
+		safestrncpy(data.name, mob_db(data.id)->name, sizeof(data.name));
+		md = mob_spawn_dataset(&data);
+		status_calc_mob(md, SCO_FIRST);
+		pool[pool_size++] = md;
+	}
+	if( pool_size < 2 ) {
+		ShowError("battle_bench: Not enough monsters in mob_db to build attacker/target pairs.\n");
+		for( i = 0; i < pool_size; i++ )
+			unit_free(&pool[i]->bl, CLR_OUTSIGHT);
+		rnd_init();
+		return;
+	}
+
+	tick = gettick_nocache();
+	for( i = 0; i < count; i++ ) {
+		struct mob_data *src = pool[rnd()%pool_size];
+		struct mob_data *target = pool[rnd()%pool_size];
+		int a = i%ARRAYLENGTH(attacks);
+		struct Damage d;
+		int64 v[5];
+
+		d = battle_calc_attack(attacks[a].type, &src->bl, &target->bl, attacks[a].skill_id, attacks[a].skill_lv, 0);
+		v[0] = d.damage;
+		v[1] = d.damage2;
+		v[2] = d.div_;
+		v[3] = d.type;
+		v[4] = d.dmg_lv;
+		for( j = 0; j < (int)sizeof(v); j++ ) {
+			checksum ^= ((uint8 *)v)[j];
+			checksum *= 16777619U; //FNV-1a prime
+		}
+	}
+	elapsed = DIFF_TICK(gettick_nocache(), tick);
+
+	for( i = 0; i < pool_size; i++ )
+		unit_free(&pool[i]->bl, CLR_OUTSIGHT);
+	rnd_init(); //Don't leave the server running on a known seed
+
+	ShowInfo("battle_bench: %d calculations over %d units in %d ms (%.0f calls/sec), seed %u, checksum %08x.\n",
+		count, pool_size, elapsed, (elapsed > 0 ? count * 1000. / elapsed : 0.), seed, checksum);
+	if( expected ) {
+		if( expected == checksum )
+			ShowStatus("battle_bench: Checksum matches the expected value.\n");
+		else
+			ShowWarning("battle_bench: Checksum mismatch, expected %08x! Damage calculation behavior has changed.\n", expected);
+	}
+}
+
 /*==========================
  * Initialize battle timer
  *--------------------------*/
@@ -695,6 +695,8 @@ extern void battle_set_defaults(void);
 int battle_set_value(const char *w1, const char *w2);
 int battle_get_value(const char *w1);
 
+void battle_bench(int count, uint32 seed, uint32 expected);
+
 struct block_list *battle_getenemyarea(struct block_list *src, int x, int y, int range, int type, int ignore_id, uint16 skill_id);
 int battle_damage_area(struct block_list *bl, va_list ap);
 
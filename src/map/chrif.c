@@ -48,7 +48,7 @@ static const int packet_len_table[0x3d] = { // U - used, F - free
 	11,10,10,-1,11,-1,266,10,	// 2b10-2b17: U->2b10, U->2b11, U->2b12, U->2b13, U->2b14, U->2b15, U->2b16, U->2b17
 	 2,10, 2,-1,-1,-1, 2, 7,	// 2b18-2b1f: U->2b18, U->2b19, U->2b1a, U->2b1b, U->2b1c, U->2b1d, U->2b1e, U->2b1f
 	-1,10, 8, 2, 2,14,19,19,	// 2b20-2b27: U->2b20, U->2b21, U->2b22, U->2b23, U->2b24, U->2b25, U->2b26, U->2b27
-	-1, 0, 6,15, 0, 6,-1,-1,	// 2b28-2b2f: U->2b28, F->2b29, U->2b2a, U->2b2b, F->2b2c, U->2b2d, U->2b2e, U->2b2f
+	-1,-1, 6,15,10, 6,-1,-1,	// 2b28-2b2f: U->2b28, U->2b29, U->2b2a, U->2b2b, U->2b2c, U->2b2d, U->2b2e, U->2b2f
 };
 
 //Used Packets:
@@ -101,10 +101,10 @@ static const int packet_len_table[0x3d] = { // U - used, F - free
 //2b26: Outgoing, chrif_authreq -> 'client authentication request'
 //2b27: Incoming, chrif_authfail -> 'client authentication failed'
 //2b28: Outgoing, chrif_req_charban -> 'ban a specific char'
-//2b29: FREE
+//2b29: Outgoing, chrif_save -> 'charsave of char XY account XY (changed sections of the struct)'
 //2b2a: Outgoing, chrif_req_charunban -> 'unban a specific char'
 //2b2b: Incoming, chrif_parse_ack_vipActive -> vip info result
-//2b2c: FREE
+//2b2c: Incoming, chrif_save_resync -> 'delta save couldn't be applied, send the complete struct'
 //2b2d: Outgoing, chrif_bsdata_request -> request bonus_script for pc_authok'ed char.
 //2b2e: Outgoing, chrif_bsdata_save -> Send bonus_script of player for saving.
 //2b2f: Incoming, chrif_bsdata_received -> received bonus_script of player for loading.
@@ -274,6 +274,125 @@ int chrif_isconnected(void) {
 	return (char_fd > 0 && session[char_fd] != NULL && chrif_state == 2);
 }
 
+/// Character data save counters, to report the char link bandwidth they use
+static struct {
+	unsigned int full, delta, skipped;
+	uint64 full_bytes, delta_bytes;
+	unsigned int start_tick;
+} chrif_save_stats;
+
+/**
+ * Sends the character data to the char-server.
+ * Only the sections that changed since the previous save are sent (0x2b29) when the char-server holds
+ * that save, the whole structure (0x2b01) otherwise and for the final save of a quitting character.
+ * @param sd: Player data
+ * @param flag: Save flag types (see chrif_save)
+ */
+static void chrif_save_status(struct map_session_data *sd, enum e_chrif_save_opt flag) {
+	struct mmo_charstatus status;
+	uint32 version;
+	int i, len;
+
+	memcpy(&status, &sd->status, sizeof(struct mmo_charstatus));
+	//If the user is on a instance map, we have to fake his current position
+	if (mapdata[sd->bl.m].instance_id)
+		memcpy(&status.last_point, &status.save_point, sizeof(struct point)); //Change his current position to his savepoint
+
+	if ((version = sd->save_version + 1) == 0)
+		version = 1; //0 means no version
+
+	if (!(flag&CSAVE_QUITTING) && sd->save_version && sd->save_status) {
+		bool changed[CHARSAVE_SECT_MAX];
+
+		len = 20;
+		for (i = 0; i < CHARSAVE_SECT_MAX; i++) {
+			size_t offset = charsave_section_offset(i), size = charsave_section_size(i);
+
+			changed[i] = (size > 0 && memcmp((uint8 *)&status + offset, (uint8 *)sd->save_status + offset, size) != 0);
+			if (changed[i])
+				len += 1 + (int)size;
+		}
+
+		if (len == 20) { //Nothing changed since the previous save
+			chrif_save_stats.skipped++;
+			return;
+		}
+
+		if (len < (int)sizeof(struct mmo_charstatus) + 17) {
+			int pos = 20;
+
+			WFIFOHEAD(char_fd,len);
+			WFIFOW(char_fd,0) = 0x2b29;
+			WFIFOW(char_fd,2) = len;
+			WFIFOL(char_fd,4) = sd->status.account_id;
+			WFIFOL(char_fd,8) = sd->status.char_id;
+			WFIFOL(char_fd,12) = sd->save_version; //Save the delta applies to
+			WFIFOL(char_fd,16) = version;
+			for (i = 0; i < CHARSAVE_SECT_MAX; i++) {
+				if (!changed[i])
+					continue;
+				WFIFOB(char_fd,pos) = i;
+				memcpy(WFIFOP(char_fd,pos + 1), (uint8 *)&status + charsave_section_offset(i), charsave_section_size(i));
+				pos += 1 + (int)charsave_section_size(i);
+			}
+			WFIFOSET(char_fd,len);
+
+			memcpy(sd->save_status, &status, sizeof(struct mmo_charstatus));
+			sd->save_version = version;
+			chrif_save_stats.delta++;
+			chrif_save_stats.delta_bytes += len;
+			return;
+		}
+	}
+
+	len = sizeof(struct mmo_charstatus) + 17;
+	WFIFOHEAD(char_fd,len);
+	WFIFOW(char_fd,0) = 0x2b01;
+	WFIFOW(char_fd,2) = len;
+	WFIFOL(char_fd,4) = sd->status.account_id;
+	WFIFOL(char_fd,8) = sd->status.char_id;
+	WFIFOB(char_fd,12) = (flag&CSAVE_QUIT) ? 1 : 0; //Flag to tell char-server this character is quitting
+	memcpy(WFIFOP(char_fd,13), &status, sizeof(struct mmo_charstatus));
+	WFIFOL(char_fd,13 + sizeof(struct mmo_charstatus)) = version;
+	WFIFOSET(char_fd,len);
+
+	if (sd->save_status == NULL)
+		CREATE(sd->save_status, struct mmo_charstatus, 1);
+	memcpy(sd->save_status, &status, sizeof(struct mmo_charstatus));
+	sd->save_version = version;
+	chrif_save_stats.full++;
+	chrif_save_stats.full_bytes += len;
+}
+
+/**
+ * The char-server couldn't apply a delta save, send the whole character data.
+ * 2b2c <account_id>.L <char_id>.L
+ */
+static void chrif_save_resync(int fd) {
+	struct map_session_data *sd = map_id2sd(RFIFOL(fd,2));
+
+	if (sd == NULL || sd->status.char_id != RFIFOL(fd,6))
+		return; //Gone, its final save is sent whole anyway
+	sd->save_version = 0;
+	chrif_save_status(sd, CSAVE_NORMAL);
+}
+
+/// Shows the character data save counters and the char link bandwidth they used.
+void chrif_save_report(void) {
+	double secs = DIFF_TICK(gettick(), chrif_save_stats.start_tick) / 1000.;
+
+	if (secs < 1.)
+		secs = 1.;
+	ShowInfo("Character saves in the last %.0f seconds:\n", secs);
+	ShowInfo("  whole: %u (%" PRIu64 " bytes), delta: %u (%" PRIu64 " bytes), unchanged: %u\n",
+		chrif_save_stats.full, chrif_save_stats.full_bytes, chrif_save_stats.delta, chrif_save_stats.delta_bytes, chrif_save_stats.skipped);
+	ShowInfo("  char link: %.0f bytes/s, %.0f bytes/s if every save was whole\n",
+		(chrif_save_stats.full_bytes + chrif_save_stats.delta_bytes) / secs,
+		(double)(chrif_save_stats.full + chrif_save_stats.delta) * (sizeof(struct mmo_charstatus) + 17) / secs);
+	memset(&chrif_save_stats, 0, sizeof(chrif_save_stats));
+	chrif_save_stats.start_tick = gettick();
+}
+
 /**
  * Saves character data.
  * @param sd: Player data
@@ -286,8 +405,6 @@ int chrif_isconnected(void) {
  *  CSAVE_CART: Character changed cart data
  */
 int chrif_save(struct map_session_data *sd, enum e_chrif_save_opt flag) {
-	uint32 mmo_charstatus_len = 0;
-
 	nullpo_retr(-1, sd);
 
 	pc_makesavestatus(sd);
@@ -316,6 +433,8 @@ int chrif_save(struct map_session_data *sd, enum e_chrif_save_opt flag) {
 		intif_storage_save(sd, &sd->inventory);
 	if (flag&CSAVE_CART)
 		intif_storage_save(sd, &sd->cart);
+	if (flag&(CSAVE_INVENTORY|CSAVE_CART))
+		pc_autosave_sent(sd, flag);
 	if (flag&CSAVE_QUITTING)
 		sd->state.storage_flag = 0; //Force close it
 
@@ -327,28 +446,7 @@ int chrif_save(struct map_session_data *sd, enum e_chrif_save_opt flag) {
 	if (sd->state.reg_dirty&1)
 		intif_saveregistry(sd, 1); //Save account2 regs
 
-	mmo_charstatus_len = sizeof(sd->status) + 13;
-	WFIFOHEAD(char_fd,mmo_charstatus_len);
-	WFIFOW(char_fd,0) = 0x2b01;
-	WFIFOW(char_fd,2) = mmo_charstatus_len;
-	WFIFOL(char_fd,4) = sd->status.account_id;
-	WFIFOL(char_fd,8) = sd->status.char_id;
-	WFIFOB(char_fd,12) = (flag&CSAVE_QUIT) ? 1 : 0; //Flag to tell char-server this character is quitting
-
-	//If the user is on a instance map, we have to fake his current position
-	if (mapdata[sd->bl.m].instance_id) {
-		struct mmo_charstatus status;
-
-		//Copy the whole status
-		memcpy(&status, &sd->status, sizeof(struct mmo_charstatus));
-		//Change his current position to his savepoint
-		memcpy(&status.last_point, &status.save_point, sizeof(struct point));
-		//Copy the copied status into the packet
-		memcpy(WFIFOP(char_fd, 13), &status, sizeof(struct mmo_charstatus));
-	} else //Copy the whole status into the packet
-		memcpy(WFIFOP(char_fd, 13), &sd->status, sizeof(struct mmo_charstatus));
-
-	WFIFOSET(char_fd, WFIFOW(char_fd,2));
+	chrif_save_status(sd, flag);
 
 	if (sd->status.pet_id > 0 && sd->pd)
 		intif_save_petdata(sd->status.account_id, &sd->pd->pet);
@@ -1498,10 +1596,25 @@ int chrif_char_online(struct map_session_data *sd) {
 
 ///Called when the connection to Char Server is disconnected.
 void chrif_on_disconnect(void) {
+	struct map_session_data *sd;
+	struct s_mapiterator *iter;
+
 	if (chrif_connected != 1)
 		ShowWarning("Connection to Char Server lost.\n\n");
 	chrif_connected = 0;
 
+	//The char-server may not hold the previous saves anymore, send them whole
+	iter = mapit_getallusers();
+	for (sd = (TBL_PC *)mapit_first(iter); mapit_exists(iter); sd = (TBL_PC *)mapit_next(iter)) {
+		int i;
+
+		sd->save_version = 0;
+		sd->autosave_hash[0] = sd->autosave_hash[1] = 0; //Inventory and cart saves in flight may be lost
+		for (i = 0; i < ARRAYLENGTH(sd->reg_index); i++) //Registry changes in flight may be lost
+			sd->reg_index[i].full = true;
+	}
+	mapit_free(iter);
+
 	other_mapserver_count = 0; //Reset counter, we receive ALL maps from all map-servers on reconnect
 	map_eraseallipport();
 
@@ -1781,6 +1894,7 @@ int chrif_parse(int fd) {
 			case 0x2b25: chrif_deadopt(RFIFOL(fd,2), RFIFOL(fd,6), RFIFOL(fd,10)); break;
 			case 0x2b27: chrif_authfail(fd); break;
 			case 0x2b2b: chrif_parse_ack_vipActive(fd); break;
+			case 0x2b2c: chrif_save_resync(fd); break;
 			case 0x2b2f: chrif_bsdata_received(fd); break;
 			default:
 				ShowError("chrif_parse : unknown packet (session #%d): 0x%x. Disconnecting.\n", fd, cmd);
@@ -1940,6 +2054,8 @@ void do_init_chrif(void) {
 		exit(EXIT_FAILURE);
 	}
 
+	chrif_save_stats.start_tick = gettick();
+
 	auth_db = idb_alloc(DB_OPT_BASE);
 	auth_db_ers = ers_new(sizeof(struct auth_node),"chrif.c::auth_db_ers",ERS_OPT_NONE);
 
@@ -56,6 +56,7 @@ int chrif_skillcooldown_save(struct map_session_data *sd);
 int chrif_skillcooldown_load(int fd);
 
 int chrif_save(struct map_session_data *sd, enum e_chrif_save_opt flag);
+void chrif_save_report(void);
 int chrif_charselectreq(struct map_session_data *sd, uint32 s_ip);
 int chrif_changemapserver(struct map_session_data *sd, uint32 ip, uint16 port);
 
@@ -3194,7 +3194,7 @@ static int clif_hpmeter(struct map_session_data *sd)
 /// 0acb <var id>.W <value>.Q (ZC_LONGPAR_CHANGE2)
 /// @TODO: Extract individual packets.
 /// FIXME: Packet lengths from packet_len(cmd)
-void clif_updatestatus(struct map_session_data *sd,int type)
+static void clif_updatestatus_send(struct map_session_data *sd,int type)
 {
 	int fd, len = 8;
 
@@ -3432,6 +3432,73 @@ void clif_updatestatus(struct map_session_data *sd,int type)
 	}
 }
 
+/// Parameters that change often enough to be coalesced to a single update per tick,
+/// in the order they are flushed (max values go before the current ones).
+/// SP_WEIGHT isn't one of them, its update also applies the overweight status.
+static const int clif_status_coalesced[] = { SP_MAXHP, SP_HP, SP_MAXSP, SP_SP, SP_MAXWEIGHT, SP_ZENY, SP_BASEEXP, SP_JOBEXP };
+static int *clif_status_dirty_list = NULL; //Ids of players with coalesced updates pending
+static int clif_status_dirty_count = 0;
+static int clif_status_dirty_max = 0;
+
+/// Sends the coalesced parameter updates of a player right away.
+/// Use before packets that must reach the client after the latest values.
+void clif_updatestatus_flush(struct map_session_data *sd)
+{
+	int i;
+
+	nullpo_retv(sd);
+
+	while( sd->status_dirty ) { //Parameters marked again by the sends go out too
+		ARR_FIND(0, ARRAYLENGTH(clif_status_coalesced), i, sd->status_dirty&(1<<i));
+		sd->status_dirty &= ~(1<<i);
+		clif_updatestatus_send(sd, clif_status_coalesced[i]);
+	}
+}
+
+/// Sends all coalesced parameter updates, invoked once per tick before data is sent.
+/// Players that aren't in the id db yet are dropped from the list, map_addiddb flushes their updates.
+static void clif_updatestatus_presend(void)
+{
+	int i;
+
+	for( i = 0; i < clif_status_dirty_count; i++ ) {
+		struct map_session_data *sd = map_id2sd(clif_status_dirty_list[i]);
+
+		if( sd )
+			clif_updatestatus_flush(sd);
+	}
+	clif_status_dirty_count = 0;
+}
+
+/// Notifies client of a character parameter change.
+/// Frequent parameters (see clif_status_coalesced) are sent once at the end of the tick
+/// with their latest value, everything else goes out immediately.
+void clif_updatestatus(struct map_session_data *sd,int type)
+{
+	int i;
+
+	nullpo_retv(sd);
+
+	if( !session_isActive(sd->fd) )
+		return;
+
+	ARR_FIND(0, ARRAYLENGTH(clif_status_coalesced), i, clif_status_coalesced[i] == type);
+	if( i == ARRAYLENGTH(clif_status_coalesced) ) {
+		clif_updatestatus_flush(sd); //Keep the order of updates to the same player
+		clif_updatestatus_send(sd, type);
+		return;
+	}
+
+	if( !sd->status_dirty ) {
+		if( clif_status_dirty_count == clif_status_dirty_max ) {
+			clif_status_dirty_max += 256;
+			RECREATE(clif_status_dirty_list, int, clif_status_dirty_max);
+		}
+		clif_status_dirty_list[clif_status_dirty_count++] = sd->bl.id;
+	}
+	sd->status_dirty |= (1<<i);
+}
+
 
 /// Notifies client of a parameter change of an another player (ZC_PAR_CHANGE_USER).
 /// 01ab <account id>.L <var id>.W <value>.L
@@ -3647,6 +3714,8 @@ void clif_initialstatus(struct map_session_data *sd)
 
 	nullpo_retv(sd);
 
+	clif_updatestatus_flush(sd); //The status window goes after the pending updates
+
 	fd = sd->fd;
 	WFIFOHEAD(fd,packet_len(0xbd));
 	buf = WFIFOP(fd,0);
@@ -3788,6 +3857,8 @@ void clif_statusupack(struct map_session_data *sd,int type,int ok,int val)
 
 	nullpo_retv(sd);
 
+	clif_updatestatus_flush(sd);
+
 	fd = sd->fd;
 	WFIFOHEAD(fd,packet_len(0xbc));
 	WFIFOW(fd,0) = 0xbc;
@@ -5323,6 +5394,7 @@ void clif_skillinfoblock(struct map_session_data *sd)
 	if( !fd )
 		return;
 
+	clif_updatestatus_flush(sd); //The skill window goes after the pending updates
 	WFIFOHEAD(fd,MAX_SKILL * 37 + 4);
 	WFIFOW(fd,0) = 0x10f;
 	for( i = 0, len = 4; i < MAX_SKILL; i++) {
@@ -5419,6 +5491,8 @@ void clif_skillup(struct map_session_data *sd, uint16 skill_id, int lv, int rang
 
 	nullpo_retv(sd);
 
+	clif_updatestatus_flush(sd);
+
 	fd = sd->fd;
 	WFIFOHEAD(fd,packet_len(0x10e));
 	WFIFOW(fd,0) = 0x10e;
@@ -21628,6 +21702,7 @@ void do_init_clif(void) {
 	packetdb_readdb();
 
 	set_defaultparse(clif_parse);
+	set_presend(clif_updatestatus_presend);
 	if( make_listen_bind(bind_ip,map_port) == -1 ) {
 		ShowFatalError("Failed to bind to port '"CL_WHITE"%d"CL_RESET"'\n", map_port);
 		exit(EXIT_FAILURE);
@@ -21641,4 +21716,6 @@ void do_init_clif(void) {
 
 void do_final_clif(void) {
 	ers_destroy(delay_clearunit_ers);
+	if( clif_status_dirty_list )
+		aFree(clif_status_dirty_list);
 }
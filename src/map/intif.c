@@ -418,8 +418,9 @@ int intif_regtostr(char *str, struct global_reg *reg, int qty)
 int intif_saveregistry(struct map_session_data *sd, int type)
 {
 	struct global_reg *reg;
+	struct s_reg_index *ri;
 	int count;
-	int i, p;
+	int i, p, sent = 0;
 
 	if (CheckForCharServer())
 		return -1;
@@ -445,19 +446,41 @@ int intif_saveregistry(struct map_session_data *sd, int type)
 			return -1;
 	}
 
+	ri = &sd->reg_index[type - 1];
+	if (ri->changes && db_size(ri->changes) == 0 && !ri->full)
+		return 1; //Nothing changed
+
 	WFIFOHEAD(inter_fd,288 * MAX_REG_NUM+13);
 	WFIFOW(inter_fd,0) = 0x3004;
 	WFIFOL(inter_fd,4) = sd->status.account_id;
 	WFIFOL(inter_fd,8) = sd->status.char_id;
-	WFIFOB(inter_fd,12) = type;
-	for (p = 13, i = 0; i < count; i++) {
-		if (reg[i].str[0] != '\0' && reg[i].value[0] != '\0') {
-			p += sprintf((char *)WFIFOP(inter_fd,p), "%s", reg[i].str) + 1; //We add 1 to consider the '\0' in place.
-			p += sprintf((char *)WFIFOP(inter_fd,p), "%s", reg[i].value) + 1;
+	if (ri->changes && !ri->full && db_size(ri->changes) < count) { //Only the variables changed since the last save, an empty value deletes
+		DBIterator *iter = db_iterator(ri->changes);
+		DBKey key;
+
+		WFIFOB(inter_fd,12) = type|REG_CHANGES;
+		p = 13;
+		for (iter->first(iter, &key); iter->exists(iter); iter->next(iter, &key)) {
+			char *value = pc_readregistry_str(sd, key.str, type);
+
+			p += sprintf((char *)WFIFOP(inter_fd,p), "%s", key.str) + 1;
+			p += sprintf((char *)WFIFOP(inter_fd,p), "%s", (value ? value : "")) + 1;
+			sent++;
+		}
+		dbi_destroy(iter);
+	} else {
+		WFIFOB(inter_fd,12) = type;
+		for (p = 13, i = 0; i < count; i++) {
+			if (reg[i].str[0] != '\0' && reg[i].value[0] != '\0') {
+				p += sprintf((char *)WFIFOP(inter_fd,p), "%s", reg[i].str) + 1; //We add 1 to consider the '\0' in place.
+				p += sprintf((char *)WFIFOP(inter_fd,p), "%s", reg[i].value) + 1;
+				sent++;
+			}
 		}
 	}
 	WFIFOW(inter_fd,2) = p;
 	WFIFOSET(inter_fd,WFIFOW(inter_fd,2));
+	pc_reg_saved(sd, type, sent);
 
 	return 1;
 }
@@ -1391,13 +1414,27 @@ int intif_parse_Registers(int fd)
 		sd = node->sd;
 	else { //Normally registries should arrive for in log-in chars.
 		sd = map_id2sd(account_id);
-		if (sd && RFIFOB(fd,12) == 3 && sd->status.char_id != char_id)
+		if (sd && (RFIFOB(fd,12)&~REG_CHANGES) == 3 && sd->status.char_id != char_id)
 			sd = NULL; //Character registry from another character.
 	}
 
 	if (!sd)
 		return 0;
 
+	if (RFIFOB(fd,12)&REG_CHANGES) { //Changes saved by another server
+		int type = RFIFOB(fd,12)&~REG_CHANGES;
+
+		for (p = 13; p < RFIFOW(fd,2); ) {
+			const char *str = (char *)RFIFOP(fd,p), *value;
+
+			p += strlen(str) + 1;
+			value = (char *)RFIFOP(fd,p);
+			p += strlen(value) + 1;
+			pc_reg_apply(sd, type, str, value);
+		}
+		return 1;
+	}
+
 	flag = (sd->save_reg.global_num == -1 || sd->save_reg.account_num == -1 || sd->save_reg.account2_num == -1);
 
 	switch (RFIFOB(fd,12)) {
@@ -1431,6 +1468,7 @@ int intif_parse_Registers(int fd)
 	}
 
 	*qty = j;
+	pc_reg_index_build(sd, RFIFOB(fd,12));
 
 	if (flag && sd->save_reg.global_num > -1 && sd->save_reg.account_num > -1 && sd->save_reg.account2_num > -1)
 		pc_reg_received(sd); //Received all registry values, execute init scripts and what-not. [Skotlex]
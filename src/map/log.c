@@ -2,10 +2,14 @@
 // For more information, see LICENCE in the main folder
 
 #include "../common/cbasetypes.h"
+#include "../common/binlog.h"
+#include "../common/malloc.h"
 #include "../common/sql.h" // SQL_INNODB
 #include "../common/strlib.h"
 #include "../common/nullpo.h"
 #include "../common/showmsg.h"
+#include "../common/timer.h"
+#include "../common/utils.h"
 #include "map.h"
 #include "battle.h"
 #include "itemdb.h"
@@ -16,9 +20,11 @@
 #include "pc.h"
 #include "pet.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <zlib.h>
 
 
 /// Filters for item logging
@@ -164,46 +170,547 @@ static bool should_log_item(unsigned short nameid, int amount, int refine)
 }
 
 
-/// logs items, that summon monsters
-void log_branch(struct map_session_data *sd)
+/// Tables or files written in batches, also the record types of binary logs
+enum e_log_batch {
+	LOG_BATCH_BRANCH  = BINLOG_BRANCH,
+	LOG_BATCH_PICK    = BINLOG_PICK,
+	LOG_BATCH_ZENY    = BINLOG_ZENY,
+	LOG_BATCH_MVPDROP = BINLOG_MVPDROP,
+	LOG_BATCH_GM      = BINLOG_GM,
+	LOG_BATCH_NPC     = BINLOG_NPC,
+	LOG_BATCH_CHAT    = BINLOG_CHAT,
+	LOG_BATCH_CASH    = BINLOG_CASH,
+	LOG_BATCH_FEEDING = BINLOG_FEEDING,
+	LOG_BATCH_MAX     = BINLOG_MAX
+};
+
+#define LOG_BATCH_MAXLEN (256*1024) // Flush a batch once its statement or text reaches this size
+
+/// Records waiting to be written to one log table or file
+static struct log_batch {
+	StringBuf buf; // VALUES tuples or text lines
+	int rows;
+	// since the previous report
+	uint64 queued, written, failed, dropped;
+	unsigned int batches;
+} log_batch[LOG_BATCH_MAX];
+
+/// Multi-row INSERT queued on the log worker, reaped once written
+struct log_flush {
+	SqlJob *job;
+	enum e_log_batch type;
+	int rows;
+	uint64 start; // gettick_usec() when queued
+	struct log_flush *next;
+};
+static struct log_flush *log_flush_head = NULL, *log_flush_tail = NULL;
+
+static int log_pending = 0; // Records buffered or queued and not written yet
+static bool log_dropping = false;
+static int log_flush_timer_id = INVALID_TIMER;
+
+/// Write times since the previous report
+static struct {
+	unsigned int waits; // Records that waited for the writer (backpressure)
+	uint64 wait_total; // Main thread time spent waiting (us)
+	uint64 write_total, write_max; // Time until a batch is written (us)
+	int pending_max;
+} log_stats;
+
+
+/// Returns the log table or file of a batch
+static const char *log_batch_target(enum e_log_batch type)
 {
-	nullpo_retv(sd);
+	switch( type ) {
+		case LOG_BATCH_BRANCH:  return log_config.log_branch;
+		case LOG_BATCH_PICK:    return log_config.log_pick;
+		case LOG_BATCH_ZENY:    return log_config.log_zeny;
+		case LOG_BATCH_MVPDROP: return log_config.log_mvpdrop;
+		case LOG_BATCH_GM:      return log_config.log_gm;
+		case LOG_BATCH_NPC:     return log_config.log_npc;
+		case LOG_BATCH_CHAT:    return log_config.log_chat;
+		case LOG_BATCH_CASH:    return log_config.log_cash;
+		case LOG_BATCH_FEEDING: return log_config.log_feeding;
+		default:                return "";
+	}
+}
 
-	if( !log_config.branch )
+
+/// Writes the INSERT statement head of a batch
+static void log_batch_header(StringBuf *buf, enum e_log_batch type)
+{
+	int i;
+
+	StringBuf_Printf(buf, LOG_QUERY " INTO `%s` ", log_batch_target(type));
+	switch( type ) {
+		case LOG_BATCH_BRANCH:
+			StringBuf_AppendStr(buf, "(`branch_date`, `account_id`, `char_id`, `char_name`, `map`)");
+			break;
+		case LOG_BATCH_PICK:
+			StringBuf_AppendStr(buf, "(`time`, `char_id`, `type`, `nameid`, `amount`, `refine`, `map`, `unique_id`, `bound`");
+			for( i = 0; i < MAX_SLOTS; ++i )
+				StringBuf_Printf(buf, ", `card%d`", i);
+			for( i = 0; i < MAX_ITEM_RDM_OPT; ++i )
+				StringBuf_Printf(buf, ", `option_id%d`, `option_val%d`, `option_parm%d`", i, i, i);
+			StringBuf_AppendStr(buf, ")");
+			break;
+		case LOG_BATCH_ZENY:
+			StringBuf_AppendStr(buf, "(`time`, `char_id`, `src_id`, `type`, `amount`, `map`)");
+			break;
+		case LOG_BATCH_MVPDROP:
+			StringBuf_AppendStr(buf, "(`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`)");
+			break;
+		case LOG_BATCH_GM:
+			StringBuf_AppendStr(buf, "(`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`)");
+			break;
+		case LOG_BATCH_NPC:
+			StringBuf_AppendStr(buf, "(`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`)");
+			break;
+		case LOG_BATCH_CHAT:
+			StringBuf_AppendStr(buf, "(`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`)");
+			break;
+		case LOG_BATCH_CASH:
+			StringBuf_AppendStr(buf, "(`time`, `char_id`, `type`, `cash_type`, `amount`, `map`)");
+			break;
+		case LOG_BATCH_FEEDING:
+			StringBuf_AppendStr(buf, "(`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`)");
+			break;
+		default:
+			break;
+	}
+	StringBuf_AppendStr(buf, " VALUES ");
+}
+
+
+/// Returns the current time as written in log records.
+/// Records are written after they happen, so the time is taken when they are logged
+/// instead of using NOW(). Formatted once per second.
+static const char *log_timestamp(void)
+{
+	static char sql_time[32], file_time[32];
+	static time_t last = 0;
+	time_t curtime = time(NULL);
+
+	if( curtime != last ) {
+		struct tm now;
+
+		localtime_r(&curtime, &now);
+		strftime(sql_time, sizeof(sql_time), "%Y-%m-%d %H:%M:%S", &now);
+		strftime(file_time, sizeof(file_time), "%m/%d/%Y %H:%M:%S", &now);
+		last = curtime;
+	}
+	return log_config.sql_logs ? sql_time : file_time;
+}
+
+
+/// Appends a quoted and escaped string to a batch
+static void log_escape(StringBuf *buf, const char *str, size_t max_len)
+{
+	char esc_str[CHAT_SIZE_MAX * 2 + 1];
+
+	Sql_EscapeStringLen(logmysql_handle, esc_str, str, safestrnlen(str, min(max_len, CHAT_SIZE_MAX)));
+	StringBuf_Printf(buf, "'%s'", esc_str);
+}
+
+
+/// Reaps the written batches, in the order they were queued
+static void log_flush_reap(void)
+{
+	while( log_flush_head && SqlJob_IsDone(log_flush_head->job) ) {
+		struct log_flush *flush = log_flush_head;
+		struct log_batch *batch = &log_batch[flush->type];
+		uint64 elapsed = gettick_usec() - flush->start;
+
+		if( SqlJob_GetResult(flush->job) != SQL_SUCCESS ) {
+			SqlJob_ShowDebug(flush->job);
+			ShowError("log_flush_reap: Failed to write %d records to '%s'.\n", flush->rows, log_batch_target(flush->type));
+			batch->failed += flush->rows;
+		} else
+			batch->written += flush->rows;
+		log_stats.write_total += elapsed;
+		log_stats.write_max = max(log_stats.write_max, elapsed);
+		log_pending -= flush->rows;
+
+		if( (log_flush_head = flush->next) == NULL )
+			log_flush_tail = NULL;
+		SqlJob_Free(flush->job);
+		aFree(flush);
+	}
+}
+
+
+/// Writes the records of a batch.
+/// SQL records are queued on the log worker as one multi-row INSERT, or written
+/// synchronously when there is no worker. File records are appended at once.
+static void log_batch_flush(enum e_log_batch type)
+{
+	struct log_batch *batch = &log_batch[type];
+	int rows = batch->rows;
+
+	if( rows == 0 )
 		return;
+	batch->rows = 0;
+	batch->batches++;
 
 	if( log_config.sql_logs ) {
-		SqlStmt *stmt;
-
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`branch_date`, `account_id`, `char_id`, `char_name`, `map`) VALUES (NOW(), '%d', '%d', ?, '%s')", log_config.log_branch, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
+		StringBuf query;
+		SqlJob *job = NULL;
+
+		StringBuf_Init(&query);
+		log_batch_header(&query, type);
+		StringBuf_Append(&query, &batch->buf);
+		StringBuf_Clear(&batch->buf);
+
+		if( logmysql_worker && (job = SqlJob_Query(logmysql_worker, StringBuf_Value(&query), 0)) != NULL ) {
+			struct log_flush *flush;
+
+			CREATE(flush, struct log_flush, 1);
+			flush->job = job;
+			flush->type = type;
+			flush->rows = rows;
+			flush->start = gettick_usec();
+			if( log_flush_tail )
+				log_flush_tail->next = flush;
+			else
+				log_flush_head = flush;
+			log_flush_tail = flush;
+		} else {
+			if( SQL_ERROR == Sql_QueryStr(logmysql_handle, StringBuf_Value(&query)) ) {
+				Sql_ShowDebug(logmysql_handle);
+				batch->failed += rows;
+			} else
+				batch->written += rows;
+			log_pending -= rows;
 		}
-		SqlStmt_Free(stmt);
+		StringBuf_Destroy(&query);
 	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
 		FILE *logfp;
 
-		if( (logfp = fopen(log_config.log_branch, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp,"%s - %s[%d:%d]\t%s\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex));
-		fclose(logfp);
+		if( (logfp = fopen(log_batch_target(type), "a")) == NULL )
+			batch->failed += rows;
+		else {
+			fwrite(StringBuf_Value(&batch->buf), 1, StringBuf_Length(&batch->buf), logfp);
+			fclose(logfp);
+			batch->written += rows;
+		}
+		StringBuf_Clear(&batch->buf);
+		log_pending -= rows;
+	}
+}
+
+
+/// Waits until the oldest queued batch is written
+static void log_flush_wait_one(void)
+{
+	if( log_flush_head ) {
+		SqlJob_Wait(log_flush_head->job);
+		log_flush_reap();
 	}
 }
 
+
+/// Starts a record of a batch.
+/// When log_max_pending records are waiting to be written, either waits for the writer or
+/// drops the record, depending on log_drop_on_overflow.
+/// @return Buffer to append the record to, or NULL if the record is dropped
+static StringBuf *log_batch_begin(enum e_log_batch type)
+{
+	struct log_batch *batch = &log_batch[type];
+
+	if( log_pending >= log_config.max_pending ) {
+		log_flush_reap();
+		if( log_pending >= log_config.max_pending && log_flush_head ) {
+			if( log_config.drop_overflow ) {
+				if( !log_dropping )
+					ShowWarning("log_batch_begin: %d log records are waiting to be written, dropping new records.\n", log_pending);
+				log_dropping = true;
+				batch->dropped++;
+				return NULL;
+			} else {
+				uint64 start = gettick_usec();
+
+				while( log_pending >= log_config.max_pending && log_flush_head )
+					log_flush_wait_one();
+				log_stats.waits++;
+				log_stats.wait_total += gettick_usec() - start;
+			}
+		}
+	}
+	if( log_dropping ) {
+		uint64 dropped = 0;
+		int i;
+
+		for( i = 0; i < LOG_BATCH_MAX; i++ )
+			dropped += log_batch[i].dropped;
+		ShowInfo("log_batch_begin: Logging resumed, %" PRIu64 " records dropped since the previous report.\n", dropped);
+		log_dropping = false;
+	}
+
+	if( batch->rows > 0 && log_config.sql_logs )
+		StringBuf_AppendStr(&batch->buf, ",");
+	return &batch->buf;
+}
+
+
+/// Ends a record started by log_batch_begin, flushing the batch once it is full
+static void log_batch_end(enum e_log_batch type)
+{
+	struct log_batch *batch = &log_batch[type];
+
+	batch->rows++;
+	batch->queued++;
+	log_pending++;
+	log_stats.pending_max = max(log_stats.pending_max, log_pending);
+	if( batch->rows >= log_config.batch_rows || StringBuf_Length(&batch->buf) >= LOG_BATCH_MAXLEN )
+		log_batch_flush(type);
+}
+
+
+#define LOG_BINARY_BLOCK (64*1024) // Flush the binary records once they reach this size
+
+/// Binary log segment being written
+static struct {
+	FILE *fp;
+	char path[256];
+	time_t created;
+	size_t size; // Bytes written to the segment
+	uint8 *buf; // Records of the next block
+	size_t len, max;
+	int rows[LOG_BATCH_MAX]; // Records in buf per type
+	bool failing; // An error was reported, the next ones are quiet until a block is written
+	// since the previous report
+	unsigned int segments;
+	uint64 raw, stored; // Bytes of records before and after compression
+} log_bin;
+
+
+/// Closes the current binary segment and starts a new one
+static void log_binary_open(void)
+{
+	uint8 header[BINLOG_HEADER_SIZE], *p = header;
+	char timestring[32];
+	struct tm now;
+	FILE *fp;
+	int i;
+
+	if( log_bin.fp ) {
+		fclose(log_bin.fp);
+		log_bin.fp = NULL;
+	}
+	log_bin.created = time(NULL);
+	localtime_r(&log_bin.created, &now);
+	strftime(timestring, sizeof(timestring), "%Y%m%d-%H%M%S", &now);
+	safesnprintf(log_bin.path, sizeof(log_bin.path), "%s/%s" BINLOG_EXT, log_config.binary_dir, timestring);
+	for( i = 1; (fp = fopen(log_bin.path, "rb")) != NULL; i++ ) { // Rotated twice in a second
+		fclose(fp);
+		safesnprintf(log_bin.path, sizeof(log_bin.path), "%s/%s_%d" BINLOG_EXT, log_config.binary_dir, timestring, i);
+	}
+	if( (log_bin.fp = fopen(log_bin.path, "wb")) == NULL ) {
+		if( !log_bin.failing )
+			ShowError("log_binary_open: Can't create the log segment '%s' (%s), binary records are dropped until it can.\n", log_bin.path, strerror(errno));
+		log_bin.failing = true;
+		return;
+	}
+
+	memcpy(p, BINLOG_MAGIC, 4);
+	p = binlog_put16(p + 4, BINLOG_VERSION);
+	p = binlog_put16(p, (log_config.binary_zlib ? BINLOG_ZLIB : 0));
+	p = binlog_put32(p, (uint32)log_bin.created);
+	binlog_put32(p, 0);
+	if( fwrite(header, 1, sizeof(header), log_bin.fp) != sizeof(header) ) {
+		if( !log_bin.failing )
+			ShowError("log_binary_open: Can't write to the log segment '%s' (%s), binary records are dropped until it can.\n", log_bin.path, strerror(errno));
+		log_bin.failing = true;
+		fclose(log_bin.fp);
+		log_bin.fp = NULL;
+		return;
+	}
+	log_bin.size = sizeof(header);
+	log_bin.segments++;
+}
+
+
+/// Appends the buffered binary records to the segment as one block,
+/// starting a new segment when the current one is too large or too old.
+static void log_binary_flush(void)
+{
+	uint8 header[BINLOG_BLOCK_SIZE], *block = log_bin.buf, *zbuf = NULL;
+	unsigned long stored = (unsigned long)log_bin.len;
+	int i, records = 0;
+	bool written = false;
+
+	if( log_bin.len == 0 )
+		return;
+
+	if( log_bin.fp == NULL || log_bin.size >= (size_t)log_config.binary_segment_size * 1024 * 1024
+	||  difftime(time(NULL), log_bin.created) >= log_config.binary_segment_time * 60 )
+		log_binary_open();
+
+	for( i = 0; i < LOG_BATCH_MAX; i++ )
+		records += log_bin.rows[i];
+
+	if( log_bin.fp && log_config.binary_zlib ) {
+		stored = compressBound((uLong)log_bin.len);
+		CREATE(zbuf, uint8, stored);
+		if( compress2(zbuf, &stored, log_bin.buf, (uLong)log_bin.len, Z_BEST_SPEED) != Z_OK ) {
+			ShowError("log_binary_flush: Failed to compress %d records.\n", records);
+			aFree(zbuf);
+			zbuf = NULL;
+		}
+		block = zbuf;
+	}
+
+	if( log_bin.fp && block ) {
+		binlog_put32(binlog_put32(binlog_put32(header, (uint32)stored), (uint32)log_bin.len), (uint32)records);
+		if( fwrite(header, 1, sizeof(header), log_bin.fp) != sizeof(header)
+		||  fwrite(block, 1, stored, log_bin.fp) != stored
+		||  fflush(log_bin.fp) != 0 ) {
+			if( !log_bin.failing )
+				ShowError("log_binary_flush: Failed to write %d records to the log segment '%s' (%s), binary records are dropped until a write succeeds.\n", records, log_bin.path, strerror(errno));
+			log_bin.failing = true;
+			//The block may be cut short, so it has to be the last one of its segment
+			fclose(log_bin.fp);
+			log_bin.fp = NULL;
+			if( log_bin.size == BINLOG_HEADER_SIZE ) //No block in it, don't leave an empty segment behind each retry
+				remove(log_bin.path);
+		} else
+			written = true;
+	}
+	if( written ) {
+		if( log_bin.failing )
+			ShowInfo("log_binary_flush: Writing binary records to '%s' again.\n", log_bin.path);
+		log_bin.failing = false;
+		log_bin.size += sizeof(header) + stored;
+		log_bin.raw += log_bin.len;
+		log_bin.stored += stored;
+		for( i = 0; i < LOG_BATCH_MAX; i++ )
+			log_batch[i].written += log_bin.rows[i];
+	} else {
+		for( i = 0; i < LOG_BATCH_MAX; i++ )
+			log_batch[i].failed += log_bin.rows[i];
+	}
+	for( i = 0; i < LOG_BATCH_MAX; i++ ) {
+		if( log_bin.rows[i] )
+			log_batch[i].batches++;
+		log_bin.rows[i] = 0;
+	}
+	log_bin.len = 0;
+	if( zbuf )
+		aFree(zbuf);
+}
+
+
+/// Starts a binary record.
+/// @return Position to write the fields of the record at, see e_binlog_type
+static uint8 *log_binary_begin(enum e_log_batch type)
+{
+	uint8 *p;
+
+	if( log_bin.len + BINLOG_RECORD_MAX > log_bin.max ) {
+		log_bin.max = max(log_bin.max * 2, LOG_BINARY_BLOCK + BINLOG_RECORD_MAX);
+		RECREATE(log_bin.buf, uint8, log_bin.max);
+	}
+	p = log_bin.buf + log_bin.len;
+	p = binlog_put16(p, 0); // Length, set by log_binary_end
+	p = binlog_put8(p, (uint8)type);
+	p = binlog_put8(p, 0);
+	return binlog_put32(p, (uint32)time(NULL));
+}
+
+
+/// Ends a binary record started by log_binary_begin
+/// @param end : Position after the last field
+static void log_binary_end(enum e_log_batch type, uint8 *end)
+{
+	uint8 *record = log_bin.buf + log_bin.len;
+
+	binlog_put16(record, (uint16)(end - record));
+	log_bin.len += end - record;
+	log_bin.rows[type]++;
+	log_batch[type].queued++;
+	if( log_bin.len >= LOG_BINARY_BLOCK )
+		log_binary_flush();
+}
+
+
+/// Writes every batch on an interval
+static TIMER_FUNC(log_flush_timer)
+{
+	int i;
+
+	log_flush_reap();
+	for( i = 0; i < LOG_BATCH_MAX; i++ )
+		log_batch_flush((enum e_log_batch)i);
+	log_binary_flush();
+	return 0;
+}
+
+
+/// Shows the records written since the previous report
+void log_report(void)
+{
+	int i;
+
+	if( log_config.binary_logs ) {
+		ShowInfo("Logging to binary segments: %u started since the previous report, current '%s' (%" PRIuPTR " KB), %" PRIuPTR " bytes buffered.\n", log_bin.segments, (log_bin.fp ? log_bin.path : "none"), log_bin.size / 1024, log_bin.len);
+		if( log_bin.raw )
+			ShowInfo("Records: %" PRIu64 " KB stored as %" PRIu64 " KB.\n", log_bin.raw / 1024, log_bin.stored / 1024);
+		log_bin.segments = 0;
+		log_bin.raw = log_bin.stored = 0;
+	} else
+		ShowInfo("Logging to %s: %d records waiting to be written, %s.\n", (log_config.sql_logs ? "tables" : "files"), log_pending, (log_flush_head ? "batches in progress" : "no batches in progress"));
+	ShowInfo("%-12s %10s %10s %8s %8s %8s\n", "target", "records", "written", "failed", "dropped", "batches");
+	for( i = 0; i < LOG_BATCH_MAX; i++ ) {
+		struct log_batch *batch = &log_batch[i];
+
+		if( batch->queued || batch->dropped || batch->written || batch->failed )
+			ShowInfo("%-12.12s %10" PRIu64 " %10" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8u\n", log_batch_target((enum e_log_batch)i), batch->queued, batch->written, batch->failed, batch->dropped, batch->batches);
+		batch->queued = batch->written = batch->failed = batch->dropped = 0;
+		batch->batches = 0;
+	}
+	ShowInfo("Most records waiting: %d. Waits for the writer: %u (%" PRIu64 " us).\n", log_stats.pending_max, log_stats.waits, log_stats.wait_total);
+	if( log_config.sql_logs && log_stats.write_max )
+		ShowInfo("Slowest batch confirmed written after %" PRIu64 " us.\n", log_stats.write_max);
+	memset(&log_stats, 0, sizeof(log_stats));
+}
+
+
+/// logs items, that summon monsters
+void log_branch(struct map_session_data *sd)
+{
+	StringBuf *buf;
+
+	nullpo_retv(sd);
+
+	if( !log_config.branch )
+		return;
+
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_BRANCH);
+
+		p = binlog_put32(p, sd->status.account_id);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_putstr(p, sd->status.name, NAME_LENGTH);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		log_binary_end(LOG_BATCH_BRANCH, p);
+		return;
+	}
+	if( (buf = log_batch_begin(LOG_BATCH_BRANCH)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		StringBuf_Printf(buf, "('%s', '%d', '%d', ", log_timestamp(), sd->status.account_id, sd->status.char_id);
+		log_escape(buf, sd->status.name, NAME_LENGTH);
+		StringBuf_Printf(buf, ", '%s')", mapindex_id2name(sd->mapindex));
+	} else
+		StringBuf_Printf(buf, "%s - %s[%d:%d]\t%s\n", log_timestamp(), sd->status.name, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex));
+	log_batch_end(LOG_BATCH_BRANCH);
+}
+
 /// logs item transactions (generic)
 void log_pick(int id, int16 m, e_log_pick_type type, int amount, struct item *itm)
 {
+	StringBuf *buf;
+
 	nullpo_retv(itm);
 
 	if( ( log_config.enable_logs&type ) == 0 ) { // disabled
@@ -213,48 +720,45 @@ void log_pick(int id, int16 m, e_log_pick_type type, int amount, struct item *it
 	if( !should_log_item(itm->nameid, amount, itm->refine) )
 		return; //we skip logging this item set - it doesn't meet our logging conditions [Lupus]
 
-	if( log_config.sql_logs ) {
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_PICK);
 		int i;
-		SqlStmt *stmt = SqlStmt_Malloc(logmysql_handle);
-		StringBuf buf;
-		StringBuf_Init(&buf);
-
-		StringBuf_Printf(&buf, "%s INTO `%s` (`time`, `char_id`, `type`, `nameid`, `amount`, `refine`, `map`, `unique_id`, `bound`", LOG_QUERY, log_config.log_pick);
-		for( i = 0; i < MAX_SLOTS; ++i )
-			StringBuf_Printf(&buf, ", `card%d`", i);
-		for( i = 0; i < MAX_ITEM_RDM_OPT; ++i ) {
-			StringBuf_Printf(&buf, ", `option_id%d`", i);
-			StringBuf_Printf(&buf, ", `option_val%d`", i);
-			StringBuf_Printf(&buf, ", `option_parm%d`", i);
+
+		p = binlog_put32(p, id);
+		p = binlog_put8(p, log_picktype2char(type));
+		p = binlog_put32(p, itm->nameid);
+		p = binlog_put32(p, amount);
+		p = binlog_put8(p, itm->refine);
+		p = binlog_putstr(p, mapdata[m].name, MAP_NAME_LENGTH_EXT);
+		p = binlog_put64(p, itm->unique_id);
+		p = binlog_put8(p, itm->bound);
+		p = binlog_put8(p, MAX_SLOTS);
+		for( i = 0; i < MAX_SLOTS; i++ )
+			p = binlog_put32(p, itm->card[i]);
+		p = binlog_put8(p, MAX_ITEM_RDM_OPT);
+		for( i = 0; i < MAX_ITEM_RDM_OPT; i++ ) {
+			p = binlog_put16(p, itm->option[i].id);
+			p = binlog_put16(p, itm->option[i].value);
+			p = binlog_put8(p, itm->option[i].param);
 		}
-		StringBuf_Printf(&buf, ") VALUES(NOW(), '%u', '%c', '%d', '%d', '%d', '%s', '%"PRIu64"', '%d'",
-			id, log_picktype2char(type), itm->nameid, amount, itm->refine, (mapdata[m].name[0] ? mapdata[m].name : ""), itm->unique_id, itm->bound);
+		log_binary_end(LOG_BATCH_PICK, p);
+		return;
+	}
+	if( (buf = log_batch_begin(LOG_BATCH_PICK)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		int i;
 
+		StringBuf_Printf(buf, "('%s', '%u', '%c', '%d', '%d', '%d', '%s', '%"PRIu64"', '%d'",
+			log_timestamp(), id, log_picktype2char(type), itm->nameid, amount, itm->refine, (mapdata[m].name[0] ? mapdata[m].name : ""), itm->unique_id, itm->bound);
 		for( i = 0; i < MAX_SLOTS; i++ )
-			StringBuf_Printf(&buf, ", '%d'", itm->card[i]);
+			StringBuf_Printf(buf, ", '%d'", itm->card[i]);
 		for( i = 0; i < MAX_ITEM_RDM_OPT; i++ )
-			StringBuf_Printf(&buf, ", '%d', '%d', '%d'", itm->option[i].id, itm->option[i].value, itm->option[i].param);
-		StringBuf_Printf(&buf, ")");
-
-		if( SQL_SUCCESS != SqlStmt_PrepareStr(stmt, StringBuf_Value(&buf)) || SQL_SUCCESS != SqlStmt_Execute(stmt) )
-			SqlStmt_ShowDebug(stmt);
-
-		SqlStmt_Free(stmt);
-		StringBuf_Destroy(&buf);
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
-
-		if( (logfp = fopen(log_config.log_pick, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp,"%s - %d\t%c\t%hu,%d,%d,%hu,%hu,%hu,%hu,%s,'%"PRIu64"',%d\n", timestring, id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], (mapdata[m].name[0] ? mapdata[m].name : ""), itm->unique_id, itm->bound);
-		fclose(logfp);
-	}
+			StringBuf_Printf(buf, ", '%d', '%d', '%d'", itm->option[i].id, itm->option[i].value, itm->option[i].param);
+		StringBuf_AppendStr(buf, ")");
+	} else
+		StringBuf_Printf(buf, "%s - %d\t%c\t%hu,%d,%d,%hu,%hu,%hu,%hu,%s,'%"PRIu64"',%d\n", log_timestamp(), id, log_picktype2char(type), itm->nameid, amount, itm->refine, itm->card[0], itm->card[1], itm->card[2], itm->card[3], (mapdata[m].name[0] ? mapdata[m].name : ""), itm->unique_id, itm->bound);
+	log_batch_end(LOG_BATCH_PICK);
 }
 
 /// logs item transactions (players)
@@ -275,252 +779,237 @@ void log_pick_mob(struct mob_data *md, e_log_pick_type type, int amount, struct
 /// logs zeny transactions
 void log_zeny(struct map_session_data *sd, e_log_pick_type type, struct map_session_data *src_sd, int amount)
 {
+	StringBuf *buf;
+
 	nullpo_retv(sd);
 
 	if( !log_config.zeny || ( log_config.zeny != 1 && abs(amount) < log_config.zeny ) )
 		return;
 
-	if( log_config.sql_logs ) {
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `src_id`, `type`, `amount`, `map`) VALUES (NOW(), '%d', '%d', '%c', '%d', '%s')",
-			log_config.log_zeny, sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_ZENY);
 
-		if( (logfp = fopen(log_config.log_zeny, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s[%d]\t%s[%d]\t%d\t\n", timestring, src_sd->status.name, src_sd->status.account_id, sd->status.name, sd->status.account_id, amount);
-		fclose(logfp);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_put32(p, src_sd->status.char_id);
+		p = binlog_put8(p, log_picktype2char(type));
+		p = binlog_put32(p, amount);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		log_binary_end(LOG_BATCH_ZENY, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_ZENY)) == NULL )
+		return;
+	if( log_config.sql_logs )
+		StringBuf_Printf(buf, "('%s', '%d', '%d', '%c', '%d', '%s')", log_timestamp(), sd->status.char_id, src_sd->status.char_id, log_picktype2char(type), amount, mapindex_id2name(sd->mapindex));
+	else
+		StringBuf_Printf(buf, "%s - %s[%d]\t%s[%d]\t%d\t\n", log_timestamp(), src_sd->status.name, src_sd->status.account_id, sd->status.name, sd->status.account_id, amount);
+	log_batch_end(LOG_BATCH_ZENY);
 }
 
 
 /// logs MVP monster rewards
 void log_mvpdrop(struct map_session_data *sd, int monster_id, unsigned int *log_mvp)
 {
+	StringBuf *buf;
+
 	nullpo_retv(sd);
 
 	if( !log_config.mvpdrop )
 		return;
 
-	if( log_config.sql_logs ) {
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`mvp_date`, `kill_char_id`, `monster_id`, `prize`, `mvpexp`, `map`) VALUES (NOW(), '%d', '%d', '%hu', '%d', '%s') ",
-			log_config.log_mvpdrop, sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_MVPDROP);
 
-		if( (logfp = fopen(log_config.log_mvpdrop,"a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp,"%s - %s[%d:%d]\t%d\t%hu,%u\n", timestring, sd->status.name, sd->status.account_id, sd->status.char_id, monster_id, log_mvp[0], log_mvp[1]);
-		fclose(logfp);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_put32(p, monster_id);
+		p = binlog_put32(p, log_mvp[0]);
+		p = binlog_put32(p, log_mvp[1]);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		log_binary_end(LOG_BATCH_MVPDROP, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_MVPDROP)) == NULL )
+		return;
+	if( log_config.sql_logs )
+		StringBuf_Printf(buf, "('%s', '%d', '%d', '%hu', '%d', '%s')", log_timestamp(), sd->status.char_id, monster_id, (unsigned short)log_mvp[0], log_mvp[1], mapindex_id2name(sd->mapindex));
+	else
+		StringBuf_Printf(buf, "%s - %s[%d:%d]\t%d\t%hu,%u\n", log_timestamp(), sd->status.name, sd->status.account_id, sd->status.char_id, monster_id, log_mvp[0], log_mvp[1]);
+	log_batch_end(LOG_BATCH_MVPDROP);
 }
 
 
 /// logs used atcommands
 void log_atcommand(struct map_session_data *sd, const char *message)
 {
+	StringBuf *buf;
+
 	nullpo_retv(sd);
 
 	if( !log_config.commands ||
 	    !pc_should_log_commands(sd) )
 		return;
 
-	if( log_config.sql_logs ) {
-		SqlStmt *stmt;
-
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`atcommand_date`, `account_id`, `char_id`, `char_name`, `map`, `command`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_gm, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char *)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_GM);
 
-		if( (logfp = fopen(log_config.log_gm, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
+		p = binlog_put32(p, sd->status.account_id);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_putstr(p, sd->status.name, NAME_LENGTH);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		p = binlog_putstr(p, message, 255);
+		log_binary_end(LOG_BATCH_GM, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_GM)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		StringBuf_Printf(buf, "('%s', '%d', '%d', ", log_timestamp(), sd->status.account_id, sd->status.char_id);
+		log_escape(buf, sd->status.name, NAME_LENGTH);
+		StringBuf_Printf(buf, ", '%s', ", mapindex_id2name(sd->mapindex));
+		log_escape(buf, message, 255);
+		StringBuf_AppendStr(buf, ")");
+	} else
+		StringBuf_Printf(buf, "%s - %s[%d]: %s\n", log_timestamp(), sd->status.name, sd->status.account_id, message);
+	log_batch_end(LOG_BATCH_GM);
 }
 
 
 /// logs messages passed to script command 'logmes'
 void log_npc(struct map_session_data *sd, const char *message)
 {
+	StringBuf *buf;
+
 	nullpo_retv(sd);
 
 	if( !log_config.npc )
 		return;
 
-	if( log_config.sql_logs ) {
-		SqlStmt *stmt;
-
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`npc_date`, `account_id`, `char_id`, `char_name`, `map`, `mes`) VALUES (NOW(), '%d', '%d', ?, '%s', ?)", log_config.log_npc, sd->status.account_id, sd->status.char_id, mapindex_id2name(sd->mapindex) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, sd->status.name, strnlen(sd->status.name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char *)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_NPC);
 
-		if( (logfp = fopen(log_config.log_npc, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s[%d]: %s\n", timestring, sd->status.name, sd->status.account_id, message);
-		fclose(logfp);
+		p = binlog_put32(p, sd->status.account_id);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_putstr(p, sd->status.name, NAME_LENGTH);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		p = binlog_putstr(p, message, 255);
+		log_binary_end(LOG_BATCH_NPC, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_NPC)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		StringBuf_Printf(buf, "('%s', '%d', '%d', ", log_timestamp(), sd->status.account_id, sd->status.char_id);
+		log_escape(buf, sd->status.name, NAME_LENGTH);
+		StringBuf_Printf(buf, ", '%s', ", mapindex_id2name(sd->mapindex));
+		log_escape(buf, message, 255);
+		StringBuf_AppendStr(buf, ")");
+	} else
+		StringBuf_Printf(buf, "%s - %s[%d]: %s\n", log_timestamp(), sd->status.name, sd->status.account_id, message);
+	log_batch_end(LOG_BATCH_NPC);
 }
 
 
 /// logs messages passed to script command 'logmes'
 void log_npc2(struct npc_data *nd, const char *message) {
+	StringBuf *buf;
+
 	nullpo_retv(nd);
 
 	if( !log_config.npc )
 		return;
 
-	if( log_config.sql_logs ) {
-		SqlStmt *stmt;
-
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`npc_date`, `char_name`, `map`, `mes`) VALUES (NOW(), ?, '%s', ?)", log_config.log_npc, map_mapid2mapname(nd->bl.m) )
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, nd->name, strnlen(nd->name, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char *)message, safestrnlen(message, 255))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_NPC);
 
-		if( (logfp = fopen(log_config.log_npc, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s: %s\n", timestring, nd->name, message);
-		fclose(logfp);
+		p = binlog_put32(p, 0);
+		p = binlog_put32(p, 0);
+		p = binlog_putstr(p, nd->name, NAME_LENGTH);
+		p = binlog_putstr(p, map_mapid2mapname(nd->bl.m), MAP_NAME_LENGTH_EXT);
+		p = binlog_putstr(p, message, 255);
+		log_binary_end(LOG_BATCH_NPC, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_NPC)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		StringBuf_Printf(buf, "('%s', '0', '0', ", log_timestamp());
+		log_escape(buf, nd->name, NAME_LENGTH);
+		StringBuf_Printf(buf, ", '%s', ", map_mapid2mapname(nd->bl.m));
+		log_escape(buf, message, 255);
+		StringBuf_AppendStr(buf, ")");
+	} else
+		StringBuf_Printf(buf, "%s - %s: %s\n", log_timestamp(), nd->name, message);
+	log_batch_end(LOG_BATCH_NPC);
 }
 
 
 /// logs chat
 void log_chat(e_log_chat_type type, int type_id, int src_charid, int src_accid, const char *mapname, int x, int y, const char *dst_charname, const char *message)
 {
+	StringBuf *buf;
+
 	if( !(log_config.chat&type) ) // Disabled
 		return;
 
 	if( log_config.log_chat_woe_disable && is_agit_start() ) // No chat logging during woe
 		return;
 
-	if( log_config.sql_logs ) {
-		SqlStmt *stmt;
-
-		stmt = SqlStmt_Malloc(logmysql_handle);
-		if( SQL_SUCCESS != SqlStmt_Prepare(stmt, LOG_QUERY " INTO `%s` (`time`, `type`, `type_id`, `src_charid`, `src_accountid`, `src_map`, `src_map_x`, `src_map_y`, `dst_charname`, `message`) VALUES (NOW(), '%c', '%d', '%d', '%d', '%s', '%d', '%d', ?, ?)", log_config.log_chat, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y)
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 0, SQLDT_STRING, (char *)dst_charname, safestrnlen(dst_charname, NAME_LENGTH))
-		||  SQL_SUCCESS != SqlStmt_BindParam(stmt, 1, SQLDT_STRING, (char *)message, safestrnlen(message, CHAT_SIZE_MAX))
-		||  SQL_SUCCESS != SqlStmt_Execute(stmt) )
-		{
-			SqlStmt_ShowDebug(stmt);
-			SqlStmt_Free(stmt);
-			return;
-		}
-		SqlStmt_Free(stmt);
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
-
-		if( (logfp = fopen(log_config.log_chat, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %c,%d,%d,%d,%s,%d,%d,%s,%s\n", timestring, log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message);
-		fclose(logfp);
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_CHAT);
+
+		p = binlog_put8(p, log_chattype2char(type));
+		p = binlog_put32(p, type_id);
+		p = binlog_put32(p, src_charid);
+		p = binlog_put32(p, src_accid);
+		p = binlog_putstr(p, mapname, MAP_NAME_LENGTH_EXT);
+		p = binlog_put16(p, x);
+		p = binlog_put16(p, y);
+		p = binlog_putstr(p, dst_charname, NAME_LENGTH);
+		p = binlog_putstr(p, message, CHAT_SIZE_MAX);
+		log_binary_end(LOG_BATCH_CHAT, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_CHAT)) == NULL )
+		return;
+	if( log_config.sql_logs ) {
+		StringBuf_Printf(buf, "('%s', '%c', '%d', '%d', '%d', '%s', '%d', '%d', ", log_timestamp(), log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y);
+		log_escape(buf, dst_charname, NAME_LENGTH);
+		StringBuf_AppendStr(buf, ", ");
+		log_escape(buf, message, CHAT_SIZE_MAX);
+		StringBuf_AppendStr(buf, ")");
+	} else
+		StringBuf_Printf(buf, "%s - %c,%d,%d,%d,%s,%d,%d,%s,%s\n", log_timestamp(), log_chattype2char(type), type_id, src_charid, src_accid, mapname, x, y, dst_charname, message);
+	log_batch_end(LOG_BATCH_CHAT);
 }
 
 
 /// logs cash transactions
 void log_cash(struct map_session_data *sd, e_log_pick_type type, e_log_cash_type cash_type, int amount) {
+	StringBuf *buf;
+
 	nullpo_retv(sd);
 
 	if( !log_config.cash )
 		return;
 
-	if( log_config.sql_logs ) {
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `type`, `cash_type`, `amount`, `map`) VALUES (NOW(), '%d', '%c', '%c', '%d', '%s')",
-			log_config.log_cash, sd->status.char_id, log_picktype2char(type), log_cashtype2char(cash_type), amount, mapindex_id2name(sd->mapindex)) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_CASH);
 
-		if( (logfp = fopen(log_config.log_cash, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s[%d]\t%d(%c)\t\n", timestring, sd->status.name, sd->status.account_id, amount, log_cashtype2char(cash_type));
-		fclose(logfp);
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_put8(p, log_picktype2char(type));
+		p = binlog_put8(p, log_cashtype2char(cash_type));
+		p = binlog_put32(p, amount);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		log_binary_end(LOG_BATCH_CASH, p);
+		return;
 	}
+	if( (buf = log_batch_begin(LOG_BATCH_CASH)) == NULL )
+		return;
+	if( log_config.sql_logs )
+		StringBuf_Printf(buf, "('%s', '%d', '%c', '%c', '%d', '%s')", log_timestamp(), sd->status.char_id, log_picktype2char(type), log_cashtype2char(cash_type), amount, mapindex_id2name(sd->mapindex));
+	else
+		StringBuf_Printf(buf, "%s - %s[%d]\t%d(%c)\t\n", log_timestamp(), sd->status.name, sd->status.account_id, amount, log_cashtype2char(cash_type));
+	log_batch_end(LOG_BATCH_CASH);
 }
 
 
@@ -533,6 +1022,7 @@ void log_cash(struct map_session_data *sd, e_log_pick_type type, e_log_cash_type
 void log_feeding(struct map_session_data *sd, e_log_feeding_type type, unsigned short nameid) {
 	unsigned int target_id = 0, intimacy = 0;
 	unsigned short target_class = 0;
+	StringBuf *buf;
 
 	nullpo_retv(sd);
 
@@ -555,26 +1045,70 @@ void log_feeding(struct map_session_data *sd, e_log_feeding_type type, unsigned
 			}
 			break;
 	}
-	if( log_config.sql_logs ) {
-		if( SQL_ERROR == Sql_Query(logmysql_handle, LOG_QUERY " INTO `%s` (`time`, `char_id`, `target_id`, `target_class`, `type`, `intimacy`, `item_id`, `map`, `x`, `y`) VALUES ( NOW(), '%"PRIu32"', '%"PRIu32"', '%hu', '%c', '%"PRIu32"', '%hu', '%s', '%hu', '%hu' )",
-			log_config.log_feeding, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y) )
-		{
-			Sql_ShowDebug(logmysql_handle);
-			return;
-		}
-	} else {
-		char timestring[255];
-		time_t curtime;
-		struct tm now;
-		FILE *logfp;
+	if( log_config.binary_logs ) {
+		uint8 *p = log_binary_begin(LOG_BATCH_FEEDING);
+
+		p = binlog_put32(p, sd->status.char_id);
+		p = binlog_put32(p, target_id);
+		p = binlog_put16(p, target_class);
+		p = binlog_put8(p, log_feedingtype2char(type));
+		p = binlog_put32(p, intimacy);
+		p = binlog_put32(p, nameid);
+		p = binlog_putstr(p, mapindex_id2name(sd->mapindex), MAP_NAME_LENGTH_EXT);
+		p = binlog_put16(p, sd->bl.x);
+		p = binlog_put16(p, sd->bl.y);
+		log_binary_end(LOG_BATCH_FEEDING, p);
+		return;
+	}
+	if( (buf = log_batch_begin(LOG_BATCH_FEEDING)) == NULL )
+		return;
+	if( log_config.sql_logs )
+		StringBuf_Printf(buf, "('%s', '%"PRIu32"', '%"PRIu32"', '%hu', '%c', '%"PRIu32"', '%hu', '%s', '%hu', '%hu')",
+			log_timestamp(), sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y);
+	else
+		StringBuf_Printf(buf, "%s - %s[%d]\t%d\t%d(%c)\t%d\t%hu\t%s\t%hu,%hu\n", log_timestamp(), sd->status.name, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y);
+	log_batch_end(LOG_BATCH_FEEDING);
+}
 
-		if( (logfp = fopen(log_config.log_feeding, "a")) == NULL )
-			return;
-		curtime = time(NULL);
-		localtime_r(&curtime, &now);
-		strftime(timestring, sizeof(timestring), "%m/%d/%Y %H:%M:%S", &now);
-		fprintf(logfp, "%s - %s[%d]\t%d\t%d(%c)\t%d\t%hu\t%s\t%hu,%hu\n", timestring, sd->status.name, sd->status.char_id, target_id, target_class, log_feedingtype2char(type), intimacy, nameid, mapindex_id2name(sd->mapindex), sd->bl.x, sd->bl.y);
-		fclose(logfp);
+
+/// Starts the batched writer
+void do_init_log(void)
+{
+	int i;
+
+	for( i = 0; i < LOG_BATCH_MAX; i++ )
+		StringBuf_Init(&log_batch[i].buf);
+	add_timer_func_list(log_flush_timer, "log_flush_timer");
+	log_flush_timer_id = add_timer_interval(gettick() + log_config.batch_interval, log_flush_timer, 0, 0, log_config.batch_interval);
+}
+
+
+/// Writes the remaining records and waits until they are written
+void do_final_log(void)
+{
+	int i;
+
+	if( log_flush_timer_id != INVALID_TIMER ) {
+		delete_timer(log_flush_timer_id, log_flush_timer);
+		log_flush_timer_id = INVALID_TIMER;
+	}
+	for( i = 0; i < LOG_BATCH_MAX; i++ )
+		log_batch_flush((enum e_log_batch)i);
+	if( log_flush_tail ) {
+		SqlJob_Wait(log_flush_tail->job);
+		log_flush_reap();
+	}
+	for( i = 0; i < LOG_BATCH_MAX; i++ )
+		StringBuf_Destroy(&log_batch[i].buf);
+
+	log_binary_flush();
+	if( log_bin.fp ) {
+		fclose(log_bin.fp);
+		log_bin.fp = NULL;
+	}
+	if( log_bin.buf ) {
+		aFree(log_bin.buf);
+		log_bin.buf = NULL;
 	}
 }
 
@@ -588,6 +1122,14 @@ void log_set_defaults(void)
 	log_config.rare_items_log   = 100;  // log rare items. drop chance <= 1%
 	log_config.price_items_log  = 1000; // 1000z
 	log_config.amount_items_log = 100;
+
+	log_config.batch_rows = 200;
+	log_config.batch_interval = 1000;
+	log_config.max_pending = 20000;
+
+	safestrncpy(log_config.binary_dir, "log/binary", sizeof(log_config.binary_dir));
+	log_config.binary_segment_size = 64;
+	log_config.binary_segment_time = 60;
 }
 
 
@@ -662,6 +1204,24 @@ int log_config_read(const char *cfgName)
 				safestrncpy(log_config.log_cash, w2, sizeof(log_config.log_cash));
 			else if( strcmpi(w1, "log_feeding_db") == 0 )
 				safestrncpy(log_config.log_feeding, w2, sizeof(log_config.log_feeding));
+			else if( strcmpi(w1, "log_batch_rows") == 0 )
+				log_config.batch_rows = cap_value(atoi(w2), 1, 5000);
+			else if( strcmpi(w1, "log_batch_interval") == 0 )
+				log_config.batch_interval = max(atoi(w2), 50);
+			else if( strcmpi(w1, "log_max_pending") == 0 )
+				log_config.max_pending = max(atoi(w2), 1);
+			else if( strcmpi(w1, "log_drop_on_overflow") == 0 )
+				log_config.drop_overflow = (bool)config_switch(w2);
+			else if( strcmpi(w1, "log_binary") == 0 )
+				log_config.binary_logs = (bool)config_switch(w2);
+			else if( strcmpi(w1, "log_binary_dir") == 0 )
+				safestrncpy(log_config.binary_dir, w2, sizeof(log_config.binary_dir));
+			else if( strcmpi(w1, "log_binary_segment_size") == 0 )
+				log_config.binary_segment_size = max(atoi(w2), 1);
+			else if( strcmpi(w1, "log_binary_segment_time") == 0 )
+				log_config.binary_segment_time = max(atoi(w2), 1);
+			else if( strcmpi(w1, "log_binary_zlib") == 0 )
+				log_config.binary_zlib = (bool)config_switch(w2);
 			//Support the import command, just like any other config
 			else if( strcmpi(w1,"import") == 0 )
 				log_config_read(w2);
@@ -673,7 +1233,7 @@ int log_config_read(const char *cfgName)
 	fclose(fp);
 
 	if( --count == 0 ) { // report final logging state
-		const char *target = log_config.sql_logs ? "table" : "file";
+		const char *target = log_config.binary_logs ? "binary record" : log_config.sql_logs ? "table" : "file";
 
 		if( log_config.enable_logs && log_config.filter ) {
 			ShowInfo("Logging item transactions to %s '%s'.\n", target, log_config.log_pick);
@@ -702,6 +1262,9 @@ int log_config_read(const char *cfgName)
 		if( log_config.feeding ) {
 			ShowInfo("Logging Feeding items to %s '%s'.\n", target, log_config.log_feeding);
 		}
+		if( log_config.binary_logs ) {
+			ShowInfo("Writing the log records to binary segments in '%s'%s.\n", log_config.binary_dir, (log_config.binary_zlib ? ", compressed" : ""));
+		}
 	}
 
 	return 0;
@@ -85,6 +85,9 @@ void log_branch(struct map_session_data *sd);
 void log_mvpdrop(struct map_session_data *sd, int monster_id, unsigned int *log_mvp);
 
 int log_config_read(const char *cfgName);
+void log_report(void);
+void do_init_log(void);
+void do_final_log(void);
 
 extern struct Log_Config {
 	e_log_pick_type enable_logs;
@@ -95,6 +98,11 @@ extern struct Log_Config {
 	int rare_items_log,refine_items_log,price_items_log,amount_items_log; //For filter
 	int branch, mvpdrop, zeny, commands, npc, chat;
 	unsigned feeding : 2;
+	int batch_rows, batch_interval, max_pending; // Batched writes
+	bool drop_overflow;
+	bool binary_logs, binary_zlib; // Binary segments, see binlog.h
+	int binary_segment_size, binary_segment_time; // MB, minutes
+	char binary_dir[256];
 	char log_branch[64], log_pick[64], log_zeny[64], log_mvpdrop[64], log_gm[64], log_npc[64], log_chat[64], log_cash[64], log_feeding[64];
 } log_config;
 
@@ -72,6 +72,9 @@ char map_server_pw[32] = "";
 char map_server_db[32] = "ragnarok";
 Sql *mmysql_handle;
 Sql *qsmysql_handle; // For query_sql
+SqlWorker *qsmysql_worker; // Ordered background queries (mapreg flushes)
+SqlWorker *qsmysql_pool; // For query_sql_async
+int query_sql_async_threads = 2;
 
 int db_use_sqldbs = 0;
 char buyingstores_db[32] = "buyingstores";
@@ -97,6 +100,7 @@ char log_db_id[32] = "ragnarok";
 char log_db_pw[32] = "ragnarok";
 char log_db_db[32] = "log";
 Sql *logmysql_handle;
+SqlWorker *logmysql_worker; // For query_logsql_async
 
 // DBMap declaration
 static DBMap *id_db = NULL; // int id -> struct block_list*
@@ -106,7 +110,8 @@ static DBMap *bossid_db = NULL; // int id -> struct mob_data* (MVP db)
 static DBMap *map_db = NULL; // unsigned int mapindex -> struct map_data*
 static DBMap *nick_db = NULL; // int char_id -> struct charid2nick* (requested names of offline characters)
 static DBMap *charid_db = NULL; // int char_id -> struct map_session_data*
-static DBMap *regen_db = NULL; // int id -> struct block_list* (status_natural_heal processing)
+static DBMap *regen_db = NULL; // int id -> struct block_list* (all units that can regenerate)
+static DBMap *regen_active_db = NULL; // int id -> struct block_list* (status_natural_heal processing, units with something left to regenerate)
 static DBMap *map_msg_db = NULL;
 
 static int map_users = 0;
@@ -128,6 +133,7 @@ int map_port = 0;
 
 int autosave_interval = DEFAULT_AUTOSAVE_INTERVAL;
 int minsave_interval = 100;
+int autosave_rate = 0;
 int16 save_settings = CHARSAVE_ALL;
 bool agit_flag = false;
 bool agit2_flag = false;
@@ -285,6 +291,57 @@ static void map_delblcell(struct block_list *bl)
 }
 #endif
 
+/*==========================================
+ * Skill unit occupancy index, kept per cell so that
+ * movement can skip cells without any skill unit in O(1).
+ *------------------------------------------*/
+static void map_addskillunitcell(struct block_list *bl)
+{
+	struct map_data *mapd;
+
+	if( bl->type != BL_SKILL || bl->m < 0 )
+		return;
+	mapd = &mapdata[bl->m];
+	if( bl->x < 0 || bl->x >= mapd->xs || bl->y < 0 || bl->y >= mapd->ys )
+		return;
+	if( mapd->skillunit_cell == NULL )
+		CREATE(mapd->skillunit_cell, unsigned short, (size_t)mapd->xs * mapd->ys);
+	mapd->skillunit_cell[bl->x + bl->y * mapd->xs]++;
+	mapd->skillunit_count++;
+}
+
+static void map_delskillunitcell(struct block_list *bl)
+{
+	struct map_data *mapd;
+	int pos;
+
+	if( bl->type != BL_SKILL || bl->m < 0 )
+		return;
+	mapd = &mapdata[bl->m];
+	if( mapd->skillunit_cell == NULL || bl->x < 0 || bl->x >= mapd->xs || bl->y < 0 || bl->y >= mapd->ys )
+		return;
+	pos = bl->x + bl->y * mapd->xs;
+	if( mapd->skillunit_cell[pos] ) {
+		mapd->skillunit_cell[pos]--;
+		mapd->skillunit_count--;
+	}
+}
+
+/*==========================================
+ * Returns true if at least one skill unit lies on the given cell.
+ *------------------------------------------*/
+bool map_skillunit_incell(int16 m, int16 x, int16 y)
+{
+	struct map_data *mapd;
+
+	if( m < 0 || m >= map_num )
+		return false;
+	mapd = &mapdata[m];
+	if( !mapd->skillunit_count || x < 0 || x >= mapd->xs || y < 0 || y >= mapd->ys )
+		return false;
+	return (mapd->skillunit_cell[x + y * mapd->xs] > 0);
+}
+
 /*==========================================
  * Adds a block to the map.
  * Returns 0 on success, 1 on failure (illegal coordinates).
@@ -332,6 +389,7 @@ int map_addblock(struct block_list *bl)
 #ifdef CELL_NOSTACK
 	map_addblcell(bl);
 #endif
+	map_addskillunitcell(bl);
 
 	return 0;
 }
@@ -354,6 +412,7 @@ int map_delblock(struct block_list *bl)
 #ifdef CELL_NOSTACK
 	map_delblcell(bl);
 #endif
+	map_delskillunitcell(bl);
 
 	pos = bl->x / BLOCK_SIZE + (bl->y / BLOCK_SIZE) * mapdata[bl->m].bxs;
 
@@ -422,10 +481,12 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 
 	if (moveblock)
 		map_delblock(bl);
+	else {
 #ifdef CELL_NOSTACK
-	else
 		map_delblcell(bl);
 #endif
+		map_delskillunitcell(bl);
+	}
 
 	bl->x = x1;
 	bl->y = y1;
@@ -433,11 +494,12 @@ int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick)
 	if (moveblock) {
 		if (map_addblock(bl))
 			return 1;
-	}
+	} else {
 #ifdef CELL_NOSTACK
-	else
 		map_addblcell(bl);
 #endif
+		map_addskillunitcell(bl);
+	}
 
 	if (bl->type&BL_CHAR) {
 		skill_unit_move(bl, tick, 3);
@@ -1084,6 +1146,9 @@ int map_foreachincell(int (*func)(struct block_list *, va_list), int16 m, int16
 	if( x < 0 || y < 0 || x >= mapdata[m].xs || y >= mapdata[m].ys )
 		return 0;
 
+	if( type == BL_SKILL && !map_skillunit_incell(m, x, y) )
+		return 0; //No skill unit on this cell, skip the block scan
+
 	by = y / BLOCK_SIZE;
 	bx = x / BLOCK_SIZE;
 
@@ -1913,6 +1978,7 @@ void map_addiddb(struct block_list *bl)
 
 		idb_put(pc_db, sd->bl.id, sd);
 		idb_put(charid_db, sd->status.char_id, sd);
+		clif_updatestatus_flush(sd); //Updates coalesced during the login, the presend couldn't find the player
 	} else if( bl->type == BL_MOB ) {
 		TBL_MOB *md = (TBL_MOB *)bl;
 
@@ -1921,8 +1987,10 @@ void map_addiddb(struct block_list *bl)
 			idb_put(bossid_db, bl->id, bl);
 	}
 
-	if( bl->type&BL_REGEN )
+	if( bl->type&BL_REGEN ) {
 		idb_put(regen_db, bl->id, bl);
+		idb_put(regen_active_db, bl->id, bl);
+	}
 
 	idb_put(id_db, bl->id, bl);
 }
@@ -1944,8 +2012,10 @@ void map_deliddb(struct block_list *bl)
 		idb_remove(bossid_db, bl->id);
 	}
 
-	if( bl->type&BL_REGEN )
+	if( bl->type&BL_REGEN ) {
 		idb_remove(regen_db, bl->id);
+		idb_remove(regen_active_db, bl->id);
+	}
 
 	idb_remove(id_db, bl->id);
 }
@@ -2303,14 +2373,30 @@ void map_foreachnpc(int (*func)(struct npc_data *nd, va_list args), ...)
 	dbi_destroy(iter);
 }
 
-/// Applies func to everything in the db.
+/// Puts a unit back into natural regen processing.
+/// Called whenever its HP/SP drops or its regen rates are recalculated.
+void map_regen_enroll(struct block_list *bl)
+{
+	if( bl == NULL || !(bl->type&BL_REGEN) || !idb_exists(regen_db, bl->id) )
+		return; //Not (or no longer) in the id db
+	idb_put(regen_active_db, bl->id, bl);
+}
+
+/// Takes a unit out of natural regen processing until it is enrolled again.
+void map_regen_dismiss(struct block_list *bl)
+{
+	nullpo_retv(bl);
+	idb_remove(regen_active_db, bl->id);
+}
+
+/// Applies func to every unit enrolled for natural regen.
 /// Stops iterating if func returns -1.
 void map_foreachregen(int (*func)(struct block_list *bl, va_list args), ...)
 {
 	DBIterator *iter;
 	struct block_list *bl;
 
-	iter = db_iterator(regen_db);
+	iter = db_iterator(regen_active_db);
 	for( bl = (struct block_list *)dbi_first(iter); dbi_exists(iter); bl = (struct block_list *)dbi_next(iter) )
 	{
 		va_list args;
@@ -2572,6 +2658,8 @@ int map_addinstancemap(const char *name, int id)
 	num_cell = (size_t)mapdata[dst_m].xs * mapdata[dst_m].ys;
 	CREATE(mapdata[dst_m].cell, struct mapcell, num_cell);
 	memcpy(mapdata[dst_m].cell, mapdata[src_m].cell, num_cell * sizeof(struct mapcell));
+	mapdata[dst_m].skillunit_cell = NULL;
+	mapdata[dst_m].skillunit_count = 0;
 
 	size = (size_t)(mapdata[dst_m].bxs * mapdata[dst_m].bys) * sizeof(struct block_list *);
 	mapdata[dst_m].block = (struct block_list **)aCalloc(1,size);
@@ -2649,6 +2737,8 @@ int map_delinstancemap(int m)
 	aFree(mapdata[m].cell);
 	aFree(mapdata[m].block);
 	aFree(mapdata[m].block_mob);
+	if(mapdata[m].skillunit_cell)
+		aFree(mapdata[m].skillunit_cell);
 	map_free_questinfo(m);
 
 	mapindex_removemap(mapdata[m].index);
@@ -3453,6 +3543,9 @@ void do_final_maps(void) {
 		if( mapdata[i].block_mob )
 			aFree(mapdata[i].block_mob);
 
+		if( mapdata[i].skillunit_cell )
+			aFree(mapdata[i].skillunit_cell);
+
 		if( battle_config.dynamic_mobs ) { //Dynamic mobs flag by [random]
 			int j;
 
@@ -3722,6 +3815,95 @@ int map_readallmaps (void)
 	return 0;
 }
 
+/*==========================================
+ * Walk step benchmark [console: bench:walk]
+ * Moves a monster 'count' cells back and forth along a row of the first map,
+ * once with no skill unit on the map and once with 'units' skill units on
+ * the cells next to its path, and reports the steps per second of both runs.
+ * Each step goes through map_moveblock and its skill_unit_move checks.
+ *------------------------------------------*/
+#define MAP_BENCH_WALK_RUN 16
+static void map_bench_walk(int count, int units)
+{
+	struct spawn_data data;
+	struct mob_data *md;
+	struct skill_unit_group *group = NULL;
+	int16 m = 0, x0 = -1, y0 = -1, x, y;
+	int i, pass;
+
+	if( count <= 0 || map_num <= 0 )
+		return;
+
+	//Row with MAP_BENCH_WALK_RUN walkable cells in a row
+	for( y = 1; y < mapdata[m].ys - 1 && x0 < 0; y++ ) {
+		int run = 0;
+
+		for( x = 0; x < mapdata[m].xs; x++ ) {
+			run = (map_getcell(m, x, y, CELL_CHKPASS) ? run + 1 : 0);
+			if( run == MAP_BENCH_WALK_RUN ) {
+				x0 = x - MAP_BENCH_WALK_RUN + 1;
+				y0 = y;
+				break;
+			}
+		}
+	}
+	if( x0 < 0 || !mobdb_checkid(1002) ) {
+		ShowError("map_bench_walk: No walkable row of %d cells on map '%s', or no monster 1002 in mob_db.\n", MAP_BENCH_WALK_RUN, mapdata[m].name);
+		return;
+	}
+
+	memset(&data, 0, sizeof(data));
+	data.m = m;
+	data.x = x0;
+	data.y = y0;
+	data.num = 1;
+	data.id = 1002;
+	safestrncpy(data.name, mob_db(data.id)->name, sizeof(data.name));
+	md = mob_spawn_dataset(&data);
+	status_calc_mob(md, SCO_FIRST);
+	map_addiddb(&md->bl); //Skill unit groups look up their source
+	map_addblock(&md->bl);
+
+	for( pass = 0; pass < 2; pass++ ) {
+		unsigned int tick;
+		int elapsed;
+
+		if( pass == 1 ) {
+			if( units <= 0 )
+				break;
+			if( (group = skill_initunitgroup(&md->bl, units, HT_SKIDTRAP, 1, skill_get_unit_id(HT_SKIDTRAP, 0), 600000, 1000)) == NULL )
+				break;
+			group->target_flag = skill_get_unit_target(HT_SKIDTRAP);
+			group->bl_flag = skill_get_unit_bl_target(HT_SKIDTRAP);
+			memset(&group->state, 0, sizeof(group->state));
+			group->item_id = 0;
+			//Stacked on the rows above and below the path, in the blocks it walks through
+			for( i = 0; i < units; i++ ) {
+				int dy = 1 + (i / MAP_BENCH_WALK_RUN) % 4;
+
+				x = x0 + i % MAP_BENCH_WALK_RUN;
+				y = cap_value(y0 + ((i / (MAP_BENCH_WALK_RUN * 4)) % 2 ? -dy : dy), 0, mapdata[m].ys - 1);
+				skill_initunit(group, i, x, y, 0, 0, 0, 0, false);
+			}
+		}
+
+		tick = gettick_nocache();
+		for( i = 0; i < count; i++ ) {
+			int step = i % (2 * (MAP_BENCH_WALK_RUN - 1));
+
+			x = x0 + (step < MAP_BENCH_WALK_RUN - 1 ? step + 1 : 2 * (MAP_BENCH_WALK_RUN - 1) - step - 1);
+			map_moveblock(&md->bl, x, y0, tick);
+		}
+		elapsed = DIFF_TICK(gettick_nocache(), tick);
+		ShowInfo("map_bench_walk: %d steps with %d skill units on the map in %d ms (%.0f steps/sec).\n",
+			count, mapdata[m].skillunit_count, elapsed, (elapsed > 0 ? count * 1000. / elapsed : 0.));
+	}
+
+	if( group )
+		skill_delunitgroup(group);
+	unit_free(&md->bl, CLR_OUTSIGHT);
+}
+
 ////////////////////////////////////////////////////////////////////////
 static int map_ip_set = 0;
 static int char_ip_set = 0;
@@ -3782,12 +3964,77 @@ int parse_console(const char *buf) {
 		}
 	} else if( strcmpi("ers_report", type) == 0 ) {
 		ers_report();
+	} else if( strcmpi("charsave_report", type) == 0 ) {
+		chrif_save_report();
+	} else if( strcmpi("reg_report", type) == 0 ) {
+		pc_reg_report();
+	} else if( strcmpi("autosave_report", type) == 0 ) {
+		pc_autosave_report();
+	} else if( strcmpi("mapreg_report", type) == 0 ) {
+		mapreg_report();
+	} else if( strcmpi("sql_report", type) == 0 ) {
+		Sql_Report(n == 2 ? atoi(command) : 0);
+	} else if( strcmpi("log_report", type) == 0 ) {
+		log_report();
+	} else if( n == 2 && strcmpi("bench", type) == 0 ) {
+		int count = 0, threads = 4, units = 2000;
+		unsigned int seed = 0, expected = 0, latency = 0;
+
+		if( sscanf(command, "battle %11d %10u %8x", &count, &seed, &expected) >= 1 && count > 0 )
+			battle_bench(count, (uint32)seed, (uint32)expected);
+		else if( sscanf(command, "walk %11d %11d", &count, &units) >= 1 && count > 0 )
+			map_bench_walk(count, units);
+		else if( sscanf(command, "skill %11d %10u", &count, &seed) >= 1 && count > 0 )
+			skill_bench(count, (uint32)seed);
+		else if( sscanf(command, "script %11d", &count) == 1 && count > 0 )
+			script_bench(count);
+		else if( sscanf(command, "query_sql %11d", &count) == 1 && count > 0 )
+			script_bench_sql(count, (stristr(command, "async") != NULL));
+		else if( sscanf(command, "sqlasync %11d %11d %10u", &count, &threads, &latency) >= 1 && count > 0 )
+			SqlWorker_Bench(count, max(threads, 1), latency);
+		else
+			ShowInfo("Usage: bench:battle <count> [<seed> [<expected checksum>]] | bench:walk <count> [<units>] | bench:skill <count> [<seed>] | bench:script <count> | bench:query_sql <count> [async] | bench:sqlasync <count> [<threads> [<latency>]]\n");
+	} else if( n == 2 && strcmpi("script_prof", type) == 0 ) {
+		int value = 0;
+
+		if( strcmpi("start", command) == 0 )
+			script_prof_start(SCRIPT_PROF_ALL, 1);
+		else if( sscanf(command, "start sample %11d", &value) == 1 && value > 0 )
+			script_prof_start(SCRIPT_PROF_SAMPLE, value);
+		else if( strcmpi("stop", command) == 0 )
+			script_prof_stop();
+		else if( strncmpi("report", command, 6) == 0 )
+			script_prof_report((sscanf(command, "report %11d", &value) == 1 && value > 0) ? value : 20);
+		else
+			ShowInfo("Usage: script_prof:start [sample <rate>] | script_prof:stop | script_prof:report [<top>]\n");
+	} else if( strcmpi("script_timeslice", type) == 0 ) {
+		int budget;
+
+		if( n == 2 && sscanf(command, "%11d", &budget) == 1 )
+			script_timeslice_set(budget);
+		script_timeslice_report();
 	} else if( strcmpi("help", type) == 0 ) {
 		ShowInfo("Available commands:\n");
 		ShowInfo("\t admin:@<atcommand> => Uses an atcommand. Do NOT use commands requiring an attached player.\n");
 		ShowInfo("\t admin:map:<map> <x> <y> => Changes the map from which console commands are executed.\n");
 		ShowInfo("\t server:shutdown => Stops the server.\n");
 		ShowInfo("\t ers_report => Displays database usage.\n");
+		ShowInfo("\t charsave_report => Displays the character saves and char link bandwidth since the previous report.\n");
+		ShowInfo("\t reg_report => Displays the variables written by the registry saves.\n");
+		ShowInfo("\t autosave_report => Displays the autosave queue and the autosaves since the previous report.\n");
+		ShowInfo("\t mapreg_report => Displays the saves of the permanent global variables since the previous report.\n");
+		ShowInfo("\t sql_report[:<top>] => Displays the slowest query templates and the statement cache since the previous report.\n");
+		ShowInfo("\t log_report => Displays the log records written, failed and dropped since the previous report.\n");
+		ShowInfo("\t bench:battle <count> [<seed> [<checksum>]] => Runs the deterministic damage calculation benchmark.\n");
+		ShowInfo("\t bench:walk <count> [<units>] => Times <count> walk steps without and with <units> (default 2000) skill units around the path.\n");
+		ShowInfo("\t bench:skill <count> [<seed>] => Times <count> random cast path skill_db lookups, packed and unpacked.\n");
+		ShowInfo("\t bench:script <count> => Runs the script interpreter benchmark.\n");
+		ShowInfo("\t bench:query_sql <count> [async] => Runs <count> ranking queries and reports the main loop stall.\n");
+		ShowInfo("\t bench:sqlasync <count> [<threads> [<latency>]] => Runs <count> jobs on a stub query pool (no database) and reports when their callbacks ran.\n");
+		ShowInfo("\t script_prof:start [sample <rate>] => Starts the script profiler, measuring every run or 1 of <rate> runs.\n");
+		ShowInfo("\t script_prof:stop => Stops the script profiler, the data is kept.\n");
+		ShowInfo("\t script_prof:report [<top>] => Shows the NPCs, labels and commands using the most time.\n");
+		ShowInfo("\t script_timeslice[:<budget>] => Shows the script time slicing counters, or changes the instruction budget (0 disables).\n");
 	}
 
 	return 0;
@@ -3864,6 +4111,10 @@ int map_config_read(char *cfgName)
 			minsave_interval= atoi(w2);
 			if (minsave_interval < 1)
 				minsave_interval = 1;
+		} else if (strcmpi(w1, "autosave_rate") == 0) {
+			autosave_rate = atoi(w2);
+			if (autosave_rate < 0)
+				autosave_rate = 0;
 		} else if (strcmpi(w1, "save_settings") == 0)
 			save_settings = atoi(w2);
 		else if (strcmpi(w1, "motd_txt") == 0)
@@ -4009,6 +4260,8 @@ int inter_config_read(char *cfgName)
 			safestrncpy(map_server_pw, w2, sizeof(map_server_pw));
 		else if( strcmpi(w1, "map_server_db") == 0 )
 			safestrncpy(map_server_db, w2, sizeof(map_server_db));
+		else if( strcmpi(w1, "query_sql_async_threads") == 0 )
+			query_sql_async_threads = atoi(w2);
 		else if( strcmpi(w1, "default_codepage") == 0 )
 			safestrncpy(default_codepage, w2, sizeof(default_codepage));
 		else if( strcmpi(w1, "use_sql_db") == 0 ) {
@@ -4064,19 +4317,31 @@ int map_sql_init(void)
 			Sql_ShowDebug(qsmysql_handle);
 	}
 
+	if( !(qsmysql_worker = SqlWorker_Create(map_server_id, map_server_pw, map_server_ip, map_server_port, map_server_db, default_codepage)) )
+		ShowWarning("Couldn't start the query_sql_async worker, queries will run synchronously.\n");
+	else if( query_sql_async_threads > 1 &&
+		!(qsmysql_pool = SqlWorker_CreatePool(map_server_id, map_server_pw, map_server_ip, map_server_port, map_server_db, default_codepage, query_sql_async_threads)) )
+		ShowWarning("Couldn't start the query_sql_async pool, queries will share the background worker.\n");
+
 	return 0;
 }
 
 int map_sql_close(void)
 {
 	ShowStatus("Close Map DB Connection....\n");
+	SqlWorker_Free(qsmysql_pool);
+	SqlWorker_Free(qsmysql_worker);
 	Sql_Free(mmysql_handle);
 	Sql_Free(qsmysql_handle);
+	qsmysql_pool = NULL;
+	qsmysql_worker = NULL;
 	mmysql_handle = NULL;
 	qsmysql_handle = NULL;
 	if( log_config.sql_logs ) {
 		ShowStatus("Close Log DB Connection....\n");
+		SqlWorker_Free(logmysql_worker);
 		Sql_Free(logmysql_handle);
+		logmysql_worker = NULL;
 		logmysql_handle = NULL;
 	}
 	return 0;
@@ -4095,6 +4360,9 @@ int log_sql_init(void)
 	if( strlen(default_codepage) > 0 )
 		if ( SQL_ERROR == Sql_SetEncoding(logmysql_handle, default_codepage) )
 			Sql_ShowDebug(logmysql_handle);
+
+	if( !(logmysql_worker = SqlWorker_Create(log_db_id, log_db_pw, log_db_ip, log_db_port, log_db_db, default_codepage)) )
+		ShowWarning("Couldn't start the query_logsql_async worker, queries will run synchronously.\n");
 	return 0;
 }
 
@@ -4443,11 +4711,13 @@ void do_final(void)
 	charid_db->destroy(charid_db, NULL);
 	iwall_db->destroy(iwall_db, NULL);
 	regen_db->destroy(regen_db, NULL);
+	regen_active_db->destroy(regen_active_db, NULL);
 
 #ifdef ADJUST_SKILL_DAMAGE
 	ers_destroy(map_skill_damage_ers);
 #endif
 
+	do_final_log();
 	map_sql_close();
 
 	ShowStatus("Finished.\n");
@@ -4690,7 +4960,8 @@ int do_init(int argc, char *argv[])
 	map_db = uidb_alloc(DB_OPT_BASE);
 	nick_db = idb_alloc(DB_OPT_BASE);
 	charid_db = idb_alloc(DB_OPT_BASE);
-	regen_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
+	regen_db = idb_alloc(DB_OPT_BASE);
+	regen_active_db = idb_alloc(DB_OPT_BASE); // efficient status_natural_heal processing
 	iwall_db = strdb_alloc(DB_OPT_RELEASE_DATA, 2 * NAME_LENGTH + 2 + 1); // [Zephyrus] Invisible Walls
 
 #ifdef ADJUST_SKILL_DAMAGE
@@ -4700,6 +4971,7 @@ int do_init(int argc, char *argv[])
 	map_sql_init();
 	if (log_config.sql_logs)
 		log_sql_init();
+	do_init_log();
 
 	mapindex_init();
 	if (enable_grf)
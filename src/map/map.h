@@ -624,6 +624,8 @@ struct map_data {
 	struct mapcell *cell; // Holds the information of each map cell (NULL if the map is not on this map-server).
 	struct block_list **block;
 	struct block_list **block_mob;
+	unsigned short *skillunit_cell; // Amount of skill units on each cell (NULL until the first unit is placed on this map)
+	int skillunit_count; // Total of skill units placed on this map
 	int16 m;
 	int16 xs, ys; // Map dimensions (in cells)
 	int16 bxs, bys; // Map dimensions (in blocks)
@@ -767,6 +769,7 @@ extern int map_num;
 
 extern int autosave_interval;
 extern int minsave_interval;
+extern int autosave_rate;
 extern int16 save_settings;
 extern int night_flag; // 0 = day, 1 = night [Yor]
 extern int enable_spy; // Determines if @spy commands are active.
@@ -822,6 +825,7 @@ int map_freeblock_unlock(void);
 int map_addblock(struct block_list *bl);
 int map_delblock(struct block_list *bl);
 int map_moveblock(struct block_list *bl, int x1, int y1, unsigned int tick);
+bool map_skillunit_incell(int16 m, int16 x, int16 y);
 int map_foreachinrange(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, ...);
 int map_foreachinallrange(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, ...);
 int map_foreachinshootrange(int (*func)(struct block_list *, va_list), struct block_list *center, int16 range, int type, ...);
@@ -888,6 +892,8 @@ void map_deliddb(struct block_list *bl);
 void map_foreachpc(int (*func)(struct map_session_data *sd, va_list args), ...);
 void map_foreachmob(int (*func)(struct mob_data *md, va_list args), ...);
 void map_foreachnpc(int (*func)(struct npc_data *nd, va_list args), ...);
+void map_regen_enroll(struct block_list *bl);
+void map_regen_dismiss(struct block_list *bl);
 void map_foreachregen(int (*func)(struct block_list *bl, va_list args), ...);
 void map_foreachiddb(int (*func)(struct block_list *bl, va_list args), ...);
 struct map_session_data *map_nick2sd(const char *);
@@ -993,6 +999,9 @@ extern int db_use_sqldbs;
 extern Sql *mmysql_handle;
 extern Sql *qsmysql_handle;
 extern Sql *logmysql_handle;
+extern SqlWorker *qsmysql_worker;
+extern SqlWorker *qsmysql_pool;
+extern SqlWorker *logmysql_worker;
 
 extern char buyingstores_db[32];
 extern char buyingstore_items_db[32];
@@ -10,7 +10,6 @@ struct mapreg_save {
 		int i;
 		char *str;
 	} u;
-	bool save;
 };
 
 void mapreg_reload(void);
@@ -22,5 +21,7 @@ int mapreg_readreg(int uid);
 char *mapreg_readregstr(int uid);
 bool mapreg_setreg(int uid, int val);
 bool mapreg_setregstr(int uid, const char *str);
+int mapreg_getarraysize(int id, int idx);
+void mapreg_report(void);
 
 #endif /* _MAPREG_H_ */
@@ -17,13 +17,47 @@
 
 static DBMap *mapreg_db = NULL; // int var_id -> int value
 static DBMap *mapregstr_db = NULL; // int var_id -> char *value
+static DBMap *mapreg_array_db = NULL; // Array member bitmaps of both (see script_array_update)
 static struct eri *mapreg_ers; //[Ind]
 
 static char mapreg_table[32] = "mapreg";
-static bool mapreg_i_dirty = false;
-static bool mapreg_str_dirty = false;
+static DBMap *mapreg_dirty_db = NULL; // int var_id -> 1, variables changed since the last flush
 
 #define MAPREG_AUTOSAVE_INTERVAL (300*1000)
+#define MAPREG_ROWSAVE_DELAY 1000 //Variables that were set or cleared are saved this soon, changed values wait for the autosave
+#define MAPREG_FLUSH_BATCH 500 //Variables per statement
+#define MAPREG_REAP_INTERVAL 50
+
+/// Flush queued on the query_sql_async worker, reaped once written
+struct mapreg_flush {
+	SqlJob **job;
+	int count;
+	int *uid; //Flushed variables, marked dirty again if the flush fails
+	int vars;
+	bool lost; //A statement couldn't be queued
+	uint64 start; //gettick_usec() when queued
+	struct mapreg_flush *next;
+};
+static struct mapreg_flush *mapreg_flush_head = NULL, *mapreg_flush_tail = NULL;
+static int mapreg_rowsave_tid = INVALID_TIMER;
+
+/// Flush times since the previous report
+static struct {
+	unsigned int flushes, failed;
+	uint64 vars;
+	uint64 build_total, build_max; //Main thread time to build and queue a flush (us)
+	uint64 write_total, write_max; //Time until a flush is written (us)
+} mapreg_stats;
+
+static TIMER_FUNC(script_rowsave_mapreg);
+
+/// Marks a permanent variable to be written by the next flush.
+/// @param rows : The variable was set or cleared, so it is saved after MAPREG_ROWSAVE_DELAY
+static void mapreg_setdirty(int uid, bool rows) {
+	idb_iput(mapreg_dirty_db, uid, 1);
+	if( rows && mapreg_rowsave_tid == INVALID_TIMER )
+		mapreg_rowsave_tid = add_timer(gettick() + MAPREG_ROWSAVE_DELAY, script_rowsave_mapreg, 0, 0);
+}
 
 
 /// Looks up the value of an integer variable using its uid.
@@ -42,44 +76,35 @@ char *mapreg_readregstr(int uid) {
 bool mapreg_setreg(int uid, int val) {
 	struct mapreg_save *m;
 	int num = (uid & 0x00ffffff);
-	int i   = (uid & 0xff000000) >> 24;
 	const char *name = get_str(num);
 
 	if( val != 0 ) {
 		if( (m = idb_get(mapreg_db,uid)) ) {
+			if( m->u.i == val )
+				return true;
 			m->u.i = val;
-			if(name[1] != '@') {
-				m->save = true;
-				mapreg_i_dirty = true;
-			}
 		} else {
 			m = ers_alloc(mapreg_ers, struct mapreg_save);
 
 			m->u.i = val;
 			m->uid = uid;
-			m->save = false;
-
-			if( name[1] != '@' ) {// write new variable to database
-				char esc_name[32 * 2 + 1];
-
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				if( SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%d')", mapreg_table, esc_name, i, val) )
-					Sql_ShowDebug(mmysql_handle);
-			}
 			idb_put(mapreg_db, uid, m);
+			script_array_update(mapreg_array_db, uid, true);
+			if( name[1] != '@' )
+				mapreg_setdirty(uid, true);
+			return true;
 		}
+		if( name[1] != '@' )
+			mapreg_setdirty(uid, false);
 	} else { // val == 0
-		if( (m = idb_get(mapreg_db,uid)) )
-			ers_free(mapreg_ers, m);
+		if( (m = idb_get(mapreg_db,uid)) == NULL )
+			return true;
+		ers_free(mapreg_ers, m);
 		idb_remove(mapreg_db,uid);
+		script_array_update(mapreg_array_db, uid, false);
 
-		if( name[1] != '@' ) {// Remove from database because it is unused
-			char esc_name[32 * 2 + 1];
-
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if( SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, esc_name, i) )
-				Sql_ShowDebug(mmysql_handle);
-		}
+		if( name[1] != '@' ) // Remove from database because it is unused
+			mapreg_setdirty(uid, true);
 	}
 
 	return true;
@@ -89,55 +114,51 @@ bool mapreg_setreg(int uid, int val) {
 bool mapreg_setregstr(int uid, const char *str) {
 	struct mapreg_save *m;
 	int num = (uid & 0x00ffffff);
-	int i   = (uid & 0xff000000) >> 24;
 	const char *name = get_str(num);
+	bool rows = true; //Set or cleared
 	
 	if( str == NULL || *str == 0 ) {
-		if( name[1] != '@' ) {
-			char esc_name[32 * 2 + 1];
-
-			Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-			if( SQL_ERROR == Sql_Query(mmysql_handle, "DELETE FROM `%s` WHERE `varname`='%s' AND `index`='%d'", mapreg_table, esc_name, i) )
-				Sql_ShowDebug(mmysql_handle);
-		}
-		if( (m = idb_get(mapregstr_db,uid)) ) {
-			if( m->u.str != NULL )
-				aFree(m->u.str);
-			ers_free(mapreg_ers, m);
-		}
+		if( (m = idb_get(mapregstr_db,uid)) == NULL )
+			return true;
+		if( m->u.str != NULL )
+			aFree(m->u.str);
+		ers_free(mapreg_ers, m);
 		idb_remove(mapregstr_db,uid);
+		script_array_update(mapreg_array_db, uid, false);
 	} else {
 		if( (m = idb_get(mapregstr_db,uid)) ) {
-			if( m->u.str != NULL )
+			if( m->u.str != NULL ) {
+				if( strcmp(m->u.str, str) == 0 )
+					return true;
 				aFree(m->u.str);
-			m->u.str = aStrdup(str);
-			if( name[1] != '@' ) {
-				mapreg_str_dirty = true;
-				m->save = true;
 			}
+			m->u.str = aStrdup(str);
+			rows = false;
 		} else {
 			m = ers_alloc(mapreg_ers, struct mapreg_save);
 
 			m->uid = uid;
 			m->u.str = aStrdup(str);
-			m->save = false;
-			
-			if(name[1] != '@') { //put returned null, so we must insert.
-				char esc_name[32 * 2 + 1];
-				char esc_str[255 * 2 + 1];
-
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				Sql_EscapeStringLen(mmysql_handle, esc_str, str, strnlen(str, 255));
-				if( SQL_ERROR == Sql_Query(mmysql_handle, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ('%s','%d','%s')", mapreg_table, esc_name, i, esc_str) )
-					Sql_ShowDebug(mmysql_handle);
-			}
 			idb_put(mapregstr_db, uid, m);
+			script_array_update(mapreg_array_db, uid, true);
 		}
 	}
+	if( name[1] != '@' )
+		mapreg_setdirty(uid, rows);
 
 	return true;
 }
 
+/// Returns the size of an array, counting from idx.
+int mapreg_getarraysize(int id, int idx) {
+	int size = script_array_size(mapreg_array_db, id, idx);
+
+	// Element 0 isn't in the bitmaps, and the values are kept apart from them
+	if( size == 0 && (idb_exists(mapreg_db, id) || idb_exists(mapregstr_db, id)) )
+		return 1;
+	return size;
+}
+
 /// Loads permanent variables from database
 static void script_load_mapreg(void) {
 	/*
@@ -183,7 +204,6 @@ static void script_load_mapreg(void) {
 
 		m = ers_alloc(mapreg_ers, struct mapreg_save);
 		m->uid = (i<<24)|s;
-		m->save = false;
 		if( varname[length - 1] == '$' ) {
 			m->u.str = aStrdup(value);
 			idb_put(mapregstr_db, m->uid, m);
@@ -191,62 +211,205 @@ static void script_load_mapreg(void) {
 			m->u.i = atoi(value);
 			idb_put(mapreg_db, m->uid, m);
 		}
+		script_array_update(mapreg_array_db, m->uid, (varname[length - 1] == '$' ? value[0] != '\0' : m->u.i != 0));
 	}
 	
 	SqlStmt_Free(stmt);
+}
 
-	mapreg_i_dirty = false;
-	mapreg_str_dirty = false;
+/// Reaps the written flushes, in the order they were queued.
+/// The variables of a failed flush are marked dirty again.
+static void mapreg_flush_reap(void) {
+	while( mapreg_flush_head && SqlJob_IsDone(mapreg_flush_head->job[mapreg_flush_head->count - 1]) ) {
+		struct mapreg_flush *flush = mapreg_flush_head;
+		uint64 elapsed = gettick_usec() - flush->start;
+		bool failed = flush->lost;
+		int i;
+
+		for( i = 0; i < flush->count; i++ ) {
+			if( SqlJob_GetResult(flush->job[i]) != SQL_SUCCESS ) {
+				SqlJob_ShowDebug(flush->job[i]);
+				failed = true;
+			}
+			SqlJob_Free(flush->job[i]);
+		}
+		if( failed ) {
+			ShowError("mapreg_flush_reap: Failed to save %d permanent global variables, retrying on the next save.\n", flush->vars);
+			for( i = 0; i < flush->vars; i++ )
+				mapreg_setdirty(flush->uid[i], true); //Rows may have been deleted already
+			mapreg_stats.failed++;
+		}
+		mapreg_stats.write_total += elapsed;
+		mapreg_stats.write_max = max(mapreg_stats.write_max, elapsed);
+
+		if( (mapreg_flush_head = flush->next) == NULL )
+			mapreg_flush_tail = NULL;
+		aFree(flush->job);
+		aFree(flush->uid);
+		aFree(flush);
+	}
+}
+
+static TIMER_FUNC(mapreg_flush_timer) {
+	mapreg_flush_reap();
+	if( mapreg_flush_head )
+		add_timer(gettick() + MAPREG_REAP_INTERVAL, mapreg_flush_timer, 0, 0);
+	return 0;
 }
 
-/// Saves permanent variables to database
-static void script_save_mapreg(void) {
+/// Waits until the queued flushes are written.
+static void mapreg_flush_wait(void) {
+	if( mapreg_flush_tail ) {
+		SqlJob_Wait(mapreg_flush_tail->job[mapreg_flush_tail->count - 1]);
+		mapreg_flush_reap();
+	}
+}
+
+/// Executes a statement of a flush, or queues it on the worker.
+static void mapreg_flush_query(struct mapreg_flush *flush, const char *query) {
+	if( flush == NULL ) {
+		if( SQL_ERROR == Sql_QueryStr(mmysql_handle, query) )
+			Sql_ShowDebug(mmysql_handle);
+		return;
+	}
+	if( (flush->job[flush->count] = SqlJob_Query(qsmysql_worker, query, 0)) != NULL )
+		flush->count++;
+	else
+		flush->lost = true;
+}
+
+/// Saves the changed permanent variables to database.
+/// Every changed variable is deleted and the ones still set are reinserted, as one DELETE
+/// and one multi-row INSERT per MAPREG_FLUSH_BATCH variables. The table has no key to upsert
+/// on; if an INSERT fails, its variables are marked dirty again and rewritten by the next save.
+/// The statements run on the query_sql_async worker when there is one.
+/// @param wait : Returns once they are written
+static void script_save_mapreg(bool wait) {
+	struct mapreg_flush *flush = NULL;
+	StringBuf del, ins;
 	DBIterator *iter;
-	struct mapreg_save *m = NULL;
+	DBKey key;
+	uint64 start = gettick_usec(), elapsed;
+	int vars = db_size(mapreg_dirty_db), n = 0, inserts = 0;
 
-	if( mapreg_i_dirty ) {
-		iter = db_iterator(mapreg_db);
-		for( m = dbi_first(iter); dbi_exists(iter); m = dbi_next(iter) ) {
-			if( m->save ) {
-				int num = (m->uid & 0x00ffffff);
-				int i   = (m->uid & 0xff000000) >> 24;
-				const char *name = get_str(num);
-				char esc_name[32 * 2 + 1];
-
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
-				if( SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%d' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, m->u.i, esc_name, i) )
-					Sql_ShowDebug(mmysql_handle);
-				m->save = false;
-			}
-		}
-		dbi_destroy(iter);
-		mapreg_i_dirty = false;
+	if( vars == 0 ) {
+		if( wait )
+			mapreg_flush_wait();
+		return;
 	}
 
-	if( mapreg_str_dirty ) {
-		iter = db_iterator(mapregstr_db);
-		for( m = dbi_first(iter); dbi_exists(iter); m = dbi_next(iter) ) {
-			if( m->save ) {
-				int num = (m->uid & 0x00ffffff);
-				int i   = (m->uid & 0xff000000) >> 24;
-				const char *name = get_str(num);
-				char esc_name[32 * 2 + 1];
-				char esc_str[2 * 255 + 1];
-
-				Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
+	if( qsmysql_worker ) {
+		CREATE(flush, struct mapreg_flush, 1);
+		CREATE(flush->job, SqlJob *, 2 * (vars / MAPREG_FLUSH_BATCH + 1));
+		CREATE(flush->uid, int, vars);
+		flush->start = start;
+	}
+	StringBuf_Init(&del);
+	StringBuf_Init(&ins);
+
+	iter = db_iterator(mapreg_dirty_db);
+	for( iter->first(iter, &key); iter->exists(iter); iter->next(iter, &key) ) {
+		int uid = key.i;
+		const char *name = get_str(uid&0x00ffffff);
+		uint32 i = (uint32)uid>>24;
+		char esc_name[32 * 2 + 1];
+		struct mapreg_save *m;
+
+		if( flush )
+			flush->uid[flush->vars++] = uid;
+		Sql_EscapeStringLen(mmysql_handle, esc_name, name, strnlen(name, 32));
+		if( n == 0 )
+			StringBuf_Printf(&del, "DELETE FROM `%s` WHERE (`varname`,`index`) IN (", mapreg_table);
+		StringBuf_Printf(&del, "%s('%s','%u')", (n ? "," : ""), esc_name, i);
+
+		if( name[strlen(name) - 1] == '$' ) {
+			if( (m = idb_get(mapregstr_db, uid)) != NULL && m->u.str ) {
+				char esc_str[255 * 2 + 1];
+
 				Sql_EscapeStringLen(mmysql_handle, esc_str, m->u.str, safestrnlen(m->u.str, 255));
-				if( SQL_ERROR == Sql_Query(mmysql_handle, "UPDATE `%s` SET `value`='%s' WHERE `varname`='%s' AND `index`='%d' LIMIT 1", mapreg_table, esc_str, esc_name, i) )
-					Sql_ShowDebug(mmysql_handle);
-				m->save = false;
+				if( inserts == 0 )
+					StringBuf_Printf(&ins, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ", mapreg_table);
+				StringBuf_Printf(&ins, "%s('%s','%u','%s')", (inserts++ ? "," : ""), esc_name, i, esc_str);
 			}
+		} else if( (m = idb_get(mapreg_db, uid)) != NULL ) {
+			if( inserts == 0 )
+				StringBuf_Printf(&ins, "INSERT INTO `%s`(`varname`,`index`,`value`) VALUES ", mapreg_table);
+			StringBuf_Printf(&ins, "%s('%s','%u','%d')", (inserts++ ? "," : ""), esc_name, i, m->u.i);
 		}
-		dbi_destroy(iter);
-		mapreg_str_dirty = false;
+
+		if( ++n == MAPREG_FLUSH_BATCH ) {
+			StringBuf_AppendStr(&del, ")");
+			mapreg_flush_query(flush, StringBuf_Value(&del));
+			if( inserts )
+				mapreg_flush_query(flush, StringBuf_Value(&ins));
+			StringBuf_Clear(&del);
+			StringBuf_Clear(&ins);
+			n = inserts = 0;
+		}
+	}
+	dbi_destroy(iter);
+	if( n ) {
+		StringBuf_AppendStr(&del, ")");
+		mapreg_flush_query(flush, StringBuf_Value(&del));
+		if( inserts )
+			mapreg_flush_query(flush, StringBuf_Value(&ins));
+	}
+	StringBuf_Destroy(&del);
+	StringBuf_Destroy(&ins);
+	db_clear(mapreg_dirty_db);
+
+	elapsed = gettick_usec() - start;
+	mapreg_stats.flushes++;
+	mapreg_stats.vars += vars;
+	mapreg_stats.build_total += elapsed;
+	mapreg_stats.build_max = max(mapreg_stats.build_max, elapsed);
+
+	if( flush == NULL ) { //Written synchronously
+		mapreg_stats.write_total += elapsed;
+		mapreg_stats.write_max = max(mapreg_stats.write_max, elapsed);
+		return;
+	}
+	if( flush->count == 0 ) { //Couldn't queue anything
+		for( n = 0; n < flush->vars; n++ )
+			mapreg_setdirty(flush->uid[n], true);
+		mapreg_stats.failed++;
+		aFree(flush->job);
+		aFree(flush->uid);
+		aFree(flush);
+		return;
 	}
+	if( mapreg_flush_tail )
+		mapreg_flush_tail->next = flush;
+	else {
+		mapreg_flush_head = flush;
+		add_timer(gettick() + MAPREG_REAP_INTERVAL, mapreg_flush_timer, 0, 0);
+	}
+	mapreg_flush_tail = flush;
+	if( wait )
+		mapreg_flush_wait();
+}
+
+/// Shows the flushes of the permanent global variables since the previous report.
+void mapreg_report(void) {
+	ShowInfo("Permanent global variables: %d changed since the last save, saves in progress: %s.\n", db_size(mapreg_dirty_db), (mapreg_flush_head ? "yes" : "no"));
+	if( mapreg_stats.flushes ) {
+		ShowInfo("Saves: %u (%u failed), %" PRIu64 " variables. Main thread: average %" PRIu64 " us, max %" PRIu64 " us. Written after: average %" PRIu64 " us, max %" PRIu64 " us.\n",
+			mapreg_stats.flushes, mapreg_stats.failed, mapreg_stats.vars,
+			mapreg_stats.build_total / mapreg_stats.flushes, mapreg_stats.build_max,
+			mapreg_stats.write_total / mapreg_stats.flushes, mapreg_stats.write_max);
+	} else
+		ShowInfo("No saves since the previous report.\n");
+	memset(&mapreg_stats, 0, sizeof(mapreg_stats));
 }
 
 static TIMER_FUNC(script_autosave_mapreg) {
-	script_save_mapreg();
+	script_save_mapreg(false);
+	return 0;
+}
+
+static TIMER_FUNC(script_rowsave_mapreg) {
+	mapreg_rowsave_tid = INVALID_TIMER;
+	script_save_mapreg(false);
 	return 0;
 }
 
@@ -255,7 +418,7 @@ void mapreg_reload(void) {
 	DBIterator *iter;
 	struct mapreg_save *m = NULL;
 
-	script_save_mapreg();
+	script_save_mapreg(true);
 
 	iter = db_iterator(mapreg_db);
 	for( m = dbi_first(iter); dbi_exists(iter); m = dbi_next(iter) ) {
@@ -274,6 +437,7 @@ void mapreg_reload(void) {
 	
 	db_clear(mapreg_db);
 	db_clear(mapregstr_db);
+	db_clear(mapreg_array_db);
 
 	script_load_mapreg();
 }
@@ -282,7 +446,11 @@ void mapreg_final(void) {
 	DBIterator *iter;
 	struct mapreg_save *m = NULL;
 	
-	script_save_mapreg();
+	if( mapreg_rowsave_tid != INVALID_TIMER ) {
+		delete_timer(mapreg_rowsave_tid, script_rowsave_mapreg);
+		mapreg_rowsave_tid = INVALID_TIMER;
+	}
+	script_save_mapreg(true);
 
 	iter = db_iterator(mapreg_db);
 	for( m = dbi_first(iter); dbi_exists(iter); m = dbi_next(iter) ) {
@@ -301,6 +469,8 @@ void mapreg_final(void) {
 		
 	db_destroy(mapreg_db);
 	db_destroy(mapregstr_db);
+	db_destroy(mapreg_array_db);
+	db_destroy(mapreg_dirty_db);
 	
 	ers_destroy(mapreg_ers);
 }
@@ -308,11 +478,15 @@ void mapreg_final(void) {
 void mapreg_init(void) {
 	mapreg_db = idb_alloc(DB_OPT_BASE);
 	mapregstr_db = idb_alloc(DB_OPT_BASE);
+	mapreg_array_db = idb_alloc(DB_OPT_BASE);
+	mapreg_dirty_db = idb_alloc(DB_OPT_BASE);
 	mapreg_ers = ers_new(sizeof(struct mapreg_save), "mapreg_sql.c::mapreg_ers", ERS_OPT_NONE);
 
 	script_load_mapreg();
 
 	add_timer_func_list(script_autosave_mapreg, "script_autosave_mapreg");
+	add_timer_func_list(script_rowsave_mapreg, "script_rowsave_mapreg");
+	add_timer_func_list(mapreg_flush_timer, "mapreg_flush_timer");
 	add_timer_interval(gettick() + MAPREG_AUTOSAVE_INTERVAL, script_autosave_mapreg, 0, 0, MAPREG_AUTOSAVE_INTERVAL);
 }
 
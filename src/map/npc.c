@@ -92,13 +92,28 @@ int npc_get_new_npc_id(void) {
 }
 
 static DBMap *ev_db; // const char *event_name -> struct event_data*
+static DBMap *ev_label_db; // const char *label_name (case-insensitive) -> struct event_label*
 static DBMap *npcname_db; // const char *npc_name -> struct npc_data*
 
 struct event_data {
 	struct npc_data *nd;
 	int pos;
+	char name[EVENT_NAME_LENGTH]; // <exname>::<label>
+	const char *label; // Points into name
+	struct event_data *label_next, *label_prev; // Neighbours in the list of the label
+	struct event_data *free_next; // Deferred release list
+	bool removed;
 };
 
+/// Events sharing a label, in export order.
+/// Global (::label) and clock events only walk these instead of the whole ev_db.
+struct event_label {
+	struct event_data *first, *last;
+};
+
+static int ev_label_lock; // Number of label lists being walked, releases are deferred while > 0
+static struct event_data *ev_label_freelist;
+
 static struct eri *timer_event_ers; //For the npc timer data [Skotlex]
 
 /* Hello */
@@ -373,6 +388,66 @@ int npc_event_dequeue(struct map_session_data *sd)
 	return 1;
 }
 
+/*==========================================
+ * Adds an event to the list of its label
+ *------------------------------------------*/
+static void npc_event_label_add(struct event_data *ev)
+{
+	struct event_label *el = (struct event_label *)strdb_get(ev_label_db, ev->label);
+
+	if( !el ) {
+		CREATE(el,struct event_label,1);
+		strdb_put(ev_label_db,ev->label,el);
+	}
+	ev->label_next = NULL;
+	ev->label_prev = el->last;
+	if( el->last )
+		el->last->label_next = ev;
+	else
+		el->first = ev;
+	el->last = ev;
+}
+
+/*==========================================
+ * Unlinks an event from its label and frees it
+ * The event is only marked as removed while a label
+ * list is being walked and freed once the walk ends
+ * (the removed event keeps its label_next link).
+ *------------------------------------------*/
+static void npc_event_release(struct event_data *ev)
+{
+	struct event_label *el = (struct event_label *)strdb_get(ev_label_db, ev->label);
+
+	if( el && (ev->label_prev || el->first == ev) ) {
+		if( ev->label_prev )
+			ev->label_prev->label_next = ev->label_next;
+		else
+			el->first = ev->label_next;
+		if( ev->label_next )
+			ev->label_next->label_prev = ev->label_prev;
+		else
+			el->last = ev->label_prev;
+		if( !el->first )
+			strdb_remove(ev_label_db, ev->label);
+	}
+	ev->removed = true;
+	if( ev_label_lock ) {
+		ev->free_next = ev_label_freelist;
+		ev_label_freelist = ev;
+	} else
+		aFree(ev);
+}
+
+/**
+ * Releases an event when it is removed from ev_db.
+ * @see DBApply
+ */
+static int npc_event_db_release(DBKey key, DBData *data, va_list ap)
+{
+	npc_event_release(db_data2ptr(data));
+	return 0;
+}
+
 /*==========================================
  * Exports a npc event label
  * called from npc_parse_script
@@ -384,7 +459,7 @@ static int npc_event_export(struct npc_data *nd, int i)
 
 	if( (lname[0] == 'O' || lname[0] == 'o') && (lname[1] == 'N' || lname[1] == 'n') ) {
 		struct event_data *ev;
-		char buf[EVENT_NAME_LENGTH];
+		DBData prev;
 
 		if( nd->bl.m > -1 && mapdata[nd->bl.m].instance_id > 0 ) { //Block script events in instances
 			int j;
@@ -404,13 +479,17 @@ static int npc_event_export(struct npc_data *nd, int i)
 			return 0;
 		}
 
-		snprintf(buf,ARRAYLENGTH(buf),"%s::%s",nd->exname,lname);
 		//Generate the data and insert it
 		CREATE(ev,struct event_data,1);
 		ev->nd = nd;
 		ev->pos = pos;
-		if( strdb_put(ev_db,buf,ev) ) //There was already another event of the same name?
+		snprintf(ev->name,ARRAYLENGTH(ev->name),"%s::%s",nd->exname,lname);
+		ev->label = strstr(ev->name,"::") + 2;
+		npc_event_label_add(ev);
+		if( ev_db->put(ev_db,db_str2key(ev->name),db_ptr2data(ev),&prev) ) { //There was already another event of the same name?
+			npc_event_release(db_data2ptr(&prev));
 			return 1;
+		}
 	}
 	return 0;
 }
@@ -418,54 +497,39 @@ static int npc_event_export(struct npc_data *nd, int i)
 int npc_event_sub(struct map_session_data *sd, struct event_data *ev, const char *eventname); //[Lance]
 
 /**
- * Exec name (NPC events) on player or global
- * Do on all NPC when called with foreach
- * @see DBApply
+ * Exec the events exported under a label (NPC events) on player or global
+ * @param name Only run the event of this name (<exname>::<label>), NULL for every NPC
+ * @param label Label name
+ * @param rid Player attached to the script
+ * @return Number of events executed
  */
-int npc_event_doall_sub(DBKey key, DBData *data, va_list ap)
+static int npc_event_label_run(const char *name, const char *label, int rid)
 {
-	const char *p = key.str;
+	struct event_label *el = (struct event_label *)strdb_get(ev_label_db, label);
 	struct event_data *ev;
-	int *c;
-	const char *name;
-	int rid;
-
-	nullpo_ret(ev = db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap,int *));
-	nullpo_ret(name = va_arg(ap,const char *));
-	rid = va_arg(ap,int);
-
-	p = strchr(p,':'); //Match only the event name
-	if( p && !strcmpi(name,p) /* && !ev->nd->src_id */ ) { //Do not run on duplicates [Paradox924X]
-		if( rid ) //A player may only have 1 script running at the same time
-			npc_event_sub(map_id2sd(rid),ev,key.str);
+	int c = 0;
+
+	if( !el )
+		return 0;
+
+	ev_label_lock++; //Events unloaded by the scripts we run stay readable until the walk ends
+	for( ev = el->first; ev; ev = ev->label_next ) {
+		if( ev->removed || (name && strcmpi(name, ev->name)) )
+			continue;
+		if( rid && !name ) //A player may only have 1 script running at the same time
+			npc_event_sub(map_id2sd(rid),ev,ev->name);
 		else
 			run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
+		c++;
 	}
-	return 0;
-}
-
-/**
- * @see DBApply
- */
-static int npc_event_do_sub(DBKey key, DBData *data, va_list ap)
-{
-	const char *p = key.str;
-	struct event_data *ev;
-	int *c, rid;
-	const char *name;
-
-	nullpo_ret(ev = db_data2ptr(data));
-	nullpo_ret(c = va_arg(ap,int *));
-	nullpo_ret(name = va_arg(ap,const char *));
-	rid = va_arg(ap,int);
-
-	if( p && strcmpi(name, p) == 0 ) {
-		run_script(ev->nd->u.scr.script,ev->pos,rid,ev->nd->bl.id);
-		(*c)++;
+	if( --ev_label_lock == 0 ) {
+		while( ev_label_freelist ) {
+			ev = ev_label_freelist;
+			ev_label_freelist = ev->free_next;
+			aFree(ev);
+		}
 	}
-	return 0;
+	return c;
 }
 
 // Runs the specified event (supports both single-npc and global events)
@@ -477,13 +541,13 @@ int npc_event_do(const char *name)
 // Runs the specified event, with a RID attached (supports both single-npc and global events)
 int npc_event_do_id(const char *name, int rid)
 {
-	int c = 0;
+	const char *label;
 
 	if( name[0] == ':' && name[1] == ':' )
-		ev_db->foreach(ev_db,npc_event_doall_sub,&c,name,0,rid);
-	else
-		ev_db->foreach(ev_db,npc_event_do_sub,&c,name,rid);
-	return c;
+		return npc_event_label_run(NULL,name + 2,0);
+	if( !(label = strstr(name,"::")) )
+		return 0;
+	return npc_event_label_run(name,label + 2,rid);
 }
 
 // Runs the specified event (global only)
@@ -500,12 +564,7 @@ void npc_event_runall(const char *eventname) {
 // Runs the specified event, with a RID attached (global only)
 int npc_event_doall_id(const char *name, int rid)
 {
-	int c = 0;
-	char buf[EVENT_NAME_LENGTH];
-
-	safesnprintf(buf,sizeof(buf),"::%s",name);
-	ev_db->foreach(ev_db,npc_event_doall_sub,&c,buf,rid);
-	return c;
+	return npc_event_label_run(NULL,name,rid);
 }
 
 /*==========================================
@@ -2148,6 +2207,7 @@ static int npc_unload_ev(DBKey key, DBData *data, va_list ap)
 
 	if(strcmp(ev->nd->exname,npcname) == 0) {
 		db_remove(ev_db, key);
+		npc_event_release(ev);
 		return 1;
 	}
 	return 0;
@@ -2949,6 +3009,12 @@ int npc_convertlabel_db(DBKey key, DBData *data, va_list ap)
 	return 0;
 }
 
+/// Orders labels by their position in the script.
+static int npc_label_list_cmp(const void *a, const void *b)
+{
+	return ((const struct npc_label_list *)a)->pos - ((const struct npc_label_list *)b)->pos;
+}
+
 //Skip the contents of a script.
 static const char *npc_skip_script(const char *start, const char *buffer, const char *filepath)
 {
@@ -3049,13 +3115,15 @@ static const char *npc_parse_script(char *w1, char *w2, char *w3, char *w4, cons
 	if( end == NULL )
 		return NULL; //(Simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,script_start - buffer), SCRIPT_USE_LABEL_DB);
+	script = parse_script_cached(script_start, end, filepath, strline(buffer,script_start - buffer), SCRIPT_USE_LABEL_DB);
 	label_list = NULL;
 	label_list_num = 0;
 	if( script ) {
 		DBMap *label_db = script_get_label_db();
 		label_db->foreach(label_db, npc_convertlabel_db, &label_list, &label_list_num, filepath);
 		db_clear(label_db); //Not needed anymore, so clear the db
+		if( label_list_num > 1 ) //Sorted so the label containing a position can be searched (script profiler)
+			qsort(label_list, label_list_num, sizeof(struct npc_label_list), npc_label_list_cmp);
 	}
 
 	nd = npc_create_npc(m, x, y);
@@ -3763,7 +3831,7 @@ static const char *npc_parse_function(char *w1, char *w2, char *w3, char *w4, co
 	if( end == NULL )
 		return NULL;// (simple) parse error, don't continue
 
-	script = parse_script(script_start, filepath, strline(buffer,start - buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
+	script = parse_script_cached(script_start, end, filepath, strline(buffer,start - buffer), SCRIPT_RETURN_EMPTY_SCRIPT);
 	if( script == NULL )// parse error, continue
 		return end;
 
@@ -3772,9 +3840,7 @@ static const char *npc_parse_function(char *w1, char *w2, char *w3, char *w4, co
 	{
 		struct script_code *oldscript = (struct script_code *)db_data2ptr(&old_data);
 		ShowWarning("npc_parse_function: Overwriting user function [%s] in file '%s', line '%d'.\n", w3, filepath, strline(buffer,start - buffer));
-		script_free_vars(oldscript->script_vars);
-		aFree(oldscript->script_buf);
-		aFree(oldscript);
+		script_free_code(oldscript);
 	}
 
 	return end;
@@ -4525,18 +4591,13 @@ void npc_read_event_script(void)
 	int i;
 
 	for( i = 0; i < NPCE_MAX; i++ ) {
-		DBIterator *iter;
-		DBKey key;
-		DBData *data;
-		char name[EVENT_NAME_LENGTH];
-
-		safesnprintf(name, EVENT_NAME_LENGTH, "::%s", npc_get_script_event_name(i));
+		struct event_label *el;
+		struct event_data *ed;
 
 		script_event[i].event_count = 0;
-		iter = db_iterator(ev_db);
-		for( data = iter->first(iter,&key); iter->exists(iter); data = iter->next(iter,&key) ) {
-			const char *p = key.str;
-			struct event_data *ed = db_data2ptr(data);
+		if( !(el = (struct event_label *)strdb_get(ev_label_db, npc_get_script_event_name(i))) )
+			continue;
+		for( ed = el->first; ed; ed = ed->label_next ) {
 			unsigned char count = script_event[i].event_count;
 
 			if( count >= ARRAYLENGTH(script_event[i].event) ) {
@@ -4544,13 +4605,10 @@ void npc_read_event_script(void)
 				break;
 			}
 
-			if( (p = strchr(p, ':')) && p && strcmpi(name, p) == 0 ) {
-				script_event[i].event[count] = ed;
-				script_event[i].event_name[count] = key.str;
-				script_event[i].event_count++;
-			}
+			script_event[i].event[count] = ed;
+			script_event[i].event_name[count] = ed->name;
+			script_event[i].event_count++;
 		}
-		dbi_destroy(iter);
 	}
 
 	if( battle_config.etc_log ) {
@@ -4578,20 +4636,23 @@ void npc_clear_pathlist(void) {
  */
 void npc_process_files(int npc_min) {
 	struct npc_src_list *file; //Current file
+	unsigned int tick = gettick();
 
 	ShowStatus("Loading NPCs...\r");
+	script_cache_load();
 	for( file = npc_src_files; file != NULL; file = file->next ) {
 		ShowStatus("Loading NPC file: %s"CL_CLL"\r", file->name);
 		npc_parsesrcfile(file->name, false);
 	}
-	ShowInfo("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs:"CL_CLL"\n"
+	script_cache_save();
+	ShowInfo("Done loading '"CL_WHITE"%d"CL_RESET"' NPCs in '"CL_WHITE"%d"CL_RESET"' ms:"CL_CLL"\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Warps\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Shops\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Scripts\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Spawn sets\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Mobs Cached\n"
 		"\t-'"CL_WHITE"%d"CL_RESET"' Mobs Not Cached\n",
-		npc_id - npc_min, npc_warp, npc_shop, npc_script, npc_mob, npc_cache_mob, npc_delay_mob);
+		npc_id - npc_min, DIFF_TICK(gettick(), tick), npc_warp, npc_shop, npc_script, npc_mob, npc_cache_mob, npc_delay_mob);
 }
 
 //Clear then reload npcs files
@@ -4608,7 +4669,8 @@ int npc_reload(void) {
 
 	db_clear(npc_path_db);
 	db_clear(npcname_db);
-	db_clear(ev_db);
+	ev_db->clear(ev_db, npc_event_db_release);
+	db_clear(ev_label_db);
 
 	//Remove all npcs/mobs [Skotlex]
 #if PACKETVER >= 20131223
@@ -4711,7 +4773,8 @@ bool npc_unloadfile(const char *path) {
 
 void do_clear_npc(void) {
 	db_clear(npcname_db);
-	db_clear(ev_db);
+	ev_db->clear(ev_db, npc_event_db_release);
+	db_clear(ev_label_db);
 }
 
 /*==========================================
@@ -4719,7 +4782,8 @@ void do_clear_npc(void) {
  *------------------------------------------*/
 void do_final_npc(void) {
 	npc_clear_pathlist();
-	ev_db->destroy(ev_db, NULL);
+	ev_db->destroy(ev_db, npc_event_db_release);
+	ev_label_db->destroy(ev_label_db, NULL);
 	npcname_db->destroy(npcname_db, NULL);
 	npc_path_db->destroy(npc_path_db, NULL);
 #if PACKETVER >= 20131223
@@ -4781,7 +4845,8 @@ void do_init_npc(void)
 	for (i = MAX_NPC_CLASS2_START; i < MAX_NPC_CLASS2_END; i++)
 		npc_viewdb2[i - MAX_NPC_CLASS2_START].class_ = i;
 
-	ev_db = strdb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA), EVENT_NAME_LENGTH);
+	ev_db = strdb_alloc(DB_OPT_DUP_KEY, EVENT_NAME_LENGTH);
+	ev_label_db = stridb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA), NAME_LENGTH + 1);
 	npcname_db = strdb_alloc(DB_OPT_BASE, NPC_NAME_LENGTH + 1);
 	npc_path_db = strdb_alloc(DB_OPT_BASE|DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA, 80);
 #if PACKETVER >= 20131223
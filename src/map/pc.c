@@ -8691,6 +8691,7 @@ bool pc_setparam(struct map_session_data *sd, int type, int val) {
 			break;
 		case SP_HP:
 			sd->battle_status.hp = cap_value(val, 1, (int)sd->battle_status.max_hp);
+			map_regen_enroll(&sd->bl);
 			break;
 		case SP_MAXHP:
 			if( sd->status.base_level < 100 )
@@ -8703,9 +8704,11 @@ bool pc_setparam(struct map_session_data *sd, int type, int val) {
 				sd->battle_status.hp = sd->battle_status.max_hp;
 				clif_updatestatus(sd, SP_HP);
 			}
+			map_regen_enroll(&sd->bl);
 			break;
 		case SP_SP:
 			sd->battle_status.sp = cap_value(val, 0, (int)sd->battle_status.max_sp);
+			map_regen_enroll(&sd->bl);
 			break;
 		case SP_MAXSP:
 			sd->battle_status.max_sp = cap_value(val, 1, battle_config.max_sp);
@@ -8713,6 +8716,7 @@ bool pc_setparam(struct map_session_data *sd, int type, int val) {
 				sd->battle_status.sp = sd->battle_status.max_sp;
 				clif_updatestatus(sd, SP_SP);
 			}
+			map_regen_enroll(&sd->bl);
 			break;
 		case SP_STR:
 			sd->status.str = cap_value(val, 1, pc_maxparameter(sd, PARAM_STR));
@@ -9554,8 +9558,9 @@ int pc_readreg(struct map_session_data *sd, int reg)
 
 	nullpo_ret(sd);
 
-	ARR_FIND(0, sd->reg_num, i, sd->reg[i].index == reg);
-	return (i < sd->reg_num) ? sd->reg[i].data : 0;
+	if( !sd->reg_db || !(i = idb_iget(sd->reg_db, reg)) )
+		return 0;
+	return sd->reg[i - 1].data;
 }
 
 /*==========================================
@@ -9568,19 +9573,25 @@ bool pc_setreg(struct map_session_data *sd, int reg, int val)
 
 	nullpo_retr(false,sd);
 
-	ARR_FIND(0, sd->reg_num, i, sd->reg[i].index == reg);
-	if( i < sd->reg_num ) { //Overwrite existing entry
-		sd->reg[i].data = val;
+	if( sd->reg_db && (i = idb_iget(sd->reg_db, reg)) ) { //Overwrite existing entry
+		sd->reg[i - 1].data = val;
 		return true;
 	}
 
+	if( !val )
+		return true; //Nothing to add, unset entries read as 0
+
+	if( !sd->reg_db )
+		sd->reg_db = idb_alloc(DB_OPT_BASE);
 	ARR_FIND(0, sd->reg_num, i, sd->reg[i].data == 0);
 	if( i == sd->reg_num ) { //Nothing free, increase size
 		sd->reg_num++;
 		RECREATE(sd->reg, struct script_reg, sd->reg_num);
-	}
+	} else //Reuse the slot of an unset entry
+		idb_remove(sd->reg_db, sd->reg[i].index);
 	sd->reg[i].index = reg;
 	sd->reg[i].data = val;
+	idb_iput(sd->reg_db, reg, i + 1);
 
 	return true;
 }
@@ -9595,8 +9606,9 @@ char *pc_readregstr(struct map_session_data *sd, int reg)
 
 	nullpo_ret(sd);
 
-	ARR_FIND(0, sd->regstr_num, i,  sd->regstr[i].index == reg);
-	return (i < sd->regstr_num) ? sd->regstr[i].data : NULL;
+	if( !sd->regstr_db || !(i = idb_iget(sd->regstr_db, reg)) )
+		return NULL;
+	return sd->regstr[i - 1].data;
 }
 
 /*==========================================
@@ -9609,8 +9621,8 @@ bool pc_setregstr(struct map_session_data *sd, int reg, const char *str)
 
 	nullpo_retr(false,sd);
 
-	ARR_FIND(0, sd->regstr_num, i, sd->regstr[i].index == reg);
-	if( i < sd->regstr_num ) { //Found entry, update
+	if( sd->regstr_db && (i = idb_iget(sd->regstr_db, reg)) ) { //Found entry, update
+		i--;
 		if( !str || *str == '\0' ) { //Empty string
 			if( sd->regstr[i].data )
 				aFree(sd->regstr[i].data);
@@ -9628,153 +9640,358 @@ bool pc_setregstr(struct map_session_data *sd, int reg, const char *str)
 	if( !str || *str == '\0' )
 		return true; //Nothing to add, empty string
 
+	if( !sd->regstr_db )
+		sd->regstr_db = idb_alloc(DB_OPT_BASE);
 	ARR_FIND(0, sd->regstr_num, i, sd->regstr[i].data == NULL);
 	if( i == sd->regstr_num ) { //Nothing free, increase size
 		sd->regstr_num++;
 		RECREATE(sd->regstr, struct script_regstr, sd->regstr_num);
-	}
+	} else //Reuse the slot of an unset entry
+		idb_remove(sd->regstr_db, sd->regstr[i].index);
 	sd->regstr[i].index = reg;
 	sd->regstr[i].data = aStrdup(str);
+	idb_iput(sd->regstr_db, reg, i + 1);
 
 	return true;
 }
 
-int pc_readregistry(struct map_session_data *sd, const char *reg, int type)
+/*==========================================
+ * Size of a ram register array of player sd, counting from idx
+ * (highest index holding a value + 1, or idx if there is none)
+ *------------------------------------------*/
+int pc_readreg_arraysize(struct map_session_data *sd, int id, int idx, bool isstring)
 {
-	struct global_reg *sd_reg;
-	int i, max;
+	int i, size = idx;
 
 	nullpo_ret(sd);
+
+	if( isstring ) {
+		for( i = 0; i < sd->regstr_num; i++ ) {
+			int j = (int)((uint32)sd->regstr[i].index>>24);
+
+			if( (sd->regstr[i].index&0x00ffffff) == id && j >= size && sd->regstr[i].data && sd->regstr[i].data[0] )
+				size = j + 1;
+		}
+	} else {
+		for( i = 0; i < sd->reg_num; i++ ) {
+			int j = (int)((uint32)sd->reg[i].index>>24);
+
+			if( (sd->reg[i].index&0x00ffffff) == id && j >= size && sd->reg[i].data )
+				size = j + 1;
+		}
+	}
+	return size;
+}
+
+/*==========================================
+ * Permanent registries (#, ## and character variables)
+ * The save_reg arrays are kept as they are sent to the char/login server,
+ * a per player index (interned name id -> position) avoids scanning them,
+ * and the keys changed since the last save are tracked per registry.
+ *------------------------------------------*/
+
+/// Returns the array, the number of entries and the maximum of a registry type.
+static struct global_reg *pc_reg_array(struct map_session_data *sd, int type, int **num, int *max)
+{
 	switch( type ) {
 		case 3: //Char reg
-			sd_reg = sd->save_reg.global;
-			max = sd->save_reg.global_num;
-			break;
+			*num = &sd->save_reg.global_num;
+			*max = GLOBAL_REG_NUM;
+			return sd->save_reg.global;
 		case 2: //Account reg
-			sd_reg = sd->save_reg.account;
-			max = sd->save_reg.account_num;
-			break;
+			*num = &sd->save_reg.account_num;
+			*max = ACCOUNT_REG_NUM;
+			return sd->save_reg.account;
 		case 1: //Account2 reg
-			sd_reg = sd->save_reg.account2;
-			max = sd->save_reg.account2_num;
-			break;
-		default:
-			return 0;
+			*num = &sd->save_reg.account2_num;
+			*max = ACCOUNT_REG2_NUM;
+			return sd->save_reg.account2;
+	}
+	return NULL;
+}
+
+/// Indexes the variable at position i of a registry.
+static void pc_reg_index_put(struct s_reg_index *ri, struct global_reg *sd_reg, int i)
+{
+	int id = add_str(sd_reg[i].str);
+
+	if( !idb_exists(ri->pos, id) )
+		idb_iput(ri->pos, id, i + 1);
+	else //Names that only differ in case share the id, pc_reg_find falls back to scanning for them
+		ri->collision = true;
+}
+
+/// Rebuilds the index of a registry after it has been (re)loaded.
+void pc_reg_index_build(struct map_session_data *sd, int type)
+{
+	struct s_reg_index *ri;
+	struct global_reg *sd_reg;
+	int i, *num, max;
+
+	nullpo_retv(sd);
+
+	if( !(sd_reg = pc_reg_array(sd, type, &num, &max)) )
+		return;
+	ri = &sd->reg_index[type - 1];
+	if( ri->pos )
+		db_clear(ri->pos);
+	else
+		ri->pos = idb_alloc(DB_OPT_BASE);
+	if( ri->changes )
+		db_clear(ri->changes);
+	else
+		ri->changes = strdb_alloc(DB_OPT_DUP_KEY, 32);
+	ri->collision = false;
+	ri->full = false;
+	ri->saved_num = *num;
+	for( i = 0; i < *num; i++ )
+		pc_reg_index_put(ri, sd_reg, i);
+}
+
+/// Frees the indexes of the registries.
+void pc_reg_index_final(struct map_session_data *sd)
+{
+	int i;
+
+	nullpo_retv(sd);
+
+	for( i = 0; i < ARRAYLENGTH(sd->reg_index); i++ ) {
+		if( sd->reg_index[i].pos )
+			db_destroy(sd->reg_index[i].pos);
+		if( sd->reg_index[i].changes )
+			db_destroy(sd->reg_index[i].changes);
+		sd->reg_index[i].pos = NULL;
+		sd->reg_index[i].changes = NULL;
+	}
+}
+
+/// Variables written by the registry saves
+static struct {
+	unsigned int saves;
+	uint64 sent; // Variables sent
+	uint64 whole; // Rows a delete and reinsert of the whole registry would have written
+} pc_reg_stats;
+
+/// Forgets the changes of a registry once it has been sent to be saved.
+/// @param sent : Number of variables sent
+void pc_reg_saved(struct map_session_data *sd, int type, int sent)
+{
+	struct s_reg_index *ri;
+	int *num, max;
+
+	nullpo_retv(sd);
+
+	if( type < 1 || type > 3 || !pc_reg_array(sd, type, &num, &max) )
+		return;
+	ri = &sd->reg_index[type - 1];
+	if( ri->changes )
+		db_clear(ri->changes);
+	ri->full = false;
+	pc_reg_stats.saves++;
+	pc_reg_stats.sent += sent;
+	pc_reg_stats.whole += ri->saved_num + *num;
+	ri->saved_num = *num;
+}
+
+/// Shows the variables written by the registry saves.
+void pc_reg_report(void)
+{
+	if( pc_reg_stats.saves == 0 ) {
+		ShowInfo("No registry saves yet.\n");
+		return;
+	}
+	ShowInfo("Registry saves: %u, variables written per save: %.1f (whole registry rewrite: %.1f rows).\n",
+		pc_reg_stats.saves, (double)pc_reg_stats.sent / pc_reg_stats.saves, (double)pc_reg_stats.whole / pc_reg_stats.saves);
+}
+
+/// Returns the position of a variable in a registry, or -1 if it isn't set.
+static int pc_reg_find(struct map_session_data *sd, int type, const char *reg)
+{
+	struct s_reg_index *ri = &sd->reg_index[type - 1];
+	struct global_reg *sd_reg;
+	int i, *num, max;
+
+	sd_reg = pc_reg_array(sd, type, &num, &max);
+	if( ri->pos ) {
+		if( (i = idb_iget(ri->pos, add_str(reg))) && strcmp(sd_reg[i - 1].str, reg) == 0 )
+			return i - 1;
+		if( !ri->collision )
+			return -1;
 	}
-	if( max == -1 ) {
+	//No index yet or there are names that only differ in case
+	ARR_FIND(0, *num, i, strcmp(sd_reg[i].str, reg) == 0);
+	return (i < *num) ? i : -1;
+}
+
+/// Records a change of a registry.
+static void pc_reg_setchanged(struct map_session_data *sd, int type, const char *reg, bool deleted)
+{
+	struct s_reg_index *ri = &sd->reg_index[type - 1];
+
+	if( ri->changes )
+		strdb_iput(ri->changes, reg, (deleted ? REG_CHANGE_DEL : REG_CHANGE_SET));
+	sd->state.reg_dirty |= 1<<(type - 1); //Mark this registry as "need to be saved"
+}
+
+/// Adds a variable to a registry.
+static bool pc_reg_add(struct map_session_data *sd, int type, const char *reg, const char *value)
+{
+	struct s_reg_index *ri = &sd->reg_index[type - 1];
+	struct global_reg *sd_reg;
+	int i, *num, max;
+
+	sd_reg = pc_reg_array(sd, type, &num, &max);
+	if( *num >= max ) {
+		ShowError("pc_setregistry : couldn't set %s, limit of registries reached (%d)\n", reg, max);
+		return false;
+	}
+	i = (*num)++;
+	memset(&sd_reg[i], 0, sizeof(struct global_reg));
+	safestrncpy(sd_reg[i].str, reg, sizeof(sd_reg[i].str));
+	safestrncpy(sd_reg[i].value, value, sizeof(sd_reg[i].value));
+	if( ri->pos )
+		pc_reg_index_put(ri, sd_reg, i);
+	pc_reg_setchanged(sd, type, sd_reg[i].str, false);
+	return true;
+}
+
+/// Removes the variable at position i from a registry, moving the last one in its place.
+static void pc_reg_delete(struct map_session_data *sd, int type, int i)
+{
+	struct s_reg_index *ri = &sd->reg_index[type - 1];
+	struct global_reg *sd_reg;
+	int *num, max, last;
+
+	sd_reg = pc_reg_array(sd, type, &num, &max);
+	last = *num - 1;
+	pc_reg_setchanged(sd, type, sd_reg[i].str, true);
+	if( ri->pos ) {
+		int id = add_str(sd_reg[i].str);
+
+		if( idb_iget(ri->pos, id) == i + 1 )
+			idb_remove(ri->pos, id);
+		if( i != last ) {
+			id = add_str(sd_reg[last].str);
+			if( idb_iget(ri->pos, id) == last + 1 )
+				idb_iput(ri->pos, id, i + 1);
+		}
+	}
+	if( i != last )
+		memcpy(&sd_reg[i], &sd_reg[last], sizeof(struct global_reg));
+	memset(&sd_reg[last], 0, sizeof(struct global_reg));
+	(*num)--;
+}
+
+/// Applies a change of a registry saved by another server, without recording it as a change of this one.
+/// @param value : New value, empty to delete the variable
+void pc_reg_apply(struct map_session_data *sd, int type, const char *reg, const char *value)
+{
+	struct s_reg_index *ri;
+	struct global_reg *sd_reg;
+	DBMap *changes;
+	int i, *num, max;
+	unsigned int dirty;
+
+	nullpo_retv(sd);
+
+	if( !(sd_reg = pc_reg_array(sd, type, &num, &max)) || *num == -1 )
+		return;
+	ri = &sd->reg_index[type - 1];
+	changes = ri->changes;
+	dirty = sd->state.reg_dirty;
+	ri->changes = NULL;
+	i = pc_reg_find(sd, type, reg);
+	if( value[0] == '\0' ) {
+		if( i >= 0 )
+			pc_reg_delete(sd, type, i);
+	} else if( i >= 0 )
+		safestrncpy(sd_reg[i].value, value, sizeof(sd_reg[i].value));
+	else
+		pc_reg_add(sd, type, reg, value);
+	ri->changes = changes;
+	sd->state.reg_dirty = dirty;
+	ri->saved_num = *num;
+}
+
+int pc_readregistry(struct map_session_data *sd, const char *reg, int type)
+{
+	struct global_reg *sd_reg;
+	int i, *num, max;
+
+	nullpo_ret(sd);
+	if( !(sd_reg = pc_reg_array(sd, type, &num, &max)) )
+		return 0;
+	if( *num == -1 ) {
 		ShowError("pc_readregistry: Trying to read reg value %s (type %d) before it's been loaded!\n", reg, type);
 		//This really shouldn't happen, so it's possible the data was lost somewhere, we should request it again.
 		intif_request_registry(sd, (type == 3 ? 4 : type));
 		return 0;
 	}
 
-	ARR_FIND(0, max, i, strcmp(sd_reg[i].str,reg) == 0);
-	return (i < max) ? atoi(sd_reg[i].value) : 0;
+	i = pc_reg_find(sd, type, reg);
+	return (i >= 0) ? atoi(sd_reg[i].value) : 0;
 }
 
 char *pc_readregistry_str(struct map_session_data *sd, const char *reg, int type)
 {
 	struct global_reg *sd_reg;
-	int i, max;
+	int i, *num, max;
 
 	nullpo_ret(sd);
-	switch( type ) {
-		case 3: //Char reg
-			sd_reg = sd->save_reg.global;
-			max = sd->save_reg.global_num;
-			break;
-		case 2: //Account reg
-			sd_reg = sd->save_reg.account;
-			max = sd->save_reg.account_num;
-			break;
-		case 1: //Account2 reg
-			sd_reg = sd->save_reg.account2;
-			max = sd->save_reg.account2_num;
-			break;
-		default:
-			return NULL;
-	}
-	if( max == -1 ) {
+	if( !(sd_reg = pc_reg_array(sd, type, &num, &max)) )
+		return NULL;
+	if( *num == -1 ) {
 		ShowError("pc_readregistry: Trying to read reg value %s (type %d) before it's been loaded!\n", reg, type);
 		//This really shouldn't happen, so it's possible the data was lost somewhere, we should request it again.
 		intif_request_registry(sd, (type == 3 ? 4 : type));
 		return NULL;
 	}
 
-	ARR_FIND(0, max, i, strcmp(sd_reg[i].str,reg) == 0);
-	return (i < max) ? sd_reg[i].value : NULL;
+	i = pc_reg_find(sd, type, reg);
+	return (i >= 0) ? sd_reg[i].value : NULL;
 }
 
 bool pc_setregistry(struct map_session_data *sd, const char *reg, int val, int type)
 {
 	struct global_reg *sd_reg;
-	int i, *max, regmax;
+	int i, *num, max;
+	char value[12];
 
 	nullpo_retr(false,sd);
 
-	switch( type ) {
-		case 3: //Char reg
-			sd_reg = sd->save_reg.global;
-			max = &sd->save_reg.global_num;
-			regmax = GLOBAL_REG_NUM;
-			break;
-		case 2: //Account reg
-			sd_reg = sd->save_reg.account;
-			max = &sd->save_reg.account_num;
-			regmax = ACCOUNT_REG_NUM;
-			break;
-		case 1: //Account2 reg
-			sd_reg = sd->save_reg.account2;
-			max = &sd->save_reg.account2_num;
-			regmax = ACCOUNT_REG2_NUM;
-			break;
-		default:
-			return false;
-	}
-
-	if( *max == -1 ) {
+	if( !(sd_reg = pc_reg_array(sd, type, &num, &max)) )
+		return false;
+	if( *num == -1 ) {
 		ShowError("pc_setregistry : refusing to set %s (type %d) until vars are received.\n", reg, type);
 		return true;
 	}
 
+	i = pc_reg_find(sd, type, reg);
 	//Delete reg
 	if( !val ) {
-		ARR_FIND(0, *max, i, strcmp(sd_reg[i].str,reg) == 0);
-		if( i < *max ) {
-			if( i != *max - 1 )
-				memcpy(&sd_reg[i], &sd_reg[*max - 1], sizeof(struct global_reg));
-			memset(&sd_reg[*max - 1], 0, sizeof(struct global_reg));
-			(*max)--;
-			sd->state.reg_dirty |= 1<<(type - 1); //Mark this registry as "need to be saved"
-		}
+		if( i >= 0 )
+			pc_reg_delete(sd, type, i);
 		return true;
 	}
+
+	safesnprintf(value, sizeof(value), "%d", val);
 	//Change value if found
-	ARR_FIND(0, *max, i, strcmp(sd_reg[i].str,reg) == 0);
-	if( i < *max ) {
-		safesnprintf(sd_reg[i].value, sizeof(sd_reg[i].value), "%d", val);
-		sd->state.reg_dirty |= 1<<(type - 1);
+	if( i >= 0 ) {
+		if( strcmp(sd_reg[i].value, value) != 0 ) {
+			safestrncpy(sd_reg[i].value, value, sizeof(sd_reg[i].value));
+			pc_reg_setchanged(sd, type, sd_reg[i].str, false);
+		}
 		return true;
 	}
 
 	//Add value if not found
-	if( i < regmax ) {
-		memset(&sd_reg[i], 0, sizeof(struct global_reg));
-		safestrncpy(sd_reg[i].str, reg, sizeof(sd_reg[i].str));
-		safesnprintf(sd_reg[i].value, sizeof(sd_reg[i].value), "%d", val);
-		(*max)++;
-		sd->state.reg_dirty |= 1<<(type - 1);
-		return true;
-	}
-
-	ShowError("pc_setregistry : couldn't set %s, limit of registries reached (%d)\n", reg, regmax);
-	return false;
+	return pc_reg_add(sd, type, reg, value);
 }
 
 bool pc_setregistry_str(struct map_session_data *sd, const char *reg, const char *val, int type)
 {
 	struct global_reg *sd_reg;
-	int i, *max, regmax;
+	int i, *num, max;
 
 	nullpo_retr(false,sd);
 
@@ -9783,66 +10000,38 @@ bool pc_setregistry_str(struct map_session_data *sd, const char *reg, const char
 		return false;
 	}
 
-	switch (type) {
-		case 3: //Char reg
-			sd_reg = sd->save_reg.global;
-			max = &sd->save_reg.global_num;
-			regmax = GLOBAL_REG_NUM;
-			break;
-		case 2: //Account reg
-			sd_reg = sd->save_reg.account;
-			max = &sd->save_reg.account_num;
-			regmax = ACCOUNT_REG_NUM;
-			break;
-		case 1: //Account2 reg
-			sd_reg = sd->save_reg.account2;
-			max = &sd->save_reg.account2_num;
-			regmax = ACCOUNT_REG2_NUM;
-			break;
-		default:
-			return false;
-	}
-	if (*max == -1) {
+	if (!(sd_reg = pc_reg_array(sd, type, &num, &max)))
+		return false;
+	if (*num == -1) {
 		ShowError("pc_setregistry_str : refusing to set %s (type %d) until vars are received.\n", reg, type);
 		return false;
 	}
 
+	i = pc_reg_find(sd, type, reg);
 	//Delete reg
 	if (!val || strcmp(val,"") == 0) {
-		ARR_FIND(0, *max, i, strcmp(sd_reg[i].str, reg) == 0);
-		if (i < *max) {
-			if (i != *max - 1)
-				memcpy(&sd_reg[i], &sd_reg[*max - 1], sizeof(struct global_reg));
-			memset(&sd_reg[*max - 1], 0, sizeof(struct global_reg));
-			(*max)--;
-			sd->state.reg_dirty |= 1<<(type - 1); //Mark this registry as "need to be saved"
+		if (i >= 0) {
+			pc_reg_delete(sd, type, i);
 			if (type != 3) intif_saveregistry(sd, type);
 		}
 		return true;
 	}
 
 	//Change value if found
-	ARR_FIND(0, *max, i, strcmp(sd_reg[i].str, reg) == 0);
-	if (i < *max) {
-		safestrncpy(sd_reg[i].value, val, sizeof(sd_reg[i].value));
-		sd->state.reg_dirty |= 1<<(type - 1); //Mark this registry as "need to be saved"
-		if (type != 3) intif_saveregistry(sd, type);
+	if (i >= 0) {
+		if (strncmp(sd_reg[i].value, val, sizeof(sd_reg[i].value) - 1) != 0) {
+			safestrncpy(sd_reg[i].value, val, sizeof(sd_reg[i].value));
+			pc_reg_setchanged(sd, type, sd_reg[i].str, false);
+			if (type != 3) intif_saveregistry(sd, type);
+		}
 		return true;
 	}
 
 	//Add value if not found
-	if (i < regmax) {
-		memset(&sd_reg[i], 0, sizeof(struct global_reg));
-		safestrncpy(sd_reg[i].str, reg, sizeof(sd_reg[i].str));
-		safestrncpy(sd_reg[i].value, val, sizeof(sd_reg[i].value));
-		(*max)++;
-		sd->state.reg_dirty |= 1<<(type - 1); //Mark this registry as "need to be saved"
-		if (type != 3) intif_saveregistry(sd, type);
-		return true;
-	}
-
-	ShowError("pc_setregistry : couldn't set %s, limit of registries reached (%d)\n", reg, regmax);
-	return false;
+	if (!pc_reg_add(sd, type, reg, val))
+		return false;
+	if (type != 3) intif_saveregistry(sd, type);
+	return true;
 }
 
 /**
@@ -11105,48 +11294,166 @@ void pc_setsavepoint(struct map_session_data *sd, short mapindex,int x,int y)
 }
 
 /*==========================================
- * Save 1 player data  at autosave intervalle
+ * Autosave queue
+ * Players are saved from the head and requeued at the tail, so each one
+ * waits for all the others before its next autosave.
  *------------------------------------------*/
-static TIMER_FUNC(pc_autosave)
+static struct {
+	struct map_session_data *head, *tail;
+	int count;
+	double credit; //Saves due but not done yet
+	double rate_credit; //Saves allowed by the rate limit
+	unsigned int last_tick;
+	//Since the previous report
+	unsigned int saves, unchanged, limited;
+	uint64 interval_total; //Time between the autosaves of the saved players
+	unsigned int interval_max;
+} pc_autosave_queue;
+
+/// Adds a player at the end of the autosave queue.
+void pc_autosave_enqueue(struct map_session_data *sd)
 {
-	int interval;
-	struct s_mapiterator *iter;
-	struct map_session_data *sd;
-	static int last_save_id = 0, save_flag = 0;
+	nullpo_retv(sd);
 
-	if (save_flag == 2) //Someone was saved on last call, normal cycle
-		save_flag = 0;
+	if( sd->state.autosave_queued )
+		return;
+	sd->autosave_prev = pc_autosave_queue.tail;
+	sd->autosave_next = NULL;
+	if( pc_autosave_queue.tail )
+		pc_autosave_queue.tail->autosave_next = sd;
 	else
-		save_flag = 1; //Noone was saved, so save first found char
+		pc_autosave_queue.head = sd;
+	pc_autosave_queue.tail = sd;
+	pc_autosave_queue.count++;
+	sd->state.autosave_queued = 1;
+	sd->autosave_tick = gettick();
+}
 
-	iter = mapit_getallusers();
-	for (sd = (TBL_PC *)mapit_first(iter); mapit_exists(iter); sd = (TBL_PC *)mapit_next(iter)) {
-		if (!sd->state.pc_loaded)
-			continue; //Player data hasn't fully loaded
-		if (sd->bl.id == last_save_id && save_flag != 1) {
-			save_flag = 1;
-			continue;
+/// Removes a player from the autosave queue.
+void pc_autosave_dequeue(struct map_session_data *sd)
+{
+	nullpo_retv(sd);
+
+	if( !sd->state.autosave_queued )
+		return;
+	if( sd->autosave_prev )
+		sd->autosave_prev->autosave_next = sd->autosave_next;
+	else
+		pc_autosave_queue.head = sd->autosave_next;
+	if( sd->autosave_next )
+		sd->autosave_next->autosave_prev = sd->autosave_prev;
+	else
+		pc_autosave_queue.tail = sd->autosave_prev;
+	sd->autosave_prev = sd->autosave_next = NULL;
+	pc_autosave_queue.count--;
+	sd->state.autosave_queued = 0;
+}
+
+/// Hash of the items of an inventory, to tell whether it changed since the previous autosave (FNV-1a).
+static uint64 pc_autosave_hash(const struct item *items, int count)
+{
+	const uint8 *p = (const uint8 *)items, *end = p + count * sizeof(struct item);
+	uint64 hash = 14695981039346656037ULL;
+
+	for( ; p < end; p++ )
+		hash = (hash ^ *p) * 1099511628211ULL;
+	return hash ? hash : 1; //0 is "unknown"
+}
+
+/// Remembers the inventory and cart sent by chrif_save, so that the autosave skips them while they stay the same.
+/// Any save counts, not only the autosave, since the char-server keeps the latest one.
+void pc_autosave_sent(struct map_session_data *sd, int flag)
+{
+	nullpo_retv(sd);
+
+	if( !chrif_isconnected() ) //chrif_save drops the save while the link is down
+		return;
+	if( flag&CSAVE_INVENTORY )
+		sd->autosave_hash[0] = pc_autosave_hash(sd->inventory.u.items_inventory, MAX_INVENTORY);
+	if( flag&CSAVE_CART )
+		sd->autosave_hash[1] = pc_autosave_hash(sd->cart.u.items_cart, MAX_CART);
+}
+
+/// Autosaves a player, skipping the inventory and cart when they didn't change.
+static void pc_autosave_sub(struct map_session_data *sd, unsigned int tick)
+{
+	enum e_chrif_save_opt flag = CSAVE_NORMAL;
+
+	if( pc_autosave_hash(sd->inventory.u.items_inventory, MAX_INVENTORY) != sd->autosave_hash[0] )
+		flag |= CSAVE_INVENTORY;
+	if( pc_autosave_hash(sd->cart.u.items_cart, MAX_CART) != sd->autosave_hash[1] )
+		flag |= CSAVE_CART;
+	if( flag == CSAVE_NORMAL )
+		pc_autosave_queue.unchanged++;
+
+	pc_autosave_queue.saves++;
+	pc_autosave_queue.interval_total += DIFF_TICK(tick, sd->autosave_tick);
+	pc_autosave_queue.interval_max = max(pc_autosave_queue.interval_max, (unsigned int)DIFF_TICK(tick, sd->autosave_tick));
+	sd->autosave_tick = tick;
+
+	if( pc_isvip(sd) ) //Check if we're still vip
+		chrif_req_login_operation(sd->status.account_id, sd->status.name, CHRIF_OP_LOGIN_VIP, 0, 0x1);
+	chrif_save(sd, flag);
+}
+
+/// Autosaves allowed per second: autosave_rate, or one per minsave_interval.
+static double pc_autosave_rate(void)
+{
+	return (autosave_rate > 0 ? autosave_rate : 1000. / minsave_interval);
+}
+
+/*==========================================
+ * Save players at autosave intervalle
+ * Saves are spread so that each player in the queue is saved once per autosave_interval,
+ * within the rate limit.
+ *------------------------------------------*/
+static TIMER_FUNC(pc_autosave)
+{
+	int elapsed = DIFF_TICK(tick, pc_autosave_queue.last_tick);
+	double rate = pc_autosave_rate();
+
+	pc_autosave_queue.last_tick = tick;
+	if( elapsed > 0 && pc_autosave_queue.count > 0 ) {
+		pc_autosave_queue.credit = min(pc_autosave_queue.credit + (double)pc_autosave_queue.count * elapsed / autosave_interval, pc_autosave_queue.count);
+		pc_autosave_queue.rate_credit = min(pc_autosave_queue.rate_credit + rate * elapsed / 1000, max(rate, 1));
+	}
+
+	while( pc_autosave_queue.credit >= 1 && pc_autosave_queue.head ) {
+		struct map_session_data *sd = pc_autosave_queue.head;
+
+		if( pc_autosave_queue.rate_credit < 1 ) {
+			pc_autosave_queue.limited++;
+			break;
 		}
-		if (save_flag != 1) //Not our turn to save yet
-			continue;
-		//Save char
-		last_save_id = sd->bl.id;
-		save_flag = 2;
-		if (pc_isvip(sd)) //Check if we're still vip
-			chrif_req_login_operation(sd->status.account_id,sd->status.name,CHRIF_OP_LOGIN_VIP,0,0x1);
-		chrif_save(sd,CSAVE_INVENTORY|CSAVE_CART);
-		break;
+		pc_autosave_queue.rate_credit--;
+		pc_autosave_queue.credit--;
+		//Requeue at the tail
+		pc_autosave_dequeue(sd);
+		pc_autosave_enqueue(sd);
+		pc_autosave_sub(sd, tick);
 	}
-	mapit_free(iter);
+	if( pc_autosave_queue.count == 0 )
+		pc_autosave_queue.credit = pc_autosave_queue.rate_credit = 0;
 
-	interval = autosave_interval / (map_usercount() + 1);
-	if (interval < minsave_interval)
-		interval = minsave_interval;
-	add_timer(gettick() + interval,pc_autosave,0,0);
+	add_timer(gettick() + minsave_interval, pc_autosave, 0, 0);
 
 	return 0;
 }
 
+/// Shows the autosave queue and the autosaves since the previous report.
+void pc_autosave_report(void)
+{
+	ShowInfo("Autosave queue: %d players, autosave_time %d s, rate limit %.1f/s.\n", pc_autosave_queue.count, autosave_interval / 1000, pc_autosave_rate());
+	if( pc_autosave_queue.saves )
+		ShowInfo("Autosaves: %u (%u with inventory and cart unchanged), interval between saves of a player: average %" PRIu64 " ms, max %u ms. Held back by the rate limit %u times.\n",
+			pc_autosave_queue.saves, pc_autosave_queue.unchanged, pc_autosave_queue.interval_total / pc_autosave_queue.saves, pc_autosave_queue.interval_max, pc_autosave_queue.limited);
+	else
+		ShowInfo("No autosaves since the previous report.\n");
+	pc_autosave_queue.saves = pc_autosave_queue.unchanged = pc_autosave_queue.limited = 0;
+	pc_autosave_queue.interval_total = 0;
+	pc_autosave_queue.interval_max = 0;
+}
+
 static int pc_daynight_timer_sub(struct map_session_data *sd,va_list ap)
 {
 	if (sd->state.night != night_flag && mapdata[sd->bl.m].flag.nightenabled) { //Night/day state does not match
@@ -12384,6 +12691,7 @@ void pc_scdata_received(struct map_session_data *sd) {
 
 	clif_weight_limit(sd);
 	sd->state.pc_loaded = true;
+	pc_autosave_enqueue(sd);
 
 	if( !sd->state.connect_new && sd->fd ) { //Character already loaded map! Gotta trigger LoadEndAck manually
 		sd->state.connect_new = 1;
@@ -13490,7 +13798,8 @@ void do_init_pc(void) {
 	add_timer_func_list(pc_expiration_timer, "pc_expiration_timer");
 	add_timer_func_list(pc_autotrade_timer, "pc_autotrade_timer");
 
-	add_timer(gettick() + autosave_interval, pc_autosave, 0, 0);
+	pc_autosave_queue.last_tick = gettick();
+	add_timer(gettick() + minsave_interval, pc_autosave, 0, 0);
 
 	//0 = day, 1 = night [Yor]
 	night_flag = battle_config.night_at_start ? 1 : 0;
@@ -201,6 +201,20 @@ struct weapon_data {
 	struct s_item_bonus_ele2 adddefele2[MAX_PC_BONUS];
 };
 
+enum e_reg_change {
+	REG_CHANGE_SET = 1, //Added or modified since the last save
+	REG_CHANGE_DEL, //Deleted since the last save
+};
+
+/// Index of a permanent registry (save_reg arrays)
+struct s_reg_index {
+	DBMap *pos; // int name id (add_str) -> position in the array + 1
+	DBMap *changes; // char *name -> enum e_reg_change
+	bool collision; // Some names only differ in case (share the id)
+	bool full; // Send the whole registry on the next save (changes may have been lost)
+	int saved_num; // Number of variables at the last load/save
+};
+
 struct map_session_data {
 	struct block_list bl;
 	struct unit_data ud;
@@ -226,6 +240,7 @@ struct map_session_data {
 		unsigned int autocast : 1; //Autospell flag [Inkfish]
 		unsigned int autotrade : 3; //&2 Requested by vending autotrade; &4 Requested by buyingstore autotrade [Fantik]
 		unsigned int reg_dirty : 4; //Marks whether registry variables have been saved or not yet [Skotlex]
+		unsigned int autosave_queued : 1; //In the autosave queue (pc_autosave)
 		unsigned int showdelay : 1;
 		unsigned int showexp : 1;
 		unsigned int showzeny : 1;
@@ -296,6 +311,11 @@ struct map_session_data {
 
 	int langtype;
 	struct mmo_charstatus status;
+	struct mmo_charstatus *save_status; //Character data as last sent to the char-server, base of the delta saves
+	uint32 save_version; //Version of save_status held by the char-server (0: the next save is sent whole)
+	struct map_session_data *autosave_prev, *autosave_next; //Autosave queue
+	unsigned int autosave_tick; //Tick of the previous autosave, or of the login
+	uint64 autosave_hash[2]; //Hash of the inventory and cart sent by the previous save (0: unknown, see pc_autosave_sent)
 	struct registry save_reg;
 
 	//Item Storages
@@ -309,6 +329,7 @@ struct map_session_data {
 	unsigned int weight,max_weight,add_max_weight;
 	int cart_weight,cart_num,cart_weight_max;
 	int fd;
+	unsigned short status_dirty; //Coalesced clif_updatestatus fields waiting to be sent at the end of the tick
 	unsigned short mapindex;
 	unsigned char head_dir; //0: Look forward. 1: Look right, 2: Look left.
 	unsigned int client_tick;
@@ -512,6 +533,9 @@ struct map_session_data {
 
 	struct script_reg *reg;
 	struct script_regstr *regstr;
+	DBMap *reg_db; // int uid -> position in reg + 1
+	DBMap *regstr_db; // int uid -> position in regstr + 1
+	struct s_reg_index reg_index[3]; // Permanent registries by type - 1 (account2, account, char)
 
 	int trade_partner;
 	struct s_deal {
@@ -1120,6 +1144,16 @@ bool pc_setparam(struct map_session_data *sd, int type, int val);
 int pc_readreg(struct map_session_data *sd, int reg);
 bool pc_setreg(struct map_session_data *sd, int reg, int val);
 char *pc_readregstr(struct map_session_data *sd, int reg);
+void pc_reg_index_build(struct map_session_data *sd, int type);
+void pc_reg_index_final(struct map_session_data *sd);
+void pc_reg_saved(struct map_session_data *sd, int type, int sent);
+void pc_reg_apply(struct map_session_data *sd, int type, const char *reg, const char *value);
+void pc_reg_report(void);
+void pc_autosave_enqueue(struct map_session_data *sd);
+void pc_autosave_dequeue(struct map_session_data *sd);
+void pc_autosave_sent(struct map_session_data *sd, int flag);
+void pc_autosave_report(void);
+int pc_readreg_arraysize(struct map_session_data *sd, int id, int idx, bool isstring);
 bool pc_setregstr(struct map_session_data *sd, int reg, const char *str);
 
 #define pc_readglobalreg(sd,reg) pc_readregistry(sd,reg,3)
@@ -170,6 +170,10 @@
 			(t) = script_getnum(st,n);
 
 #define SCRIPT_MAX_ARRAYSIZE 128 /// Maximum amount of elements in script arrays
+/// Array member bitmaps are stored in the variable storage under the indexes past the last element
+#define SCRIPT_ARRAY_WORDS (SCRIPT_MAX_ARRAYSIZE / 32)
+/// Returns if the uid uses an index reserved for the array member bitmaps
+#define reference_uid_isreserved(uid) ( ((uint32)(uid)>>24) >= SCRIPT_MAX_ARRAYSIZE )
 #define SCRIPT_CMD_SUCCESS 0 /// When a buildin cmd was correctly done
 #define SCRIPT_CMD_FAILURE 1 /// When an errors appear in cmd, show_debug will follow
 
@@ -312,6 +316,9 @@ int str_hash[SCRIPT_HASH_SIZE];
 static DBMap *scriptlabel_db = NULL; // const char *label_name -> int script_pos
 static DBMap *userfunc_db = NULL; // const char *func_name -> struct script_code*
 static int parse_options = 0;
+static int parse_warnings = 0; // Warnings shown while compiling the current script
+static int *parse_userfuncs = NULL; // Global functions called by name by the current script (str_data ids)
+static int parse_userfunc_count = 0, parse_userfunc_max = 0;
 DBMap *script_get_label_db(void){ return scriptlabel_db; }
 DBMap *script_get_userfunc_db(void){ return userfunc_db; }
 
@@ -321,6 +328,14 @@ static int buildin_callsub_ref = 0;
 static int buildin_callfunc_ref = 0;
 static int buildin_getelementofarray_ref = 0;
 
+/// Time slicing of long running scripts, see script_config.timeslice
+static struct {
+	unsigned int preempted; // Times a script was suspended
+	unsigned int finished; // Scripts suspended at least once that ended
+	unsigned int max_slices; // Most slices used by one of them
+} script_timeslice_stats;
+static int script_run_depth = 0; // Nesting of run_script_main (scripts run from a command)
+
 // Caches compiled autoscript item code
 // NOTE: This is not cleared when reloading itemdb
 static DBMap *autobonus_db = NULL; // char *script -> char *bytecode
@@ -329,6 +344,9 @@ struct Script_Config script_config = {
 	1, //warn_func_mismatch_argtypes
 	1, 65535, 2048, //warn_func_mismatch_paramnum/check_cmdcount/check_gotocount
 	0, INT_MAX, //input_min_value/input_max_value
+	true, "script_cache.dat", //script_cache/script_cache_file
+	SCRIPT_PROF_OFF, 100, //profiler/profiler_sample_rate
+	0, //timeslice
 	// NOTE: None of these event labels should be longer than <EVENT_NAME_LENGTH> characters
 	// PC related
 	"OnPCDieEvent", //die_event_name
@@ -441,6 +459,12 @@ int potion_target = 0;
 
 c_op get_com(unsigned char *script,int *pos);
 int get_num(unsigned char *script,int *pos);
+static void script_build_insn(struct script_code *code);
+static enum c_op script_decode_op(const unsigned char *buf, int *pos, int *val);
+static void script_query_sql_async_abandon(struct script_state *st);
+
+#define QUERY_SQL_ASYNC_POLL 1000 //Interval (ms) in which a suspended script checks its query, the query callback normally resumes it right away
+static int query_sql_async_pending = 0; //Number of queries being waited on
 
 typedef struct script_function {
 	int (*func)(struct script_state *st);
@@ -743,6 +767,7 @@ static void disp_error_message2(const char *mes,const char *pos,int report)
 #define disp_error_message(mes,pos) disp_error_message2(mes,pos,1)
 
 static void disp_warning_message(const char *mes, const char *pos) {
+	parse_warnings++;
 	script_warning(parser_current_src,parser_current_file,parser_current_line,mes,pos);
 }
 
@@ -1091,6 +1116,13 @@ static const char *parse_callfunc(const char *p, int require_paren, int is_custo
 		if( !is_custom && strdb_get(userfunc_db, name) == NULL )
 			disp_error_message("parse_line: expect command, missing function name or calling undeclared function",p);
 		else {
+			if( !is_custom ) { //The script cache checks that it still exists
+				if( parse_userfunc_count == parse_userfunc_max ) {
+					parse_userfunc_max += 16;
+					RECREATE(parse_userfuncs, int, parse_userfunc_max);
+				}
+				parse_userfuncs[parse_userfunc_count++] = func;
+			}
 			add_scriptl(buildin_callfunc_ref);
 			add_scriptc(C_ARG);
 			add_scriptc(C_STR);
@@ -2501,29 +2533,38 @@ void script_warning(const char *src, const char *file, int start_line, const cha
 /*==========================================
  * Analysis of the script
  *------------------------------------------*/
+/// Registers the built-in functions and constants the first time a script is parsed.
+static void parse_script_init(void)
+{
+	static bool first = true;
+
+	if( first ) {
+		add_buildin_func();
+		read_constdb();
+		script_hardcoded_constants();
+		first = false;
+	}
+}
+
 struct script_code *parse_script(const char *src, const char *file, int line, int options)
 {
 	const char *p, *tmpp;
 	int i;
 	struct script_code *code = NULL;
-	static int first = 1;
 	char end;
 	bool unresolved_names = false;
 
 	parser_current_src = src;
 	parser_current_file = file;
 	parser_current_line = line;
+	parse_warnings = 0;
+	parse_userfunc_count = 0;
 
 	if( src == NULL )
 		return NULL; //Empty script
 
 	memset(&syntax,0,sizeof(syntax));
-	if( first ) {
-		add_buildin_func();
-		read_constdb();
-		script_hardcoded_constants();
-		first = 0;
-	}
+	parse_script_init();
 
 	script_buf = (unsigned char *)aMalloc(SCRIPT_BLOCK_SIZE * sizeof(unsigned char));
 	script_pos = 0;
@@ -2688,9 +2729,428 @@ struct script_code *parse_script(const char *src, const char *file, int line, in
 	code->script_buf  = script_buf;
 	code->script_size = script_size;
 	code->script_vars = idb_alloc(DB_OPT_RELEASE_DATA);
+	script_build_insn(code);
 	return code;
 }
 
+/*==========================================
+ * Compiled script cache
+ * Keeps the byte code of the NPC scripts between runs, keyed by
+ * the hash of their source, so unchanged scripts are not parsed
+ * again at startup and on @reloadscript.
+ * The str_data ids referenced by the byte code are stored as names
+ * and interned again when the script is loaded from the cache.
+ * Scripts that compile with warnings are not cached, so the warnings
+ * are shown on every load.
+ *------------------------------------------*/
+#define SCRIPT_CACHE_MAGIC "IDASCRC"
+#define SCRIPT_CACHE_VERSION 2
+
+struct script_cache_entry {
+	uint64 hash; // Hash of the source
+	uint32 src_len; // Length of the source
+	int options; // Parse options
+	bool used; // Used by the current load, saved back to the file
+	uint32 len;
+	unsigned char *data; // Serialized script (see script_cache_store), allocated with the entry
+};
+
+static DBMap *script_cache_db = NULL; // char *key -> struct script_cache_entry*
+static uint64 script_cache_fingerprint;
+static int script_cache_hits, script_cache_misses, script_cache_warned;
+
+/// FNV-1a
+static uint64 script_cache_hash(const void *data, size_t len, uint64 hash)
+{
+	const unsigned char *p = (const unsigned char *)data;
+
+	while( len-- ) {
+		hash ^= *p++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/// Fingerprint of everything the byte code depends on besides the source:
+/// the cache format, the build of the compiler, built-in functions and their
+/// arguments, parameters and constants.
+/// Global functions are checked per script (see script_cache_restore).
+static uint64 script_cache_compute_fingerprint(void)
+{
+	static const char build[] = __DATE__ " " __TIME__; //Any rebuild of the compiler invalidates the cache
+	uint64 hash = script_cache_hash(SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC), 0xcbf29ce484222325ULL);
+	int i, version = SCRIPT_CACHE_VERSION;
+
+	hash = script_cache_hash(&version, sizeof(version), hash);
+	hash = script_cache_hash(build, sizeof(build), hash);
+	for( i = LABEL_START; i < str_num; i++ ) {
+		const char *name;
+
+		if( str_data[i].type != C_INT && str_data[i].type != C_PARAM && str_data[i].type != C_FUNC )
+			continue;
+		name = get_str(i);
+		hash = script_cache_hash(name, strlen(name) + 1, hash);
+		hash = script_cache_hash(&str_data[i].type, sizeof(str_data[i].type), hash);
+		hash = script_cache_hash(&str_data[i].val, sizeof(str_data[i].val), hash);
+		if( str_data[i].type == C_FUNC )
+			hash = script_cache_hash(buildin_func[str_data[i].val].arg, strlen(buildin_func[str_data[i].val].arg) + 1, hash);
+	}
+	return hash;
+}
+
+static void script_cache_key(char *key, size_t size, uint64 hash, uint32 src_len, int options)
+{
+	safesnprintf(key, size, "%016"PRIx64"%08x%08x", hash, src_len, (unsigned int)options);
+}
+
+static struct script_cache_entry *script_cache_create(uint64 hash, uint32 src_len, int options, uint32 len)
+{
+	struct script_cache_entry *entry = (struct script_cache_entry *)aMalloc(sizeof(struct script_cache_entry) + len);
+	char key[33];
+
+	entry->hash = hash;
+	entry->src_len = src_len;
+	entry->options = options;
+	entry->used = false;
+	entry->len = len;
+	entry->data = (unsigned char *)(entry + 1);
+	script_cache_key(key, sizeof(key), hash, src_len, options);
+	strdb_put(script_cache_db, key, entry);
+	return entry;
+}
+
+/// Serializes a freshly compiled script into the cache.
+/// Layout: <code size>.L <name count>.L <label count>.L <function count>.L <code>.?B { <name>.?B }*name count
+///         { <pos>.L <label>.?B }*label count { <function>.?B }*function count
+/// C_NAME operands in the code are replaced by their index in the name list.
+/// The functions are the global functions the script calls by name (see parse_callfunc).
+static void script_cache_store(uint64 hash, uint32 src_len, int options, struct script_code *code)
+{
+	struct script_cache_entry *entry;
+	DBMap *name_db = idb_alloc(DB_OPT_BASE); // str_data id -> name index + 1
+	int *names = NULL, name_count = 0, name_max = 0;
+	uint32 len, label_count = 0, val32;
+	unsigned char *p;
+	int pos, val, i;
+
+	len = 16 + code->script_size;
+	for( i = 0; i < parse_userfunc_count; i++ )
+		len += (uint32)strlen(get_str(parse_userfuncs[i])) + 1;
+	for( pos = 0; pos < code->script_size; ) {
+		if( script_decode_op(code->script_buf, &pos, &val) != C_NAME || idb_iget(name_db, val) )
+			continue;
+		if( name_count == name_max ) {
+			name_max += 64;
+			RECREATE(names, int, name_max);
+		}
+		names[name_count++] = val;
+		idb_iput(name_db, val, name_count);
+		len += (uint32)strlen(get_str(val)) + 1;
+	}
+	if( options&SCRIPT_USE_LABEL_DB ) {
+		DBIterator *iter = db_iterator(scriptlabel_db);
+		DBKey key;
+
+		for( iter->first(iter, &key); iter->exists(iter); iter->next(iter, &key) ) {
+			len += 4 + (uint32)strlen(key.str) + 1;
+			label_count++;
+		}
+		dbi_destroy(iter);
+	}
+
+	entry = script_cache_create(hash, src_len, options, len);
+	p = entry->data;
+	val32 = code->script_size; memcpy(p, &val32, 4); p += 4;
+	val32 = name_count; memcpy(p, &val32, 4); p += 4;
+	memcpy(p, &label_count, 4); p += 4;
+	val32 = parse_userfunc_count; memcpy(p, &val32, 4); p += 4;
+	memcpy(p, code->script_buf, code->script_size);
+	for( pos = 0; pos < code->script_size; ) {
+		if( script_decode_op(code->script_buf, &pos, &val) == C_NAME )
+			SETVALUE(p, pos - 3, idb_iget(name_db, val) - 1);
+	}
+	p += code->script_size;
+	for( i = 0; i < name_count; i++ ) {
+		const char *name = get_str(names[i]);
+		size_t n = strlen(name) + 1;
+
+		memcpy(p, name, n);
+		p += n;
+	}
+	if( label_count ) {
+		DBIterator *iter = db_iterator(scriptlabel_db);
+		DBKey key;
+		DBData *data;
+
+		for( data = iter->first(iter, &key); iter->exists(iter); data = iter->next(iter, &key) ) {
+			size_t n = strlen(key.str) + 1;
+
+			val32 = db_data2i(data);
+			memcpy(p, &val32, 4);
+			memcpy(p + 4, key.str, n);
+			p += 4 + n;
+		}
+		dbi_destroy(iter);
+	}
+	for( i = 0; i < parse_userfunc_count; i++ ) {
+		const char *name = get_str(parse_userfuncs[i]);
+		size_t n = strlen(name) + 1;
+
+		memcpy(p, name, n);
+		p += n;
+	}
+	entry->used = true;
+
+	aFree(names);
+	db_destroy(name_db);
+}
+
+/// Rebuilds a script from its cache entry.
+/// Returns NULL if the entry is corrupted, or if a global function it calls no longer exists.
+/// The script is then compiled again, which reports the missing function.
+static struct script_code *script_cache_restore(struct script_cache_entry *entry)
+{
+	const unsigned char *p = entry->data, *end = entry->data + entry->len;
+	const char **names = NULL;
+	struct script_code *code;
+	unsigned char *buf = NULL;
+	uint32 size, name_count, label_count, userfunc_count, i;
+	int pos, val;
+
+	if( entry->len < 16 )
+		return NULL;
+	memcpy(&size, p, 4);
+	memcpy(&name_count, p + 4, 4);
+	memcpy(&label_count, p + 8, 4);
+	memcpy(&userfunc_count, p + 12, 4);
+	p += 16;
+	if( size == 0 || size >= (1<<24) || size > (uint32)(end - p) || p[size - 1] != C_NOP || name_count > entry->len )
+		return NULL;
+
+	//Padded so that decoding a truncated operand stays in the buffer
+	buf = (unsigned char *)aCalloc(size + 4, sizeof(unsigned char));
+	memcpy(buf, p, size);
+	p += size;
+	if( name_count )
+		CREATE(names, const char *, name_count);
+	for( i = 0; i < name_count; i++ ) {
+		const unsigned char *nul = (const unsigned char *)memchr(p, '\0', end - p);
+
+		if( !nul )
+			goto fail;
+		names[i] = (const char *)p;
+		p = nul + 1;
+	}
+
+	for( pos = 0; pos < (int)size; ) {
+		if( script_decode_op(buf, &pos, &val) == C_NAME ) {
+			int id;
+
+			if( val < 0 || (uint32)val >= name_count )
+				goto fail;
+			id = add_str(names[val]);
+			if( str_data[id].type == C_NOP ) { //Unknown references default to variables, as in parse_script
+				str_data[id].type = C_NAME;
+				str_data[id].label = id;
+			}
+			SETVALUE(buf, pos - 3, id);
+		}
+	}
+	if( pos != (int)size )
+		goto fail;
+
+	if( entry->options&SCRIPT_USE_LABEL_DB ) {
+		db_clear(scriptlabel_db);
+		for( i = 0; i < label_count; i++ ) {
+			const unsigned char *nul;
+
+			if( end - p < 5 || !(nul = (const unsigned char *)memchr(p + 4, '\0', end - p - 4)) )
+				goto fail;
+			memcpy(&val, p, 4);
+			strdb_iput(scriptlabel_db, get_str(add_str((const char *)p + 4)), val);
+			p = nul + 1;
+		}
+	}
+	for( i = 0; i < userfunc_count; i++ ) {
+		const unsigned char *nul = (const unsigned char *)memchr(p, '\0', end - p);
+
+		if( !nul || strdb_get(userfunc_db, (const char *)p) == NULL )
+			goto fail;
+		p = nul + 1;
+	}
+
+	aFree(names);
+	CREATE(code, struct script_code, 1);
+	code->script_buf = buf;
+	code->script_size = size;
+	code->script_vars = idb_alloc(DB_OPT_RELEASE_DATA);
+	script_build_insn(code);
+	return code;
+
+fail:
+	if( entry->options&SCRIPT_USE_LABEL_DB )
+		db_clear(scriptlabel_db);
+	aFree(names);
+	aFree(buf);
+	return NULL;
+}
+
+/// Parses a script whose source ends at src_end, reusing the cached byte code when the source didn't change.
+/// Falls back to parse_script when the cache isn't loaded.
+struct script_code *parse_script_cached(const char *src, const char *src_end, const char *file, int line, int options)
+{
+	struct script_cache_entry *entry;
+	struct script_code *code;
+	char key[33];
+	uint32 src_len;
+	uint64 hash;
+
+	if( !script_cache_db || !src || src_end < src )
+		return parse_script(src, file, line, options);
+
+	src_len = (uint32)(src_end - src);
+	hash = script_cache_hash(src, src_len, script_cache_fingerprint);
+	script_cache_key(key, sizeof(key), hash, src_len, options);
+	if( (entry = (struct script_cache_entry *)strdb_get(script_cache_db, key)) && (code = script_cache_restore(entry)) ) {
+		entry->used = true;
+		script_cache_hits++;
+		return code;
+	}
+
+	if( (code = parse_script(src, file, line, options)) ) {
+		if( parse_warnings )
+			script_cache_warned++;
+		else {
+			script_cache_store(hash, src_len, options, code);
+			script_cache_misses++;
+		}
+	}
+	return code;
+}
+
+/// Loads the compiled script cache, called before the npc files are parsed.
+void script_cache_load(void)
+{
+	char magic[sizeof(SCRIPT_CACHE_MAGIC)];
+	uint32 version, count, i;
+	uint64 fingerprint;
+	FILE *fp;
+
+	script_cache_final();
+	if( !script_config.script_cache )
+		return;
+
+	parse_script_init();
+	script_cache_fingerprint = script_cache_compute_fingerprint();
+	script_cache_db = strdb_alloc((DBOptions)(DB_OPT_DUP_KEY|DB_OPT_RELEASE_DATA), 0);
+	script_cache_hits = script_cache_misses = script_cache_warned = 0;
+
+	if( !(fp = fopen(script_config.script_cache_file, "rb")) )
+		return;
+
+	if( fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, SCRIPT_CACHE_MAGIC, sizeof(magic)) ||
+		fread(&version, sizeof(version), 1, fp) != 1 || version != SCRIPT_CACHE_VERSION ||
+		fread(&fingerprint, sizeof(fingerprint), 1, fp) != 1 || fingerprint != script_cache_fingerprint ||
+		fread(&count, sizeof(count), 1, fp) != 1 )
+	{
+		ShowInfo("Script cache '"CL_WHITE"%s"CL_RESET"' is outdated, all scripts will be compiled.\n", script_config.script_cache_file);
+		fclose(fp);
+		return;
+	}
+
+	for( i = 0; i < count; i++ ) {
+		struct script_cache_entry *entry;
+		uint64 hash;
+		uint32 src_len, len;
+		int options;
+
+		if( fread(&hash, sizeof(hash), 1, fp) != 1 || fread(&src_len, sizeof(src_len), 1, fp) != 1 ||
+			fread(&options, sizeof(options), 1, fp) != 1 || fread(&len, sizeof(len), 1, fp) != 1 || len > (1<<26) )
+			break;
+		entry = script_cache_create(hash, src_len, options, len);
+		if( fread(entry->data, 1, len, fp) != len ) {
+			char key[33];
+
+			script_cache_key(key, sizeof(key), hash, src_len, options);
+			strdb_remove(script_cache_db, key);
+			break;
+		}
+	}
+	if( i < count )
+		ShowWarning("script_cache_load: Cache file '%s' is truncated, read %u of %u scripts.\n", script_config.script_cache_file, i, count);
+	fclose(fp);
+}
+
+/// Writes the scripts used by this load back to the cache file and releases the cache.
+/// Scripts that are no longer in any npc file are dropped.
+void script_cache_save(void)
+{
+	DBIterator *iter;
+	struct script_cache_entry *entry;
+	char tmpfile[sizeof(script_config.script_cache_file) + 4];
+	uint32 version = SCRIPT_CACHE_VERSION, count = 0, unused = 0;
+	FILE *fp;
+
+	if( !script_cache_db )
+		return;
+
+	iter = db_iterator(script_cache_db);
+	for( entry = (struct script_cache_entry *)dbi_first(iter); dbi_exists(iter); entry = (struct script_cache_entry *)dbi_next(iter) ) {
+		if( entry->used )
+			count++;
+		else
+			unused++;
+	}
+
+	ShowInfo("Script cache: '"CL_WHITE"%d"CL_RESET"' scripts reused, '"CL_WHITE"%d"CL_RESET"' compiled ('"CL_WHITE"%d"CL_RESET"' not cached because of warnings).\n", script_cache_hits, script_cache_misses + script_cache_warned, script_cache_warned);
+	if( !script_cache_misses && !unused ) { //Nothing changed
+		dbi_destroy(iter);
+		script_cache_final();
+		return;
+	}
+
+	safesnprintf(tmpfile, sizeof(tmpfile), "%s.tmp", script_config.script_cache_file);
+	if( !(fp = fopen(tmpfile, "wb")) ) {
+		ShowError("script_cache_save: Can't write to '%s'.\n", tmpfile);
+		dbi_destroy(iter);
+		script_cache_final();
+		return;
+	}
+	fwrite(SCRIPT_CACHE_MAGIC, sizeof(SCRIPT_CACHE_MAGIC), 1, fp);
+	fwrite(&version, sizeof(version), 1, fp);
+	fwrite(&script_cache_fingerprint, sizeof(script_cache_fingerprint), 1, fp);
+	fwrite(&count, sizeof(count), 1, fp);
+	for( entry = (struct script_cache_entry *)dbi_first(iter); dbi_exists(iter); entry = (struct script_cache_entry *)dbi_next(iter) ) {
+		if( !entry->used )
+			continue;
+		fwrite(&entry->hash, sizeof(entry->hash), 1, fp);
+		fwrite(&entry->src_len, sizeof(entry->src_len), 1, fp);
+		fwrite(&entry->options, sizeof(entry->options), 1, fp);
+		fwrite(&entry->len, sizeof(entry->len), 1, fp);
+		fwrite(entry->data, 1, entry->len, fp);
+	}
+	dbi_destroy(iter);
+
+	if( ferror(fp) | fclose(fp) ) {
+		ShowError("script_cache_save: Failed to write '%s'.\n", tmpfile);
+		remove(tmpfile);
+	} else {
+		remove(script_config.script_cache_file);
+		if( rename(tmpfile, script_config.script_cache_file) )
+			ShowError("script_cache_save: Can't replace '%s'.\n", script_config.script_cache_file);
+	}
+	script_cache_final();
+}
+
+/// Releases the compiled script cache.
+void script_cache_final(void)
+{
+	if( script_cache_db ) {
+		db_destroy(script_cache_db);
+		script_cache_db = NULL;
+	}
+}
+
 /// Returns the player attached to this script, identified by the rid.
 /// If there is no player attached, the script is terminated.
 TBL_PC *script_rid2sd(struct script_state *st)
@@ -2762,7 +3222,7 @@ void get_val_(struct script_state *st, struct script_data *data, struct map_sess
 						data->ref      ? *data->ref:
 						name[1] == '@' ?  st->stack->var_function: // Instance/scope variable
 										  st->script->script_vars; // Npc variable
-					if( n )
+					if( n && !reference_uid_isreserved(reference_getuid(data)) )
 						data->u.str = (char *)idb_get(n, reference_getuid(data));
 					else
 						data->u.str = NULL;
@@ -2770,9 +3230,12 @@ void get_val_(struct script_state *st, struct script_data *data, struct map_sess
 				break;
 			case '\'': {
 						int instance_id = script_instancegetid(st);
-						if( instance_id )
-							data->u.str = (char *)idb_get(instance_data[instance_id].vars, reference_getuid(data));
-						else {
+						if( instance_id ) {
+							if( !reference_uid_isreserved(reference_getuid(data)) )
+								data->u.str = (char *)idb_get(instance_data[instance_id].vars, reference_getuid(data));
+							else
+								data->u.str = NULL;
+						} else {
 							ShowWarning("script:get_val: cannot access instance variable '%s', defaulting to \"\"\n", name);
 							data->u.str = NULL;
 						}
@@ -2814,7 +3277,7 @@ void get_val_(struct script_state *st, struct script_data *data, struct map_sess
 							data->ref      ? *data->ref:
 							name[1] == '@' ?  st->stack->var_function: // Instance/scope variable
 											  st->script->script_vars; // Npc variable
-						if( n )
+						if( n && !reference_uid_isreserved(reference_getuid(data)) )
 							data->u.num = (int)idb_iget(n, reference_getuid(data));
 						else
 							data->u.num = 0;
@@ -2822,9 +3285,12 @@ void get_val_(struct script_state *st, struct script_data *data, struct map_sess
 					break;
 				case '\'': {
 						int instance_id = script_instancegetid(st);
-						if( instance_id )
-							data->u.num = (int)idb_iget(instance_data[instance_id].vars, reference_getuid(data));
-						else {
+						if( instance_id ) {
+							if( !reference_uid_isreserved(reference_getuid(data)) )
+								data->u.num = (int)idb_iget(instance_data[instance_id].vars, reference_getuid(data));
+							else
+								data->u.num = 0;
+						} else {
 							ShowWarning("script:get_val: cannot access instance variable '%s', defaulting to 0\n", name);
 							data->u.num = 0;
 						}
@@ -2866,6 +3332,13 @@ static int set_reg(struct script_state *st, TBL_PC *sd, int num, const char *nam
 {
 	char prefix = name[0];
 
+	if( (prefix == '.' || prefix == '\'') && reference_uid_isreserved(num) ) {
+		ShowError("script:set_reg: index %d of '%s' is out of range.\n", (int)((uint32)num>>24), name);
+		if( st )
+			script_reportsrc(st);
+		return 0;
+	}
+
 	if( is_string_variable(name) ) { // String variable
 		const char *str = (const char *)value;
 
@@ -2885,6 +3358,7 @@ static int set_reg(struct script_state *st, TBL_PC *sd, int num, const char *nam
 						idb_remove(n, num);
 						if( str[0] )
 							idb_put(n, num, aStrdup(str));
+						script_array_update(n, num, (str[0] != '\0'));
 					}
 				}
 				return 1;
@@ -2895,6 +3369,7 @@ static int set_reg(struct script_state *st, TBL_PC *sd, int num, const char *nam
 						idb_remove(instance_data[instance_id].vars, num);
 						if( str[0] )
 							idb_put(instance_data[instance_id].vars, num, aStrdup(str));
+						script_array_update(instance_data[instance_id].vars, num, (str[0] != '\0'));
 					}
 				}
 				return 1;
@@ -2932,6 +3407,7 @@ static int set_reg(struct script_state *st, TBL_PC *sd, int num, const char *nam
 						idb_remove(n, num);
 						if( val != 0 )
 							idb_iput(n, num, val);
+						script_array_update(n, num, (val != 0));
 					}
 				}
 				return 1;
@@ -2942,6 +3418,7 @@ static int set_reg(struct script_state *st, TBL_PC *sd, int num, const char *nam
 						idb_remove(instance_data[instance_id].vars, num);
 						if( val != 0 )
 							idb_iput(instance_data[instance_id].vars, num, val);
+						script_array_update(instance_data[instance_id].vars, num, (val != 0));
 					}
 				}
 				return 1;
@@ -3215,6 +3692,8 @@ void script_free_code(struct script_code *code)
 	nullpo_retv(code);
 
 	script_free_vars(code->script_vars);
+	if( code->insn )
+		aFree(code->insn);
 	aFree(code->script_buf);
 	aFree(code);
 }
@@ -3257,6 +3736,12 @@ void script_free_state(struct script_state *st)
 		ShowDebug("script_free_state: Previous script state lost (rid=%d, oid=%d, state=%d, bk_npcid=%d).\n", st->bk_st->rid, st->bk_st->oid, st->bk_st->state, st->bk_npcid);
 	if(st->sleep.timer != INVALID_TIMER)
 		delete_timer(st->sleep.timer, run_script_timer);
+	if(st->sqljob) //Abandon the pending query
+		script_query_sql_async_abandon(st);
+	if(st->slice.slices) {
+		script_timeslice_stats.finished++;
+		script_timeslice_stats.max_slices = max(script_timeslice_stats.max_slices, st->slice.slices);
+	}
 	script_free_vars(st->stack->var_function);
 	pop_stack(st, 0, st->stack->sp);
 	aFree(st->stack->stack_data);
@@ -3299,6 +3784,81 @@ int get_num(unsigned char *script,int *pos)
 	return i + ((script[(*pos)++]&0x7f)<<j);
 }
 
+/*==========================================
+ * Read command and its operand
+ *------------------------------------------*/
+static enum c_op script_decode_op(const unsigned char *buf, int *pos, int *val)
+{
+	enum c_op c = get_com((unsigned char *)buf,pos);
+
+	switch( c ) {
+		case C_INT:
+			*val = get_num((unsigned char *)buf,pos);
+			break;
+		case C_POS:
+		case C_NAME:
+			*val = GETVALUE(buf,*pos);
+			*pos += 3;
+			break;
+		case C_STR:
+			*val = *pos;
+			while( buf[(*pos)++] );
+			break;
+		default:
+			*val = 0;
+			break;
+	}
+	return c;
+}
+
+/*==========================================
+ * Decode script_buf into a fixed-width instruction stream,
+ * so that run_script_main doesn't decode the variable length
+ * byte code of every instruction each time it runs.
+ *------------------------------------------*/
+static void script_build_insn(struct script_code *code)
+{
+	int pos, val, count = 0;
+
+	code->insn = NULL;
+	code->insn_count = 0;
+	if( code->script_size <= 0 || code->script_size >= (1<<24) )
+		return; //Too big for the packed positions, run from the byte code
+
+	for( pos = 0; pos < code->script_size; count++ )
+		script_decode_op(code->script_buf, &pos, &val);
+	if( pos != code->script_size )
+		return; //Truncated instruction, leave it to the byte code path to report
+
+	CREATE(code->insn, struct script_insn, count);
+	for( pos = 0; code->insn_count < count; code->insn_count++ ) {
+		struct script_insn *in = &code->insn[code->insn_count];
+
+		in->op = script_decode_op(code->script_buf, &pos, &val);
+		in->val = val;
+		in->next = pos;
+	}
+}
+
+/// Returns the index of the instruction starting at pos, or -1 if there is none.
+static int script_insn_find(const struct script_code *code, int pos)
+{
+	int lo = 0, hi = code->insn_count - 1;
+
+	while( lo <= hi ) {
+		int mid = (lo + hi) / 2;
+		int start = (mid ? (int)code->insn[mid - 1].next : 0);
+
+		if( start == pos )
+			return mid;
+		if( start < pos )
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return -1;
+}
+
 /*==========================================
  * Remove the value from the stack
  *------------------------------------------*/
@@ -3613,6 +4173,318 @@ static void script_check_buildin_argtype(struct script_state *st, int func)
 }
 
 
+/*==========================================
+ * Script profiler
+ * Attributes the instructions and wall time of the scripts
+ * to their NPC, to the label or function being executed
+ * (callsub/callfunc targets) and to the buildin commands.
+ * Times are inclusive: a label includes the commands it
+ * calls and a NPC the scripts it runs synchronously.
+ * In sampling mode only 1 of sample_rate runs is measured
+ * and the report scales the totals back up.
+ *------------------------------------------*/
+struct script_prof_entry {
+	char name[EVENT_NAME_LENGTH + 8];
+	unsigned int calls;
+	uint64 insn;
+	uint64 usec;
+};
+
+/// State of a profiled run_script_main call
+struct script_prof_run {
+	struct script_prof_entry *npc;
+	struct script_prof_entry *frame; // Label/function being executed
+	const struct script_code *code; // Code and position range of the frame label
+	int lo, hi;
+	uint64 start, frame_start;
+	unsigned int insn, frame_insn;
+};
+
+static struct {
+	enum script_prof_mode mode;
+	int sample_rate;
+	unsigned int counter;
+	unsigned int runs; // Runs seen since started
+	unsigned int sampled; // Runs measured since started
+	int running; // Nesting of profiled runs (scripts started from a builtin)
+	time_t started;
+	DBMap *npc_db; // char *name -> struct script_prof_entry*
+	DBMap *label_db;
+	DBMap *func_db;
+	// Sorted code -> name of the user functions
+	struct script_prof_userfunc {
+		const struct script_code *code;
+		const char *name;
+	} *userfuncs;
+	int userfunc_count;
+} script_prof;
+
+static struct script_prof_entry *script_prof_get(DBMap *db, const char *name)
+{
+	struct script_prof_entry *entry = (struct script_prof_entry *)strdb_get(db, name);
+
+	if( !entry ) {
+		CREATE(entry, struct script_prof_entry, 1);
+		safestrncpy(entry->name, name, sizeof(entry->name));
+		strdb_put(db, entry->name, entry);
+	}
+	return entry;
+}
+
+static int script_prof_userfunc_cmp(const void *a, const void *b)
+{
+	const struct script_code *ca = ((const struct script_prof_userfunc *)a)->code;
+	const struct script_code *cb = ((const struct script_prof_userfunc *)b)->code;
+
+	return (ca < cb ? -1 : (ca > cb ? 1 : 0));
+}
+
+static const char *script_prof_userfunc_find(const struct script_code *code)
+{
+	int lo = 0, hi = script_prof.userfunc_count - 1;
+
+	while( lo <= hi ) {
+		int mid = (lo + hi) / 2;
+
+		if( script_prof.userfuncs[mid].code == code )
+			return script_prof.userfuncs[mid].name;
+		if( script_prof.userfuncs[mid].code < code )
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return NULL;
+}
+
+/// Returns the name of the user function of this code, or NULL.
+static const char *script_prof_userfunc(const struct script_code *code)
+{
+	const char *name = script_prof_userfunc_find(code);
+	DBIterator *iter;
+	DBKey key;
+	DBData *data;
+
+	if( name && strdb_get(userfunc_db, name) == code )
+		return name;
+
+	//Functions were loaded or replaced since the table was built
+	script_prof.userfunc_count = 0;
+	RECREATE(script_prof.userfuncs, struct script_prof_userfunc, db_size(userfunc_db) + 1);
+	iter = db_iterator(userfunc_db);
+	for( data = iter->first(iter, &key); iter->exists(iter); data = iter->next(iter, &key) ) {
+		script_prof.userfuncs[script_prof.userfunc_count].code = (struct script_code *)db_data2ptr(data);
+		script_prof.userfuncs[script_prof.userfunc_count].name = key.str;
+		script_prof.userfunc_count++;
+	}
+	dbi_destroy(iter);
+	qsort(script_prof.userfuncs, script_prof.userfunc_count, sizeof(struct script_prof_userfunc), script_prof_userfunc_cmp);
+	return script_prof_userfunc_find(code);
+}
+
+/// Flushes the instructions and time of the current frame.
+static void script_prof_flush(struct script_prof_run *run, uint64 now)
+{
+	if( run->frame ) {
+		run->frame->insn += run->insn - run->frame_insn;
+		run->frame->usec += now - run->frame_start;
+	}
+	run->frame_insn = run->insn;
+	run->frame_start = now;
+}
+
+/// Decides whether this run is measured and starts measuring it.
+static bool script_prof_begin(struct script_state *st, struct script_prof_run *run)
+{
+	struct npc_data *nd;
+
+	if( script_prof.mode == SCRIPT_PROF_OFF )
+		return false;
+	if( !script_prof.running ) { //Scripts started by a measured run are always measured
+		script_prof.runs++;
+		if( script_prof.mode == SCRIPT_PROF_SAMPLE && (++script_prof.counter % script_prof.sample_rate) != 0 )
+			return false;
+		script_prof.sampled++;
+	}
+	script_prof.running++;
+	memset(run, 0, sizeof(*run));
+	nd = map_id2nd(st->oid);
+	run->npc = script_prof_get(script_prof.npc_db, (nd ? nd->exname : "<other>"));
+	run->npc->calls++;
+	run->start = run->frame_start = gettick_usec();
+	return true;
+}
+
+/// Moves the run to the label or function at st->pos, called when the script jumps or reaches the next label.
+static void script_prof_switch(struct script_state *st, struct script_prof_run *run)
+{
+	struct script_prof_entry *frame;
+	struct npc_data *nd;
+	const char *fname;
+	char name[EVENT_NAME_LENGTH + 8];
+
+	if( st->script == run->code && st->pos >= run->lo && st->pos < run->hi )
+		return; //Same label
+	run->code = st->script;
+	run->lo = 0;
+	run->hi = INT_MAX;
+	if( (nd = map_id2nd(st->oid)) && nd->subtype == NPCTYPE_SCRIPT && st->script == nd->u.scr.script ) {
+		//Label list is sorted by position, find the last label at or before pos
+		int lo = 0, hi = nd->u.scr.label_list_num - 1, i = -1;
+
+		while( lo <= hi ) {
+			int mid = (lo + hi) / 2;
+
+			if( nd->u.scr.label_list[mid].pos <= st->pos ) {
+				i = mid;
+				lo = mid + 1;
+			} else
+				hi = mid - 1;
+		}
+		if( i >= 0 )
+			run->lo = nd->u.scr.label_list[i].pos;
+		if( i + 1 < nd->u.scr.label_list_num )
+			run->hi = nd->u.scr.label_list[i + 1].pos;
+		safesnprintf(name, sizeof(name), "%s::%s", nd->exname, (i >= 0 ? nd->u.scr.label_list[i].name : "<start>"));
+	} else if( (fname = script_prof_userfunc(st->script)) )
+		safesnprintf(name, sizeof(name), "%s()", fname);
+	else
+		safesnprintf(name, sizeof(name), "%s", run->npc->name);
+
+	frame = script_prof_get(script_prof.label_db, name);
+	if( frame != run->frame ) {
+		script_prof_flush(run, gettick_usec());
+		run->frame = frame;
+		frame->calls++;
+	}
+}
+
+static void script_prof_end(struct script_prof_run *run)
+{
+	uint64 now = gettick_usec();
+
+	script_prof_flush(run, now);
+	run->npc->insn += run->insn;
+	run->npc->usec += now - run->start;
+	script_prof.running--;
+}
+
+/// Accounts a buildin command that started at start.
+static void script_prof_buildin(int func, uint64 start)
+{
+	struct script_prof_entry *entry = script_prof_get(script_prof.func_db, get_str(func));
+
+	entry->calls++;
+	entry->usec += gettick_usec() - start;
+}
+
+static int script_prof_entry_cmp(const void *a, const void *b)
+{
+	const struct script_prof_entry *ea = *(const struct script_prof_entry **)a;
+	const struct script_prof_entry *eb = *(const struct script_prof_entry **)b;
+
+	return (ea->usec < eb->usec ? 1 : (ea->usec > eb->usec ? -1 : 0));
+}
+
+static void script_prof_report_db(const char *title, DBMap *db, int top, int scale)
+{
+	struct script_prof_entry **list, *entry;
+	DBIterator *iter;
+	int i, count = 0;
+
+	if( !db_size(db) )
+		return;
+	CREATE(list, struct script_prof_entry *, db_size(db));
+	iter = db_iterator(db);
+	for( entry = (struct script_prof_entry *)dbi_first(iter); dbi_exists(iter); entry = (struct script_prof_entry *)dbi_next(iter) )
+		list[count++] = entry;
+	dbi_destroy(iter);
+	qsort(list, count, sizeof(*list), script_prof_entry_cmp);
+
+	ShowInfo("Top %d %s:\n", min(top, count), title);
+	ShowMessage("  %-40s %12s %14s %12s %10s\n", "name", "calls", "instructions", "time (ms)", "avg (us)");
+	for( i = 0; i < count && i < top; i++ ) {
+		entry = list[i];
+		ShowMessage("  %-40s %12"PRIu64" %14"PRIu64" %12"PRIu64" %10"PRIu64"\n", entry->name,
+			(uint64)entry->calls * scale, entry->insn * scale, entry->usec * scale / 1000, (entry->calls ? entry->usec / entry->calls : 0));
+	}
+	aFree(list);
+}
+
+/// Prints the top entries of each category.
+void script_prof_report(int top)
+{
+	int scale = (script_prof.mode == SCRIPT_PROF_SAMPLE ? script_prof.sample_rate : 1);
+
+	if( !script_prof.npc_db ) {
+		ShowInfo("Script profiler: no data, start it with 'script_prof:start [sample <rate>]'.\n");
+		return;
+	}
+	ShowInfo("Script profiler: %u runs in %u seconds, %u measured%s.\n", script_prof.runs, (unsigned int)(time(NULL) - script_prof.started),
+		script_prof.sampled, (scale > 1 ? " (totals are scaled by the sample rate)" : ""));
+	script_prof_report_db("NPCs", script_prof.npc_db, top, scale);
+	script_prof_report_db("labels/functions", script_prof.label_db, top, scale);
+	script_prof_report_db("buildin commands", script_prof.func_db, top, scale);
+}
+
+/// Starts the profiler, measuring every run or 1 of sample_rate runs, and clears the previous data.
+void script_prof_start(enum script_prof_mode mode, int sample_rate)
+{
+	script_prof_stop();
+	if( mode == SCRIPT_PROF_OFF )
+		return;
+	if( script_prof.npc_db ) {
+		db_clear(script_prof.npc_db);
+		db_clear(script_prof.label_db);
+		db_clear(script_prof.func_db);
+	} else {
+		script_prof.npc_db = strdb_alloc(DB_OPT_RELEASE_DATA, 0);
+		script_prof.label_db = strdb_alloc(DB_OPT_RELEASE_DATA, 0);
+		script_prof.func_db = strdb_alloc(DB_OPT_RELEASE_DATA, 0);
+	}
+	script_prof.mode = mode;
+	script_prof.sample_rate = max(sample_rate, 1);
+	script_prof.counter = script_prof.runs = script_prof.sampled = 0;
+	script_prof.started = time(NULL);
+}
+
+/// Stops measuring, the data is kept for script_prof_report.
+void script_prof_stop(void)
+{
+	script_prof.mode = SCRIPT_PROF_OFF;
+}
+
+/// Changes the instruction budget of a time slice, 0 disables time slicing.
+void script_timeslice_set(int budget)
+{
+	script_config.timeslice = max(budget, 0);
+}
+
+void script_timeslice_report(void)
+{
+	if( script_config.timeslice > 0 )
+		ShowInfo("Script time slicing: budget of '"CL_WHITE"%d"CL_RESET"' instructions per slice.\n", script_config.timeslice);
+	else
+		ShowInfo("Script time slicing: disabled.\n");
+	ShowInfo("\t'"CL_WHITE"%u"CL_RESET"' preemptions, '"CL_WHITE"%u"CL_RESET"' sliced scripts finished (at most '"CL_WHITE"%u"CL_RESET"' slices).\n",
+		script_timeslice_stats.preempted, script_timeslice_stats.finished, script_timeslice_stats.max_slices);
+}
+
+static void script_prof_final(void)
+{
+	script_prof_stop();
+	if( script_prof.npc_db ) {
+		db_destroy(script_prof.npc_db);
+		db_destroy(script_prof.label_db);
+		db_destroy(script_prof.func_db);
+		script_prof.npc_db = NULL;
+	}
+	if( script_prof.userfuncs ) {
+		aFree(script_prof.userfuncs);
+		script_prof.userfuncs = NULL;
+	}
+	script_prof.userfunc_count = 0;
+}
+
 /// Executes a buildin command.
 /// Stack: C_NAME(<command>) C_ARG <arg0> <arg1> ... <argN>
 int run_func(struct script_state *st)
@@ -3651,8 +4523,12 @@ int run_func(struct script_state *st)
 		script_check_buildin_argtype(st, func);
 
 	if( str_data[func].func ) {
+		uint64 prof_start = (script_prof.running ? gettick_usec() : 0);
+
 		if( str_data[func].func(st) ) //Report error
 			script_reportsrc(st);
+		if( script_prof.running )
+			script_prof_buildin(func, prof_start);
 	} else {
 		ShowError("script:run_func: '%s' (id=%d type=%s) has no C function. please report this!!!\n", get_str(func), func, script_op2name(str_data[func].type));
 		script_reportsrc(st);
@@ -3848,11 +4724,27 @@ void run_script_main(struct script_state *st)
 	int gotocount = script_config.check_gotocount;
 	struct map_session_data *sd = NULL;
 	struct script_stack *stack;
+	struct script_code *code = NULL;
+	int ip = -1;
+	struct script_prof_run prof_run;
+	bool prof;
+	int budget = 0; //Instructions left in the time slice, 0 if the run can't be suspended
 
 	nullpo_retv(st);
 
 	stack = st->stack;
 	script_attach_state(st);
+	prof = script_prof_begin(st, &prof_run);
+
+	//Only top-level NPC scripts are sliced, callers of nested and item scripts expect them to end before returning
+	script_run_depth++;
+	if (script_config.timeslice > 0 && script_run_depth == 1 && map_id2nd(st->oid) && st->oid != fake_nd->bl.id)
+		budget = script_config.timeslice;
+	if (st->slice.preempted) { //Resuming, the loop checks cover the whole run and not each slice
+		cmdcount = st->slice.cmdcount;
+		gotocount = st->slice.gotocount;
+		st->slice.preempted = false;
+	}
 
 	if (st->state == RERUNLINE) {
 		run_func(st);
@@ -3862,7 +4754,26 @@ void run_script_main(struct script_state *st)
 		st->state = RUN;
 
 	while (st->state == RUN) {
-		enum c_op c = get_com(st->script->script_buf,&st->pos);
+		enum c_op c;
+		int val;
+
+		//Fetch from the decoded stream, re-syncing when the code or position was changed by a jump/call
+		if (code != st->script || ip < 0 || ip >= code->insn_count || (ip ? (int)code->insn[ip - 1].next : 0) != st->pos) {
+			code = st->script;
+			ip = (code->insn ? script_insn_find(code, st->pos) : -1);
+			if (prof)
+				script_prof_switch(st, &prof_run);
+		} else if (prof && (st->pos < prof_run.lo || st->pos >= prof_run.hi))
+			script_prof_switch(st, &prof_run); //Fell through into the next label
+		if (prof)
+			prof_run.insn++;
+		if (ip >= 0) {
+			c = (enum c_op)code->insn[ip].op;
+			val = code->insn[ip].val;
+			st->pos = code->insn[ip].next;
+			ip++;
+		} else
+			c = script_decode_op(code->script_buf,&st->pos,&val);
 
 		switch (c) {
 			case C_EOL:
@@ -3872,19 +4783,15 @@ void run_script_main(struct script_state *st)
 					pop_stack(st, stack->defsp, stack->sp); //Pop unused stack data (unused return value)
 				break;
 			case C_INT:
-				push_val(stack,C_INT,get_num(st->script->script_buf,&st->pos));
-				break;
 			case C_POS:
 			case C_NAME:
-				push_val(stack,c,GETVALUE(st->script->script_buf,st->pos));
-				st->pos += 3;
+				push_val(stack,c,val);
 				break;
 			case C_ARG:
 				push_val(stack,c,0);
 				break;
 			case C_STR:
-				push_str(stack,C_CONSTSTR,(char *)(st->script->script_buf + st->pos));
-				while (st->script->script_buf[st->pos++]);
+				push_str(stack,C_CONSTSTR,(char *)(code->script_buf + val));
 				break;
 			case C_FUNC:
 				run_func(st);
@@ -3940,9 +4847,21 @@ void run_script_main(struct script_state *st)
 			ShowError("run_script: too many opeartions being processed non-stop !\n");
 			script_reportsrc(st);
 			st->state = END;
+		} else if (budget > 0 && (--budget) == 0 && st->state == RUN) { //Time slice used up, continue on the next tick
+			st->slice.preempted = true;
+			st->slice.slices++;
+			st->slice.cmdcount = cmdcount;
+			st->slice.gotocount = gotocount;
+			st->sleep.tick = 1;
+			st->state = STOP;
+			script_timeslice_stats.preempted++;
 		}
 	}
 
+	script_run_depth--;
+	if (prof)
+		script_prof_end(&prof_run);
+
 	if (st->sleep.tick > 0) {
 		script_detach_state(st, false); //Restore previous script
 		if ((sd = map_id2sd(st->rid)) && //Get sd since script might have attached someone while running [Inkfish]
@@ -4009,6 +4928,16 @@ int script_config_read(char *cfgName)
 			script_config.input_max_value = config_switch(w2);
 		else if (!strcmpi(w1,"warn_func_mismatch_argtypes"))
 			script_config.warn_func_mismatch_argtypes = config_switch(w2);
+		else if (!strcmpi(w1,"script_cache"))
+			script_config.script_cache = (config_switch(w2) != 0);
+		else if (!strcmpi(w1,"script_cache_file"))
+			safestrncpy(script_config.script_cache_file, w2, sizeof(script_config.script_cache_file));
+		else if (!strcmpi(w1,"script_profiler"))
+			script_config.profiler = cap_value(config_switch(w2), SCRIPT_PROF_OFF, SCRIPT_PROF_SAMPLE);
+		else if (!strcmpi(w1,"script_profiler_sample_rate"))
+			script_config.profiler_sample_rate = max(config_switch(w2), 1);
+		else if (!strcmpi(w1,"script_timeslice"))
+			script_config.timeslice = max(config_switch(w2), 0);
 		else if (!strcmpi(w1,"import"))
 			script_config_read(w2);
 		else
@@ -4030,6 +4959,123 @@ static int db_script_free_code_sub(DBKey key, DBData *data, va_list ap)
 	return 0;
 }
 
+/*==========================================
+ * Script interpreter benchmark [console: bench:script]
+ * Runs a few micro scripts (arithmetic loop, string building, array
+ * writes, local sub and global function calls and the array idioms of
+ * event NPCs) 'count' times each and reports the loop iterations per
+ * second, to time changes to the interpreter.
+ *------------------------------------------*/
+#define SCRIPT_BENCH_LOOPS 1000
+void script_bench(int count)
+{
+	static const struct {
+		const char *name;
+		const char *src;
+	} benches[] = {
+		{ "arith",  "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) .@s += .@i * 3 % 7; end; }" },
+		{ "string", "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) { .@s$ = .@s$ + \"a\"; if( getstrlen(.@s$) > 32 ) .@s$ = \"\"; } end; }" },
+		{ "array",  "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) setarray .@a[.@i % 128], .@i, .@i + 1; .@n = getarraysize(.@a); end; }" },
+		{ "call",   "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) .@s += callsub(L_Inc, .@i); end; L_Inc: return getarg(0) + 1; }" },
+		{ "func",   "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) .@s += callfunc(\"script_bench_inc\", .@i); end; }" },
+		{ "arrops", "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) { setarray .@a[0], 1, 2, 3, 4, 5, 6, 7, 8; deletearray .@a[2], 3; copyarray .@b[0], .@a[0], getarraysize(.@a); .@a[getarraysize(.@a)] = .@i; cleararray .@b[0], 0, getarraysize(.@b); } end; }" },
+		{ "gblarr", "{ freeloop(1); for( .@i = 0; .@i < 1000; .@i++ ) { $@bench_a[getarraysize($@bench_a)] = .@i; if( getarraysize($@bench_a) >= 64 ) deletearray $@bench_a; } deletearray $@bench_a; end; }" },
+	};
+	struct script_code *func;
+	int i, j;
+
+	if( count <= 0 )
+		return;
+
+	//Global function of the callfunc benchmark
+	if( strdb_exists(userfunc_db, "script_bench_inc") )
+		func = NULL;
+	else if( (func = parse_script("{ return getarg(0) + 1; }", "script_bench", 0, 0)) != NULL )
+		strdb_put(userfunc_db, "script_bench_inc", func);
+
+	for( i = 0; i < ARRAYLENGTH(benches); i++ ) {
+		struct script_code *code = parse_script(benches[i].src, "script_bench", 0, 0);
+		unsigned int tick;
+		int elapsed;
+
+		if( !code ) {
+			ShowError("script_bench: Failed to parse the '%s' benchmark.\n", benches[i].name);
+			continue;
+		}
+		tick = gettick_nocache();
+		for( j = 0; j < count; j++ )
+			run_script(code, 0, 0, 0);
+		elapsed = DIFF_TICK(gettick_nocache(), tick);
+		ShowInfo("script_bench: %-6s %d runs in %d ms (%.0f iterations/sec, %d instructions).\n", benches[i].name,
+			count, elapsed, (elapsed > 0 ? (double)count * SCRIPT_BENCH_LOOPS * 1000. / elapsed : 0.), code->insn_count);
+		script_free_code(code);
+	}
+
+	if( func ) {
+		strdb_remove(userfunc_db, "script_bench_inc");
+		script_free_code(func);
+		script_prof.userfunc_count = 0; //The profiler's function table may point at it
+	}
+}
+
+/*==========================================
+ * query_sql load test [console: bench:query_sql]
+ * Starts 'count' scripts running a ranking query through query_sql or
+ * query_sql_async and samples the main loop timer lateness until all of
+ * them have finished, to show how much the queries stall the server.
+ *------------------------------------------*/
+static struct {
+	struct script_code *code;
+	unsigned int start;
+	int count, timer, max_delay, samples;
+	bool async;
+} script_bench_sql_data = { NULL, 0, 0, INVALID_TIMER, 0, 0, false };
+
+static TIMER_FUNC(script_bench_sql_timer)
+{
+	int delay = DIFF_TICK(gettick_nocache(), tick);
+
+	script_bench_sql_data.max_delay = max(script_bench_sql_data.max_delay, delay);
+	script_bench_sql_data.samples++;
+	if( query_sql_async_pending > 0 )
+		return 0;
+
+	ShowInfo("script_bench_sql: %d %s queries done in %d ms, main loop max tick delay %d ms over %d samples.\n",
+		script_bench_sql_data.count, (script_bench_sql_data.async ? "async" : "sync"),
+		DIFF_TICK(gettick_nocache(), script_bench_sql_data.start), script_bench_sql_data.max_delay, script_bench_sql_data.samples);
+	delete_timer(id, script_bench_sql_timer);
+	script_bench_sql_data.timer = INVALID_TIMER;
+	script_free_code(script_bench_sql_data.code);
+	script_bench_sql_data.code = NULL;
+	return 0;
+}
+
+void script_bench_sql(int count, bool async)
+{
+	char src[256];
+	int i;
+
+	if( count <= 0 )
+		return;
+	if( script_bench_sql_data.timer != INVALID_TIMER ) {
+		ShowWarning("script_bench_sql: A test is already running.\n");
+		return;
+	}
+
+	safesnprintf(src, sizeof(src), "{ .@n = %s(\"SELECT `char_id`, `name`, `base_level` FROM `char` ORDER BY `base_level` DESC, `base_exp` DESC LIMIT 100\", .@id, .@name$, .@lv); end; }",
+		(async ? "query_sql_async" : "query_sql"));
+	if( !(script_bench_sql_data.code = parse_script(src, "script_bench_sql", 0, 0)) )
+		return;
+	script_bench_sql_data.count = count;
+	script_bench_sql_data.async = async;
+	script_bench_sql_data.max_delay = 0;
+	script_bench_sql_data.samples = 0;
+	script_bench_sql_data.start = gettick_nocache();
+	script_bench_sql_data.timer = add_timer_interval(gettick_nocache() + 10, script_bench_sql_timer, 0, 0, 10);
+	for( i = 0; i < count; i++ )
+		run_script(script_bench_sql_data.code, 0, 0, 0);
+}
+
 void script_run_autobonus(const char *autobonus, struct map_session_data *sd, unsigned int pos)
 {
 	struct script_code *script = (struct script_code *)strdb_get(autobonus_db, autobonus);
@@ -4174,6 +5220,8 @@ void do_final_script(void) {
 #endif
 
 	mapreg_final();
+	script_cache_final();
+	script_prof_final();
 
 	db_destroy(scriptlabel_db);
 	userfunc_db->destroy(userfunc_db, db_script_free_code_sub);
@@ -4194,6 +5242,8 @@ void do_final_script(void) {
 		aFree(str_data);
 	if(str_buf)
 		aFree(str_buf);
+	if(parse_userfuncs)
+		aFree(parse_userfuncs);
 
 	for(i = 0; i < atcmd_binding_count; i++)
 		aFree(atcmd_binding[i]);
@@ -4211,6 +5261,7 @@ void do_init_script(void) {
 	autobonus_db = strdb_alloc(DB_OPT_DUP_KEY,0);
 
 	mapreg_init();
+	script_prof_start((enum script_prof_mode)script_config.profiler, script_config.profiler_sample_rate);
 }
 
 void script_reload(void) {
@@ -4218,6 +5269,7 @@ void script_reload(void) {
 
 	userfunc_db->clear(userfunc_db, db_script_free_code_sub);
 	db_clear(scriptlabel_db);
+	script_prof.userfunc_count = 0; //Names point into userfunc_db
 
 	// @commands (script based)
 	// Clear bindings
@@ -5487,10 +6539,81 @@ BUILDIN_FUNC(setr)
 ///
 
 /// Returns the size of the specified array
+/// Records whether an element of an array holds a value, in the member bitmap of its storage.
+/// Element 0 isn't tracked, so that plain (non-array) variables don't pay for it.
+void script_array_update(struct DBMap *db, int32 uid, bool set)
+{
+	int32 idx = (int32)((uint32)uid>>24);
+	int32 key;
+	uint32 bits, mask;
+
+	if( idx == 0 || idx >= SCRIPT_MAX_ARRAYSIZE )
+		return;
+	key = reference_uid(uid, SCRIPT_MAX_ARRAYSIZE + idx / 32);
+	mask = 1U<<(idx % 32);
+	bits = (uint32)idb_iget(db, key);
+	if( set == ((bits&mask) != 0) )
+		return; // No change
+	bits ^= mask;
+	if( bits )
+		idb_iput(db, key, (int)bits);
+	else
+		idb_remove(db, key);
+}
+
+/// Returns the size of an array from its member bitmap, counting from idx.
+/// (the highest index holding a value + 1, or idx if there is none)
+/// Element 0 is looked up in db, so storages that keep their values apart
+/// from the bitmaps have to check it themselves.
+int32 script_array_size(struct DBMap *db, int32 id, int32 idx)
+{
+	int32 w;
+
+	if( db == NULL )
+		return idx;
+	for( w = SCRIPT_ARRAY_WORDS - 1; w >= 0 && w >= idx / 32; --w ) {
+		uint32 bits = (uint32)idb_iget(db, reference_uid(id, SCRIPT_MAX_ARRAYSIZE + w));
+		int32 b;
+
+		if( w == idx / 32 )
+			bits &= ~((1U<<(idx % 32)) - 1); // Ignore the elements before idx
+		if( !bits )
+			continue;
+		for( b = 31; !(bits&(1U<<b)); --b );
+		return w * 32 + b + 1;
+	}
+	if( idx == 0 && idb_exists(db, reference_uid(id, 0)) )
+		return 1;
+	return idx;
+}
+
+/// Returns the size of the array, counting from idx.
+/// Uses the member bitmaps of the storage for array scopes, so it doesn't have to read every element.
 static int32 getarraysize(struct script_state *st, int32 id, int32 idx, int isstring, struct DBMap **ref)
 {
+	const char *name = get_str(id);
 	int32 ret = idx;
 
+	switch( *name ) {
+		case '.': {
+				struct DBMap *n = (ref) ? *ref : (name[1] == '@') ? st->stack->var_function : st->script->script_vars;
+
+				return script_array_size(n, id, idx);
+			}
+		case '\'': {
+				int instance_id = script_instancegetid(st);
+
+				return (instance_id ? script_array_size(instance_data[instance_id].vars, id, idx) : idx);
+			}
+		case '$':
+			return mapreg_getarraysize(id, idx);
+		case '@': {
+				TBL_PC *sd = script_rid2sd(st);
+
+				return (sd ? pc_readreg_arraysize(sd, id, idx, (isstring != 0)) : idx);
+			}
+	}
+
 	if( isstring ) {
 		for( ; idx < SCRIPT_MAX_ARRAYSIZE; ++idx ) {
 			char *str = (char *)get_val2(st, reference_uid(id, idx), ref);
@@ -5609,6 +6732,12 @@ BUILDIN_FUNC(cleararray)
 	end = start + script_getnum(st, 4);
 	if( end > SCRIPT_MAX_ARRAYSIZE )
 		end = SCRIPT_MAX_ARRAYSIZE;
+	if( is_string_variable(name) ? !*(const char *)v : !v ) { // Clearing, the elements past the size are already empty
+		int32 size = getarraysize(st, id, start, is_string_variable(name), script_getref(st,2));
+
+		if( end > size )
+			end = size;
+	}
 
 	for( ; start < end; ++start )
 		set_reg(st, sd, reference_uid(id, start), name, v, script_getref(st,2));
@@ -5678,6 +6807,14 @@ BUILDIN_FUNC(copyarray)
 	if( count <= 0 || (id1 == id2 && idx1 == idx2) )
 		return 0; // Nothing to copy
 
+	// Past the size of both arrays it would only copy empty elements over empty elements
+	i = max(getarraysize(st, id1, idx1, is_string_variable(name1), reference_getref(data1)) - idx1,
+		getarraysize(st, id2, idx2, is_string_variable(name2), reference_getref(data2)) - idx2);
+	if( count > i )
+		count = i;
+	if( count <= 0 )
+		return 0; // Nothing to copy
+
 	if( id1 == id2 && idx1 > idx2 ) { // Destination might be overlapping the source - copy in reverse order
 		for( i = count - 1; i >= 0; --i ) {
 			v = get_val2(st, reference_uid(id2, idx2 + i), reference_getref(data2));
@@ -5767,7 +6904,8 @@ BUILDIN_FUNC(deletearray)
 			return 0; // No player attached
 	}
 
-	end = SCRIPT_MAX_ARRAYSIZE;
+	// The elements past the size are already empty
+	end = getarraysize(st, id, start, is_string_variable(name), reference_getref(data));
 
 	if( start >= end )
 		return 0; // Nothing to free
@@ -16091,37 +17229,74 @@ BUILDIN_FUNC(setd)
 	return SCRIPT_CMD_SUCCESS;
 }
 
-int buildin_query_sql_sub(struct script_state *st, Sql *handle)
+/// Checks the target variables of query_sql.
+/// @return false if the query shouldn't be executed
+static bool buildin_query_sql_checkvars(struct script_state *st, TBL_PC **sd, int *max_rows)
 {
-	int i, j;
-	TBL_PC *sd = NULL;
-	const char *query;
-	struct script_data *data;
-	const char *name;
-	int max_rows = SCRIPT_MAX_ARRAYSIZE; //Maximum number of rows
-	int num_vars;
-	int num_cols;
+	int i;
 
-	//Check target variables
+	*sd = NULL;
+	*max_rows = SCRIPT_MAX_ARRAYSIZE; //Maximum number of rows
 	for( i = 3; script_hasdata(st,i); ++i ) {
-		data = script_getdata(st,i);
+		struct script_data *data = script_getdata(st,i);
+
 		if( data_isreference(data) ) { //It's a variable
-			name = reference_getname(data);
-			if( not_server_variable(*name) && sd == NULL ) { //Requires a player
-				sd = script_rid2sd(st);
-				if( sd == NULL ) //No player attached
-					return 1;
+			const char *name = reference_getname(data);
+
+			if( not_server_variable(*name) && *sd == NULL ) { //Requires a player
+				*sd = script_rid2sd(st);
+				if( *sd == NULL ) //No player attached
+					return false;
 			}
 			if( not_array_variable(*name) )
-				max_rows = 1; //Not an array, limit to one row
+				*max_rows = 1; //Not an array, limit to one row
 		} else {
 			ShowError("script:query_sql: not a variable\n");
 			script_reportdata(data);
 			st->state = END;
-			return 1;
+			return false;
 		}
 	}
-	num_vars = i - 3;
+	return true;
+}
+
+/// Reports a mismatch between the number of columns and target variables of query_sql.
+static void buildin_query_sql_checkcols(struct script_state *st, int num_vars, int num_cols)
+{
+	if( num_vars < num_cols ) {
+		ShowWarning("script:query_sql: Too many columns, discarding last %u columns.\n",(unsigned int)(num_cols - num_vars));
+		script_reportsrc(st);
+	} else if( num_vars > num_cols ) {
+		ShowWarning("script:query_sql: Too many variables (%u extra).\n",(unsigned int)(num_vars - num_cols));
+		script_reportsrc(st);
+	}
+}
+
+/// Stores a column of the query_sql result in its target variable.
+static void buildin_query_sql_setvar(struct script_state *st, TBL_PC *sd, int row, int var, const char *str)
+{
+	struct script_data *data = script_getdata(st,var + 3);
+	const char *name = reference_getname(data);
+
+	if( is_string_variable(name) )
+		setd_sub(st,sd,name,row,(void *)(str ? str : ""),reference_getref(data));
+	else
+		setd_sub(st,sd,name,row,(void *)__64BPRTSIZE((str ? atoi(str) : 0)),reference_getref(data));
+}
+
+int buildin_query_sql_sub(struct script_state *st, Sql *handle)
+{
+	int i, j;
+	TBL_PC *sd = NULL;
+	const char *query;
+	int max_rows; //Maximum number of rows
+	int num_vars;
+	int num_cols;
+
+	//Check target variables
+	if( !buildin_query_sql_checkvars(st,&sd,&max_rows) )
+		return 1;
+	num_vars = script_lastdata(st) - 2;
 
 	//Execute the query
 	query = script_getstr(st,2);
@@ -16140,13 +17315,7 @@ int buildin_query_sql_sub(struct script_state *st, Sql *handle)
 
 	//Count the number of columns to store
 	num_cols = Sql_NumColumns(handle);
-	if( num_vars < num_cols ) {
-		ShowWarning("script:query_sql: Too many columns, discarding last %u columns.\n",(unsigned int)(num_cols - num_vars));
-		script_reportsrc(st);
-	} else if( num_vars > num_cols ) {
-		ShowWarning("script:query_sql: Too many variables (%u extra).\n",(unsigned int)(num_vars - num_cols));
-		script_reportsrc(st);
-	}
+	buildin_query_sql_checkcols(st,num_vars,num_cols);
 
 	//Store data
 	for( i = 0; i < max_rows && SQL_SUCCESS == Sql_NextRow(handle); ++i ) {
@@ -16155,13 +17324,7 @@ int buildin_query_sql_sub(struct script_state *st, Sql *handle)
 
 			if( j < num_cols )
 				Sql_GetData(handle,j,&str,NULL);
-
-			data = script_getdata(st,j + 3);
-			name = reference_getname(data);
-			if( is_string_variable(name) )
-				setd_sub(st,sd,name,i,(void *)(str ? str : ""),reference_getref(data));
-			else
-				setd_sub(st,sd,name,i,(void *)__64BPRTSIZE((str ? atoi(str) : 0)),reference_getref(data));
+			buildin_query_sql_setvar(st,sd,i,j,str);
 		}
 	}
 	if( i == max_rows && max_rows < Sql_NumRows(handle) ) {
@@ -16188,6 +17351,108 @@ BUILDIN_FUNC(query_logsql) {
 	return buildin_query_sql_sub(st,logmysql_handle);
 }
 
+/// Drops the pending query of a script state that is being freed.
+static void script_query_sql_async_abandon(struct script_state *st)
+{
+	SqlJob_Free(st->sqljob);
+	st->sqljob = NULL;
+	query_sql_async_pending--;
+}
+
+/// Resumes the script that was waiting for a query_sql_async query.
+static void script_query_sql_async_done(SqlJob *job, void *data)
+{
+	struct script_state *st = (struct script_state *)data;
+
+	if( st->sqljob == job && st->sleep.timer != INVALID_TIMER )
+		settick_timer(st->sleep.timer, gettick());
+}
+
+/// Asynchronous version of query_sql.
+/// The query is executed by a worker thread on its own connection while the
+/// script sleeps, then the script is resumed on the main loop by the query
+/// callback to store the result.
+int buildin_query_sql_async_sub(struct script_state *st, SqlWorker *worker, Sql *handle)
+{
+	int i, j, stored_rows, num_vars, num_cols;
+	int max_rows; //Maximum number of rows
+	TBL_PC *sd = NULL;
+
+	if( !st->sqljob ) { //First call, queue the query
+		if( !worker ) //No worker available, run it on the main loop
+			return buildin_query_sql_sub(st,handle);
+		if( !buildin_query_sql_checkvars(st,&sd,&max_rows) )
+			return 1;
+		if( !(st->sqljob = SqlJob_QueryCallback(worker,script_getstr(st,2),max_rows,script_query_sql_async_done,st)) ) {
+			ShowError("script:query_sql_async: failed to queue the query.\n");
+			script_pushint(st,-1);
+			return 1;
+		}
+		query_sql_async_pending++;
+	}
+	if( !SqlJob_IsDone(st->sqljob) ) { //Check again later
+		st->state = RERUNLINE;
+		st->sleep.tick = QUERY_SQL_ASYNC_POLL;
+		return SCRIPT_CMD_SUCCESS;
+	}
+
+	//Query done, continue the script
+	st->state = RUN;
+	st->sleep.tick = 0;
+	query_sql_async_pending--;
+	if( SqlJob_GetResult(st->sqljob) == SQL_ERROR || SqlJob_NumRows(st->sqljob) == 0 ) {
+		if( SqlJob_GetResult(st->sqljob) == SQL_ERROR )
+			SqlJob_ShowDebug(st->sqljob);
+		SqlJob_Free(st->sqljob);
+		st->sqljob = NULL;
+		script_pushint(st,-1);
+		return 0;
+	}
+	if( !buildin_query_sql_checkvars(st,&sd,&max_rows) ) { //Player may have logged out meanwhile
+		SqlJob_Free(st->sqljob);
+		st->sqljob = NULL;
+		return 1;
+	}
+
+	num_vars = script_lastdata(st) - 2;
+	num_cols = SqlJob_NumColumns(st->sqljob);
+	buildin_query_sql_checkcols(st,num_vars,num_cols);
+
+	//Store data
+	stored_rows = (int)SqlJob_NumStoredRows(st->sqljob);
+	for( i = 0; i < stored_rows; ++i ) {
+		for( j = 0; j < num_vars; ++j ) {
+			char *str = NULL;
+
+			if( j < num_cols )
+				SqlJob_GetData(st->sqljob,i,j,&str);
+			buildin_query_sql_setvar(st,sd,i,j,str);
+		}
+	}
+	if( i == max_rows && (uint64)max_rows < SqlJob_NumRows(st->sqljob) ) {
+		ShowWarning("script:query_sql: Only %d/%u rows have been stored.\n",max_rows,(unsigned int)SqlJob_NumRows(st->sqljob));
+		script_reportsrc(st);
+	}
+
+	SqlJob_Free(st->sqljob);
+	st->sqljob = NULL;
+	script_pushint(st,i);
+	return SCRIPT_CMD_SUCCESS;
+}
+
+BUILDIN_FUNC(query_sql_async) {
+	return buildin_query_sql_async_sub(st,(qsmysql_pool ? qsmysql_pool : qsmysql_worker),qsmysql_handle);
+}
+
+BUILDIN_FUNC(query_logsql_async) {
+	if( !log_config.sql_logs ) { //logmysql_handle == NULL
+		ShowWarning("buildin_query_logsql_async: SQL logs are disabled, query '%s' will not be executed.\n",script_getstr(st,2));
+		script_pushint(st,-1);
+		return 1;
+	}
+	return buildin_query_sql_async_sub(st,logmysql_worker,logmysql_handle);
+}
+
 //Allows escaping of a given string
 BUILDIN_FUNC(escape_sql)
 {
@@ -23443,6 +24708,8 @@ struct script_function buildin_func[] = {
 	BUILDIN_DEF(axtoi,"s"),
 	BUILDIN_DEF(query_sql,"s*"),
 	BUILDIN_DEF(query_logsql,"s*"),
+	BUILDIN_DEF(query_sql_async,"s*"),
+	BUILDIN_DEF(query_logsql_async,"s*"),
 	BUILDIN_DEF(escape_sql,"v"),
 	BUILDIN_DEF(atoi,"s"),
 	BUILDIN_DEF(strtol,"si"),
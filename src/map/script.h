@@ -21,6 +21,11 @@ extern struct Script_Config {
 	int check_gotocount;
 	int input_min_value;
 	int input_max_value;
+	bool script_cache;
+	char script_cache_file[256];
+	int profiler; //enum script_prof_mode
+	int profiler_sample_rate;
+	int timeslice; //Instructions a NPC script runs before it is suspended until the next tick, 0 disables
 
 	//PC related
 	const char *die_event_name;
@@ -144,12 +149,21 @@ struct script_data {
 	struct DBMap **ref;
 };
 
+/// Pre-decoded instruction of a script_buf (see script_build_insn)
+struct script_insn {
+	int val; // Decoded operand (number, str_data reference or position of the string)
+	unsigned int next : 24; // Position of the next instruction in script_buf
+	unsigned int op : 8; // enum c_op
+};
+
 // Moved defsp from script_state to script_stack since
 // it must be saved when script state is RERUNLINE. [Eoe / jA 1094]
 struct script_code {
 	int script_size;
 	unsigned char *script_buf;
 	struct DBMap *script_vars;
+	struct script_insn *insn; // Fixed-width copy of script_buf (NULL if not available)
+	int insn_count;
 };
 
 struct script_stack {
@@ -185,6 +199,12 @@ struct script_state {
 	unsigned npc_item_flag : 1;
 	unsigned mes_active : 1;  // Store if invoking character has a NPC dialog box open.
 	char *funcname; // Stores the current running function name
+	struct SqlJob *sqljob; // Pending query of query_sql_async/query_logsql_async
+	struct script_timeslice {
+		unsigned int slices; // Times the script was suspended
+		bool preempted; // Suspended by the time slicing, resumes without re-running a command
+		int cmdcount, gotocount; // Loop checks carried over to the next slice
+	} slice;
 };
 
 struct script_reg {
@@ -203,6 +223,12 @@ enum script_parse_options {
 	SCRIPT_RETURN_EMPTY_SCRIPT = 0x4 //Returns the script object instead of NULL for empty scripts
 };
 
+enum script_prof_mode {
+	SCRIPT_PROF_OFF = 0,
+	SCRIPT_PROF_ALL, //Measures every run
+	SCRIPT_PROF_SAMPLE //Measures 1 of profiler_sample_rate runs
+};
+
 enum monsterinfo_types {
 	MOB_NAME = 0,
 	MOB_LV,
@@ -1750,6 +1776,10 @@ void script_warning(const char *src, const char *file, int start_line, const cha
 
 bool is_number(const char *p);
 struct script_code *parse_script(const char *src, const char *file, int line, int options);
+struct script_code *parse_script_cached(const char *src, const char *src_end, const char *file, int line, int options);
+void script_cache_load(void);
+void script_cache_save(void);
+void script_cache_final(void);
 void run_script_sub(struct script_code *rootscript, int pos, int rid, int oid, char *file, int lineno);
 void run_script(struct script_code *rootscript, int pos, int rid, int oid);
 
@@ -1763,6 +1793,16 @@ void run_script_main(struct script_state *st);
 void script_stop_sleeptimers(int id);
 struct linkdb_node *script_erase_sleepdb(struct linkdb_node *n);
 void script_free_code(struct script_code *code);
+void script_array_update(struct DBMap *db, int32 uid, bool set);
+int32 script_array_size(struct DBMap *db, int32 id, int32 idx);
+
+void script_prof_start(enum script_prof_mode mode, int sample_rate);
+void script_prof_stop(void);
+void script_prof_report(int top);
+void script_timeslice_set(int budget);
+void script_timeslice_report(void);
+void script_bench(int count);
+void script_bench_sql(int count, bool async);
 void script_free_vars(struct DBMap *storage);
 struct script_state *script_alloc_state(struct script_code *script, int pos, int rid, int oid);
 void script_free_state(struct script_state *st);
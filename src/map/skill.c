@@ -71,6 +71,18 @@ struct skill_usave {
 
 struct s_skill_db skill_db[MAX_SKILL_DB];
 
+//Hot copies of the skill_db fields read on every cast, packed so that a skill level
+//lookup touches a single cache line instead of one per field. Rebuilt by skill_readdb()
+struct s_skill_hot {
+	int hit, inf, nk, inf2, inf3, max;
+};
+struct s_skill_lvhot {
+	int cast, delay;
+	int16 range, splash, element;
+};
+static struct s_skill_hot skill_hot[MAX_SKILL_DB];
+static struct s_skill_lvhot skill_lvhot[MAX_SKILL_DB][MAX_SKILL_LEVEL];
+
 struct s_skill_produce_db skill_produce_db[MAX_SKILL_PRODUCE_DB];
 
 struct s_skill_arrow_db skill_arrow_db[MAX_SKILL_ARROW_DB];
@@ -193,16 +205,16 @@ static void skill_chk3(int *idx) {
 #define skill_get3(var,id,x) { skill_chk(&id); if (!id) return 0; skill_chk3(&x); return var; }
 
 //Skill DB
-int skill_get_hit(uint16 skill_id)                               { skill_get(skill_db[skill_id].hit, skill_id); }
-int skill_get_inf(uint16 skill_id)                               { skill_get(skill_db[skill_id].inf, skill_id); }
-int skill_get_ele(uint16 skill_id ,uint16 skill_lv)              { skill_get2(skill_db[skill_id].element[skill_lv - 1], skill_id, skill_lv); }
-int skill_get_nk(uint16 skill_id)                                { skill_get(skill_db[skill_id].nk, skill_id); }
-int skill_get_max(uint16 skill_id)                               { skill_get(skill_db[skill_id].max, skill_id); }
-int skill_get_range(uint16 skill_id ,uint16 skill_lv)            { skill_get2(skill_db[skill_id].range[skill_lv - 1], skill_id, skill_lv); }
-int skill_get_splash(uint16 skill_id ,uint16 skill_lv)           { skill_get2((skill_db[skill_id].splash[skill_lv - 1] >= 0 ? skill_db[skill_id].splash[skill_lv - 1] : AREA_SIZE), skill_id, skill_lv); }
+int skill_get_hit(uint16 skill_id)                               { skill_get(skill_hot[skill_id].hit, skill_id); }
+int skill_get_inf(uint16 skill_id)                               { skill_get(skill_hot[skill_id].inf, skill_id); }
+int skill_get_ele(uint16 skill_id ,uint16 skill_lv)              { skill_get2(skill_lvhot[skill_id][skill_lv - 1].element, skill_id, skill_lv); }
+int skill_get_nk(uint16 skill_id)                                { skill_get(skill_hot[skill_id].nk, skill_id); }
+int skill_get_max(uint16 skill_id)                               { skill_get(skill_hot[skill_id].max, skill_id); }
+int skill_get_range(uint16 skill_id ,uint16 skill_lv)            { skill_get2(skill_lvhot[skill_id][skill_lv - 1].range, skill_id, skill_lv); }
+int skill_get_splash(uint16 skill_id ,uint16 skill_lv)           { skill_get2(skill_lvhot[skill_id][skill_lv - 1].splash, skill_id, skill_lv); }
 int skill_get_num(uint16 skill_id ,uint16 skill_lv)              { skill_get2(skill_db[skill_id].num[skill_lv - 1], skill_id, skill_lv); }
-int skill_get_cast(uint16 skill_id ,uint16 skill_lv)             { skill_get2(skill_db[skill_id].cast[skill_lv - 1], skill_id, skill_lv); }
-int skill_get_delay(uint16 skill_id ,uint16 skill_lv)            { skill_get2(skill_db[skill_id].delay[skill_lv - 1], skill_id, skill_lv); }
+int skill_get_cast(uint16 skill_id ,uint16 skill_lv)             { skill_get2(skill_lvhot[skill_id][skill_lv - 1].cast, skill_id, skill_lv); }
+int skill_get_delay(uint16 skill_id ,uint16 skill_lv)            { skill_get2(skill_lvhot[skill_id][skill_lv - 1].delay, skill_id, skill_lv); }
 int skill_get_walkdelay(uint16 skill_id, uint16 skill_lv)        { skill_get2(skill_db[skill_id].walkdelay[skill_lv - 1], skill_id, skill_lv); }
 static int skill_get_time_sub(uint16 skill_id, uint16 skill_lv)  { skill_get2(skill_db[skill_id].upkeep_time[skill_lv - 1], skill_id, skill_lv); }
 int skill_get_time(uint16 skill_id, uint16 skill_lv)
@@ -223,8 +235,8 @@ int skill_get_time2(uint16 skill_id, uint16 skill_lv)
 	return duration;
 }
 int skill_get_castdef(uint16 skill_id)                           { skill_get(skill_db[skill_id].cast_def_rate, skill_id); }
-int skill_get_inf2(uint16 skill_id)                              { skill_get(skill_db[skill_id].inf2, skill_id); }
-int skill_get_inf3(uint16 skill_id)                              { skill_get(skill_db[skill_id].inf3, skill_id); }
+int skill_get_inf2(uint16 skill_id)                              { skill_get(skill_hot[skill_id].inf2, skill_id); }
+int skill_get_inf3(uint16 skill_id)                              { skill_get(skill_hot[skill_id].inf3, skill_id); }
 int skill_get_castcancel(uint16 skill_id)                        { skill_get(skill_db[skill_id].castcancel, skill_id); }
 int skill_get_maxcount(uint16 skill_id, uint16 skill_lv)         { skill_get2(skill_db[skill_id].maxcount[skill_lv - 1], skill_id, skill_lv); }
 int skill_get_blewcount(uint16 skill_id, uint16 skill_lv)        { skill_get2(skill_db[skill_id].blewcount[skill_lv - 1], skill_id, skill_lv); }
@@ -7435,9 +7447,10 @@ int skill_castend_nodamage_id(struct block_list *src, struct block_list *bl, uin
 					sd->state.prevend = 1;
 					sd->vend_skill_lv = skill_lv;
 					ARR_FIND(0,MAX_CART,i,(sd->cart.u.items_cart[i].nameid && !sd->cart.u.items_cart[i].id));
-					if (i < MAX_CART)
+					if (i < MAX_CART) {
 						intif_storage_save(sd,&sd->cart);
-					else
+						pc_autosave_sent(sd, CSAVE_CART);
+					} else
 						clif_openvendingreq(sd,2 + skill_lv);
 				}
 			}
@@ -21696,6 +21709,35 @@ static bool skill_parse_row_skilldamage(char *split[], int columns, int current)
 }
 #endif
 
+/**
+ * Packs the per-skill and per-level fields read on every cast into the hot tables.
+ * Must be called after every skill_db (re)load.
+ */
+static void skill_build_hotdb(void)
+{
+	int i, j;
+
+	for( i = 1; i < MAX_SKILL_DB; i++ ) {
+		struct s_skill_db *sk = &skill_db[i];
+
+		skill_hot[i].hit = sk->hit;
+		skill_hot[i].inf = sk->inf;
+		skill_hot[i].nk = sk->nk;
+		skill_hot[i].inf2 = sk->inf2;
+		skill_hot[i].inf3 = sk->inf3;
+		skill_hot[i].max = sk->max;
+		for( j = 0; j < MAX_SKILL_LEVEL; j++ ) {
+			struct s_skill_lvhot *lv = &skill_lvhot[i][j];
+
+			lv->cast = sk->cast[j];
+			lv->delay = sk->delay[j];
+			lv->range = (int16)cap_value(sk->range[j], SINT16_MIN, SINT16_MAX);
+			lv->splash = (int16)(sk->splash[j] >= 0 ? cap_value(sk->splash[j], 0, SINT16_MAX) : AREA_SIZE);
+			lv->element = (int16)cap_value(sk->element[j], SINT16_MIN, SINT16_MAX);
+		}
+	}
+}
+
 /*===============================
  * DB reading.
  * skill_db.txt
@@ -21750,6 +21792,7 @@ static void skill_readdb(void)
 #ifdef ADJUST_SKILL_DAMAGE
 	sv_readdb(db_path, "skill_damage_db.txt"         , ',',     4,  7, MAX_SKILL_DB, skill_parse_row_skilldamage);
 #endif
+	skill_build_hotdb();
 }
 
 void skill_reload(void) {
@@ -21765,6 +21808,75 @@ void skill_reload(void) {
 	mapit_free(iter);
 }
 
+/*==========================================
+ * Cast path lookup benchmark [console: bench:skill]
+ * Reads the fields checked on every cast (hit, inf, inf2, inf3, nk, range,
+ * splash, cast, delay, element) of 'count' random skill levels, once through
+ * the packed tables of the skill_get_* getters and once straight from skill_db,
+ * and reports the lookups per second of both. The random order makes most
+ * lookups miss the CPU caches, as the casts of many different players do.
+ * Both passes read the same levels and must give the same checksum.
+ *------------------------------------------*/
+void skill_bench(int count, uint32 seed)
+{
+	uint16 *ids;
+	uint32 checksum[2];
+	int id_count = 0, i, pass;
+
+	if( count <= 0 )
+		return;
+
+	CREATE(ids, uint16, MAX_SKILL_DB);
+	for( i = 1; i <= UINT16_MAX && id_count < MAX_SKILL_DB; i++ ) {
+		int idx = skill_get_index((uint16)i);
+
+		if( idx && skill_db[idx].max > 0 )
+			ids[id_count++] = (uint16)i;
+	}
+	if( !id_count ) {
+		ShowError("skill_bench: No skill in skill_db.\n");
+		aFree(ids);
+		return;
+	}
+
+	for( pass = 0; pass < 2; pass++ ) {
+		unsigned int tick;
+		int elapsed;
+
+		rnd_seed(seed);
+		checksum[pass] = 2166136261U; //FNV-1a offset basis
+		tick = gettick_nocache();
+		for( i = 0; i < count; i++ ) {
+			uint16 skill_id = ids[rnd()%id_count];
+			uint32 v;
+
+			if( pass == 0 ) {
+				uint16 skill_lv = 1 + rnd()%skill_get_max(skill_id);
+
+				v = skill_get_hit(skill_id) + skill_get_inf(skill_id) + skill_get_inf2(skill_id) + skill_get_inf3(skill_id) + skill_get_nk(skill_id)
+					+ skill_get_range(skill_id, skill_lv) + skill_get_splash(skill_id, skill_lv) + skill_get_cast(skill_id, skill_lv)
+					+ skill_get_delay(skill_id, skill_lv) + skill_get_ele(skill_id, skill_lv);
+			} else {
+				struct s_skill_db *sk = &skill_db[skill_get_index(skill_id)];
+				int lv = min(rnd()%sk->max, MAX_SKILL_LEVEL - 1);
+
+				v = sk->hit + sk->inf + sk->inf2 + sk->inf3 + sk->nk
+					+ sk->range[lv] + (sk->splash[lv] >= 0 ? sk->splash[lv] : AREA_SIZE) + sk->cast[lv]
+					+ sk->delay[lv] + sk->element[lv];
+			}
+			checksum[pass] = (checksum[pass] ^ v) * 16777619U; //FNV-1a prime
+		}
+		elapsed = DIFF_TICK(gettick_nocache(), tick);
+		ShowInfo("skill_bench: %-8s %d lookups over %d skills in %d ms (%.0f lookups/sec), checksum %08x.\n", (pass == 0 ? "packed" : "skill_db"),
+			count, id_count, elapsed, (elapsed > 0 ? count * 1000. / elapsed : 0.), checksum[pass]);
+	}
+	if( checksum[0] != checksum[1] )
+		ShowWarning("skill_bench: The packed tables don't match skill_db!\n");
+
+	aFree(ids);
+	rnd_init(); //Don't leave the server running on a known seed
+}
+
 /*==========================================
  *
  *------------------------------------------*/
@@ -362,6 +362,7 @@ int skill_get_blewcount(uint16 skill_id, uint16 skill_lv);
 int skill_get_unit_flag(uint16 skill_id);
 int skill_get_cooldown(uint16 skill_id, uint16 skill_lv);
 int skill_get_unit_target(uint16 skill_id);
+int skill_get_unit_bl_target(uint16 skill_id);
 int skill_get_inf3(uint16 skill_id);
 
 //Accessor for skill requirements
@@ -490,6 +491,7 @@ int skill_blockmerc_start(struct mercenary_data*, uint16 skill_id, int tick);
 int skill_attack(int attack_type, struct block_list *src, struct block_list *dsrc, struct block_list *bl, uint16 skill_id, uint16 skill_lv, unsigned int tick, int flag);
 
 void skill_reload(void);
+void skill_bench(int count, uint32 seed);
 
 //List of State Requirements
 enum e_require_state {
@@ -1678,6 +1678,9 @@ int status_damage(struct block_list *src, struct block_list *target, int64 in_hp
 	status->hp -= hp;
 	status->sp -= sp;
 
+	if (hp || sp)
+		map_regen_enroll(target);
+
 	if (sc && hp && status->hp) {
 		if (sc->data[SC_AUTOBERSERK] && (!sc->data[SC_PROVOKE] || !sc->data[SC_PROVOKE]->val2) && status->hp < status->max_hp>>2)
 			sc_start4(src, target, SC_PROVOKE, 100, 10, 1, 0, 0, 60000);
@@ -4507,6 +4510,8 @@ void status_calc_regen(struct block_list *bl, struct status_data *status, struct
 	if( !(bl->type&BL_REGEN) || !regen )
 		return;
 
+	map_regen_enroll(bl); //Max HP/SP or regen bonuses may have changed
+
 	sd = BL_CAST(BL_PC, bl);
 	sc = status_get_sc(bl);
 
@@ -4597,6 +4602,7 @@ void status_calc_regen_rate(struct block_list *bl, struct regen_data *regen, str
 	if( !(bl->type&BL_REGEN) || !regen )
 		return;
 
+	map_regen_enroll(bl);
 	regen->flag = RGN_HP|RGN_SP;
 
 	if( regen->sregen ) {
@@ -14013,6 +14019,11 @@ static int status_natural_heal(struct block_list *bl, va_list args)
 	if (sc && !sc->count)
 		sc = NULL;
 	sd = BL_CAST(BL_PC,bl);
+	if (status->hp >= status->max_hp && status->sp >= status->max_sp &&
+		!(sd && (sd->hp_loss.value || sd->sp_loss.value || sd->hp_regen.value || sd->sp_regen.value))) {
+		map_regen_dismiss(bl); //Nothing to regenerate until enrolled again by status_damage/status_calc_regen
+		return 0;
+	}
 	flag = regen->flag;
 	if (flag&RGN_HP && (status->hp >= status->max_hp || regen->state.block&1))
 		flag &= ~(RGN_HP|RGN_SHP);
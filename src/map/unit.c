@@ -3093,6 +3093,21 @@ int unit_free(struct block_list *bl, clr_type clrtype)
 					sd->regstr = NULL;
 					sd->regstr_num = 0;
 				}
+				if( sd->reg_db ) {
+					db_destroy(sd->reg_db);
+					sd->reg_db = NULL;
+				}
+				if( sd->regstr_db ) {
+					db_destroy(sd->regstr_db);
+					sd->regstr_db = NULL;
+				}
+				pc_reg_index_final(sd);
+				pc_autosave_dequeue(sd);
+				if( sd->save_status ) {
+					aFree(sd->save_status);
+					sd->save_status = NULL;
+					sd->save_version = 0;
+				}
 				if( sd->st && sd->st->state != RUN ) { //Free attached scripts that are waiting
 					script_free_state(sd->st);
 					sd->st = NULL;
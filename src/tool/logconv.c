@@ -0,0 +1,505 @@
+// Copyright (c) Athena Dev Teams - Licensed under GNU GPL
+// For more information, see LICENCE in the main folder
+
+// Converts the binary log segments written with 'log_binary' (see binlog.h)
+// to INSERT statements for the log tables, or to CSV files.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/mmo.h"
+#include "../common/binlog.h"
+#include "../common/grfio.h"
+#include "../common/malloc.h"
+#include "../common/showmsg.h"
+#include "../common/strlib.h"
+
+#define LOGCONV_BATCH 500 // Rows per INSERT statement
+#define LOGCONV_MAX_COLUMNS 64
+
+enum logconv_mode {
+	LOGCONV_SQL = 0,
+	LOGCONV_CSV,
+};
+
+enum logconv_mode mode = LOGCONV_SQL;
+char sql_file[256] = "log/logconv.sql";
+char csv_dir[256] = "log";
+
+// Names used with -table, and the default tables of conf/log_athena.conf
+const char *type_name[BINLOG_MAX] = { "branch", "pick", "zeny", "mvpdrop", "gm", "npc", "chat", "cash", "feeding" };
+char table_name[BINLOG_MAX][64] = { "branchlog", "picklog", "zenylog", "mvplog", "atcommandlog", "npclog", "chatlog", "cashlog", "feedinglog" };
+
+// Columns of each table, in the order the records are converted
+char *column[BINLOG_MAX][LOGCONV_MAX_COLUMNS];
+int column_count[BINLOG_MAX];
+
+// Values of the record being converted
+char value[LOGCONV_MAX_COLUMNS][UINT8_MAX + 1];
+int value_count;
+
+FILE *sql_fp;
+StringBuf sql_batch[BINLOG_MAX];
+int sql_rows[BINLOG_MAX];
+FILE *csv_fp[BINLOG_MAX];
+
+unsigned int records[BINLOG_MAX], skipped, segments;
+
+
+// Adds a column to a table
+void add_column(enum e_binlog_type type, const char *name)
+{
+	column[type][column_count[type]++] = aStrdup(name);
+}
+
+// Sets up the columns of the log tables
+void init_columns(void)
+{
+	const char *list[BINLOG_MAX] = {
+		"branch_date,account_id,char_id,char_name,map",
+		"time,char_id,type,nameid,amount,refine,map,unique_id,bound",
+		"time,char_id,src_id,type,amount,map",
+		"mvp_date,kill_char_id,monster_id,prize,mvpexp,map",
+		"atcommand_date,account_id,char_id,char_name,map,command",
+		"npc_date,account_id,char_id,char_name,map,mes",
+		"time,type,type_id,src_charid,src_accountid,src_map,src_map_x,src_map_y,dst_charname,message",
+		"time,char_id,type,cash_type,amount,map",
+		"time,char_id,target_id,target_class,type,intimacy,item_id,map,x,y",
+	};
+	char name[32];
+	int type, i;
+
+	for( type = 0; type < BINLOG_MAX; type++ ) {
+		const char *p = list[type];
+
+		while( sscanf(p, "%31[^,]", name) == 1 ) {
+			add_column((enum e_binlog_type)type, name);
+			p += strlen(name);
+			if( *p == ',' )
+				p++;
+		}
+	}
+	for( i = 0; i < MAX_SLOTS; i++ ) {
+		sprintf(name, "card%d", i);
+		add_column(BINLOG_PICK, name);
+	}
+	for( i = 0; i < MAX_ITEM_RDM_OPT; i++ ) {
+		sprintf(name, "option_id%d", i);
+		add_column(BINLOG_PICK, name);
+		sprintf(name, "option_val%d", i);
+		add_column(BINLOG_PICK, name);
+		sprintf(name, "option_parm%d", i);
+		add_column(BINLOG_PICK, name);
+	}
+}
+
+void add_int(int64 v)
+{
+	sprintf(value[value_count++], "%" PRId64, v);
+}
+
+void add_uint(uint64 v)
+{
+	sprintf(value[value_count++], "%" PRIu64, v);
+}
+
+void add_char(uint8 c)
+{
+	sprintf(value[value_count++], "%c", c);
+}
+
+void add_str(struct binlog_reader *r)
+{
+	binlog_getstr(r, value[value_count++], sizeof(value[0]));
+}
+
+// Reads the fields of a record into value[]
+// @return false if the record is cut short
+bool read_record(enum e_binlog_type type, time_t logtime, struct binlog_reader *r)
+{
+	int i, n;
+
+	value_count = 0;
+	strftime(value[value_count++], sizeof(value[0]), "%Y-%m-%d %H:%M:%S", localtime(&logtime));
+
+	switch( type ) {
+		case BINLOG_BRANCH:
+			add_uint(binlog_get32(r)); // account_id
+			add_uint(binlog_get32(r)); // char_id
+			add_str(r); // char_name
+			add_str(r); // map
+			break;
+		case BINLOG_PICK:
+			add_uint(binlog_get32(r)); // char_id
+			add_char(binlog_get8(r)); // type
+			add_uint(binlog_get32(r)); // nameid
+			add_int((int32)binlog_get32(r)); // amount
+			add_uint(binlog_get8(r)); // refine
+			add_str(r); // map
+			add_uint(binlog_get64(r)); // unique_id
+			add_uint(binlog_get8(r)); // bound
+			n = binlog_get8(r);
+			for( i = 0; i < n; i++ ) {
+				uint32 card = binlog_get32(r);
+
+				if( i < MAX_SLOTS )
+					add_uint(card);
+			}
+			for( ; i < MAX_SLOTS; i++ )
+				add_uint(0);
+			n = binlog_get8(r);
+			for( i = 0; i < n; i++ ) {
+				int16 id = (int16)binlog_get16(r), val = (int16)binlog_get16(r);
+				uint8 param = binlog_get8(r);
+
+				if( i < MAX_ITEM_RDM_OPT ) {
+					add_int(id);
+					add_int(val);
+					add_int(param);
+				}
+			}
+			for( ; i < MAX_ITEM_RDM_OPT; i++ ) {
+				add_int(0);
+				add_int(0);
+				add_int(0);
+			}
+			break;
+		case BINLOG_ZENY:
+			add_uint(binlog_get32(r)); // char_id
+			add_uint(binlog_get32(r)); // src_id
+			add_char(binlog_get8(r)); // type
+			add_int((int32)binlog_get32(r)); // amount
+			add_str(r); // map
+			break;
+		case BINLOG_MVPDROP:
+			add_uint(binlog_get32(r)); // kill_char_id
+			add_uint(binlog_get32(r)); // monster_id
+			add_uint(binlog_get32(r)); // prize
+			add_uint(binlog_get32(r)); // mvpexp
+			add_str(r); // map
+			break;
+		case BINLOG_GM:
+		case BINLOG_NPC:
+			add_uint(binlog_get32(r)); // account_id
+			add_uint(binlog_get32(r)); // char_id
+			add_str(r); // char_name
+			add_str(r); // map
+			add_str(r); // command, mes
+			break;
+		case BINLOG_CHAT:
+			add_char(binlog_get8(r)); // type
+			add_int((int32)binlog_get32(r)); // type_id
+			add_uint(binlog_get32(r)); // src_charid
+			add_uint(binlog_get32(r)); // src_accountid
+			add_str(r); // src_map
+			add_uint(binlog_get16(r)); // src_map_x
+			add_uint(binlog_get16(r)); // src_map_y
+			add_str(r); // dst_charname
+			add_str(r); // message
+			break;
+		case BINLOG_CASH:
+			add_uint(binlog_get32(r)); // char_id
+			add_char(binlog_get8(r)); // type
+			add_char(binlog_get8(r)); // cash_type
+			add_int((int32)binlog_get32(r)); // amount
+			add_str(r); // map
+			break;
+		case BINLOG_FEEDING:
+			add_uint(binlog_get32(r)); // char_id
+			add_uint(binlog_get32(r)); // target_id
+			add_uint(binlog_get16(r)); // target_class
+			add_char(binlog_get8(r)); // type
+			add_uint(binlog_get32(r)); // intimacy
+			add_uint(binlog_get32(r)); // item_id
+			add_str(r); // map
+			add_uint(binlog_get16(r)); // x
+			add_uint(binlog_get16(r)); // y
+			break;
+		default:
+			return false;
+	}
+	return !r->error;
+}
+
+// Writes the pending INSERT statement of a table
+void flush_sql(enum e_binlog_type type)
+{
+	if( sql_rows[type] == 0 )
+		return;
+	fprintf(sql_fp, "%s;\n", StringBuf_Value(&sql_batch[type]));
+	StringBuf_Clear(&sql_batch[type]);
+	sql_rows[type] = 0;
+}
+
+// Adds the values of a record to the INSERT statement of its table
+void write_sql(enum e_binlog_type type)
+{
+	StringBuf *buf = &sql_batch[type];
+	int i;
+
+	if( sql_rows[type] == 0 ) {
+		StringBuf_Printf(buf, "INSERT INTO `%s` (", table_name[type]);
+		for( i = 0; i < column_count[type]; i++ )
+			StringBuf_Printf(buf, "%s`%s`", (i ? ", " : ""), column[type][i]);
+		StringBuf_AppendStr(buf, ") VALUES\n(");
+	} else
+		StringBuf_AppendStr(buf, ",\n(");
+
+	for( i = 0; i < value_count; i++ ) {
+		const char *c;
+
+		StringBuf_AppendStr(buf, (i ? ", '" : "'"));
+		for( c = value[i]; *c; c++ ) {
+			switch( *c ) {
+				case '\'': StringBuf_AppendStr(buf, "\\'"); break;
+				case '"':  StringBuf_AppendStr(buf, "\\\""); break;
+				case '\\': StringBuf_AppendStr(buf, "\\\\"); break;
+				case '\n': StringBuf_AppendStr(buf, "\\n"); break;
+				case '\r': StringBuf_AppendStr(buf, "\\r"); break;
+				case '\x1a': StringBuf_AppendStr(buf, "\\Z"); break;
+				default:   StringBuf_Printf(buf, "%c", *c); break;
+			}
+		}
+		StringBuf_AppendStr(buf, "'");
+	}
+	StringBuf_AppendStr(buf, ")");
+
+	if( ++sql_rows[type] >= LOGCONV_BATCH )
+		flush_sql(type);
+}
+
+// Appends the values of a record to the CSV file of its table,
+// creating the file with a header line on first use
+void write_csv(enum e_binlog_type type)
+{
+	FILE *fp = csv_fp[type];
+	int i;
+
+	if( fp == NULL ) {
+		char path[512];
+
+		sprintf(path, "%s/%s.csv", csv_dir, table_name[type]);
+		if( (fp = csv_fp[type] = fopen(path, "a+")) == NULL ) {
+			ShowError("Can't open '%s' for writing.\n", path);
+			exit(EXIT_FAILURE);
+		}
+		fseek(fp, 0, SEEK_END);
+		if( ftell(fp) == 0 ) {
+			for( i = 0; i < column_count[type]; i++ )
+				fprintf(fp, "%s%s", (i ? "," : ""), column[type][i]);
+			fprintf(fp, "\n");
+		}
+	}
+
+	for( i = 0; i < value_count; i++ ) {
+		if( i )
+			fputc(',', fp);
+		if( strpbrk(value[i], ",\"\r\n") ) {
+			const char *c;
+
+			fputc('"', fp);
+			for( c = value[i]; *c; c++ ) {
+				if( *c == '"' )
+					fputc('"', fp);
+				fputc(*c, fp);
+			}
+			fputc('"', fp);
+		} else
+			fputs(value[i], fp);
+	}
+	fputc('\n', fp);
+}
+
+// Converts the records of a block
+void convert_block(const uint8 *data, size_t len, const char *file)
+{
+	struct binlog_reader block;
+
+	block.p = data;
+	block.end = data + len;
+	block.error = false;
+
+	while( block.p < block.end ) {
+		struct binlog_reader r;
+		uint16 length;
+		uint8 type;
+		time_t logtime;
+
+		r = block;
+		length = binlog_get16(&r);
+		type = binlog_get8(&r);
+		binlog_get8(&r);
+		logtime = (time_t)binlog_get32(&r);
+		if( r.error || length < BINLOG_RECORD_SIZE || length > (size_t)(block.end - block.p) ) {
+			ShowError("%s: Malformed record, skipping the rest of the block.\n", file);
+			return;
+		}
+		r.end = block.p + length;
+		block.p += length;
+
+		if( type >= BINLOG_MAX || !read_record((enum e_binlog_type)type, logtime, &r) ) {
+			skipped++;
+			continue;
+		}
+		if( mode == LOGCONV_SQL )
+			write_sql((enum e_binlog_type)type);
+		else
+			write_csv((enum e_binlog_type)type);
+		records[type]++;
+	}
+}
+
+// Converts a segment
+void convert_segment(const char *file)
+{
+	FILE *fp;
+	uint8 *data;
+	long size;
+	struct binlog_reader r;
+	uint16 version, flags;
+
+	if( (fp = fopen(file, "rb")) == NULL ) {
+		ShowError("Can't open segment '%s'.\n", file);
+		return;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = (uint8 *)aMalloc(max(size, 1));
+	if( fread(data, 1, size, fp) != (size_t)size ) {
+		ShowError("Can't read segment '%s'.\n", file);
+		fclose(fp);
+		aFree(data);
+		return;
+	}
+	fclose(fp);
+
+	r.p = data;
+	r.end = data + size;
+	r.error = false;
+	if( size < BINLOG_HEADER_SIZE || memcmp(data, BINLOG_MAGIC, 4) != 0 ) {
+		ShowError("'%s' isn't a binary log segment.\n", file);
+		aFree(data);
+		return;
+	}
+	r.p += 4;
+	version = binlog_get16(&r);
+	flags = binlog_get16(&r);
+	r.p += 8; // created, reserved
+	if( version != BINLOG_VERSION ) {
+		ShowError("Segment '%s' has version %d, expected %d.\n", file, version, BINLOG_VERSION);
+		aFree(data);
+		return;
+	}
+
+	while( r.p < r.end ) {
+		uint32 length = binlog_get32(&r), raw_len = binlog_get32(&r);
+
+		binlog_get32(&r); // records
+		if( r.error || length > (size_t)(r.end - r.p) ) {
+			ShowWarning("%s: The last block is cut short, skipping it.\n", file);
+			break;
+		}
+		if( flags&BINLOG_ZLIB ) {
+			unsigned long len = raw_len;
+			uint8 *raw = (uint8 *)aMalloc(max(raw_len, 1));
+
+			if( decode_zip(raw, &len, r.p, length) != 0 || len != raw_len )
+				ShowError("%s: Failed to inflate a block, skipping it.\n", file);
+			else
+				convert_block(raw, len, file);
+			aFree(raw);
+		} else
+			convert_block(r.p, length, file);
+		r.p += length;
+	}
+	aFree(data);
+	segments++;
+}
+
+// Processes command-line arguments
+// @return index of the first segment
+int process_args(int argc, char *argv[])
+{
+	int i, type;
+
+	for( i = 1; i < argc; i++ ) {
+		if( strcmp(argv[i], "-sql") == 0 && i + 1 < argc ) {
+			mode = LOGCONV_SQL;
+			safestrncpy(sql_file, argv[++i], sizeof(sql_file));
+		} else if( strcmp(argv[i], "-csv") == 0 && i + 1 < argc ) {
+			mode = LOGCONV_CSV;
+			safestrncpy(csv_dir, argv[++i], sizeof(csv_dir));
+		} else if( strcmp(argv[i], "-table") == 0 && i + 2 < argc ) {
+			for( type = 0; type < BINLOG_MAX; type++ )
+				if( strcmpi(argv[i + 1], type_name[type]) == 0 )
+					break;
+			if( type == BINLOG_MAX )
+				ShowWarning("Unknown record type '%s'.\n", argv[i + 1]);
+			else
+				safestrncpy(table_name[type], argv[i + 2], sizeof(table_name[type]));
+			i += 2;
+		} else if( argv[i][0] == '-' ) {
+			ShowWarning("Unknown option '%s'.\n", argv[i]);
+		} else
+			break;
+	}
+	return i;
+}
+
+int do_init(int argc, char **argv)
+{
+	int i, first;
+
+	init_columns();
+	first = process_args(argc, argv);
+	if( first >= argc ) {
+		ShowInfo("Usage: logconv [-sql <file> | -csv <dir>] [-table <type> <table>]... <segment" BINLOG_EXT ">...\n");
+		ShowInfo("  -sql <file>  Writes INSERT statements for the log tables to <file> (default %s).\n", sql_file);
+		ShowInfo("  -csv <dir>   Appends the records to <dir>/<table>.csv (default %s).\n", csv_dir);
+		ShowInfo("  -table       Table of a record type: branch, pick, zeny, mvpdrop, gm, npc, chat, cash or feeding.\n");
+		return 0;
+	}
+
+	if( mode == LOGCONV_SQL ) {
+		if( (sql_fp = fopen(sql_file, "w")) == NULL ) {
+			ShowError("Can't open '%s' for writing.\n", sql_file);
+			exit(EXIT_FAILURE);
+		}
+		for( i = 0; i < BINLOG_MAX; i++ )
+			StringBuf_Init(&sql_batch[i]);
+	}
+
+	for( i = first; i < argc; i++ ) {
+		ShowStatus("Converting segment '"CL_WHITE"%s"CL_RESET"'...\n", argv[i]);
+		convert_segment(argv[i]);
+	}
+
+	for( i = 0; i < BINLOG_MAX; i++ ) {
+		if( mode == LOGCONV_SQL ) {
+			flush_sql((enum e_binlog_type)i);
+			StringBuf_Destroy(&sql_batch[i]);
+		} else if( csv_fp[i] )
+			fclose(csv_fp[i]);
+		if( records[i] )
+			ShowInfo("%-10s %u records\n", table_name[i], records[i]);
+	}
+	if( sql_fp )
+		fclose(sql_fp);
+	if( skipped )
+		ShowWarning("%u records of unknown type or cut short were skipped.\n", skipped);
+	ShowStatus("Converted %d segments to %s '%s'.\n", segments, (mode == LOGCONV_SQL ? "file" : "directory"), (mode == LOGCONV_SQL ? sql_file : csv_dir));
+
+	return 0;
+}
+
+void do_final(void)
+{
+	int i, j;
+
+	for( i = 0; i < BINLOG_MAX; i++ )
+		for( j = 0; j < column_count[i]; j++ )
+			aFree(column[i][j]);
+}